@@ -35,11 +35,13 @@ _services: dict[str, tuple] = {
   "liveCalibration": (True, 4., 4),
   "liveTorqueParameters": (True, 4., 1),
   "androidLog": (True, 0.),
+  "androidLogBatch": (True, 0.),
   "carState": (True, 100., 10),
   "carControl": (True, 100., 10),
   "carOutput": (True, 100., 10),
   "longitudinalPlan": (True, 20., 5),
   "procLog": (True, 0.5, 15),
+  "loopTiming": (True, 1., 1),
   "gpsLocationExternal": (True, 10., 10),
   "gpsLocation": (True, 1., 1),
   "ubloxGnss": (True, 10.),
@@ -1,11 +1,18 @@
 #include "common/clutil.h"
 
+#include <unistd.h>
+
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <vector>
 
-#include "common/util.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "system/hardware/hw.h"
 
 namespace {  // helper functions
 
@@ -53,6 +60,121 @@ void cl_print_build_errors(cl_program program, cl_device_id device) {
   LOGE("build failed; status=%d, log: %s", status, log.c_str());
 }
 
+// compiled programs are cached by a hash of everything that affects the binary. the full key is
+// stored in the entry and compared on load, a corrupt or mismatched entry is rebuilt from source.
+const char CL_CACHE_MAGIC[8] = "CLPROG1";
+
+struct ClCacheHeader {
+  char magic[8];
+  uint64_t key_size;
+  uint64_t binary_size;
+  uint64_t binary_hash;
+};
+
+uint64_t fnv1a_hash(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+  const uint8_t *p = (const uint8_t *)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::vector<std::string> cl_include_dirs(const char *args) {
+  std::vector<std::string> dirs;
+  std::istringstream stream(args ? args : "");
+  for (std::string arg; stream >> arg;) {
+    if (arg == "-I") {
+      if (stream >> arg) dirs.push_back(arg);
+    } else if (util::starts_with(arg, "-I")) {
+      dirs.push_back(arg.substr(2));
+    }
+  }
+  return dirs;
+}
+
+std::string cl_cache_key(cl_device_id device_id, const std::string &src, const char *args) {
+  cl_platform_id platform = NULL;
+  clGetDeviceInfo(device_id, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+  std::string key = get_platform_info(platform, CL_PLATFORM_VERSION) + '\n' +
+                    get_device_info(device_id, CL_DEVICE_NAME) + '\n' +
+                    get_device_info(device_id, CL_DEVICE_VERSION) + '\n' +
+                    get_device_info(device_id, CL_DRIVER_VERSION) + '\n' +
+                    (args ? args : "") + '\n';
+  // the source can #include anything in the -I dirs, so their contents are part of the key
+  for (const std::string &dir : cl_include_dirs(args)) {
+    for (const auto &[name, content] : util::read_files_in_dir(dir)) {
+      key += util::string_format("%s/%s %016lx\n", dir.c_str(), name.c_str(), fnv1a_hash(content.data(), content.size()));
+    }
+  }
+  return key + src;
+}
+
+std::string cl_cache_file(const std::string &key) {
+  return util::string_format("%s/%016lx", Path::cl_cache().c_str(), fnv1a_hash(key.data(), key.size()));
+}
+
+cl_program cl_program_from_cache(cl_context ctx, cl_device_id device_id, const std::string &key, const char *args) {
+  const std::string file = cl_cache_file(key);
+  std::string content = util::read_file(file);
+  if (content.empty()) return NULL;
+
+  ClCacheHeader header = {};
+  if (content.size() >= sizeof(header)) {
+    memcpy(&header, content.data(), sizeof(header));
+  }
+  const char *binary = content.data() + sizeof(header) + header.key_size;
+  if (memcmp(header.magic, CL_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      content.size() != sizeof(header) + header.key_size + header.binary_size ||
+      content.compare(sizeof(header), header.key_size, key) != 0 ||
+      fnv1a_hash(binary, header.binary_size) != header.binary_hash) {
+    LOGW("invalid cl cache entry %s", file.c_str());
+    unlink(file.c_str());
+    return NULL;
+  }
+
+  cl_int err = CL_SUCCESS;
+  size_t length = header.binary_size;
+  cl_program prg = clCreateProgramWithBinary(ctx, 1, &device_id, &length, (const uint8_t **)&binary, NULL, &err);
+  if (err == CL_SUCCESS && clBuildProgram(prg, 1, &device_id, args, NULL, NULL) == CL_SUCCESS) {
+    return prg;
+  }
+  LOGW("failed to load cl cache entry %s, err %d", file.c_str(), err);
+  if (prg) clReleaseProgram(prg);
+  unlink(file.c_str());
+  return NULL;
+}
+
+void cl_program_to_cache(cl_program prg, const std::string &key) {
+  size_t binary_size = 0;
+  if (clGetProgramInfo(prg, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL) != CL_SUCCESS || binary_size == 0) {
+    return;
+  }
+  std::string binary(binary_size, '\0');
+  uint8_t *binary_ptr = (uint8_t *)binary.data();
+  if (clGetProgramInfo(prg, CL_PROGRAM_BINARIES, sizeof(binary_ptr), &binary_ptr, NULL) != CL_SUCCESS) {
+    return;
+  }
+
+  ClCacheHeader header = {};
+  memcpy(header.magic, CL_CACHE_MAGIC, sizeof(header.magic));
+  header.key_size = key.size();
+  header.binary_size = binary.size();
+  header.binary_hash = fnv1a_hash(binary.data(), binary.size());
+  std::string content((const char *)&header, sizeof(header));
+  content += key;
+  content += binary;
+
+  // write atomically, processes may build the same program concurrently
+  const std::string file = cl_cache_file(key);
+  const std::string tmp_file = file + "." + std::to_string(getpid()) + ".tmp";
+  if (!util::create_directories(Path::cl_cache(), 0775) ||
+      util::write_file(tmp_file.c_str(), content.data(), content.size(), O_WRONLY | O_CREAT | O_TRUNC) != 0 ||
+      rename(tmp_file.c_str(), file.c_str()) != 0) {
+    LOGW("failed to write cl cache entry %s", file.c_str());
+    unlink(tmp_file.c_str());
+  }
+}
+
 }  // namespace
 
 cl_device_id cl_get_device_id(cl_device_type device_type) {
@@ -84,12 +206,21 @@ cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const ch
 }
 
 cl_program cl_program_from_source(cl_context ctx, cl_device_id device_id, const std::string& src, const char* args) {
+  const double start_t = millis_since_boot();
+  const std::string key = cl_cache_key(device_id, src, args);
+  if (cl_program prg = cl_program_from_cache(ctx, device_id, key, args)) {
+    LOG("cl program loaded from cache in %.1f ms", millis_since_boot() - start_t);
+    return prg;
+  }
+
   const char *csrc = src.c_str();
   cl_program prg = CL_CHECK_ERR(clCreateProgramWithSource(ctx, 1, &csrc, NULL, &err));
   if (int err = clBuildProgram(prg, 1, &device_id, args, NULL, NULL); err != 0) {
     cl_print_build_errors(prg, device_id);
     assert(0);
   }
+  cl_program_to_cache(prg, key);
+  LOG("cl program built from source in %.1f ms", millis_since_boot() - start_t);
   return prg;
 }
 
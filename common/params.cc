@@ -1,15 +1,21 @@
 #include "common/params.h"
 
 #include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
 
 #include <algorithm>
 #include <cassert>
 #include <csignal>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
 #include "common/queue.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
 
@@ -73,6 +79,170 @@ std::string ensure_params_path(const std::string &prefix, const std::string &pat
   return params_path;
 }
 
+int write_tmp_file(const std::string &dir, const char *value, size_t value_size, std::string &tmp_path) {
+  tmp_path = dir + "/.tmp_value_XXXXXX";
+  int tmp_fd = mkstemp((char*)tmp_path.c_str());
+  if (tmp_fd < 0) return -1;
+
+  int result = 0;
+  // Write value to temp.
+  ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, value_size));
+  if (bytes_written < 0 || (size_t)bytes_written != value_size) {
+    result = -20;
+  } else {
+    // fsync to force persist the changes.
+    result = fsync(tmp_fd);
+  }
+
+  close(tmp_fd);
+  if (result != 0) {
+    ::unlink(tmp_path.c_str());
+  }
+  return result;
+}
+
+} // namespace
+
+// Process-wide cache of the values in one params directory. Each lookup first
+// drains the inotify events of the directory, so a value is never served after
+// the write that replaced it has completed, in this or any other process.
+class ParamsCache {
+public:
+  ParamsCache(const std::string &params_path, const std::string &key_path, bool log_errors = true) {
+    fd = HANDLE_EINTR(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if (fd < 0) {
+      if (log_errors) LOGE("params cache: inotify_init1 failed, errno=%d", errno);
+      failed_ts = millis_since_boot();
+      return;
+    }
+
+    // the key path is a symlink that may be swapped out under us, so also watch its parent
+    link_name = key_path.substr(key_path.find_last_of('/') + 1);
+    key_wd = inotify_add_watch(fd, key_path.c_str(), IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE |
+                                                     IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE_SELF);
+    int parent_wd = inotify_add_watch(fd, params_path.c_str(), IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+    if (key_wd < 0 || parent_wd < 0) {
+      if (log_errors) LOGE("params cache: inotify_add_watch failed, errno=%d", errno);
+      failed_ts = millis_since_boot();
+      detach();
+    }
+  }
+
+  ~ParamsCache() { detach(); }
+
+  void detach() {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  bool valid() {
+    std::lock_guard lk(lock);
+    return fd >= 0;
+  }
+
+  // time the inotify setup failed at, 0 if it succeeded
+  double failure_ts() const { return failed_ts; }
+
+  // returns false if the value can't be served from the cache
+  bool get(const std::string &key_path, const std::string &key, std::string &value) {
+    std::lock_guard lk(lock);
+    drain();
+    if (fd < 0) return false;
+
+    auto it = values.find(key);
+    if (it == values.end()) {
+      it = values.emplace(key, util::read_file(key_path + "/" + key)).first;
+    }
+    value = it->second;
+    return true;
+  }
+
+  // blocks until the params directory changes or the timeout expires
+  void wait(int timeout_ms) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    poll(&pfd, 1, timeout_ms);
+  }
+
+private:
+  void drain() {
+    alignas(struct inotify_event) char buf[4096];
+    while (fd >= 0) {
+      ssize_t len = HANDLE_EINTR(read(fd, buf, sizeof(buf)));
+      if (len <= 0) break;
+
+      for (char *p = buf; p < buf + len;) {
+        auto *ev = (struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + ev->len;
+
+        if (ev->mask & IN_Q_OVERFLOW) {
+          values.clear();
+        } else if (ev->wd != key_wd) {
+          // the key path itself was replaced
+          if (ev->len > 0 && link_name == ev->name) {
+            values.clear();
+            detach();
+          }
+        } else if (ev->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+          values.clear();
+          detach();
+        } else if (ev->len > 0) {
+          values.erase(ev->name);
+        }
+      }
+    }
+  }
+
+  int fd = -1;
+  int key_wd = -1;
+  double failed_ts = 0;
+  std::string link_name;
+  std::mutex lock;
+  std::unordered_map<std::string, std::string> values;
+};
+
+namespace {
+
+const double CACHE_RETRY_MS = 10000;
+std::mutex caches_lock;
+std::unordered_map<std::string, std::shared_ptr<ParamsCache>> caches;
+
+// the inotify queue is shared with forked children, they start over with their own caches
+void caches_atfork_prepare() { caches_lock.lock(); }
+void caches_atfork_parent() { caches_lock.unlock(); }
+void caches_atfork_child() {
+  for (auto &[path, cache] : caches) {
+    cache->detach();
+    // other threads may have held its lock at fork time, so never destroy it
+    new std::shared_ptr<ParamsCache>(cache);
+  }
+  caches.clear();
+  caches_lock.unlock();
+}
+
+std::shared_ptr<ParamsCache> get_params_cache(const std::string &params_path, const std::string &key_path) {
+  static std::once_flag atfork_flag;
+  std::call_once(atfork_flag, []() {
+    pthread_atfork(caches_atfork_prepare, caches_atfork_parent, caches_atfork_child);
+  });
+
+  std::lock_guard lk(caches_lock);
+  auto &cache = caches[key_path];
+  if (!cache) {
+    cache = std::make_shared<ParamsCache>(params_path, key_path);
+  } else if (!cache->valid()) {
+    // reads are uncached after a failed setup, retry it rarely and only log the first failure
+    const double failed_ts = cache->failure_ts();
+    if (failed_ts == 0) {
+      cache = std::make_shared<ParamsCache>(params_path, key_path);
+    } else if (millis_since_boot() - failed_ts > CACHE_RETRY_MS) {
+      cache = std::make_shared<ParamsCache>(params_path, key_path, false);
+    }
+  }
+  return cache;
+}
+
 class FileLock {
 public:
   FileLock(const std::string &fn) {
@@ -240,22 +410,11 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   // 3) fsync() the temp file
   // 4) rename the temp file to the real name
   // 5) fsync() the containing directory
-  std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
-  int tmp_fd = mkstemp((char*)tmp_path.c_str());
-  if (tmp_fd < 0) return -1;
+  std::string tmp_path;
+  int result = write_tmp_file(params_path, value, value_size, tmp_path);
+  if (result != 0) return result;
 
-  int result = -1;
   do {
-    // Write value to temp.
-    ssize_t bytes_written = HANDLE_EINTR(write(tmp_fd, value, value_size));
-    if (bytes_written < 0 || (size_t)bytes_written != value_size) {
-      result = -20;
-      break;
-    }
-
-    // fsync to force persist the changes.
-    if ((result = fsync(tmp_fd)) < 0) break;
-
     FileLock file_lock(params_path + "/.lock");
 
     // Move temp into place.
@@ -265,13 +424,40 @@ int Params::put(const char* key, const char* value, size_t value_size) {
     result = fsync_dir(getParamPath());
   } while (false);
 
-  close(tmp_fd);
   if (result != 0) {
     ::unlink(tmp_path.c_str());
   }
   return result;
 }
 
+int Params::putMany(const std::map<std::string, std::string> &values) {
+  // same steps as put(), with a single fsync() of the directory for all values
+  std::vector<std::pair<std::string, std::string>> tmp_paths;
+  int result = 0;
+  for (auto &[key, value] : values) {
+    std::string tmp_path;
+    if ((result = write_tmp_file(params_path, value.data(), value.size(), tmp_path)) != 0) break;
+    tmp_paths.push_back({tmp_path, key});
+  }
+
+  size_t renamed = 0;
+  if (result == 0) {
+    FileLock file_lock(params_path + "/.lock");
+    for (; renamed < tmp_paths.size(); ++renamed) {
+      auto &[tmp_path, key] = tmp_paths[renamed];
+      if ((result = rename(tmp_path.c_str(), getParamPath(key).c_str())) < 0) break;
+    }
+    if (result == 0) {
+      result = fsync_dir(getParamPath());
+    }
+  }
+
+  for (size_t i = renamed; i < tmp_paths.size(); ++i) {
+    ::unlink(tmp_paths[i].first.c_str());
+  }
+  return result;
+}
+
 int Params::remove(const std::string &key) {
   FileLock file_lock(params_path + "/.lock");
   int result = unlink(getParamPath(key).c_str());
@@ -281,9 +467,20 @@ int Params::remove(const std::string &key) {
   return fsync_dir(getParamPath());
 }
 
+std::string Params::read(const std::string &key, std::shared_ptr<ParamsCache> &cache) {
+  std::string value;
+  cache = get_params_cache(params_path, getParamPath());
+  if (!cache->get(getParamPath(), key, value)) {
+    cache.reset();
+    value = util::read_file(getParamPath(key));
+  }
+  return value;
+}
+
 std::string Params::get(const std::string &key, bool block) {
+  std::shared_ptr<ParamsCache> cache;
   if (!block) {
-    return util::read_file(getParamPath(key));
+    return read(key, cache);
   } else {
     // blocking read until successful
     params_do_exit = 0;
@@ -292,10 +489,15 @@ std::string Params::get(const std::string &key, bool block) {
 
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
+      if (value = read(key, cache); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      // wake up on the next change of the params directory, the timeout covers signals
+      if (cache) {
+        cache->wait(100);
+      } else {
+        util::sleep_for(100);  // 0.1 s
+      }
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -2,6 +2,7 @@
 
 #include <future>
 #include <map>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -19,6 +20,8 @@ enum ParamKeyType {
   ALL = 0xFFFFFFFF
 };
 
+class ParamsCache;
+
 class Params {
 public:
   explicit Params(const std::string &path = {});
@@ -53,12 +56,15 @@ public:
   inline int putBool(const std::string &key, bool val) {
     return put(key.c_str(), val ? "1" : "0", 1);
   }
+  // write several values with a single fsync of the params directory
+  int putMany(const std::map<std::string, std::string> &values);
   void putNonBlocking(const std::string &key, const std::string &val);
   inline void putBoolNonBlocking(const std::string &key, bool val) {
     putNonBlocking(key, val ? "1" : "0");
   }
 
 private:
+  std::string read(const std::string &key, std::shared_ptr<ParamsCache> &cache);
   void asyncWriteThread();
 
   std::string params_path;
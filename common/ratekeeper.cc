@@ -1,23 +1,112 @@
 #include "common/ratekeeper.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <mutex>
 
 #include "common/swaglog.h"
 #include "common/timing.h"
 #include "common/util.h"
 
+namespace {
+
+std::mutex registry_lock;
+std::vector<std::shared_ptr<LoopStats>> registry;
+
+void sleep_until(double t) {
+#ifdef __APPLE__
+  util::sleep_for((t - seconds_since_boot()) * 1000);
+#else
+  // absolute deadline, so time spent outside the sleep doesn't accumulate as drift
+  struct timespec ts;
+  ts.tv_sec = (time_t)t;
+  ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+  while (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#endif
+}
+
+}  // namespace
+
+int LoopHistogram::bucket(uint64_t us) {
+  if (us < 8) return us;
+  int msb = 63 - __builtin_clzll(us);
+  int sub = (us >> (msb - 2)) & 3;
+  return std::min(8 + (msb - 3) * 4 + sub, BUCKETS - 1);
+}
+
+uint64_t LoopHistogram::bucketUpperBound(int i) {
+  if (i < 8) return i;
+  int msb = (i - 8) / 4 + 3;
+  int sub = (i - 8) % 4;
+  return ((uint64_t)(4 + sub + 1) << (msb - 2)) - 1;
+}
+
+void LoopHistogram::add(uint64_t us) {
+  counts[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t prev = max_us.load(std::memory_order_relaxed);
+  while (us > prev && !max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {}
+}
+
+LoopHistogram::Summary LoopHistogram::collect() {
+  std::array<uint32_t, BUCKETS> window;
+  uint64_t total = 0;
+  for (int i = 0; i < BUCKETS; ++i) {
+    window[i] = counts[i].exchange(0, std::memory_order_relaxed);
+    total += window[i];
+  }
+
+  Summary s;
+  s.max_ms = max_us.exchange(0, std::memory_order_relaxed) / 1000.0;
+  if (total == 0) return s;
+
+  uint64_t p50_rank = std::ceil(total * 0.5), p99_rank = std::ceil(total * 0.99);
+  uint64_t seen = 0;
+  bool p50_found = false;
+  for (int i = 0; i < BUCKETS; ++i) {
+    seen += window[i];
+    if (!p50_found && seen >= p50_rank) {
+      s.p50_ms = bucketUpperBound(i) / 1000.0;
+      p50_found = true;
+    }
+    if (seen >= p99_rank) {
+      s.p99_ms = bucketUpperBound(i) / 1000.0;
+      break;
+    }
+  }
+  // bucket bounds are an overestimate, the max is exact
+  s.p50_ms = std::min(s.p50_ms, s.max_ms);
+  s.p99_ms = std::min(s.p99_ms, s.max_ms);
+  return s;
+}
+
 RateKeeper::RateKeeper(const std::string &name, float rate, float print_delay_threshold)
     : name(name),
       print_delay_threshold(std::max(0.f, print_delay_threshold)) {
   interval = 1 / rate;
   last_monitor_time = seconds_since_boot();
+  last_wake_time = last_monitor_time;
   next_frame_time = last_monitor_time + interval;
+
+  stats = std::make_shared<LoopStats>();
+  stats->name = name;
+  stats->rate = rate;
+  std::lock_guard lk(registry_lock);
+  registry.push_back(stats);
+}
+
+RateKeeper::~RateKeeper() {
+  std::lock_guard lk(registry_lock);
+  registry.erase(std::remove(registry.begin(), registry.end(), stats), registry.end());
 }
 
 bool RateKeeper::keepTime() {
   bool lagged = monitorTime();
   if (remaining_ > 0) {
-    util::sleep_for(remaining_ * 1000);
+    double wake_target = last_monitor_time + remaining_;
+    sleep_until(wake_target);
+    last_wake_time = seconds_since_boot();
+    stats->sleep_overshoot.add(std::max(0.0, last_wake_time - wake_target) * 1e6);
   }
   return lagged;
 }
@@ -27,8 +116,14 @@ bool RateKeeper::monitorTime() {
   last_monitor_time = seconds_since_boot();
   remaining_ = next_frame_time - last_monitor_time;
 
+  stats->frames.fetch_add(1, std::memory_order_relaxed);
+  stats->work_time.add((last_monitor_time - last_wake_time) * 1e6);
+  // without keepTime() the loop's own wait counts as work
+  last_wake_time = last_monitor_time;
+
   bool lagged = remaining_ < 0;
   if (lagged) {
+    stats->lag_count.fetch_add(1, std::memory_order_relaxed);
     if (print_delay_threshold > 0 && remaining_ < -print_delay_threshold) {
       LOGW("%s lagging by %.2f ms", name.c_str(), -remaining_ * 1000);
     }
@@ -38,3 +133,24 @@ bool RateKeeper::monitorTime() {
   }
   return lagged;
 }
+
+std::vector<LoopTimingSummary> RateKeeper::collectStats() {
+  std::vector<std::shared_ptr<LoopStats>> loops;
+  {
+    std::lock_guard lk(registry_lock);
+    loops = registry;
+  }
+
+  std::vector<LoopTimingSummary> ret;
+  for (auto &l : loops) {
+    ret.push_back({
+      .name = l->name,
+      .rate = l->rate,
+      .frames = l->frames.exchange(0, std::memory_order_relaxed),
+      .lag_count = l->lag_count.exchange(0, std::memory_order_relaxed),
+      .work_time = l->work_time.collect(),
+      .sleep_overshoot = l->sleep_overshoot.collect(),
+    });
+  }
+  return ret;
+}
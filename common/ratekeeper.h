@@ -1,23 +1,73 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+// Lock-free histogram of durations in microseconds: exact below 8us, then 4
+// buckets per power of two. Written by one loop thread, read from any thread.
+class LoopHistogram {
+public:
+  struct Summary {
+    float p50_ms = 0;
+    float p99_ms = 0;
+    float max_ms = 0;
+  };
+
+  void add(uint64_t us);
+  // returns the distribution since the last call and starts a new window
+  Summary collect();
+
+  static int bucket(uint64_t us);
+  static uint64_t bucketUpperBound(int i);
+  static constexpr int BUCKETS = 96;
+
+private:
+  std::array<std::atomic<uint32_t>, BUCKETS> counts = {};
+  std::atomic<uint64_t> max_us = 0;
+};
+
+struct LoopStats {
+  std::string name;
+  float rate;
+  std::atomic<uint64_t> frames = 0;
+  std::atomic<uint32_t> lag_count = 0;
+  LoopHistogram work_time;
+  LoopHistogram sleep_overshoot;
+};
+
+struct LoopTimingSummary {
+  std::string name;
+  float rate;
+  uint64_t frames;
+  uint32_t lag_count;
+  LoopHistogram::Summary work_time;
+  LoopHistogram::Summary sleep_overshoot;
+};
 
 class RateKeeper {
 public:
   RateKeeper(const std::string &name, float rate, float print_delay_threshold = 0);
-  ~RateKeeper() {}
+  ~RateKeeper();
   bool keepTime();
   bool monitorTime();
   inline uint64_t frame() const { return frame_; }
   inline double remaining() const { return remaining_; }
 
+  // timing of every RateKeeper in the process since the previous call
+  static std::vector<LoopTimingSummary> collectStats();
+
 private:
   double interval;
   double next_frame_time;
   double last_monitor_time;
+  double last_wake_time;
   double remaining_ = 0;
   float print_delay_threshold = 0;
   uint64_t frame_ = 0;
   std::string name;
+  std::shared_ptr<LoopStats> stats;
 };
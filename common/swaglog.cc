@@ -4,10 +4,19 @@
 
 #include "common/swaglog.h"
 
+#include <pthread.h>
+
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include <stdarg.h>
@@ -15,6 +24,71 @@
 #include "common/version.h"
 #include "system/hardware/hw.h"
 
+bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
+bool SWAGLOG_SYNC = getenv("SWAGLOG_SYNC");
+bool SWAGLOG_BINARY = getenv("SWAGLOG_BINARY");
+uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
+
+struct LogRecord {
+  int levelnum;
+  const char* filename;
+  int lineno;
+  const char* func;
+  double created;
+  bool msg_is_json;
+  std::string msg;
+};
+
+// Single producer (the logging thread), single consumer (the flusher) ring.
+// Slots are reused, so once their strings have grown logging doesn't allocate.
+class LogRing {
+public:
+  LogRecord *claim() {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == slots.size()) {
+      return nullptr;
+    }
+    return &slots[h % slots.size()];
+  }
+
+  // returns true if the ring was empty before this record
+  bool commit() {
+    size_t h = head.load(std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_release);
+    return h == tail.load(std::memory_order_acquire);
+  }
+
+  template <typename F>
+  void drain(F &&f) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    for (; t != h; ++t) {
+      LogRecord &r = slots[t % slots.size()];
+      f(r);
+      // don't hold on to the memory of huge messages
+      if (r.msg.capacity() > 4096) {
+        std::string().swap(r.msg);
+      }
+    }
+    tail.store(t, std::memory_order_release);
+  }
+
+  bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+  std::atomic<bool> closed = false;
+
+private:
+  std::array<LogRecord, 256> slots;
+  alignas(64) std::atomic<size_t> head = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+};
+
+static void append_uint(std::string &out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out += (char)((v >> (8 * i)) & 0xFF);
+  }
+}
+
 class SwaglogState {
 public:
   SwaglogState() {
@@ -37,7 +111,7 @@ public:
       }
     }
 
-    ctx_j = json11::Json::object{};
+    json11::Json::object ctx_j;
     if (char* dongle_id = getenv("DONGLE_ID")) {
       ctx_j["dongle_id"] = dongle_id;
     }
@@ -56,66 +130,257 @@ public:
     ctx_j["version"] = COMMA_VERSION;
     ctx_j["dirty"] = !getenv("CLEAN");
     ctx_j["device"] = Hardware::get_name();
+    ctx_s = json11::Json(ctx_j).dump();
+
+    instance = this;
+    if (!SWAGLOG_SYNC) {
+      flusher = std::make_unique<std::thread>(&SwaglogState::flusher_thread, this);
+      pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+    }
   }
 
   ~SwaglogState() {
+    if (flusher) {
+      stopping = true;
+      cv.notify_one();
+      flusher->join();
+    }
     zmq_close(sock);
     zmq_ctx_destroy(zctx);
   }
 
-  void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
+  // returns the record slot of the calling thread, or nullptr if it has to log synchronously,
+  // which is also the case when its ring is full
+  LogRecord *claim() {
+    if (!flusher) return nullptr;
+
+    struct ThreadRing {
+      std::shared_ptr<LogRing> ring;
+      ~ThreadRing() { if (ring) ring->closed = true; }
+    };
+    static thread_local ThreadRing tr;
+    if (!tr.ring) {
+      tr.ring = std::make_shared<LogRing>();
+      std::lock_guard lk(lock);
+      rings.push_back(tr.ring);
+    }
+    ring = tr.ring.get();
+    return ring->claim();
+  }
+
+  void commit() {
+    // only the first record of a burst wakes up the flusher
+    if (ring->commit()) {
+      cv.notify_one();
+    }
+  }
+
+  void log(const LogRecord &r) {
     std::lock_guard lk(lock);
-    if (levelnum >= print_level) {
-      printf("%s: %s\n", filename, msg);
+    // the records this thread queued before go first. the lock keeps the flusher out of the ring
+    if (ring) {
+      ring->drain([this](const LogRecord &queued) { send(queued); });
     }
+    send(r);
+  }
+
+  std::string ctx_s;
+  int print_level;
+
+private:
+  void send(const LogRecord &r) {
+    std::string log_s;
+    log_s += (char)r.levelnum;
+    serialize_json(r, log_s);
     zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
   }
 
+  // same output as dumping the record as a json11 object, with the ctx pre-serialized
+  void serialize_json(const LogRecord &r, std::string &out) {
+    out += "{\"created\": ";
+    json11::Json(r.created).dump(out);
+    out += ", \"ctx\": ";
+    out += ctx_s;
+    out += ", \"filename\": ";
+    json11::Json(r.filename).dump(out);
+    out += ", \"funcname\": ";
+    json11::Json(r.func).dump(out);
+    out += ", \"levelnum\": " + std::to_string(r.levelnum);
+    out += ", \"lineno\": " + std::to_string(r.lineno);
+    out += ", \"msg\": ";
+    if (r.msg_is_json) {
+      out += r.msg;
+    } else {
+      json11::Json(r.msg).dump(out);
+    }
+    out += "}";
+  }
+
+  // compact batch format, expanded back to json records by logmessaged
+  void serialize_binary(const LogRecord &r, std::string &out) {
+    size_t filename_len = std::min<size_t>(strlen(r.filename), UINT16_MAX);
+    size_t func_len = std::min<size_t>(strlen(r.func), UINT16_MAX);
+    uint64_t created;
+    memcpy(&created, &r.created, sizeof(created));
+
+    out += (char)r.levelnum;
+    out += (char)r.msg_is_json;
+    append_uint(out, r.lineno, 4);
+    append_uint(out, created, 8);
+    append_uint(out, filename_len, 2);
+    out.append(r.filename, filename_len);
+    append_uint(out, func_len, 2);
+    out.append(r.func, func_len);
+    append_uint(out, r.msg.size(), 4);
+    out += r.msg;
+  }
+
+  void flush() {
+    std::vector<std::shared_ptr<LogRing>> to_flush;
+    {
+      std::lock_guard lk(lock);
+      // rings of exited threads are released once drained
+      for (auto it = rings.begin(); it != rings.end();) {
+        if ((*it)->closed && (*it)->empty()) {
+          it = rings.erase(it);
+        } else {
+          to_flush.push_back(*it++);
+        }
+      }
+    }
+
+    std::string batch;
+    uint32_t count = 0;
+    size_t count_offset = 0;
+    if (SWAGLOG_BINARY) {
+      batch += (char)SWAGLOG_BINARY_MAGIC;
+      batch += (char)SWAGLOG_BINARY_VERSION;
+      append_uint(batch, ctx_s.size(), 4);
+      batch += ctx_s;
+      count_offset = batch.size();
+      append_uint(batch, 0, 4);  // filled in below
+    }
+
+    std::lock_guard lk(lock);
+    for (auto &ring : to_flush) {
+      ring->drain([&](const LogRecord &r) {
+        if (SWAGLOG_BINARY) {
+          serialize_binary(r, batch);
+          count++;
+        } else {
+          send(r);
+        }
+      });
+    }
+
+    if (count > 0) {
+      for (int i = 0; i < 4; ++i) {
+        batch[count_offset + i] = (char)((count >> (8 * i)) & 0xFF);
+      }
+      zmq_send(sock, batch.data(), batch.length(), ZMQ_NOBLOCK);
+    }
+  }
+
+  void flusher_thread() {
+    pthread_setname_np(pthread_self(), "swaglog");
+    while (!stopping) {
+      {
+        std::unique_lock lk(cv_lock);
+        cv.wait_for(lk, std::chrono::milliseconds(100));
+      }
+      flush();
+    }
+    flush();
+  }
+
+  // the flusher doesn't survive a fork, the child logs synchronously
+  static SwaglogState *instance;
+  static void atfork_prepare() { instance->lock.lock(); }
+  static void atfork_parent() { instance->lock.unlock(); }
+  static void atfork_child() {
+    instance->lock.unlock();
+    instance->flusher.release();
+    // the parent flushes the records queued before the fork
+    ring = nullptr;
+  }
+
   std::mutex lock;
   void* zctx = nullptr;
   void* sock = nullptr;
-  int print_level;
-  json11::Json::object ctx_j;
+
+  std::unique_ptr<std::thread> flusher;
+  std::atomic<bool> stopping = false;
+  std::mutex cv_lock;
+  std::condition_variable cv;
+  std::vector<std::shared_ptr<LogRing>> rings;
+  static thread_local LogRing *ring;
 };
 
-bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
-uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
+SwaglogState *SwaglogState::instance = nullptr;
+thread_local LogRing *SwaglogState::ring = nullptr;
 
-static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
-                            char* msg_buf, const json11::Json::object &msg_j={}) {
+static SwaglogState &swaglog_state() {
   static SwaglogState s;
+  return s;
+}
 
-  json11::Json::object log_j = json11::Json::object {
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  if (msg_j.empty()) {
-    log_j["msg"] = msg_buf;
+// returns the slot to fill in, the ring slot of the thread or sync_record
+static LogRecord *begin_record(SwaglogState &s, int levelnum, LogRecord &sync_record) {
+  // critical messages usually precede a crash, don't leave them in the ring
+  LogRecord *r = levelnum < CLOUDLOG_CRITICAL ? s.claim() : nullptr;
+  return r ? r : &sync_record;
+}
+
+static void end_record(SwaglogState &s, LogRecord *r, const LogRecord &sync_record, int levelnum,
+                       const char* filename, int lineno, const char* func, bool msg_is_json) {
+  r->levelnum = levelnum;
+  r->filename = filename;
+  r->lineno = lineno;
+  r->func = func;
+  r->created = seconds_since_epoch();
+  r->msg_is_json = msg_is_json;
+
+  if (r == &sync_record) {
+    s.log(*r);
   } else {
-    log_j["msg"] = msg_j;
+    s.commit();
   }
+}
 
-  std::string log_s;
-  log_s += (char)levelnum;
-  ((json11::Json)log_j).dump(log_s);
-  s.log(levelnum, filename, lineno, func, msg_buf, log_s);
+static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
+                            const char* fmt, va_list args) {
+  SwaglogState &s = swaglog_state();
+  LogRecord sync_record;
+  LogRecord *r = begin_record(s, levelnum, sync_record);
 
-  free(msg_buf);
+  // format straight into the record, reusing its capacity
+  va_list args_copy;
+  va_copy(args_copy, args);
+  r->msg.resize(r->msg.capacity());
+  int ret = vsnprintf(r->msg.data(), r->msg.size() + 1, fmt, args);
+  if (ret >= 0 && ret > (int)r->msg.size()) {
+    r->msg.resize(ret);
+    ret = vsnprintf(r->msg.data(), r->msg.size() + 1, fmt, args_copy);
+  }
+  va_end(args_copy);
+  if (ret <= 0) {
+    // the claimed slot is not committed, the next call overwrites it
+    return;
+  }
+  r->msg.resize(ret);
+
+  if (levelnum >= s.print_level) {
+    printf("%s: %s\n", filename, r->msg.c_str());
+  }
+  end_record(s, r, sync_record, levelnum, filename, lineno, func, false);
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
+  cloudlog_common(levelnum, filename, lineno, func, fmt, args);
   va_end(args);
-  if (ret <= 0 || !msg_buf) return;
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf);
 }
 
 void cloudlog_t_common(int levelnum, const char* filename, int lineno, const char* func,
@@ -123,7 +388,9 @@ void cloudlog_t_common(int levelnum, const char* filename, int lineno, const cha
   if (!LOG_TIMESTAMPS) return;
   char* msg_buf = nullptr;
   int ret = vasprintf(&msg_buf, fmt, args);
-  if (ret <= 0 || !msg_buf) return;
+  if (ret <= 0 || !msg_buf) {
+    return;
+  }
   json11::Json::object tspt_j = json11::Json::object{
     {"event", msg_buf},
     {"time", std::to_string(nanos_since_boot())}
@@ -132,7 +399,17 @@ void cloudlog_t_common(int levelnum, const char* filename, int lineno, const cha
     tspt_j["frame_id"] = std::to_string(frame_id);
   }
   tspt_j = json11::Json::object{{"timestamp", tspt_j}};
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf, tspt_j);
+
+  SwaglogState &s = swaglog_state();
+  LogRecord sync_record;
+  LogRecord *r = begin_record(s, levelnum, sync_record);
+  r->msg.clear();
+  json11::Json(tspt_j).dump(r->msg);
+  if (levelnum >= s.print_level) {
+    printf("%s: %s\n", filename, msg_buf);
+  }
+  end_record(s, r, sync_record, levelnum, filename, lineno, func, true);
+  free(msg_buf);
 }
 
 
@@ -8,6 +8,11 @@
 #define CLOUDLOG_ERROR 40
 #define CLOUDLOG_CRITICAL 50
 
+// first byte of a batch in the binary record format (SWAGLOG_BINARY=1),
+// never a valid levelnum. see system/logmessaged.py for the layout
+#define SWAGLOG_BINARY_MAGIC 0xFF
+#define SWAGLOG_BINARY_VERSION 1
+
 
 #ifdef __GNUC__
 #define SWAG_LOG_CHECK_FMT(a, b) __attribute__ ((format (printf, a, b)))
@@ -0,0 +1,113 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/clutil.h"
+#include "common/util.h"
+
+namespace {
+
+const char *KERNEL_SRC = R"(
+#include "value.h"
+__kernel void fill(__global int *out) { out[get_global_id(0)] = VALUE; }
+)";
+
+std::vector<std::string> cache_entries(const std::string &dir) {
+  std::vector<std::string> entries;
+  for (const auto &[name, content] : util::read_files_in_dir(dir)) {
+    entries.push_back(dir + "/" + name);
+  }
+  return entries;
+}
+
+int run_fill(cl_context ctx, cl_device_id device_id, cl_program prg) {
+  const cl_queue_properties props[] = {0};
+  cl_command_queue q = CL_CHECK_ERR(clCreateCommandQueueWithProperties(ctx, device_id, props, &err));
+  cl_mem buf = CL_CHECK_ERR(clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, sizeof(int), NULL, &err));
+  cl_kernel kernel = CL_CHECK_ERR(clCreateKernel(prg, "fill", &err));
+  CL_CHECK(clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf));
+  const size_t work_size = 1;
+  CL_CHECK(clEnqueueNDRangeKernel(q, kernel, 1, NULL, &work_size, NULL, 0, NULL, NULL));
+  int value = 0;
+  CL_CHECK(clEnqueueReadBuffer(q, buf, CL_TRUE, 0, sizeof(value), &value, 0, NULL, NULL));
+  clReleaseKernel(kernel);
+  clReleaseMemObject(buf);
+  clReleaseCommandQueue(q);
+  return value;
+}
+
+}  // namespace
+
+TEST_CASE("cl_program_from_source cache") {
+  char tmp[] = "/tmp/test_clutil_XXXXXX";
+  REQUIRE(mkdtemp(tmp) != nullptr);
+  const std::string root = tmp, cache_dir = root + "/cache", include_dir = root + "/include";
+  REQUIRE(util::create_directories(include_dir, 0775));
+  setenv("CL_CACHE_DIR", cache_dir.c_str(), 1);
+
+  const std::string args = "-I" + include_dir;
+  const std::string header = include_dir + "/value.h";
+  REQUIRE(util::write_file(header.c_str(), "#define VALUE 1\n", 16, O_WRONLY | O_CREAT | O_TRUNC) == 0);
+
+  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context ctx = cl_create_context(device_id);
+
+  // first build stores an entry, the second load uses it
+  cl_program prg = cl_program_from_source(ctx, device_id, KERNEL_SRC, args.c_str());
+  REQUIRE(run_fill(ctx, device_id, prg) == 1);
+  clReleaseProgram(prg);
+  auto entries = cache_entries(cache_dir);
+  REQUIRE(entries.size() == 1);
+  const std::string entry = util::read_file(entries[0]);
+  REQUIRE(util::starts_with(entry, "CLPROG1"));
+
+  prg = cl_program_from_source(ctx, device_id, KERNEL_SRC, args.c_str());
+  REQUIRE(run_fill(ctx, device_id, prg) == 1);
+  clReleaseProgram(prg);
+  REQUIRE(cache_entries(cache_dir) == entries);
+
+  SECTION("corrupt entry is rebuilt") {
+    std::string corrupt = entry;
+    corrupt[corrupt.size() - 1] ^= 0xff;
+    REQUIRE(util::write_file(entries[0].c_str(), corrupt.data(), corrupt.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+
+    prg = cl_program_from_source(ctx, device_id, KERNEL_SRC, args.c_str());
+    REQUIRE(run_fill(ctx, device_id, prg) == 1);
+    clReleaseProgram(prg);
+    const std::string rebuilt = util::read_file(entries[0]);
+    REQUIRE(util::starts_with(rebuilt, "CLPROG1"));
+    REQUIRE(rebuilt != corrupt);
+  }
+
+  SECTION("truncated entry is rebuilt") {
+    REQUIRE(util::write_file(entries[0].c_str(), entry.data(), 4, O_WRONLY | O_CREAT | O_TRUNC) == 0);
+
+    prg = cl_program_from_source(ctx, device_id, KERNEL_SRC, args.c_str());
+    REQUIRE(run_fill(ctx, device_id, prg) == 1);
+    clReleaseProgram(prg);
+    const std::string rebuilt = util::read_file(entries[0]);
+    REQUIRE(util::starts_with(rebuilt, "CLPROG1"));
+    REQUIRE(rebuilt.size() > 4);
+  }
+
+  SECTION("changing an included header misses the cache") {
+    REQUIRE(util::write_file(header.c_str(), "#define VALUE 2\n", 16, O_WRONLY | O_CREAT | O_TRUNC) == 0);
+
+    prg = cl_program_from_source(ctx, device_id, KERNEL_SRC, args.c_str());
+    REQUIRE(run_fill(ctx, device_id, prg) == 2);
+    clReleaseProgram(prg);
+    REQUIRE(cache_entries(cache_dir).size() == 2);
+  }
+
+  clReleaseContext(ctx);
+  unsetenv("CL_CACHE_DIR");
+  for (const auto &f : cache_entries(cache_dir)) unlink(f.c_str());
+  rmdir(cache_dir.c_str());
+  unlink(header.c_str());
+  rmdir(include_dir.c_str());
+  rmdir(root.c_str());
+}
@@ -1,6 +1,9 @@
+#include <thread>
+
 #include "catch2/catch.hpp"
 #define private public
 #include "common/params.h"
+#include "common/timing.h"
 #include "common/util.h"
 
 TEST_CASE("params_nonblocking_put") {
@@ -25,3 +28,57 @@ TEST_CASE("params_nonblocking_put") {
     REQUIRE(p.get(name) == "1");
   }
 }
+
+TEST_CASE("params_cache_invalidation") {
+  char tmp_path[] = "/tmp/paramsCache_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+
+  REQUIRE(params.get("CarParams").empty());
+  params.put("CarParams", "1");
+  REQUIRE(params.get("CarParams") == "1");
+
+  // written by another Params instance
+  Params other(param_path);
+  other.put("CarParams", "2");
+  REQUIRE(params.get("CarParams") == "2");
+
+  // written without Params
+  REQUIRE(util::write_file(params.getParamPath("CarParams").c_str(), (void *)"3", 1) == 0);
+  REQUIRE(params.get("CarParams") == "3");
+
+  other.remove("CarParams");
+  REQUIRE(params.get("CarParams").empty());
+}
+
+TEST_CASE("params_blocking_get") {
+  char tmp_path[] = "/tmp/paramsBlocking_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+
+  auto start = millis_since_boot();
+  std::thread writer([&]() {
+    util::sleep_for(20);
+    Params(param_path).put("CarParams", "1");
+  });
+  REQUIRE(params.get("CarParams", true) == "1");
+  writer.join();
+  // woken up by inotify rather than the 100ms timeout
+  REQUIRE(millis_since_boot() - start < 90);
+}
+
+TEST_CASE("params_put_many") {
+  char tmp_path[] = "/tmp/paramsPutMany_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params params(param_path);
+
+  std::map<std::string, std::string> values = {{"CarParams", "abc"}, {"IsMetric", "1"}, {"DongleId", "xyz"}};
+  REQUIRE(params.putMany(values) == 0);
+  for (auto &[key, value] : values) {
+    REQUIRE(params.get(key) == value);
+  }
+  // no temp files are left behind
+  for (auto &[name, value] : util::read_files_in_dir(param_path)) {
+    REQUIRE(name.find(".tmp_value_") == std::string::npos);
+  }
+}
@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "catch2/catch.hpp"
+#include "common/ratekeeper.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+TEST_CASE("LoopHistogram buckets") {
+  for (uint64_t us : {0, 1, 7, 8, 9, 15, 16, 100, 1000, 12345, 1000000}) {
+    int i = LoopHistogram::bucket(us);
+    INFO("us " << us);
+    REQUIRE(us <= LoopHistogram::bucketUpperBound(i));
+    if (i > 0) {
+      REQUIRE(us > LoopHistogram::bucketUpperBound(i - 1));
+    }
+  }
+  REQUIRE(LoopHistogram::bucket(UINT64_MAX) == LoopHistogram::BUCKETS - 1);
+}
+
+TEST_CASE("LoopHistogram percentiles") {
+  LoopHistogram h;
+  for (int i = 0; i < 98; ++i) h.add(1000);
+  h.add(5000);
+  h.add(20000);
+
+  auto s = h.collect();
+  REQUIRE(s.p50_ms == Approx(1.0).epsilon(0.25));
+  REQUIRE(s.p99_ms == Approx(5.0).epsilon(0.25));
+  REQUIRE(s.max_ms == Approx(20.0));
+
+  // a new window starts after collecting
+  s = h.collect();
+  REQUIRE(s.max_ms == 0);
+  REQUIRE(s.p99_ms == 0);
+}
+
+TEST_CASE("RateKeeper stats") {
+  RateKeeper::collectStats();
+  const int frames = 50;
+  double start = seconds_since_boot();
+  {
+    RateKeeper rk("test_loop", 100);
+    for (int i = 0; i < frames; ++i) {
+      util::sleep_for(1);
+      rk.keepTime();
+    }
+
+    auto stats = RateKeeper::collectStats();
+    auto it = std::find_if(stats.begin(), stats.end(), [](auto &s) { return s.name == "test_loop"; });
+    REQUIRE(it != stats.end());
+    REQUIRE(it->frames == frames);
+    REQUIRE(it->lag_count == 0);
+    REQUIRE(it->work_time.p50_ms >= 1.0);
+    REQUIRE(it->work_time.max_ms < 10.0);
+  }
+  // absolute deadlines don't drift
+  REQUIRE(seconds_since_boot() - start == Approx(frames * 0.01).margin(0.005));
+
+  // unregistered when destroyed
+  for (auto &s : RateKeeper::collectStats()) {
+    REQUIRE(s.name != "test_loop");
+  }
+}
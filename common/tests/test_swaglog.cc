@@ -1,5 +1,6 @@
 #include <zmq.h>
 
+#include <algorithm>
 #include <iostream>
 
 #include "catch2/catch.hpp"
@@ -86,3 +87,58 @@ TEST_CASE("swaglog") {
 
   recv_log(thread_cnt, thread_msg_cnt);
 }
+
+TEST_CASE("swaglog keeps the order of a burst that overflows the ring") {
+  // a burst longer than the ring of the thread falls back to logging synchronously
+  const int msg_cnt = 600;
+  std::thread([=]() {
+    for (int i = 0; i < msg_cnt; ++i) {
+      LOGD("burst %d", i);
+    }
+  }).join();
+
+  void *zctx = zmq_ctx_new();
+  void *sock = zmq_socket(zctx, ZMQ_PULL);
+  zmq_bind(sock, Path::swaglog_ipc().c_str());
+  int received = 0;
+  for (auto start = std::chrono::steady_clock::now(), now = start;
+       now < start + std::chrono::seconds{1} && received < msg_cnt;
+       now = std::chrono::steady_clock::now()) {
+    char buf[4096] = {};
+    if (zmq_recv(sock, buf, sizeof(buf), ZMQ_DONTWAIT) <= 0) {
+      if (errno == EAGAIN || errno == EINTR || errno == EFSM) continue;
+      break;
+    }
+    std::string err;
+    auto msg = json11::Json::parse(buf + 1, err)["msg"].string_value();
+    REQUIRE(msg == "burst " + std::to_string(received));
+    received++;
+  }
+  REQUIRE(received == msg_cnt);
+  zmq_close(sock);
+  zmq_ctx_destroy(zctx);
+}
+
+TEST_CASE("swaglog call latency under contention", "[.][benchmark]") {
+  const int thread_cnt = 8;
+  const int thread_msg_cnt = 10000;
+
+  std::vector<std::vector<double>> latencies(thread_cnt);
+  std::vector<std::thread> log_threads;
+  for (int i = 0; i < thread_cnt; ++i) {
+    log_threads.emplace_back([&, i]() {
+      for (int j = 0; j < thread_msg_cnt; ++j) {
+        double start = millis_since_boot();
+        LOGD("Panda CAN checksum failed %d %d", i, j);
+        latencies[i].push_back((millis_since_boot() - start) * 1e3);
+      }
+    });
+  }
+  for (auto &t : log_threads) t.join();
+
+  std::vector<double> all;
+  for (auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  printf("swaglog call latency (%d threads): p50 %.2f us, p99 %.2f us, max %.2f us\n", thread_cnt,
+         all[all.size() / 2], all[all.size() * 99 / 100], all.back());
+}
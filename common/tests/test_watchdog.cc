@@ -0,0 +1,38 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#include "catch2/catch.hpp"
+#include "common/timing.h"
+#include "common/util.h"
+#include "common/watchdog.h"
+
+TEST_CASE("watchdog_kick") {
+  // a table of its own, the slot of the process is claimed on the first kick
+  std::string prefix = "test_watchdog_" + std::to_string(getpid());
+  std::string dir = "/dev/shm/" + prefix;
+  REQUIRE(mkdir(dir.c_str(), 0777) == 0);
+  setenv("OPENPILOT_PREFIX", prefix.c_str(), 1);
+
+  const uint64_t start = nanos_since_boot();
+  for (int i = 1; i <= 10; ++i) {
+    REQUIRE(watchdog_kick(start + i * 1000000ULL));
+  }
+  REQUIRE(watchdog_kick(start + 30 * 1000000ULL));
+
+  auto states = watchdog_read();
+  unsetenv("OPENPILOT_PREFIX");
+  unlink((dir + "/watchdog").c_str());
+  rmdir(dir.c_str());
+
+  auto it = std::find_if(states.begin(), states.end(), [](auto &s) { return s.pid == getpid(); });
+  REQUIRE(it != states.end());
+  REQUIRE(!it->name.empty());
+  REQUIRE(it->kicks == 11);
+  REQUIRE(it->last_kick == start + 30 * 1000000ULL);
+  REQUIRE(it->last_loop_time == 20 * 1000000ULL);
+  REQUIRE(it->max_loop_time == 20 * 1000000ULL);
+}
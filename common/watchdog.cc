@@ -1,11 +1,140 @@
-#include <string>
-
 #include "common/watchdog.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include "common/swaglog.h"
 #include "common/util.h"
 
-const std::string watchdog_fn_prefix = "/dev/shm/wd_";  // + <pid>
+namespace {
+
+const uint32_t WATCHDOG_MAGIC = 0x57444731;  // "WDG1"
+const int WATCHDOG_SLOTS = 63;
+const uint64_t LOOP_TIME_WINDOW = 5e9;
+
+// the layout is mirrored in common/watchdog.py
+struct alignas(64) WatchdogSlot {
+  std::atomic<int32_t> pid;  // 0 if free, -1 while being claimed
+  uint32_t reserved;
+  std::atomic<uint64_t> last_kick;
+  std::atomic<uint64_t> kicks;
+  std::atomic<uint64_t> last_loop_time;
+  std::atomic<uint64_t> max_loop_time;
+  char name[24];
+};
+static_assert(sizeof(WatchdogSlot) == 64);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+struct WatchdogTable {
+  alignas(64) uint32_t magic;
+  uint32_t slot_count;
+  WatchdogSlot slots[WATCHDOG_SLOTS];
+};
+static_assert(sizeof(WatchdogTable) == 4096);
+
+WatchdogTable *open_table(bool writable) {
+  std::string prefix = util::getenv("OPENPILOT_PREFIX");
+  std::string path = "/dev/shm/" + (prefix.empty() ? "" : prefix + "/") + "watchdog";
+  int fd = HANDLE_EINTR(open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0666));
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  bool ok = writable ? ftruncate(fd, sizeof(WatchdogTable)) == 0
+                     : fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(WatchdogTable);
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *addr = ok ? mmap(nullptr, sizeof(WatchdogTable), prot, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    if (writable) LOGE("failed to map the watchdog table %s: %s", path.c_str(), strerror(errno));
+    return nullptr;
+  }
+
+  auto table = (WatchdogTable *)addr;
+  if (writable) {
+    // the same values from whichever process creates the table
+    table->magic = WATCHDOG_MAGIC;
+    table->slot_count = WATCHDOG_SLOTS;
+  }
+  return table;
+}
+
+WatchdogSlot *claim_slot(WatchdogTable *table) {
+  const int pid = getpid();
+  std::string name = util::getenv("MANAGER_DAEMON", util::read_file("/proc/self/comm"));
+  name.erase(std::remove(name.begin(), name.end(), '\n'), name.end());
+
+  // a free slot, one left by a previous process with this pid, or one of a process that exited
+  for (auto &slot : table->slots) {
+    int32_t owner = slot.pid.load();
+    bool reusable = owner == 0 || owner == pid || (owner > 0 && kill(owner, 0) != 0 && errno == ESRCH);
+    if (reusable && slot.pid.compare_exchange_strong(owner, -1)) {
+      strncpy(slot.name, name.c_str(), sizeof(slot.name) - 1);
+      slot.name[sizeof(slot.name) - 1] = '\0';
+      slot.last_kick = 0;
+      slot.kicks = 0;
+      slot.last_loop_time = 0;
+      slot.max_loop_time = 0;
+      slot.pid.store(pid, std::memory_order_release);
+      return &slot;
+    }
+  }
+  LOGE("no free watchdog slot for %s", name.c_str());
+  return nullptr;
+}
+
+}  // namespace
 
 bool watchdog_kick(uint64_t ts) {
-  static std::string fn = watchdog_fn_prefix + std::to_string(getpid());
-  return util::write_file(fn.c_str(), &ts, sizeof(ts), O_WRONLY | O_CREAT) > 0;
+  static WatchdogSlot *slot = [] {
+    WatchdogTable *table = open_table(true);
+    return table ? claim_slot(table) : nullptr;
+  }();
+  if (!slot) return false;
+
+  // the max loop time covers the previous window and the current one
+  static uint64_t prev_ts = 0, kicks = 0, window_start = 0, window_max = 0, prev_window_max = 0;
+  if (ts > prev_ts && prev_ts != 0) {
+    const uint64_t dt = ts - prev_ts;
+    if (ts - window_start > LOOP_TIME_WINDOW) {
+      prev_window_max = window_max;
+      window_max = 0;
+      window_start = ts;
+    }
+    window_max = std::max(window_max, dt);
+    slot->last_loop_time.store(dt, std::memory_order_relaxed);
+    slot->max_loop_time.store(std::max(window_max, prev_window_max), std::memory_order_relaxed);
+  }
+  prev_ts = ts;
+  slot->kicks.store(++kicks, std::memory_order_relaxed);
+  slot->last_kick.store(ts, std::memory_order_release);
+  return true;
+}
+
+std::vector<WatchdogState> watchdog_read() {
+  static WatchdogTable *table = nullptr;
+  if (!table && !(table = open_table(false))) return {};
+  if (table->magic != WATCHDOG_MAGIC) return {};
+
+  std::vector<WatchdogState> states;
+  for (auto &slot : table->slots) {
+    int32_t pid = slot.pid.load(std::memory_order_acquire);
+    if (pid <= 0) continue;
+    states.push_back({
+      .pid = pid,
+      .name = std::string(slot.name, strnlen(slot.name, sizeof(slot.name))),
+      .last_kick = slot.last_kick.load(std::memory_order_acquire),
+      .kicks = slot.kicks.load(std::memory_order_relaxed),
+      .last_loop_time = slot.last_loop_time.load(std::memory_order_relaxed),
+      .max_loop_time = slot.max_loop_time.load(std::memory_order_relaxed),
+    });
+  }
+  return states;
 }
@@ -1,5 +1,23 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <vector>
 
+// every process kicking the watchdog owns a slot in a table in shared memory,
+// which the manager reads to restart hung processes. common/watchdog.py reads it from python.
+
+// ts is nanos_since_boot, a ts of 0 has the manager restart the process right away
 bool watchdog_kick(uint64_t ts);
+
+struct WatchdogState {
+  int pid;
+  std::string name;
+  uint64_t last_kick;       // nanos_since_boot
+  uint64_t kicks;
+  uint64_t last_loop_time;  // ns between the last two kicks
+  uint64_t max_loop_time;   // largest ns between two kicks in the last 5 to 10 seconds
+};
+
+// the processes that kicked the watchdog, slots of exited ones are kept until they're reused
+std::vector<WatchdogState> watchdog_read();
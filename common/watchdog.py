@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+import mmap
+import os
+import struct
+import time
+from dataclasses import dataclass
+
+# reads the table of watchdog slots written by common/watchdog.cc
+
+MAGIC = 0x57444731
+SLOT_SIZE = 64
+HEADER = struct.Struct('<II')  # magic, slot count
+SLOT = struct.Struct('<iIQQQQ24s')  # pid, reserved, last kick, kicks, last loop time, max loop time, name
+
+
+@dataclass
+class WatchdogState:
+  pid: int
+  name: str
+  last_kick: int  # nanoseconds since boot
+  kicks: int
+  last_loop_time: int  # nanoseconds between the last two kicks
+  max_loop_time: int  # largest nanoseconds between two kicks in the last 5 to 10 seconds
+
+
+def watchdog_path() -> str:
+  return os.path.join('/dev/shm', os.getenv('OPENPILOT_PREFIX', ''), 'watchdog')
+
+
+class WatchdogTable:
+  def __init__(self, path: str | None = None):
+    self.path = path
+    self.mm: mmap.mmap | None = None
+
+  def read(self) -> dict[int, WatchdogState]:
+    # the table is created by the first process to kick
+    if self.mm is None:
+      try:
+        with open(self.path or watchdog_path(), 'rb') as f:
+          self.mm = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+      except (OSError, ValueError):
+        return {}
+
+    magic, slot_count = HEADER.unpack_from(self.mm, 0)
+    if magic != MAGIC or len(self.mm) < SLOT_SIZE * (slot_count + 1):
+      return {}
+
+    states = {}
+    for i in range(slot_count):
+      pid, _, last_kick, kicks, last_loop_time, max_loop_time, name = SLOT.unpack_from(self.mm, SLOT_SIZE * (i + 1))
+      if pid > 0:
+        states[pid] = WatchdogState(pid, name.split(b'\0')[0].decode(errors='replace'), last_kick, kicks, last_loop_time, max_loop_time)
+    return states
+
+  def get(self, pid: int) -> WatchdogState | None:
+    return self.read().get(pid)
+
+
+def main():
+  now = time.monotonic()
+  print(f"{'name':<24} {'pid':>7} {'alive':>5} {'last kick':>10} {'kicks':>10} {'loop':>9} {'max loop':>9}")
+  for s in sorted(WatchdogTable().read().values(), key=lambda s: s.name):
+    alive = os.path.exists(f"/proc/{s.pid}")
+    since = f"{now - s.last_kick / 1e9:.2f}s" if s.last_kick else "-"
+    print(f"{s.name:<24} {s.pid:>7} {alive!s:>5} {since:>10} {s.kicks:>10} {s.last_loop_time / 1e6:>7.1f}ms {s.max_loop_time / 1e6:>7.1f}ms")
+
+
+if __name__ == "__main__":
+  main()
@@ -41,7 +41,15 @@ def print_androidlog(t, msg):
   except Exception:
     m = msg.message
 
-  print(f"[{t / 1e9:.6f}] {source} {msg.pid} {msg.tag} - {m}")
+  repeated = f" (repeated {msg.repeated}x)" if msg.repeated else ""
+  print(f"[{t / 1e9:.6f}] {source} {msg.pid} {msg.tag} - {m}{repeated}")
+
+
+def print_androidlogbatch(t, batch):
+  for entry in batch.entries:
+    print_androidlog(t, entry)
+  if batch.dropped:
+    print(f"[{t / 1e9:.6f}] logcatd dropped {batch.dropped} entries")
 
 
 if __name__ == "__main__":
@@ -67,13 +75,15 @@ if __name__ == "__main__":
           print_logmessage(m.logMonoTime-st, m.errorLogMessage, min_level)
         elif m.which() == 'androidLog':
           print_androidlog(m.logMonoTime-st, m.androidLog)
+        elif m.which() == 'androidLogBatch':
+          print_androidlogbatch(m.logMonoTime-st, m.androidLogBatch)
   else:
-    sm = messaging.SubMaster(['logMessage', 'androidLog'], addr=args.addr)
+    sm = messaging.SubMaster(['logMessage', 'androidLogBatch'], addr=args.addr)
     while True:
       sm.update()
 
       if sm.updated['logMessage']:
         print_logmessage(sm.logMonoTime['logMessage'], sm['logMessage'], min_level)
 
-      if sm.updated['androidLog']:
-        print_androidlog(sm.logMonoTime['androidLog'], sm['androidLog'])
+      if sm.updated['androidLogBatch']:
+        print_androidlogbatch(sm.logMonoTime['androidLogBatch'], sm['androidLogBatch'])
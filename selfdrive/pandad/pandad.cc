@@ -546,6 +546,38 @@ void peripheral_control_thread(Panda *panda, bool no_fan_control) {
   }
 }
 
+void loop_timing_thread() {
+  util::set_thread_name("pandad_loop_timing");
+
+  PubMaster pm({"loopTiming"});
+  RateKeeper rk("pandad_loop_timing", 1);
+
+  while (!do_exit) {
+    auto stats = RateKeeper::collectStats();
+
+    auto set_distribution = [](cereal::LoopTiming::Distribution::Builder d, const LoopHistogram::Summary &h) {
+      d.setP50(h.p50_ms);
+      d.setP99(h.p99_ms);
+      d.setMax(h.max_ms);
+    };
+
+    MessageBuilder msg;
+    auto loops = msg.initEvent().initLoopTiming().initLoops(stats.size());
+    for (int i = 0; i < stats.size(); ++i) {
+      auto l = loops[i];
+      l.setName(stats[i].name);
+      l.setRate(stats[i].rate);
+      l.setFrames(stats[i].frames);
+      l.setLagCount(stats[i].lag_count);
+      set_distribution(l.initWorkTime(), stats[i].work_time);
+      set_distribution(l.initSleepOvershoot(), stats[i].sleep_overshoot);
+    }
+    pm.send("loopTiming", msg);
+
+    rk.keepTime();
+  }
+}
+
 void pandad_main_thread(std::vector<std::string> serials) {
   LOGW("launching pandad");
 
@@ -588,6 +620,7 @@ void pandad_main_thread(std::vector<std::string> serials) {
 
     threads.emplace_back(can_send_thread, pandas, getenv("FAKESEND") != nullptr);
     threads.emplace_back(can_recv_thread, pandas);
+    threads.emplace_back(loop_timing_thread);
 
     for (auto &t : threads) t.join();
   }
@@ -1,6 +1,12 @@
 
 #include "selfdrive/ui/qt/onroad/annotated_camera.h"
 
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#include <GLES3/gl3.h>
+#endif
+
 #include <QPainter>
 #include <algorithm>
 #include <cmath>
@@ -9,6 +15,52 @@
 #include "selfdrive/ui/qt/onroad/buttons.h"
 #include "selfdrive/ui/qt/util.h"
 
+namespace {
+
+const int MAX_GRADIENT_STOPS = 32;
+
+const char overlay_vertex_shader[] =
+#ifdef __APPLE__
+  "#version 330 core\n"
+#else
+  "#version 300 es\n"
+#endif
+  "layout(location = 0) in vec2 aPosition;\n"
+  "layout(location = 1) in float aEdge;\n"
+  "uniform vec2 uSize;\n"
+  "out float vEdge;\n"
+  "void main() {\n"
+  "  gl_Position = vec4(aPosition.x / uSize.x * 2.0 - 1.0, 1.0 - aPosition.y / uSize.y * 2.0, 0.0, 1.0);\n"
+  "  vEdge = aEdge;\n"
+  "}\n";
+
+const char overlay_fragment_shader[] =
+#ifdef __APPLE__
+  "#version 330 core\n"
+#else
+  "#version 300 es\n"
+  "precision mediump float;\n"
+#endif
+  "uniform int uStopCount;\n"
+  "uniform float uStopPos[32];\n"
+  "uniform vec4 uStopColor[32];\n"
+  "uniform float uFramebufferHeight;\n"
+  "in float vEdge;\n"
+  "out vec4 colorOut;\n"
+  "void main() {\n"
+  // vertical gradient, 0 at the bottom of the widget and 1 at the top
+  "  float t = gl_FragCoord.y / uFramebufferHeight;\n"
+  "  vec4 color = uStopColor[0];\n"
+  "  for (int i = 1; i < uStopCount; ++i) {\n"
+  "    color = mix(color, uStopColor[i], clamp((t - uStopPos[i - 1]) / max(uStopPos[i] - uStopPos[i - 1], 1e-4), 0.0, 1.0));\n"
+  "  }\n"
+  // antialias the outer edges of lines
+  "  float coverage = clamp((1.0 - abs(vEdge)) / max(fwidth(vEdge), 1e-4), 0.0, 1.0);\n"
+  "  colorOut = color * coverage;\n"
+  "}\n";
+
+}  // namespace
+
 // Window that shows camera view and variety of info drawn on top
 AnnotatedCameraWidget::AnnotatedCameraWidget(VisionStreamType type, QWidget* parent) : fps_filter(UI_FREQ, 3, 1. / UI_FREQ), CameraWidget("camerad", type, true, parent) {
   pm = std::make_unique<PubMaster, const std::initializer_list<const char *>>({"uiDebug"});
@@ -23,6 +75,15 @@ AnnotatedCameraWidget::AnnotatedCameraWidget(VisionStreamType type, QWidget* par
   dm_img = loadPixmap("../assets/img_driver_face.png", {img_size + 5, img_size + 5});
 }
 
+AnnotatedCameraWidget::~AnnotatedCameraWidget() {
+  makeCurrent();
+  if (isValid()) {
+    glDeleteVertexArrays(1, &overlay_vao);
+    glDeleteBuffers(1, &overlay_vbo);
+  }
+  doneCurrent();
+}
+
 void AnnotatedCameraWidget::updateState(const UIState &s) {
   const int SET_SPEED_NA = 255;
   const SubMaster &sm = *(s.sm);
@@ -129,6 +190,28 @@ void AnnotatedCameraWidget::initializeGL() {
 
   prev_draw_t = millis_since_boot();
   setBackgroundColor(bg_colors[STATUS_DISENGAGED]);
+  initializeOverlay();
+}
+
+void AnnotatedCameraWidget::initializeOverlay() {
+  overlay_program = std::make_unique<QOpenGLShaderProgram>(context());
+  bool ret = overlay_program->addShaderFromSourceCode(QOpenGLShader::Vertex, overlay_vertex_shader);
+  assert(ret);
+  ret = overlay_program->addShaderFromSourceCode(QOpenGLShader::Fragment, overlay_fragment_shader);
+  assert(ret);
+  overlay_program->link();
+
+  glGenVertexArrays(1, &overlay_vao);
+  glBindVertexArray(overlay_vao);
+  glGenBuffers(1, &overlay_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, overlay_vbo);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (const void *)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (const void *)(sizeof(float) * 2));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+  overlay_key = {};
 }
 
 void AnnotatedCameraWidget::updateFrameMat() {
@@ -149,62 +232,136 @@ void AnnotatedCameraWidget::updateFrameMat() {
       .translate(-intrinsic_matrix.v[2], -intrinsic_matrix.v[5]);
 }
 
-void AnnotatedCameraWidget::drawLaneLines(QPainter &painter, const UIState *s) {
-  painter.save();
+void AnnotatedCameraWidget::updateOverlay(UIState *s) {
+  SubMaster &sm = *(s->sm);
+  const bool show_leads = s->scene.longitudinal_control && sm.rcv_frame("radarState") > s->scene.started_frame;
+  // project the model once per message instead of on every frame
+  auto key = std::tuple(sm.rcv_frame("modelV2"), show_leads ? sm.rcv_frame("radarState") : 0, sm.rcv_frame("liveCalibration"),
+                        s->scene.wide_cam, sm["controlsState"].getControlsState().getExperimentalMode(), s->car_space_transform);
+  if (key == overlay_key) return;
+
+  overlay_key = key;
+  overlay_vertices.clear();
+  overlay_draws.clear();
+
+  const cereal::ModelDataV2::Reader &model = sm["modelV2"].getModelV2();
+  update_model(s, model);
+  addLaneLines(s);
+
+  if (show_leads) {
+    auto radar_state = sm["radarState"].getRadarState();
+    update_leads(s, radar_state, model.getPosition());
+    auto lead_one = radar_state.getLeadOne();
+    auto lead_two = radar_state.getLeadTwo();
+    if (lead_one.getStatus()) {
+      addLead(lead_one, s->scene.lead_vertices[0]);
+    }
+    if (lead_two.getStatus() && (std::abs(lead_one.getDRel() - lead_two.getDRel()) > 3.0)) {
+      addLead(lead_two, s->scene.lead_vertices[1]);
+    }
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, overlay_vbo);
+  glBufferData(GL_ARRAY_BUFFER, overlay_vertices.size() * sizeof(OverlayVertex), overlay_vertices.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void AnnotatedCameraWidget::drawOverlay() {
+  if (overlay_draws.empty()) return;
+
+  glViewport(0, 0, glWidth(), glHeight());
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+  glUseProgram(overlay_program->programId());
+  glUniform2f(overlay_program->uniformLocation("uSize"), width(), height());
+  glUniform1f(overlay_program->uniformLocation("uFramebufferHeight"), glHeight());
+  const GLint stop_count_loc = overlay_program->uniformLocation("uStopCount");
+  const GLint stop_pos_loc = overlay_program->uniformLocation("uStopPos");
+  const GLint stop_color_loc = overlay_program->uniformLocation("uStopColor");
+
+  glBindVertexArray(overlay_vao);
+  for (const auto &draw : overlay_draws) {
+    float pos[MAX_GRADIENT_STOPS], colors[MAX_GRADIENT_STOPS][4];
+    const int count = std::min<int>(draw.stops.size(), MAX_GRADIENT_STOPS);
+    for (int i = 0; i < count; ++i) {
+      // premultiplied, as QPainter interpolates gradients
+      const QColor &c = draw.stops[i].second;
+      pos[i] = draw.stops[i].first;
+      colors[i][0] = c.redF() * c.alphaF();
+      colors[i][1] = c.greenF() * c.alphaF();
+      colors[i][2] = c.blueF() * c.alphaF();
+      colors[i][3] = c.alphaF();
+    }
+    glUniform1i(stop_count_loc, count);
+    glUniform1fv(stop_pos_loc, count, pos);
+    glUniform4fv(stop_color_loc, count, &colors[0][0]);
+    glDrawArrays(draw.mode, draw.first, draw.count);
+  }
+  glBindVertexArray(0);
+  glUseProgram(0);
+  glDisable(GL_BLEND);
+}
 
+void AnnotatedCameraWidget::addLaneLines(const UIState *s) {
   const UIScene &scene = s->scene;
   SubMaster &sm = *(s->sm);
 
+  auto add_strip = [this](const QPolygonF &strip, const QGradientStops &stops) {
+    if (strip.size() < 4) return;
+    overlay_draws.push_back({GL_TRIANGLE_STRIP, (GLint)overlay_vertices.size(), (GLsizei)strip.size(), stops});
+    for (int i = 0; i < strip.size(); ++i) {
+      overlay_vertices.push_back({(float)strip[i].x(), (float)strip[i].y(), i % 2 ? 1.0f : -1.0f});
+    }
+  };
+
   // lanelines
   for (int i = 0; i < std::size(scene.lane_line_vertices); ++i) {
-    painter.setBrush(QColor::fromRgbF(1.0, 1.0, 1.0, std::clamp<float>(scene.lane_line_probs[i], 0.0, 0.7)));
-    painter.drawPolygon(scene.lane_line_vertices[i]);
+    add_strip(scene.lane_line_vertices[i], {{0.0, QColor::fromRgbF(1.0, 1.0, 1.0, std::clamp<float>(scene.lane_line_probs[i], 0.0, 0.7))}});
   }
 
   // road edges
   for (int i = 0; i < std::size(scene.road_edge_vertices); ++i) {
-    painter.setBrush(QColor::fromRgbF(1.0, 0, 0, std::clamp<float>(1.0 - scene.road_edge_stds[i], 0.0, 1.0)));
-    painter.drawPolygon(scene.road_edge_vertices[i]);
+    add_strip(scene.road_edge_vertices[i], {{0.0, QColor::fromRgbF(1.0, 0, 0, std::clamp<float>(1.0 - scene.road_edge_stds[i], 0.0, 1.0))}});
   }
 
   // paint path
-  QLinearGradient bg(0, height(), 0, 0);
+  QGradientStops stops;
   if (sm["controlsState"].getControlsState().getExperimentalMode()) {
-    // The first half of track_vertices are the points for the right side of the path
+    // sampled along the right edge of the path starting from its far end
     const auto &acceleration = sm["modelV2"].getModelV2().getAcceleration().getX();
-    const int max_len = std::min<int>(scene.track_vertices.length() / 2, acceleration.size());
+    const int track_size = scene.track_vertices.size();
+    const int max_len = std::min<int>(track_size / 2, acceleration.size());
 
     for (int i = 0; i < max_len; ++i) {
+      const QPointF &track_point = scene.track_vertices[track_size - 1 - i * 2];
       // Some points are out of frame
-      if (scene.track_vertices[i].y() < 0 || scene.track_vertices[i].y() > height()) continue;
+      if (track_point.y() < 0 || track_point.y() > height()) continue;
 
       // Flip so 0 is bottom of frame
-      float lin_grad_point = (height() - scene.track_vertices[i].y()) / height();
+      float lin_grad_point = (height() - track_point.y()) / height();
 
       // speed up: 120, slow down: 0
       float path_hue = fmax(fmin(60 + acceleration[i] * 35, 120), 0);
-      // FIXME: painter.drawPolygon can be slow if hue is not rounded
-      path_hue = int(path_hue * 100 + 0.5) / 100;
 
       float saturation = fmin(fabs(acceleration[i] * 1.5), 1);
       float lightness = util::map_val(saturation, 0.0f, 1.0f, 0.95f, 0.62f);  // lighter when grey
       float alpha = util::map_val(lin_grad_point, 0.75f / 2.f, 0.75f, 0.4f, 0.0f);  // matches previous alpha fade
-      bg.setColorAt(lin_grad_point, QColor::fromHslF(path_hue / 360., saturation, lightness, alpha));
+      stops.push_back({lin_grad_point, QColor::fromHslF(path_hue / 360., saturation, lightness, alpha)});
 
       // Skip a point, unless next is last
       i += (i + 2) < max_len ? 1 : 0;
     }
-
+    std::stable_sort(stops.begin(), stops.end(), [](auto &a, auto &b) { return a.first < b.first; });
   } else {
-    bg.setColorAt(0.0, QColor::fromHslF(148 / 360., 0.94, 0.51, 0.4));
-    bg.setColorAt(0.5, QColor::fromHslF(112 / 360., 1.0, 0.68, 0.35));
-    bg.setColorAt(1.0, QColor::fromHslF(112 / 360., 1.0, 0.68, 0.0));
+    stops = {
+      {0.0, QColor::fromHslF(148 / 360., 0.94, 0.51, 0.4)},
+      {0.5, QColor::fromHslF(112 / 360., 1.0, 0.68, 0.35)},
+      {1.0, QColor::fromHslF(112 / 360., 1.0, 0.68, 0.0)},
+    };
+  }
+  if (!stops.empty()) {
+    add_strip(scene.track_vertices, stops);
   }
-
-  painter.setBrush(bg);
-  painter.drawPolygon(scene.track_vertices);
-
-  painter.restore();
 }
 
 void AnnotatedCameraWidget::drawDriverState(QPainter &painter, const UIState *s) {
@@ -248,9 +405,7 @@ void AnnotatedCameraWidget::drawDriverState(QPainter &painter, const UIState *s)
   painter.restore();
 }
 
-void AnnotatedCameraWidget::drawLead(QPainter &painter, const cereal::RadarState::LeadData::Reader &lead_data, const QPointF &vd) {
-  painter.save();
-
+void AnnotatedCameraWidget::addLead(const cereal::RadarState::LeadData::Reader &lead_data, const QPointF &vd) {
   const float speedBuff = 10.;
   const float leadBuff = 40.;
   const float d_rel = lead_data.getDRel();
@@ -272,16 +427,14 @@ void AnnotatedCameraWidget::drawLead(QPainter &painter, const cereal::RadarState
   float g_xo = sz / 5;
   float g_yo = sz / 10;
 
-  QPointF glow[] = {{x + (sz * 1.35) + g_xo, y + sz + g_yo}, {x, y - g_yo}, {x - (sz * 1.35) - g_xo, y + sz + g_yo}};
-  painter.setBrush(QColor(218, 202, 37, 255));
-  painter.drawPolygon(glow, std::size(glow));
+  auto add_triangle = [this](const OverlayVertex (&vertices)[3], const QColor &color) {
+    overlay_draws.push_back({GL_TRIANGLES, (GLint)overlay_vertices.size(), 3, {{0.0, color}}});
+    overlay_vertices.insert(overlay_vertices.end(), std::begin(vertices), std::end(vertices));
+  };
+  add_triangle({{x + (sz * 1.35f) + g_xo, y + sz + g_yo, 0}, {x, y - g_yo, 0}, {x - (sz * 1.35f) - g_xo, y + sz + g_yo, 0}}, QColor(218, 202, 37, 255));
 
   // chevron
-  QPointF chevron[] = {{x + (sz * 1.25), y + sz}, {x, y}, {x - (sz * 1.25), y + sz}};
-  painter.setBrush(redColor(fillAlpha));
-  painter.drawPolygon(chevron, std::size(chevron));
-
-  painter.restore();
+  add_triangle({{x + (sz * 1.25f), y + sz, 0}, {x, y, 0}, {x - (sz * 1.25f), y + sz, 0}}, redColor(fillAlpha));
 }
 
 void AnnotatedCameraWidget::paintGL() {
@@ -333,28 +486,17 @@ void AnnotatedCameraWidget::paintGL() {
     CameraWidget::paintGL();
   }
 
+  if (s->scene.world_objects_visible) {
+    const double overlay_start_t = millis_since_boot();
+    updateOverlay(s);
+    drawOverlay();
+    overlay_time = millis_since_boot() - overlay_start_t;
+  }
+
   QPainter painter(this);
   painter.setRenderHint(QPainter::Antialiasing);
   painter.setPen(Qt::NoPen);
 
-  if (s->scene.world_objects_visible) {
-    update_model(s, model);
-    drawLaneLines(painter, s);
-
-    if (s->scene.longitudinal_control && sm.rcv_frame("radarState") > s->scene.started_frame) {
-      auto radar_state = sm["radarState"].getRadarState();
-      update_leads(s, radar_state, model.getPosition());
-      auto lead_one = radar_state.getLeadOne();
-      auto lead_two = radar_state.getLeadTwo();
-      if (lead_one.getStatus()) {
-        drawLead(painter, lead_one, s->scene.lead_vertices[0]);
-      }
-      if (lead_two.getStatus() && (std::abs(lead_one.getDRel() - lead_two.getDRel()) > 3.0)) {
-        drawLead(painter, lead_two, s->scene.lead_vertices[1]);
-      }
-    }
-  }
-
   // DMoji
   if (!hideBottomIcons && (sm.rcv_frame("driverStateV2") > s->scene.started_frame)) {
     update_dmonitoring(s, sm["driverStateV2"].getDriverStateV2(), dm_fade_state, rightHandDM);
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <QBrush>
 #include <QVBoxLayout>
 #include <memory>
+#include <tuple>
+#include <vector>
 
 #include "selfdrive/ui/qt/onroad/buttons.h"
 #include "selfdrive/ui/qt/widgets/cameraview.h"
@@ -11,7 +14,9 @@ class AnnotatedCameraWidget : public CameraWidget {
 
 public:
   explicit AnnotatedCameraWidget(VisionStreamType type, QWidget* parent = 0);
+  ~AnnotatedCameraWidget();
   void updateState(const UIState &s);
+  double overlayTime() const { return overlay_time; }
 
 private:
   void drawText(QPainter &p, int x, int y, const QString &text, int alpha = 255);
@@ -40,8 +45,11 @@ protected:
   void initializeGL() override;
   void showEvent(QShowEvent *event) override;
   void updateFrameMat() override;
-  void drawLaneLines(QPainter &painter, const UIState *s);
-  void drawLead(QPainter &painter, const cereal::RadarState::LeadData::Reader &lead_data, const QPointF &vd);
+  void initializeOverlay();
+  void updateOverlay(UIState *s);
+  void drawOverlay();
+  void addLaneLines(const UIState *s);
+  void addLead(const cereal::RadarState::LeadData::Reader &lead_data, const QPointF &vd);
   void drawHud(QPainter &p);
   void drawDriverState(QPainter &painter, const UIState *s);
   inline QColor redColor(int alpha = 255) { return QColor(201, 34, 49, alpha); }
@@ -50,4 +58,23 @@ protected:
 
   double prev_draw_t = 0;
   FirstOrderFilter fps_filter;
+
+  // model lines and leads, drawn in GL as triangle strips filled with a vertical gradient
+  struct OverlayVertex {
+    float x, y;
+    float edge;  // -1 and 1 on the outer edges of a line, 0 elsewhere
+  };
+  struct OverlayDraw {
+    GLenum mode;
+    GLint first;
+    GLsizei count;
+    QGradientStops stops;
+  };
+  std::unique_ptr<QOpenGLShaderProgram> overlay_program;
+  GLuint overlay_vao = 0, overlay_vbo = 0;
+  std::vector<OverlayVertex> overlay_vertices;
+  std::vector<OverlayDraw> overlay_draws;
+  // the overlay is rebuilt when any of its inputs change
+  std::tuple<uint64_t, uint64_t, uint64_t, bool, bool, QTransform> overlay_key;
+  double overlay_time = 0;
 };
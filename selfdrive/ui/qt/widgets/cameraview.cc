@@ -300,6 +300,7 @@ void CameraWidget::paintGL() {
   glUseProgram(program->programId());
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+  const double upload_start_t = millis_since_boot();
 #ifdef QCOM2
   // no frame copy
   glActiveTexture(GL_TEXTURE0);
@@ -319,6 +320,7 @@ void CameraWidget::paintGL() {
   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, stream_width/2, stream_height/2, GL_RG, GL_UNSIGNED_BYTE, frame->uv);
   assert(glGetError() == GL_NO_ERROR);
 #endif
+  upload_time = millis_since_boot() - upload_start_t;
 
   glUniformMatrix4fv(program->uniformLocation("uTransform"), 1, GL_TRUE, frame_mat.v);
   glEnableVertexAttribArray(0);
@@ -40,6 +40,8 @@ public:
   void setFrameId(int frame_id) { draw_frame_id = frame_id; }
   void setStreamType(VisionStreamType type) { requested_stream_type = type; }
   VisionStreamType getStreamType() { return active_stream_type; }
+  // milliseconds spent uploading the last drawn frame
+  double uploadTime() const { return upload_time; }
   void stopVipcThread();
 
 signals:
@@ -93,6 +95,7 @@ protected:
   std::deque<std::pair<uint32_t, VisionBuf*>> frames;
   uint32_t draw_frame_id = 0;
   uint32_t prev_frame_id = 0;
+  double upload_time = 0;
 
 protected slots:
   void vipcConnected(VisionIpcClient *vipc_client);
@@ -0,0 +1,321 @@
+#include <bzlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QLinearGradient>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLPaintDevice>
+#include <QPainter>
+#include <QTimer>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "msgq/visionipc/visionipc_server.h"
+#include "selfdrive/ui/qt/onroad/onroad_home.h"
+#include "selfdrive/ui/qt/util.h"
+#include "selfdrive/ui/ui.h"
+
+// Renders the onroad UI offscreen from a recorded log, one UI frame per 50ms of log time,
+// and reports the cost of UIState::update, painting, the camera frame upload and the model overlay.
+// the overlay is also drawn with QPainter into an offscreen framebuffer of the same size, as it
+// was before it moved to GL, so both are compared on the same frames.
+// run with a software GL driver, e.g. QT_QPA_PLATFORM=offscreen or under xvfb-run.
+
+namespace {
+
+const uint64_t UI_FRAME_NS = 1e9 / UI_FREQ;
+const int CAMERA_WIDTH = 1928, CAMERA_HEIGHT = 1208;
+
+std::string decompressBZ2(const std::string &in) {
+  bz_stream strm = {};
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return {};
+
+  std::string out;
+  std::vector<char> buf(1 << 20);
+  strm.next_in = (char *)in.data();
+  strm.avail_in = in.size();
+  int ret = BZ_OK;
+  do {
+    strm.next_out = buf.data();
+    strm.avail_out = buf.size();
+    ret = BZ2_bzDecompress(&strm);
+    out.append(buf.data(), buf.size() - strm.avail_out);
+  } while (ret == BZ_OK && (strm.avail_in > 0 || strm.avail_out == 0));
+  BZ2_bzDecompressEnd(&strm);
+  return ret == BZ_STREAM_END ? out : std::string{};
+}
+
+struct LogEvent {
+  uint64_t mono_time;
+  std::string name;
+  std::unique_ptr<capnp::FlatArrayMessageReader> reader;
+};
+
+struct Log {
+  std::string data;
+  std::vector<LogEvent> events;
+};
+
+bool readLog(const std::string &file, Log &log) {
+  log.data = util::read_file(file);
+  if (util::ends_with(file, ".bz2")) {
+    log.data = decompressBZ2(log.data);
+  }
+
+  std::vector<std::string> names;
+  for (auto field : capnp::Schema::from<cereal::Event>().asStruct().getUnionFields()) {
+    names.resize(std::max<size_t>(names.size(), field.getProto().getDiscriminantValue() + 1));
+    names[field.getProto().getDiscriminantValue()] = field.getProto().getName();
+  }
+
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data.data(), log.data.size() / sizeof(capnp::word));
+  try {
+    while (words.size() > 0) {
+      auto reader = std::make_unique<capnp::FlatArrayMessageReader>(words);
+      words = kj::arrayPtr(reader->getEnd(), words.end());
+      auto event = reader->getRoot<cereal::Event>();
+      log.events.push_back({event.getLogMonoTime(), names[event.which()], std::move(reader)});
+    }
+  } catch (const kj::Exception &e) {
+    fprintf(stderr, "failed to parse log: %s\n", e.getDescription().cStr());
+  }
+  std::stable_sort(log.events.begin(), log.events.end(), [](auto &a, auto &b) { return a.mono_time < b.mono_time; });
+  return !log.events.empty();
+}
+
+// the triangle strip of update_line_data as the outline polygon QPainter used to fill:
+// the right edge from the far end, then the left edge from the near end
+QPolygonF outline(const QPolygonF &strip) {
+  QPolygonF poly;
+  poly.reserve(strip.size());
+  for (int i = strip.size() - 1 - strip.size() % 2; i > 0; i -= 2) poly.push_back(strip[i]);
+  for (int i = 0; i < strip.size(); i += 2) poly.push_back(strip[i]);
+  return poly;
+}
+
+void drawPainterLead(QPainter &painter, const cereal::RadarState::LeadData::Reader &lead_data, const QPointF &vd, int width, int height) {
+  const float speedBuff = 10.;
+  const float leadBuff = 40.;
+  const float d_rel = lead_data.getDRel();
+  const float v_rel = lead_data.getVRel();
+
+  float fillAlpha = 0;
+  if (d_rel < leadBuff) {
+    fillAlpha = 255 * (1.0 - (d_rel / leadBuff));
+    if (v_rel < 0) {
+      fillAlpha += 255 * (-1 * (v_rel / speedBuff));
+    }
+    fillAlpha = (int)(fmin(fillAlpha, 255));
+  }
+
+  float sz = std::clamp((25 * 30) / (d_rel / 3 + 30), 15.0f, 30.0f) * 2.35;
+  float x = std::clamp((float)vd.x(), 0.f, width - sz / 2);
+  float y = std::fmin(height - sz * .6, (float)vd.y());
+
+  float g_xo = sz / 5;
+  float g_yo = sz / 10;
+
+  QPointF glow[] = {{x + (sz * 1.35) + g_xo, y + sz + g_yo}, {x, y - g_yo}, {x - (sz * 1.35) - g_xo, y + sz + g_yo}};
+  painter.setBrush(QColor(218, 202, 37, 255));
+  painter.drawPolygon(glow, std::size(glow));
+
+  QPointF chevron[] = {{x + (sz * 1.25), y + sz}, {x, y}, {x - (sz * 1.25), y + sz}};
+  painter.setBrush(QColor(201, 34, 49, fillAlpha));
+  painter.drawPolygon(chevron, std::size(chevron));
+}
+
+// lane lines, road edges, path and leads as AnnotatedCameraWidget drew them with QPainter on every frame
+void drawPainterOverlay(QPainter &painter, UIState *s, int width, int height) {
+  const UIScene &scene = s->scene;
+  SubMaster &sm = *(s->sm);
+  const cereal::ModelDataV2::Reader &model = sm["modelV2"].getModelV2();
+  update_model(s, model);
+
+  painter.setRenderHint(QPainter::Antialiasing);
+  painter.setPen(Qt::NoPen);
+  for (int i = 0; i < std::size(scene.lane_line_vertices); ++i) {
+    painter.setBrush(QColor::fromRgbF(1.0, 1.0, 1.0, std::clamp<float>(scene.lane_line_probs[i], 0.0, 0.7)));
+    painter.drawPolygon(outline(scene.lane_line_vertices[i]));
+  }
+  for (int i = 0; i < std::size(scene.road_edge_vertices); ++i) {
+    painter.setBrush(QColor::fromRgbF(1.0, 0, 0, std::clamp<float>(1.0 - scene.road_edge_stds[i], 0.0, 1.0)));
+    painter.drawPolygon(outline(scene.road_edge_vertices[i]));
+  }
+
+  const QPolygonF track = outline(scene.track_vertices);
+  QLinearGradient bg(0, height, 0, 0);
+  if (sm["controlsState"].getControlsState().getExperimentalMode()) {
+    // The first half of track is the right side of the path
+    const auto &acceleration = model.getAcceleration().getX();
+    const int max_len = std::min<int>(track.length() / 2, acceleration.size());
+    for (int i = 0; i < max_len; ++i) {
+      if (track[i].y() < 0 || track[i].y() > height) continue;
+
+      float lin_grad_point = (height - track[i].y()) / height;
+      float path_hue = fmax(fmin(60 + acceleration[i] * 35, 120), 0);
+      path_hue = int(path_hue * 100 + 0.5) / 100;
+      float saturation = fmin(fabs(acceleration[i] * 1.5), 1);
+      float lightness = util::map_val(saturation, 0.0f, 1.0f, 0.95f, 0.62f);
+      float alpha = util::map_val(lin_grad_point, 0.75f / 2.f, 0.75f, 0.4f, 0.0f);
+      bg.setColorAt(lin_grad_point, QColor::fromHslF(path_hue / 360., saturation, lightness, alpha));
+
+      i += (i + 2) < max_len ? 1 : 0;
+    }
+  } else {
+    bg.setColorAt(0.0, QColor::fromHslF(148 / 360., 0.94, 0.51, 0.4));
+    bg.setColorAt(0.5, QColor::fromHslF(112 / 360., 1.0, 0.68, 0.35));
+    bg.setColorAt(1.0, QColor::fromHslF(112 / 360., 1.0, 0.68, 0.0));
+  }
+  painter.setBrush(bg);
+  painter.drawPolygon(track);
+
+  if (scene.longitudinal_control && sm.rcv_frame("radarState") > scene.started_frame) {
+    auto radar_state = sm["radarState"].getRadarState();
+    update_leads(s, radar_state, model.getPosition());
+    auto lead_one = radar_state.getLeadOne();
+    auto lead_two = radar_state.getLeadTwo();
+    if (lead_one.getStatus()) {
+      drawPainterLead(painter, lead_one, scene.lead_vertices[0], width, height);
+    }
+    if (lead_two.getStatus() && (std::abs(lead_one.getDRel() - lead_two.getDRel()) > 3.0)) {
+      drawPainterLead(painter, lead_two, scene.lead_vertices[1], width, height);
+    }
+  }
+}
+
+void report(const char *name, std::vector<double> &times) {
+  if (times.empty()) return;
+  std::sort(times.begin(), times.end());
+  printf("%-16s p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", name,
+         times[times.size() / 2], times[times.size() * 99 / 100], times.back());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  initApp(argc, argv);
+
+  QApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmark rendering the onroad UI from a recorded log.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("log", "rlog or rlog.bz2 of a route segment");
+  parser.addOption({"frames", "number of UI frames to render. default is 600", "n", "600"});
+  parser.process(app);
+  if (parser.positionalArguments().empty()) {
+    parser.showHelp(1);
+  }
+
+  Log log;
+  if (!readLog(QDir::current().absoluteFilePath(parser.positionalArguments().first()).toStdString(), log)) {
+    qCritical() << "No events in log";
+    return 1;
+  }
+
+  // synthetic road camera frames, the upload costs the same regardless of the content
+  VisionIpcServer vipc_server("camerad");
+  vipc_server.create_buffers(VISION_STREAM_ROAD, 4, false, CAMERA_WIDTH, CAMERA_HEIGHT);
+  vipc_server.start_listener();
+
+  // change working directory to find assets
+  if (!QDir::setCurrent(QCoreApplication::applicationDirPath() + QDir::separator() + "..")) {
+    qCritical() << "Failed to set current directory";
+    return 1;
+  }
+
+  // UIState is driven by the log instead of its 20Hz timer
+  UIState *s = uiState();
+  s->timer->stop();
+
+  OnroadWindow w;
+  w.setFixedSize(2160, 1080);
+  w.show();
+  auto nvg = w.findChild<AnnotatedCameraWidget *>();
+  std::atomic<int> frames_received = 0;
+  QObject::connect(nvg, &CameraWidget::vipcThreadFrameReceived, [&]() { frames_received++; });
+  nvg->makeCurrent();
+  auto painter_fbo = std::make_unique<QOpenGLFramebufferObject>(nvg->size(), QOpenGLFramebufferObject::CombinedDepthStencil);
+  nvg->doneCurrent();
+
+  const int max_frames = parser.value("frames").toInt();
+  std::vector<double> update_times, paint_times, upload_times, overlay_times, painter_overlay_times;
+  uint32_t frame_id = 0;
+  auto &events = log.events;
+  auto it = events.begin();
+  for (uint64_t t = events.front().mono_time; it != events.end() && paint_times.size() < max_frames; t += UI_FRAME_NS) {
+    std::vector<std::pair<std::string, cereal::Event::Reader>> msgs;
+    for (; it != events.end() && it->mono_time < t + UI_FRAME_NS; ++it) {
+      auto event = it->reader->getRoot<cereal::Event>();
+      if (event.isModelV2()) frame_id = event.getModelV2().getFrameId();
+      msgs.push_back({it->name, event});
+    }
+    s->sm->update_msgs(nanos_since_boot(), msgs);
+
+    VisionBuf *buf = vipc_server.get_buffer(VISION_STREAM_ROAD);
+    VisionIpcBufExtra extra = {.frame_id = frame_id};
+    const int frames_sent = frames_received + 1;
+    vipc_server.send(buf, &extra);
+
+    double start_t = millis_since_boot();
+    s->processMessages();
+    double update_t = millis_since_boot() - start_t;
+
+    // wait for the camera widget to receive the frame, the first one also waits for it to connect
+    for (double wait_start_t = millis_since_boot(); frames_received < frames_sent && millis_since_boot() - wait_start_t < 5000;) {
+      app.processEvents(QEventLoop::AllEvents, 10);
+    }
+    app.processEvents();
+
+    start_t = millis_since_boot();
+    nvg->repaint();
+    nvg->makeCurrent();
+    QOpenGLContext::currentContext()->functions()->glFinish();
+    nvg->doneCurrent();
+    double paint_t = millis_since_boot() - start_t;
+
+    if (s->scene.world_objects_visible) {
+      update_times.push_back(update_t);
+      paint_times.push_back(paint_t);
+      upload_times.push_back(nvg->uploadTime());
+      overlay_times.push_back(nvg->overlayTime());
+
+      // the same overlay through QPainter, timed the same way: projection and issuing the draws
+      nvg->makeCurrent();
+      painter_fbo->bind();
+      QOpenGLPaintDevice device(painter_fbo->size());
+      start_t = millis_since_boot();
+      {
+        QPainter painter(&device);
+        drawPainterOverlay(painter, s, device.width(), device.height());
+      }
+      painter_overlay_times.push_back(millis_since_boot() - start_t);
+      painter_fbo->release();
+      nvg->doneCurrent();
+    }
+  }
+
+  printf("%zu frames at %dx%d\n", paint_times.size(), w.width(), w.height());
+  report("UIState::update", update_times);
+  report("paint", paint_times);
+  report("GL upload", upload_times);
+  report("overlay GL", overlay_times);
+  report("overlay QPainter", painter_overlay_times);
+
+  nvg->makeCurrent();
+  painter_fbo.reset();
+  nvg->doneCurrent();
+  return paint_times.empty() ? 1 : 0;
+}
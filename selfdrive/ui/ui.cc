@@ -16,18 +16,28 @@
 #define BACKLIGHT_DT 0.05
 #define BACKLIGHT_TS 10.00
 
+// The projection from car space to full frame image space, calibration and
+// intrinsics followed by the widget transform, as a single homography.
+static mat3 calib_frame_to_full_frame_matrix(const UIState *s) {
+  const mat3 &calib = s->scene.wide_cam ? s->scene.view_from_wide_calib : s->scene.view_from_calib;
+  const mat3 &intrinsics = s->scene.wide_cam ? ECAM_INTRINSIC_MATRIX : FCAM_INTRINSIC_MATRIX;
+  const QTransform &t = s->car_space_transform;
+  const mat3 transform = {{
+    (float)t.m11(), (float)t.m21(), (float)t.dx(),
+    (float)t.m12(), (float)t.m22(), (float)t.dy(),
+    0.0f, 0.0f, 1.0f,
+  }};
+  return matmul3(transform, matmul3(intrinsics, calib));
+}
+
 // Projects a point in car to space to the corresponding point in full frame
 // image space.
-static bool calib_frame_to_full_frame(const UIState *s, float in_x, float in_y, float in_z, QPointF *out) {
+static bool calib_frame_to_full_frame(const UIState *s, const mat3 &projection, float in_x, float in_y, float in_z, QPointF *out) {
   const float margin = 500.0f;
   const QRectF clip_region{-margin, -margin, s->fb_w + 2 * margin, s->fb_h + 2 * margin};
 
-  const vec3 pt = (vec3){{in_x, in_y, in_z}};
-  const vec3 Ep = matvecmul3(s->scene.wide_cam ? s->scene.view_from_wide_calib : s->scene.view_from_calib, pt);
-  const vec3 KEp = matvecmul3(s->scene.wide_cam ? ECAM_INTRINSIC_MATRIX : FCAM_INTRINSIC_MATRIX, Ep);
-
-  // Project.
-  QPointF point = s->car_space_transform.map(QPointF{KEp.v[0] / KEp.v[2], KEp.v[1] / KEp.v[2]});
+  const vec3 p = matvecmul3(projection, (vec3){{in_x, in_y, in_z}});
+  QPointF point{p.v[0] / p.v[2], p.v[1] / p.v[2]};
   if (clip_region.contains(point)) {
     *out = point;
     return true;
@@ -45,33 +55,35 @@ int get_path_length_idx(const cereal::XYZTData::Reader &line, const float path_h
 }
 
 void update_leads(UIState *s, const cereal::RadarState::Reader &radar_state, const cereal::XYZTData::Reader &line) {
+  const mat3 projection = calib_frame_to_full_frame_matrix(s);
   for (int i = 0; i < 2; ++i) {
     auto lead_data = (i == 0) ? radar_state.getLeadOne() : radar_state.getLeadTwo();
     if (lead_data.getStatus()) {
       float z = line.getZ()[get_path_length_idx(line, lead_data.getDRel())];
-      calib_frame_to_full_frame(s, lead_data.getDRel(), -lead_data.getYRel(), z + 1.22, &s->scene.lead_vertices[i]);
+      calib_frame_to_full_frame(s, projection, lead_data.getDRel(), -lead_data.getYRel(), z + 1.22, &s->scene.lead_vertices[i]);
     }
   }
 }
 
-void update_line_data(const UIState *s, const cereal::XYZTData::Reader &line,
+void update_line_data(const UIState *s, const mat3 &projection, const cereal::XYZTData::Reader &line,
                       float y_off, float z_off, QPolygonF *pvd, int max_idx, bool allow_invert=true) {
   const auto line_x = line.getX(), line_y = line.getY(), line_z = line.getZ();
   QPointF left, right;
   pvd->clear();
+  pvd->reserve((max_idx + 1) * 2);
   for (int i = 0; i <= max_idx; i++) {
     // highly negative x positions  are drawn above the frame and cause flickering, clip to zy plane of camera
     if (line_x[i] < 0) continue;
 
-    bool l = calib_frame_to_full_frame(s, line_x[i], line_y[i] - y_off, line_z[i] + z_off, &left);
-    bool r = calib_frame_to_full_frame(s, line_x[i], line_y[i] + y_off, line_z[i] + z_off, &right);
+    bool l = calib_frame_to_full_frame(s, projection, line_x[i], line_y[i] - y_off, line_z[i] + z_off, &left);
+    bool r = calib_frame_to_full_frame(s, projection, line_x[i], line_y[i] + y_off, line_z[i] + z_off, &right);
     if (l && r) {
       // For wider lines the drawn polygon will "invert" when going over a hill and cause artifacts
-      if (!allow_invert && pvd->size() && left.y() > pvd->back().y()) {
+      if (!allow_invert && pvd->size() && left.y() > (*pvd)[pvd->size() - 2].y()) {
         continue;
       }
       pvd->push_back(left);
-      pvd->push_front(right);
+      pvd->push_back(right);
     }
   }
 }
@@ -79,6 +91,7 @@ void update_line_data(const UIState *s, const cereal::XYZTData::Reader &line,
 void update_model(UIState *s,
                   const cereal::ModelDataV2::Reader &model) {
   UIScene &scene = s->scene;
+  const mat3 projection = calib_frame_to_full_frame_matrix(s);
   auto model_position = model.getPosition();
   float max_distance = std::clamp(*(model_position.getX().end() - 1),
                                   MIN_DRAW_DISTANCE, MAX_DRAW_DISTANCE);
@@ -89,7 +102,7 @@ void update_model(UIState *s,
   int max_idx = get_path_length_idx(lane_lines[0], max_distance);
   for (int i = 0; i < std::size(scene.lane_line_vertices); i++) {
     scene.lane_line_probs[i] = lane_line_probs[i];
-    update_line_data(s, lane_lines[i], 0.025 * scene.lane_line_probs[i], 0, &scene.lane_line_vertices[i], max_idx);
+    update_line_data(s, projection, lane_lines[i], 0.025 * scene.lane_line_probs[i], 0, &scene.lane_line_vertices[i], max_idx);
   }
 
   // update road edges
@@ -97,7 +110,7 @@ void update_model(UIState *s,
   const auto road_edge_stds = model.getRoadEdgeStds();
   for (int i = 0; i < std::size(scene.road_edge_vertices); i++) {
     scene.road_edge_stds[i] = road_edge_stds[i];
-    update_line_data(s, road_edges[i], 0.025, 0, &scene.road_edge_vertices[i], max_idx);
+    update_line_data(s, projection, road_edges[i], 0.025, 0, &scene.road_edge_vertices[i], max_idx);
   }
 
   // update path
@@ -107,7 +120,7 @@ void update_model(UIState *s,
     max_distance = std::clamp((float)(lead_d - fmin(lead_d * 0.35, 10.)), 0.0f, max_distance);
   }
   max_idx = get_path_length_idx(model_position, max_distance);
-  update_line_data(s, model_position, 0.9, 1.22, &scene.track_vertices, max_idx, false);
+  update_line_data(s, projection, model_position, 0.9, 1.22, &scene.track_vertices, max_idx, false);
 }
 
 void update_dmonitoring(UIState *s, const cereal::DriverStateV2::Reader &driverstate, float dm_fade_state, bool is_rhd) {
@@ -261,6 +274,10 @@ UIState::UIState(QObject *parent) : QObject(parent) {
 
 void UIState::update() {
   update_sockets(this);
+  processMessages();
+}
+
+void UIState::processMessages() {
   update_state(this);
   updateStatus();
 
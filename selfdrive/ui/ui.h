@@ -78,7 +78,7 @@ typedef struct UIScene {
   mat3 view_from_wide_calib = DEFAULT_CALIBRATION;
   cereal::PandaState::PandaType pandaType;
 
-  // modelV2
+  // modelV2, lines are triangle strips alternating between their left and right edge
   float lane_line_probs[4];
   float road_edge_stds[2];
   QPolygonF track_vertices;
@@ -109,6 +109,8 @@ class UIState : public QObject {
 public:
   UIState(QObject* parent = 0);
   void updateStatus();
+  // updates the scene from the messages already in sm and notifies the widgets
+  void processMessages();
   inline bool engaged() const {
     return scene.started && (*sm)["controlsState"].getControlsState().getEnabled();
   }
@@ -120,6 +122,7 @@ public:
   int fb_w = 0, fb_h = 0;
 
   std::unique_ptr<SubMaster> sm;
+  QTimer *timer;  // drives update() at UI_FREQ
 
   UIStatus status;
   UIScene scene = {};
@@ -138,7 +141,6 @@ private slots:
   void update();
 
 private:
-  QTimer *timer;
   bool started_prev = false;
   PrimeType prime_type = PrimeType::UNKNOWN;
 };
@@ -187,5 +189,5 @@ void update_model(UIState *s,
                   const cereal::ModelDataV2::Reader &model);
 void update_dmonitoring(UIState *s, const cereal::DriverStateV2::Reader &driverstate, float dm_fade_state, bool is_rhd);
 void update_leads(UIState *s, const cereal::RadarState::Reader &radar_state, const cereal::XYZTData::Reader &line);
-void update_line_data(const UIState *s, const cereal::XYZTData::Reader &line,
+void update_line_data(const UIState *s, const mat3 &projection, const cereal::XYZTData::Reader &line,
                       float y_off, float z_off, QPolygonF *pvd, int max_idx, bool allow_invert);
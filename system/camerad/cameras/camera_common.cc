@@ -1,6 +1,7 @@
 #include "system/camerad/cameras/camera_common.h"
 
 #include <cassert>
+#include <cstring>
 #include <string>
 
 #include "third_party/libyuv/include/libyuv.h"
@@ -17,44 +18,45 @@
 
 ExitHandler do_exit;
 
-class ImgProc {
-public:
-  ImgProc(cl_device_id device_id, cl_context context, const CameraBuf *b, const CameraState *s, int buf_width, int uv_offset) {
-    char args[4096];
-    const SensorInfo *ci = s->ci.get();
-    snprintf(args, sizeof(args),
-             "-cl-fast-relaxed-math -cl-denorms-are-zero -Isensors "
-             "-DFRAME_WIDTH=%d -DFRAME_HEIGHT=%d -DFRAME_STRIDE=%d -DFRAME_OFFSET=%d "
-             "-DRGB_WIDTH=%d -DRGB_HEIGHT=%d -DYUV_STRIDE=%d -DUV_OFFSET=%d "
-             "-DSENSOR_ID=%hu -DHDR_OFFSET=%d -DVIGNETTING=%d ",
-             ci->frame_width, ci->frame_height, ci->hdr_offset > 0 ? ci->frame_stride * 2 : ci->frame_stride, ci->frame_offset,
-             b->rgb_width, b->rgb_height, buf_width, uv_offset,
-             static_cast<unsigned short>(ci->image_sensor), ci->hdr_offset, s->camera_num == 1);
-    const char *cl_file = "cameras/process_raw.cl";
-    cl_program prg_imgproc = cl_program_from_file(context, device_id, cl_file, args);
-    krnl_ = CL_CHECK_ERR(clCreateKernel(prg_imgproc, "process_raw", &err));
-    CL_CHECK(clReleaseProgram(prg_imgproc));
-
-  }
+std::string process_raw_build_args(const SensorInfo *ci, int rgb_width, int rgb_height, int yuv_stride, int uv_offset, bool vignetting) {
+  return util::string_format(
+      "-cl-fast-relaxed-math -cl-denorms-are-zero -Isensors "
+      "-DFRAME_WIDTH=%d -DFRAME_HEIGHT=%d -DFRAME_STRIDE=%d -DFRAME_OFFSET=%d "
+      "-DRGB_WIDTH=%d -DRGB_HEIGHT=%d -DYUV_STRIDE=%d -DUV_OFFSET=%d "
+      "-DSENSOR_ID=%hu -DHDR_OFFSET=%d -DVIGNETTING=%d ",
+      ci->frame_width, ci->frame_height, ci->hdr_offset > 0 ? ci->frame_stride * 2 : ci->frame_stride, ci->frame_offset,
+      rgb_width, rgb_height, yuv_stride, uv_offset,
+      static_cast<unsigned short>(ci->image_sensor), ci->hdr_offset, (int)vignetting);
+}
 
-  void queue(cl_command_queue q, cl_mem cam_buf_cl, cl_mem buf_cl, int width, int height, cl_event *imgproc_event, int expo_time) {
-    CL_CHECK(clSetKernelArg(krnl_, 0, sizeof(cl_mem), &cam_buf_cl));
-    CL_CHECK(clSetKernelArg(krnl_, 1, sizeof(cl_mem), &buf_cl));
-    CL_CHECK(clSetKernelArg(krnl_, 2, sizeof(cl_int), &expo_time));
+ImgProc::ImgProc(cl_device_id device_id, cl_context context, const SensorInfo *ci, int rgb_width, int rgb_height,
+                 int yuv_stride, int uv_offset, bool vignetting, const std::string &extra_args) {
+  const std::string args = process_raw_build_args(ci, rgb_width, rgb_height, yuv_stride, uv_offset, vignetting) + extra_args;
+  const char *cl_file = "cameras/process_raw.cl";
+  cl_program prg_imgproc = cl_program_from_file(context, device_id, cl_file, args.c_str());
+  krnl_ = CL_CHECK_ERR(clCreateKernel(prg_imgproc, "process_raw", &err));
+  CL_CHECK(clReleaseProgram(prg_imgproc));
+}
 
-    const size_t globalWorkSize[] = {size_t(width / 2), size_t(height / 2)};
-    const int imgproc_local_worksize = 16;
-    const size_t localWorkSize[] = {imgproc_local_worksize, imgproc_local_worksize};
-    CL_CHECK(clEnqueueNDRangeKernel(q, krnl_, 2, NULL, globalWorkSize, localWorkSize, 0, 0, imgproc_event));
-  }
+void ImgProc::queue(cl_command_queue q, cl_mem cam_buf_cl, cl_mem buf_cl, int width, int height, cl_event *imgproc_event, int expo_time) {
+  CL_CHECK(clSetKernelArg(krnl_, 0, sizeof(cl_mem), &cam_buf_cl));
+  CL_CHECK(clSetKernelArg(krnl_, 1, sizeof(cl_mem), &buf_cl));
+  CL_CHECK(clSetKernelArg(krnl_, 2, sizeof(cl_int), &expo_time));
 
-  ~ImgProc() {
-    CL_CHECK(clReleaseKernel(krnl_));
-  }
+  const size_t globalWorkSize[] = {size_t(width / 2), size_t(height / 2)};
+#ifdef QCOM2
+  const int imgproc_local_worksize = 16;
+  const size_t localWorkSize[] = {imgproc_local_worksize, imgproc_local_worksize};
+#else
+  // OpenCL 1.2 runtimes need the global size to be a multiple of the local size, let them pick it
+  const size_t *localWorkSize = NULL;
+#endif
+  CL_CHECK(clEnqueueNDRangeKernel(q, krnl_, 2, NULL, globalWorkSize, localWorkSize, 0, 0, imgproc_event));
+}
 
-private:
-  cl_kernel krnl_;
-};
+ImgProc::~ImgProc() {
+  CL_CHECK(clReleaseKernel(krnl_));
+}
 
 void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s, VisionIpcServer * v, int frame_cnt, VisionStreamType type) {
   vipc_server = v;
@@ -89,7 +91,7 @@ void CameraBuf::init(cl_device_id device_id, cl_context context, CameraState *s,
   vipc_server->create_buffers_with_sizes(stream_type, YUV_BUFFER_COUNT, false, rgb_width, rgb_height, nv12_size, nv12_width, nv12_uv_offset);
   LOGD("created %d YUV vipc buffers with size %dx%d", YUV_BUFFER_COUNT, nv12_width, nv12_height);
 
-  imgproc = new ImgProc(device_id, context, this, s, nv12_width, nv12_uv_offset);
+  imgproc = new ImgProc(device_id, context, ci, rgb_width, rgb_height, nv12_width, nv12_uv_offset, s->camera_num == 1);
 
   const cl_queue_properties props[] = {0};  //CL_QUEUE_PRIORITY_KHR, CL_QUEUE_PRIORITY_HIGH_KHR, 0};
   q = CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
@@ -168,30 +170,24 @@ kj::Array<uint8_t> get_raw_frame_image(const CameraBuf *b) {
   return kj::mv(frame_image);
 }
 
-static kj::Array<capnp::byte> yuv420_to_jpeg(const CameraBuf *b, int thumbnail_width, int thumbnail_height) {
-  int downscale = b->cur_yuv_buf->width / thumbnail_width;
-  assert(downscale * thumbnail_height == b->cur_yuv_buf->height);
-  int in_stride = b->cur_yuv_buf->stride;
+kj::Array<capnp::byte> yuv420_to_jpeg(const VisionBuf *yuv, int thumbnail_width, int thumbnail_height) {
+  const int width = yuv->width, height = yuv->height, stride = yuv->stride;
+  const int uv_width = width / 2, uv_height = height / 2;
 
   // make the buffer big enough. jpeg_write_raw_data requires 16-pixels aligned height to be used.
-  std::unique_ptr<uint8[]> buf(new uint8_t[(thumbnail_width * ((thumbnail_height + 15) & ~15) * 3) / 2]);
+  const int planes_size = (thumbnail_width * ((thumbnail_height + 15) & ~15) * 3) / 2;
+  std::unique_ptr<uint8[]> buf(new uint8_t[planes_size + uv_width * uv_height * 2]);
   uint8_t *y_plane = buf.get();
   uint8_t *u_plane = y_plane + thumbnail_width * thumbnail_height;
   uint8_t *v_plane = u_plane + (thumbnail_width * thumbnail_height) / 4;
   {
-    // subsampled conversion from nv12 to yuv
-    for (int hy = 0; hy < thumbnail_height/2; hy++) {
-      for (int hx = 0; hx < thumbnail_width/2; hx++) {
-        int ix = hx * downscale + (downscale-1)/2;
-        int iy = hy * downscale + (downscale-1)/2;
-        y_plane[(hy*2 + 0)*thumbnail_width + (hx*2 + 0)] = b->cur_yuv_buf->y[(iy*2 + 0) * in_stride + ix*2 + 0];
-        y_plane[(hy*2 + 0)*thumbnail_width + (hx*2 + 1)] = b->cur_yuv_buf->y[(iy*2 + 0) * in_stride + ix*2 + 1];
-        y_plane[(hy*2 + 1)*thumbnail_width + (hx*2 + 0)] = b->cur_yuv_buf->y[(iy*2 + 1) * in_stride + ix*2 + 0];
-        y_plane[(hy*2 + 1)*thumbnail_width + (hx*2 + 1)] = b->cur_yuv_buf->y[(iy*2 + 1) * in_stride + ix*2 + 1];
-        u_plane[hy*thumbnail_width/2 + hx] = b->cur_yuv_buf->uv[iy*in_stride + ix*2 + 0];
-        v_plane[hy*thumbnail_width/2 + hx] = b->cur_yuv_buf->uv[iy*in_stride + ix*2 + 1];
-      }
-    }
+    // box filtered downscale from nv12 to yuv. libyuv has no NV12 scaler, so chroma is deinterleaved at full size first
+    uint8_t *u_full = buf.get() + planes_size;
+    uint8_t *v_full = u_full + uv_width * uv_height;
+    libyuv::SplitUVPlane(yuv->uv, stride, u_full, uv_width, v_full, uv_width, uv_width, uv_height);
+    libyuv::ScalePlane(yuv->y, stride, width, height, y_plane, thumbnail_width, thumbnail_width, thumbnail_height, libyuv::kFilterBox);
+    libyuv::ScalePlane(u_full, uv_width, uv_width, uv_height, u_plane, thumbnail_width / 2, thumbnail_width / 2, thumbnail_height / 2, libyuv::kFilterBox);
+    libyuv::ScalePlane(v_full, uv_width, uv_width, uv_height, v_plane, thumbnail_width / 2, thumbnail_width / 2, thumbnail_height / 2, libyuv::kFilterBox);
   }
 
   struct jpeg_compress_struct cinfo;
@@ -245,7 +241,7 @@ static kj::Array<capnp::byte> yuv420_to_jpeg(const CameraBuf *b, int thumbnail_w
 }
 
 static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
-  auto thumbnail = yuv420_to_jpeg(b, b->rgb_width / 4, b->rgb_height / 4);
+  auto thumbnail = yuv420_to_jpeg(b->cur_yuv_buf, b->rgb_width / 4, b->rgb_height / 4);
   if (thumbnail.size() == 0) return;
 
   MessageBuilder msg;
@@ -257,30 +253,65 @@ static void publish_thumbnail(PubMaster *pm, const CameraBuf *b) {
   pm->send("thumbnail", msg);
 }
 
-float set_exposure_target(const CameraBuf *b, Rect ae_xywh, int x_skip, int y_skip) {
-  int lum_med;
-  uint32_t lum_binning[256] = {0};
-  const uint8_t *pix_ptr = b->cur_yuv_buf->y;
-
-  unsigned int lum_total = 0;
-  for (int y = ae_xywh.y; y < ae_xywh.y + ae_xywh.h; y += y_skip) {
-    for (int x = ae_xywh.x; x < ae_xywh.x + ae_xywh.w; x += x_skip) {
-      uint8_t lum = pix_ptr[(y * b->rgb_width) + x];
-      lum_binning[lum]++;
-      lum_total += 1;
+uint32_t luma_histogram(const uint8_t *y, int stride, Rect rect, int x_skip, int y_skip, uint32_t hist[256]) {
+  // samples go round robin to 4 banks, so runs of similar pixels don't serialize on the same counter.
+  // rows are read 8 bytes at a time for the skips camerad uses
+  uint32_t banks[4][256] = {};
+  const int count = (rect.w + x_skip - 1) / x_skip;
+  uint32_t total = 0;
+  for (int row = rect.y; row < rect.y + rect.h; row += y_skip) {
+    const uint8_t *p = y + row * stride + rect.x;
+    int i = 0;
+    if (x_skip == 1) {
+      for (; i + 8 <= count; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, sizeof(v));
+        banks[0][v & 0xFF]++;
+        banks[1][(v >> 8) & 0xFF]++;
+        banks[2][(v >> 16) & 0xFF]++;
+        banks[3][(v >> 24) & 0xFF]++;
+        banks[0][(v >> 32) & 0xFF]++;
+        banks[1][(v >> 40) & 0xFF]++;
+        banks[2][(v >> 48) & 0xFF]++;
+        banks[3][v >> 56]++;
+      }
+    } else if (x_skip == 2) {
+      for (; 2 * i + 8 <= rect.w; i += 4) {
+        uint64_t v;
+        memcpy(&v, p + 2 * i, sizeof(v));
+        banks[0][v & 0xFF]++;
+        banks[1][(v >> 16) & 0xFF]++;
+        banks[2][(v >> 32) & 0xFF]++;
+        banks[3][(v >> 48) & 0xFF]++;
+      }
+    }
+    for (; i < count; ++i) {
+      banks[i & 3][p[i * x_skip]]++;
     }
+    total += count;
   }
 
-  // Find mean lumimance value
-  unsigned int lum_cur = 0;
-  for (lum_med = 255; lum_med >= 0; lum_med--) {
-    lum_cur += lum_binning[lum_med];
+  for (int i = 0; i < 256; ++i) {
+    hist[i] = banks[0][i] + banks[1][i] + banks[2][i] + banks[3][i];
+  }
+  return total;
+}
 
-    if (lum_cur >= lum_total / 2) {
-      break;
-    }
+int histogram_percentile(const uint32_t hist[256], uint32_t count) {
+  uint32_t cur = 0;
+  int value = 255;
+  for (; value >= 0; value--) {
+    cur += hist[value];
+    if (cur >= count) break;
   }
+  return value;
+}
 
+float set_exposure_target(const CameraBuf *b, Rect ae_xywh, int x_skip, int y_skip) {
+  uint32_t lum_binning[256];
+  const uint32_t lum_total = luma_histogram(b->cur_yuv_buf->y, b->rgb_width, ae_xywh, x_skip, y_skip, lum_binning);
+  // Find mean lumimance value
+  const int lum_med = histogram_percentile(lum_binning, lum_total / 2);
   return lum_med / 256.0;
 }
 
@@ -2,6 +2,7 @@
 
 #include <fcntl.h>
 #include <memory>
+#include <string>
 #include <thread>
 
 #include "cereal/messaging/messaging.h"
@@ -45,7 +46,19 @@ typedef struct FrameMetadata {
 
 struct MultiCameraState;
 class CameraState;
-class ImgProc;
+class SensorInfo;
+
+// runs cameras/process_raw.cl, converting RAW frames of the sensor to NV12
+class ImgProc {
+public:
+  ImgProc(cl_device_id device_id, cl_context context, const SensorInfo *ci, int rgb_width, int rgb_height,
+          int yuv_stride, int uv_offset, bool vignetting, const std::string &extra_args = "");
+  ~ImgProc();
+  void queue(cl_command_queue q, cl_mem cam_buf_cl, cl_mem buf_cl, int width, int height, cl_event *imgproc_event, int expo_time);
+
+private:
+  cl_kernel krnl_;
+};
 
 class CameraBuf {
 private:
@@ -76,6 +89,13 @@ typedef void (*process_thread_cb)(MultiCameraState *s, CameraState *c, int cnt);
 
 void fill_frame_data(cereal::FrameData::Builder &framed, const FrameMetadata &frame_data, CameraState *c);
 kj::Array<uint8_t> get_raw_frame_image(const CameraBuf *b);
+std::string process_raw_build_args(const SensorInfo *ci, int rgb_width, int rgb_height, int yuv_stride, int uv_offset, bool vignetting);
+// box filtered thumbnail of the NV12 image
+kj::Array<capnp::byte> yuv420_to_jpeg(const VisionBuf *yuv, int thumbnail_width, int thumbnail_height);
+// histogram of every x_skip'th pixel on every y_skip'th row of rect, returns the number of samples
+uint32_t luma_histogram(const uint8_t *y, int stride, Rect rect, int x_skip, int y_skip, uint32_t hist[256]);
+// the highest value with at least `count` samples at or above it
+int histogram_percentile(const uint32_t hist[256], uint32_t count);
 float set_exposure_target(const CameraBuf *b, Rect ae_xywh, int x_skip, int y_skip);
 std::thread start_process_thread(MultiCameraState *cameras, CameraState *cs, process_thread_cb callback);
 
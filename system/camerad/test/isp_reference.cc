@@ -0,0 +1,408 @@
+#include "system/camerad/test/isp_reference.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "third_party/linux/include/msm_media_info.h"
+
+namespace {
+
+// the float4/int4 of the kernel, rgb values use the first 3 lanes
+typedef float float4 __attribute__((vector_size(16)));
+typedef int int4 __attribute__((vector_size(16)));
+
+const float ox03c10_lut[] = {
+#include "system/camerad/sensors/ox03c10_lut.h"
+};
+
+// OpenCL semantics: NaN clamps to the lower bound and converts to 0, conversions round toward zero
+inline float clampf(float v, float lo, float hi) { return fminf(fmaxf(v, lo), hi); }
+inline float4 clamp01(float4 v) {
+  for (int i = 0; i < 4; ++i) v[i] = clampf(v[i], 0.0f, 1.0f);
+  return v;
+}
+inline uint8_t convert_uchar_sat(float v) { return v > 0.0f ? (v < 255.0f ? (uint8_t)v : 255) : 0; }
+inline float4 convert_float4(int4 v) { return float4{(float)v[0], (float)v[1], (float)v[2], (float)v[3]}; }
+
+inline float4 color_correct(float4 rgb, const float4 (&ccm)[3]) {
+  return rgb[0] * ccm[0] + rgb[1] * ccm[1] + rgb[2] * ccm[2];
+}
+
+struct AR0231Isp {
+  static constexpr int BIT_DEPTH = 12;
+  static constexpr bool BGGR = false;
+  static constexpr float VIGNETTE_RSZ = 1.0f;
+
+  static float4 normalize(int4 parsed, int4 short_parsed, float vignette_factor, int expo_time) {
+    const float BLACK_LVL = 168, PV_MAX = 4096;
+    float4 pv = (convert_float4(parsed) - BLACK_LVL) / (PV_MAX - BLACK_LVL);
+    return clamp01(pv * vignette_factor);
+  }
+  static float4 colorCorrect(float4 rgb) {
+    static const float4 ccm[3] = {{1.82717181f, -0.31231438f, 0.07307673f, 0},
+                                  {-0.5743977f, 1.36858544f, -0.53183455f, 0},
+                                  {-0.25277411f, -0.05627105f, 1.45875782f, 0}};
+    return color_correct(rgb, ccm);
+  }
+  static float4 applyGamma(float4 rgb, int expo_time) {
+    const float gamma_k = 0.75f, gamma_b = 0.125f, mp = 0.01f;
+    const float rk = 9 - 100 * mp;
+    for (int i = 0; i < 3; ++i) {
+      const float x = rgb[i];
+      rgb[i] = x > mp ?
+        ((rk * (x - mp) * (1 - (gamma_k * mp + gamma_b)) * (1 + 1 / (rk * (1 - mp))) / (1 + rk * (x - mp))) + gamma_k * mp + gamma_b) :
+        ((rk * (x - mp) * (gamma_k * mp + gamma_b) * (1 + 1 / (rk * mp)) / (1 - rk * (x - mp))) + gamma_k * mp + gamma_b);
+    }
+    return rgb;
+  }
+};
+
+struct OX03C10Isp {
+  static constexpr int BIT_DEPTH = 12;
+  static constexpr bool BGGR = false;
+  static constexpr float VIGNETTE_RSZ = 1.0f;
+
+  static float4 normalize(int4 parsed, int4 short_parsed, float vignette_factor, int expo_time) {
+    float4 pv = {ox03c10_lut[parsed[0]], ox03c10_lut[parsed[1]], ox03c10_lut[parsed[2]], ox03c10_lut[parsed[3]]};
+    return clamp01(pv * vignette_factor * 256.0f);
+  }
+  static float4 colorCorrect(float4 rgb) {
+    static const float4 ccm[3] = {{1.5664815f, -0.29808738f, -0.03973474f, 0},
+                                  {-0.48672447f, 1.41914433f, -0.40295248f, 0},
+                                  {-0.07975703f, -0.12105695f, 1.44268722f, 0}};
+    return color_correct(rgb, ccm);
+  }
+  static float4 applyGamma(float4 rgb, int expo_time) {
+    for (int i = 0; i < 3; ++i) {
+      const float x = rgb[i];
+      rgb[i] = -0.507089f * expf(-12.54124638f * x) + 0.9655f * powf(x, 0.5f) - 0.472597f * x + 0.507089f;
+    }
+    return rgb;
+  }
+};
+
+struct OS04C10Isp {
+  static constexpr int BIT_DEPTH = 10;
+  static constexpr bool BGGR = true;
+  static constexpr float VIGNETTE_RSZ = 2.2545f;
+
+  static float combineDualPvs(float lv, float sv, int expo_time) {
+    const float PV_MAX10 = 1023, PV_MAX16 = 65536, BLACK_LVL = 64;
+    const float svc = fmaxf(sv * expo_time, 64 * (PV_MAX10 - BLACK_LVL));
+    const float svd = sv * fminf(expo_time, 8.0f) / 8;
+    if (expo_time > 64) {
+      return lv < PV_MAX10 - BLACK_LVL ? lv / (PV_MAX16 - BLACK_LVL) : (svc / 64) / (PV_MAX16 - BLACK_LVL);
+    } else {
+      return lv > 32 ? (lv * 64 / fmaxf(expo_time, 8.0f)) / (PV_MAX16 - BLACK_LVL) : svd / (PV_MAX16 - BLACK_LVL);
+    }
+  }
+  static float4 normalize(int4 parsed, int4 short_parsed, float vignette_factor, int expo_time) {
+    const float4 pl = convert_float4(parsed - 64);
+    const float4 ps = convert_float4(short_parsed - 64);
+    float4 pv;
+    for (int i = 0; i < 4; ++i) {
+      pv[i] = combineDualPvs(pl[i], ps[i], expo_time);
+    }
+    return clamp01(pv * vignette_factor);
+  }
+  static float4 colorCorrect(float4 rgb) {
+    static const float4 ccm[3] = {{1.55361989f, -0.268894615f, -0.000593219f, 0},
+                                  {-0.421217301f, 1.51883144f, -0.69760146f, 0},
+                                  {-0.132402589f, -0.249936825f, 1.69819468f, 0}};
+    return color_correct(rgb, ccm);
+  }
+  static float4 applyGamma(float4 rgb, int expo_time) {
+    float s = log2f((float)expo_time);
+    if (s < 6) s = fminf(12.0f - s, 9.0f);
+    for (int i = 0; i < 3; ++i) {
+      const float v = logf(1 + rgb[i] * (65536 - 64)) * (0.48f * s * s - 12.92f * s + 115.0f) - (1.08f * s * s - 29.2f * s + 260.0f);
+      rgb[i] = clampf(v, 0.0f, 255.0f) / 255.0f;
+    }
+    return rgb;
+  }
+};
+
+float get_vignetting_s(float r) {
+  if (r < 62500) {
+    return 1.0f + 0.0000008f * r;
+  } else if (r < 490000) {
+    return 0.9625f + 0.0000014f * r;
+  } else if (r < 1102500) {
+    return 1.26434f + 0.0000000000016f * r * r;
+  } else {
+    return 0.53503625f + 0.0000000000022f * r * r;
+  }
+}
+
+int4 parse_12bit(const uint8_t *pvs) {
+  return int4{((int)pvs[0] << 4) + (pvs[1] >> 4),
+              ((int)pvs[2] << 4) + (pvs[4] & 0xF),
+              ((int)pvs[3] << 4) + (pvs[4] >> 4),
+              ((int)pvs[5] << 4) + (pvs[7] & 0xF)};
+}
+
+int4 parse_10bit(const uint8_t *pvs, uint8_t ext, bool aligned) {
+  if (aligned) {
+    return int4{((int)pvs[0] << 2) + (pvs[1] & 0b00000011),
+                ((int)pvs[2] << 2) + ((pvs[6] & 0b11000000) / 64),
+                ((int)pvs[3] << 2) + ((pvs[6] & 0b00110000) / 16),
+                ((int)pvs[4] << 2) + ((pvs[6] & 0b00001100) / 4)};
+  } else {
+    return int4{((int)pvs[0] << 2) + ((pvs[3] & 0b00110000) / 16),
+                ((int)pvs[1] << 2) + ((pvs[3] & 0b00001100) / 4),
+                ((int)pvs[2] << 2) + ((pvs[3] & 0b00000011)),
+                ((int)pvs[4] << 2) + ((ext & 0b11000000) / 64)};
+  }
+}
+
+inline float get_k(float a, float b, float c, float d) {
+  return 2.0f - (fabsf(a - b) + fabsf(c - d));
+}
+
+struct Rgb {
+  uint8_t r, g, b;
+};
+
+template <typename S>
+Rgb to_rgb(float4 rgb, int expo_time) {
+  rgb = S::applyGamma(S::colorCorrect(clamp01(rgb)), expo_time) * 255.0f;
+  return {convert_uchar_sat(rgb[0]), convert_uchar_sat(rgb[1]), convert_uchar_sat(rgb[2])};
+}
+
+inline uint8_t rgb_to_y(int r, int g, int b) { return (((b * 13 + g * 65 + r * 33) + 64) >> 7) + 16; }
+inline uint8_t rgb_to_u(int r, int g, int b) { return (b * 56 - g * 37 - r * 19 + 0x8080) >> 8; }
+inline uint8_t rgb_to_v(int r, int g, int b) { return (r * 56 - g * 47 - b * 9 + 0x8080) >> 8; }
+
+// one row of work items at a time, each stage over the whole row
+template <typename S>
+void process_raw(const IspFrame &f, const uint8_t *in, uint8_t *out, int expo_time, IspTimes *times) {
+  const SensorInfo *ci = f.ci;
+  const int width = f.rgb_width / 2, height = f.rgb_height / 2;
+  const int stride = ci->hdr_offset > 0 ? ci->frame_stride * 2 : ci->frame_stride;
+  const int read_order[4] = {S::BGGR ? 3 : 0, S::BGGR ? 2 : 1, S::BGGR ? 1 : 2, S::BGGR ? 0 : 3};
+  const int write_order[4] = {S::BGGR ? 2 : 0, S::BGGR ? 3 : 1, S::BGGR ? 0 : 2, S::BGGR ? 1 : 3};
+
+  std::vector<float4> windows(width * 4);
+  std::vector<Rgb> rgbs(width * 4);
+  for (int gid_y = 0; gid_y < height; ++gid_y) {
+    double t0 = millis_since_boot();
+
+    // unpack the 4x4 pixels around each 2x2 output
+    const int row_offsets[4] = {gid_y == 0 ? 2 : 0, 1, 2, gid_y == height - 1 ? 1 : 3};
+    for (int gid_x = 0; gid_x < width; ++gid_x) {
+      float vignette_factor = 1.0f;
+      if (f.vignetting) {
+        const int gx = gid_x * 2 - f.rgb_width / 2;
+        const int gy = gid_y * 2 - f.rgb_height / 2;
+        vignette_factor = get_vignetting_s((gx * gx + gy * gy) / S::VIGNETTE_RSZ);
+      }
+
+      const bool aligned10 = gid_x % 2 == 0;
+      int start_idx = (2 * gid_y - 1) * stride + stride * ci->frame_offset;
+      if (S::BIT_DEPTH == 10) {
+        start_idx += aligned10 ? (5 * gid_x / 2 - 2) : (5 * (gid_x - 1) / 2 + 1);
+      } else {
+        start_idx += 3 * gid_x - 2;
+      }
+
+      float4 *v_rows = &windows[gid_x * 4];
+      for (int i = 0; i < 4; ++i) {
+        const uint8_t *row = in + start_idx + stride * row_offsets[i];
+        uint8_t dat[8];
+        if (i == 1 && gid_x == 0 && gid_y == 0) {
+          dat[0] = dat[1] = 0;
+          memcpy(dat + 2, row + 2, 6);
+        } else {
+          memcpy(dat, row, 8);
+        }
+
+        int4 parsed, short_parsed = {};
+        if (S::BIT_DEPTH == 10) {
+          // for now it's always HDR
+          const uint8_t *short_row = row + stride * (ci->hdr_offset / 2) + stride / 2;
+          parsed = parse_10bit(dat, aligned10 ? 0 : row[8], aligned10);
+          short_parsed = parse_10bit(short_row, aligned10 ? 0 : short_row[8], aligned10);
+        } else {
+          parsed = parse_12bit(dat);
+        }
+        v_rows[read_order[i]] = S::normalize(parsed, short_parsed, vignette_factor, expo_time);
+      }
+
+      // mirror padding
+      if (gid_x == 0) {
+        for (int i = 0; i < 4; ++i) v_rows[i][0] = v_rows[i][2];
+      } else if (gid_x == width - 1) {
+        for (int i = 0; i < 4; ++i) v_rows[i][3] = v_rows[i][1];
+      }
+    }
+    double t1 = millis_since_boot();
+
+    // debayering
+    for (int gid_x = 0; gid_x < width; ++gid_x) {
+      const float4 *v = &windows[gid_x * 4];
+      Rgb *rgb_out = &rgbs[gid_x * 4];
+      float4 rgb_tmp = {};
+
+      const float k01 = get_k(v[0][0], v[1][1], v[0][2], v[1][1]);
+      const float k02 = get_k(v[0][2], v[1][1], v[2][2], v[1][1]);
+      const float k03 = get_k(v[2][0], v[1][1], v[2][2], v[1][1]);
+      const float k04 = get_k(v[0][0], v[1][1], v[2][0], v[1][1]);
+      rgb_tmp[0] = (k02 * v[1][2] + k04 * v[1][0]) / (k02 + k04);
+      rgb_tmp[1] = v[1][1];
+      rgb_tmp[2] = (k01 * v[0][1] + k03 * v[2][1]) / (k01 + k03);
+      rgb_out[write_order[0]] = to_rgb<S>(rgb_tmp, expo_time);
+
+      const float k11 = get_k(v[0][1], v[2][1], v[0][3], v[2][3]);
+      const float k12 = get_k(v[0][2], v[1][1], v[1][3], v[2][2]);
+      const float k13 = get_k(v[0][1], v[0][3], v[2][1], v[2][3]);
+      const float k14 = get_k(v[0][2], v[1][3], v[2][2], v[1][1]);
+      rgb_tmp[0] = v[1][2];
+      rgb_tmp[1] = (k11 * (v[0][2] + v[2][2]) * 0.5f + k13 * (v[1][3] + v[1][1]) * 0.5f) / (k11 + k13);
+      rgb_tmp[2] = (k12 * (v[0][3] + v[2][1]) * 0.5f + k14 * (v[0][1] + v[2][3]) * 0.5f) / (k12 + k14);
+      rgb_out[write_order[1]] = to_rgb<S>(rgb_tmp, expo_time);
+
+      const float k21 = get_k(v[1][0], v[3][0], v[1][2], v[3][2]);
+      const float k22 = get_k(v[1][1], v[2][0], v[2][2], v[3][1]);
+      const float k23 = get_k(v[1][0], v[1][2], v[3][0], v[3][2]);
+      const float k24 = get_k(v[1][1], v[2][2], v[3][1], v[2][0]);
+      rgb_tmp[0] = (k22 * (v[1][2] + v[3][0]) * 0.5f + k24 * (v[1][0] + v[3][2]) * 0.5f) / (k22 + k24);
+      rgb_tmp[1] = (k21 * (v[1][1] + v[3][1]) * 0.5f + k23 * (v[2][2] + v[2][0]) * 0.5f) / (k21 + k23);
+      rgb_tmp[2] = v[2][1];
+      rgb_out[write_order[2]] = to_rgb<S>(rgb_tmp, expo_time);
+
+      const float k31 = get_k(v[1][1], v[2][2], v[1][3], v[2][2]);
+      const float k32 = get_k(v[1][3], v[2][2], v[3][3], v[2][2]);
+      const float k33 = get_k(v[3][1], v[2][2], v[3][3], v[2][2]);
+      const float k34 = get_k(v[1][1], v[2][2], v[3][1], v[2][2]);
+      rgb_tmp[0] = (k31 * v[1][2] + k33 * v[3][2]) / (k31 + k33);
+      rgb_tmp[1] = v[2][2];
+      rgb_tmp[2] = (k32 * v[2][3] + k34 * v[2][1]) / (k32 + k34);
+      rgb_out[write_order[3]] = to_rgb<S>(rgb_tmp, expo_time);
+    }
+    double t2 = millis_since_boot();
+
+    // rgb2yuv(nv12)
+    uint8_t *y0 = out + (gid_y * 2) * f.yuv_stride;
+    uint8_t *y1 = y0 + f.yuv_stride;
+    uint8_t *uv = out + f.uv_offset + gid_y * f.yuv_stride;
+    for (int gid_x = 0; gid_x < width; ++gid_x) {
+      const Rgb *c = &rgbs[gid_x * 4];
+      y0[gid_x * 2 + 0] = rgb_to_y(c[0].r, c[0].g, c[0].b);
+      y0[gid_x * 2 + 1] = rgb_to_y(c[1].r, c[1].g, c[1].b);
+      y1[gid_x * 2 + 0] = rgb_to_y(c[2].r, c[2].g, c[2].b);
+      y1[gid_x * 2 + 1] = rgb_to_y(c[3].r, c[3].g, c[3].b);
+
+      const int ar = (c[0].r + c[1].r + c[2].r + c[3].r + 1) >> 1;
+      const int ag = (c[0].g + c[1].g + c[2].g + c[3].g + 1) >> 1;
+      const int ab = (c[0].b + c[1].b + c[2].b + c[3].b + 1) >> 1;
+      uv[gid_x * 2 + 0] = rgb_to_u(ar, ag, ab);
+      uv[gid_x * 2 + 1] = rgb_to_v(ar, ag, ab);
+    }
+    double t3 = millis_since_boot();
+
+    if (times) {
+      times->unpack_ms += t1 - t0;
+      times->debayer_ms += t2 - t1;
+      times->yuv_ms += t3 - t2;
+    }
+  }
+}
+
+void pack_12bit(uint8_t *dst, const uint16_t *pixels, int width) {
+  for (int x = 0; x < width; x += 2, dst += 3) {
+    dst[0] = pixels[x] >> 4;
+    dst[1] = pixels[x + 1] >> 4;
+    dst[2] = (pixels[x] & 0xF) | ((pixels[x + 1] & 0xF) << 4);
+  }
+}
+
+void pack_10bit(uint8_t *dst, const uint16_t *pixels, int width) {
+  for (int x = 0; x < width; x += 4, dst += 5) {
+    dst[4] = 0;
+    for (int i = 0; i < 4; ++i) {
+      dst[i] = pixels[x + i] >> 2;
+      dst[4] |= (pixels[x + i] & 0b11) << (i * 2);
+    }
+  }
+}
+
+}  // namespace
+
+IspFrame::IspFrame(const SensorInfo *ci, bool vignetting) : ci(ci), vignetting(vignetting) {
+  rgb_width = ci->frame_width;
+  rgb_height = ci->hdr_offset > 0 ? (ci->frame_height - ci->hdr_offset) / 2 : ci->frame_height;
+  yuv_stride = VENUS_Y_STRIDE(COLOR_FMT_NV12, rgb_width);
+  uv_offset = yuv_stride * VENUS_Y_SCANLINES(COLOR_FMT_NV12, rgb_height);
+  frame_size = (size_t)(ci->frame_height + ci->extra_height) * ci->frame_stride;
+  raw_size = frame_size + 16;
+  yuv_size = uv_offset + yuv_stride * VENUS_UV_SCANLINES(COLOR_FMT_NV12, rgb_height);
+}
+
+std::vector<uint8_t> synthetic_raw_frame(const IspFrame &f, int seed) {
+  const SensorInfo *ci = f.ci;
+  const bool hdr = ci->hdr_offset > 0;
+  const bool bggr = ci->image_sensor == cereal::FrameData::ImageSensor::OS04C10;
+  const int max_code = hdr ? 1023 : 4095;
+  const int black_lvl = ci->image_sensor == cereal::FrameData::ImageSensor::AR0231 ? 168 : 64;
+
+  // linear scene: color bars that darken towards the top, bright enough at the bottom to saturate
+  const float bars[8][3] = {{1, 1, 1}, {1, 1, 0}, {0, 1, 1}, {0, 1, 0}, {1, 0, 1}, {1, 0, 0}, {0, 0, 1}, {0.2, 0.2, 0.2}};
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> noise(0.0f, 4.0f);
+
+  std::vector<uint8_t> raw(f.raw_size);
+  std::vector<uint16_t> pixels(f.rgb_width), short_pixels(f.rgb_width);
+  for (int y = 0; y < f.rgb_height; ++y) {
+    const float brightness = 1.25f * y / f.rgb_height;
+    for (int x = 0; x < f.rgb_width; ++x) {
+      // 0: R, 1: G, 2: B of a GRBG or BGGR pattern
+      const bool even_row = (y % 2 == 0), even_col = (x % 2 == 0);
+      const int channel = bggr ? (even_row == even_col ? (even_row ? 2 : 0) : 1)
+                               : (even_row == even_col ? 1 : (even_row ? 0 : 2));
+      const int bar = ((x + seed * 37) * 8 / f.rgb_width) % 8;
+      const float v = std::min(bars[bar][channel] * brightness + 0.02f, 1.0f);
+      if (ci->image_sensor == cereal::FrameData::ImageSensor::OX03C10) {
+        // already companded, the kernel decompresses it with the PWL table
+        pixels[x] = std::clamp((int)(std::sqrt(v) * max_code + noise(rng)), 0, max_code);
+      } else {
+        pixels[x] = std::clamp((int)(black_lvl + v * (max_code - black_lvl) + noise(rng)), 0, max_code);
+      }
+      if (hdr) {
+        short_pixels[x] = std::clamp((int)(black_lvl + v * (max_code - black_lvl) / 16 + noise(rng)), 0, max_code);
+      }
+    }
+
+    if (hdr) {
+      // the long and the staggered short exposure lines alternate
+      const int row = (y + ci->frame_offset) * 2;
+      pack_10bit(&raw[row * ci->frame_stride], pixels.data(), f.rgb_width);
+      pack_10bit(&raw[(row + ci->hdr_offset + 1) * ci->frame_stride], short_pixels.data(), f.rgb_width);
+    } else {
+      pack_12bit(&raw[(y + ci->frame_offset) * ci->frame_stride], pixels.data(), f.rgb_width);
+    }
+  }
+  return raw;
+}
+
+std::vector<uint8_t> load_raw_frame(const IspFrame &f, const std::string &file) {
+  std::string content = util::read_file(file);
+  if (content.size() != f.frame_size) return {};
+
+  std::vector<uint8_t> raw(f.raw_size);
+  std::copy(content.begin(), content.end(), raw.begin());
+  return raw;
+}
+
+void process_raw_reference(const IspFrame &f, const uint8_t *in, uint8_t *out, int expo_time, IspTimes *times) {
+  switch (f.ci->image_sensor) {
+    case cereal::FrameData::ImageSensor::AR0231: process_raw<AR0231Isp>(f, in, out, expo_time, times); break;
+    case cereal::FrameData::ImageSensor::OX03C10: process_raw<OX03C10Isp>(f, in, out, expo_time, times); break;
+    case cereal::FrameData::ImageSensor::OS04C10: process_raw<OS04C10Isp>(f, in, out, expo_time, times); break;
+    default: assert(0);
+  }
+}
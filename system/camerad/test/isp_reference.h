@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "system/camerad/sensors/sensor.h"
+
+// CPU reference of cameras/process_raw.cl, and RAW frames in the sensor formats to feed it.
+// it follows the kernel work item by work item, quirks of the unpacking included, so the
+// output only differs from the kernel's by floating point rounding.
+
+// the buffers camerad processes for a sensor
+struct IspFrame {
+  IspFrame(const SensorInfo *ci, bool vignetting = false);
+
+  const SensorInfo *ci;
+  bool vignetting;
+  int rgb_width, rgb_height;
+  int yuv_stride, uv_offset;
+  size_t frame_size;  // of the RAW frame camerad receives
+  size_t raw_size;    // frame_size padded, the kernel reads past the end of the last line of the OS04C10
+  size_t yuv_size;
+};
+
+struct IspTimes {
+  double unpack_ms = 0;   // parsing and normalizing the RAW pixels
+  double debayer_ms = 0;  // debayering, color correction and gamma
+  double yuv_ms = 0;      // RGB to NV12
+};
+
+// a synthetic scene of gradients, color bars and noise, packed as the sensor outputs it
+std::vector<uint8_t> synthetic_raw_frame(const IspFrame &f, int seed);
+// a RAW frame dumped from FrameData.image of a log recorded with LOG_RAW_FRAMES, empty if it doesn't fit the sensor
+std::vector<uint8_t> load_raw_frame(const IspFrame &f, const std::string &file);
+// `out` is yuv_size bytes of NV12, `times` accumulates the time spent in each stage
+void process_raw_reference(const IspFrame &f, const uint8_t *in, uint8_t *out, int expo_time, IspTimes *times = nullptr);
@@ -0,0 +1,150 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <jpeglib.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "common/timing.h"
+#include "system/camerad/cameras/camera_common.h"
+
+namespace {
+
+const int W = 1928, H = 1208, STRIDE = 2048;
+
+struct Frame {
+  Frame(int width, int height, int stride) : data(stride * height * 3 / 2) {
+    buf.width = width;
+    buf.height = height;
+    buf.stride = stride;
+    buf.y = data.data();
+    buf.uv = buf.y + stride * height;
+  }
+  std::vector<uint8_t> data;
+  VisionBuf buf = {};
+};
+
+uint32_t scalar_histogram(const uint8_t *y, int stride, Rect rect, int x_skip, int y_skip, uint32_t hist[256]) {
+  memset(hist, 0, 256 * sizeof(uint32_t));
+  uint32_t total = 0;
+  for (int row = rect.y; row < rect.y + rect.h; row += y_skip) {
+    for (int x = rect.x; x < rect.x + rect.w; x += x_skip) {
+      hist[y[row * stride + x]]++;
+      total++;
+    }
+  }
+  return total;
+}
+
+// decodes to YCbCr, so the planes can be compared to the input
+std::vector<uint8_t> decode_jpeg(const kj::Array<capnp::byte> &jpeg, int &width, int &height) {
+  jpeg_decompress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, (unsigned char *)jpeg.begin(), jpeg.size());
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_YCbCr;
+  jpeg_start_decompress(&cinfo);
+  width = cinfo.output_width;
+  height = cinfo.output_height;
+  std::vector<uint8_t> pixels(width * height * 3);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &pixels[cinfo.output_scanline * width * 3];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return pixels;
+}
+
+}  // namespace
+
+TEST_CASE("luma_histogram") {
+  Frame frame(W, H, STRIDE);
+  std::mt19937 rng(0);
+  for (auto &v : frame.data) v = rng();
+
+  auto [x_skip, y_skip] = GENERATE(std::pair{1, 1}, std::pair{2, 2}, std::pair{2, 4}, std::pair{3, 1}, std::pair{4, 4});
+  for (Rect rect : {Rect{0, 0, W, H}, Rect{96, 160, 1734, 986}, Rect{1, 3, 17, 5}, Rect{W - 9, H - 9, 9, 9}}) {
+    INFO("rect " << rect.x << "," << rect.y << " " << rect.w << "x" << rect.h << ", skip " << x_skip << "," << y_skip);
+    uint32_t hist[256], expected[256];
+    REQUIRE(luma_histogram(frame.buf.y, STRIDE, rect, x_skip, y_skip, hist) ==
+            scalar_histogram(frame.buf.y, STRIDE, rect, x_skip, y_skip, expected));
+    REQUIRE(memcmp(hist, expected, sizeof(hist)) == 0);
+  }
+}
+
+TEST_CASE("histogram_percentile") {
+  uint32_t hist[256] = {};
+  hist[10] = 5;
+  hist[100] = 3;
+  hist[200] = 2;
+  REQUIRE(histogram_percentile(hist, 0) == 255);
+  REQUIRE(histogram_percentile(hist, 2) == 200);
+  REQUIRE(histogram_percentile(hist, 3) == 100);
+  REQUIRE(histogram_percentile(hist, 5) == 100);
+  REQUIRE(histogram_percentile(hist, 6) == 10);
+  REQUIRE(histogram_percentile(hist, 10) == 10);
+  REQUIRE(histogram_percentile(hist, 11) == -1);
+}
+
+TEST_CASE("yuv420_to_jpeg") {
+  // left half dark and red, right half bright and blue
+  Frame frame(W, H, STRIDE);
+  for (int y = 0; y < H; ++y) {
+    memset(frame.buf.y + y * STRIDE, 40, W / 2);
+    memset(frame.buf.y + y * STRIDE + W / 2, 200, W / 2);
+  }
+  for (int y = 0; y < H / 2; ++y) {
+    for (int x = 0; x < W / 2; ++x) {
+      frame.buf.uv[y * STRIDE + x * 2 + 0] = x < W / 4 ? 90 : 200;
+      frame.buf.uv[y * STRIDE + x * 2 + 1] = x < W / 4 ? 220 : 100;
+    }
+  }
+
+  auto jpeg = yuv420_to_jpeg(&frame.buf, W / 4, H / 4);
+  int width = 0, height = 0;
+  auto pixels = decode_jpeg(jpeg, width, height);
+  REQUIRE(width == W / 4);
+  REQUIRE(height == H / 4);
+
+  // away from the edge, where compression blurs
+  for (int y : {8, height / 2, height - 8}) {
+    const uint8_t *left = &pixels[(y * width + 16) * 3];
+    const uint8_t *right = &pixels[(y * width + width - 16) * 3];
+    REQUIRE(std::abs(left[0] - 40) <= 3);
+    REQUIRE(std::abs(left[1] - 90) <= 3);
+    REQUIRE(std::abs(left[2] - 220) <= 3);
+    REQUIRE(std::abs(right[0] - 200) <= 3);
+    REQUIRE(std::abs(right[1] - 200) <= 3);
+    REQUIRE(std::abs(right[2] - 100) <= 3);
+  }
+}
+
+TEST_CASE("camera stats benchmark", "[.][benchmark]") {
+  Frame frame(W, H, STRIDE);
+  std::mt19937 rng(0);
+  for (auto &v : frame.data) v = rng();
+
+  const int histogram_runs = 1000;
+  const Rect rect = {96, 160, 1734, 986};
+  uint32_t hist[256];
+  for (auto [x_skip, y_skip] : {std::pair{2, 2}, std::pair{2, 4}}) {
+    double start = millis_since_boot();
+    for (int i = 0; i < histogram_runs; ++i) scalar_histogram(frame.buf.y, STRIDE, rect, x_skip, y_skip, hist);
+    double scalar_ms = (millis_since_boot() - start) / histogram_runs;
+
+    start = millis_since_boot();
+    for (int i = 0; i < histogram_runs; ++i) luma_histogram(frame.buf.y, STRIDE, rect, x_skip, y_skip, hist);
+    double banked_ms = (millis_since_boot() - start) / histogram_runs;
+    printf("AE histogram skip %d,%d: scalar %.3f ms, banked %.3f ms\n", x_skip, y_skip, scalar_ms, banked_ms);
+  }
+
+  const int thumbnail_runs = 100;
+  double start = millis_since_boot();
+  for (int i = 0; i < thumbnail_runs; ++i) yuv420_to_jpeg(&frame.buf, W / 4, H / 4);
+  printf("thumbnail %dx%d: %.3f ms\n", W / 4, H / 4, (millis_since_boot() - start) / thumbnail_runs);
+}
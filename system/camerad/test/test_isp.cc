@@ -0,0 +1,176 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/clutil.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "system/camerad/cameras/camera_common.h"
+#include "system/camerad/test/isp_reference.h"
+
+// runs process_raw.cl through ImgProc on the default OpenCL device and compares it to the CPU reference.
+// a frame recorded with LOG_RAW_FRAMES is checked as well when given with
+// RAW_FRAME=<file with the bytes of FrameData.image> RAW_SENSOR=<ar0231|ox03c10|os04c10>
+
+namespace {
+
+std::unique_ptr<SensorInfo> make_sensor(const std::string &name) {
+  if (name == "ar0231") return std::make_unique<AR0231>();
+  if (name == "ox03c10") return std::make_unique<OX03C10>();
+  if (name == "os04c10") return std::make_unique<OS04C10>();
+  return nullptr;
+}
+
+class ClIsp {
+public:
+  ClIsp(const IspFrame &f) : f(f) {
+    // the kernel is loaded relative to system/camerad, as by camerad
+    std::string exe = util::readlink("/proc/self/exe");
+    REQUIRE(chdir((exe.substr(0, exe.rfind('/')) + "/..").c_str()) == 0);
+
+    device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
+    context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+    const cl_queue_properties props[] = {0};
+    q = CL_CHECK_ERR(clCreateCommandQueueWithProperties(context, device_id, props, &err));
+    // devices without fp64 treat double constants as float, PC runtimes need to be told
+    imgproc = std::make_unique<ImgProc>(device_id, context, f.ci, f.rgb_width, f.rgb_height, f.yuv_stride, f.uv_offset, f.vignetting,
+                                        "-cl-single-precision-constant");
+    raw_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_ONLY, f.raw_size, NULL, &err));
+    yuv_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_WRITE_ONLY, f.yuv_size, NULL, &err));
+  }
+
+  ~ClIsp() {
+    imgproc.reset();
+    CL_CHECK(clReleaseMemObject(raw_cl));
+    CL_CHECK(clReleaseMemObject(yuv_cl));
+    CL_CHECK(clReleaseCommandQueue(q));
+    CL_CHECK(clReleaseContext(context));
+  }
+
+  void process(const uint8_t *in, uint8_t *out, int expo_time) {
+    double t0 = millis_since_boot();
+    CL_CHECK(clEnqueueWriteBuffer(q, raw_cl, CL_TRUE, 0, f.raw_size, in, 0, NULL, NULL));
+    double t1 = millis_since_boot();
+    cl_event event;
+    imgproc->queue(q, raw_cl, yuv_cl, f.rgb_width, f.rgb_height, &event, expo_time);
+    clWaitForEvents(1, &event);
+    CL_CHECK(clReleaseEvent(event));
+    double t2 = millis_since_boot();
+    CL_CHECK(clEnqueueReadBuffer(q, yuv_cl, CL_TRUE, 0, f.yuv_size, out, 0, NULL, NULL));
+    double t3 = millis_since_boot();
+
+    upload_ms += t1 - t0;
+    kernel_ms += t2 - t1;
+    download_ms += t3 - t2;
+  }
+
+  double upload_ms = 0, kernel_ms = 0, download_ms = 0;
+
+private:
+  const IspFrame &f;
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue q;
+  std::unique_ptr<ImgProc> imgproc;
+  cl_mem raw_cl, yuv_cl;
+};
+
+// the largest difference between the images, and the fraction of equal bytes
+std::pair<int, double> compare_yuv(const IspFrame &f, const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+  int max_diff = 0;
+  size_t equal = 0, total = 0;
+  for (auto [offset, rows] : {std::pair{0, f.rgb_height}, std::pair{f.uv_offset, f.rgb_height / 2}}) {
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < f.rgb_width; ++x) {
+        const int i = offset + y * f.yuv_stride + x;
+        const int diff = std::abs(a[i] - b[i]);
+        max_diff = std::max(max_diff, diff);
+        equal += diff == 0;
+        ++total;
+      }
+    }
+  }
+  return {max_diff, (double)equal / total};
+}
+
+void check_frame(const IspFrame &f, ClIsp &isp, const std::vector<uint8_t> &raw, int expo_time) {
+  std::vector<uint8_t> yuv(f.yuv_size), ref_yuv(f.yuv_size);
+  isp.process(raw.data(), yuv.data(), expo_time);
+  process_raw_reference(f, raw.data(), ref_yuv.data(), expo_time);
+
+  // the kernel is built with -cl-fast-relaxed-math, rounding may differ by a step after the tone curve
+  auto [max_diff, equal] = compare_yuv(f, yuv, ref_yuv);
+  INFO("expo_time " << expo_time << ", vignetting " << f.vignetting << ": max diff " << max_diff << ", " << equal * 100 << "% equal");
+  REQUIRE(max_diff <= 2);
+  REQUIRE(equal > 0.95);
+}
+
+}  // namespace
+
+TEST_CASE("process_raw matches the CPU reference") {
+  auto name = GENERATE("ar0231", "ox03c10", "os04c10");
+  auto vignetting = GENERATE(false, true);
+  auto ci = make_sensor(name);
+  IspFrame f(ci.get(), vignetting);
+  ClIsp isp(f);
+  INFO(name);
+
+  auto raw = synthetic_raw_frame(f, 0);
+  for (int expo_time : {16, 256}) {
+    check_frame(f, isp, raw, expo_time);
+  }
+}
+
+TEST_CASE("process_raw on a recorded frame") {
+  const char *file = getenv("RAW_FRAME");
+  if (!file) return;
+
+  auto ci = make_sensor(util::getenv("RAW_SENSOR", "ar0231"));
+  REQUIRE(ci);
+  IspFrame f(ci.get());
+  auto raw = load_raw_frame(f, file);
+  REQUIRE(!raw.empty());
+  ClIsp isp(f);
+  check_frame(f, isp, raw, 256);
+}
+
+TEST_CASE("process_raw throughput", "[.][benchmark]") {
+  const int cl_frames = 100, ref_frames = 5;
+  for (auto name : {"ar0231", "ox03c10", "os04c10"}) {
+    auto ci = make_sensor(name);
+    IspFrame f(ci.get(), true);
+    ClIsp isp(f);
+    std::vector<std::vector<uint8_t>> raws;
+    for (int i = 0; i < 4; ++i) {
+      raws.push_back(synthetic_raw_frame(f, i));
+    }
+    std::vector<uint8_t> yuv(f.yuv_size);
+
+    // first frame warms up the device
+    isp.process(raws[0].data(), yuv.data(), 256);
+    isp.upload_ms = isp.kernel_ms = isp.download_ms = 0;
+    double start = millis_since_boot();
+    for (int i = 0; i < cl_frames; ++i) {
+      isp.process(raws[i % raws.size()].data(), yuv.data(), 256);
+    }
+    double cl_ms = millis_since_boot() - start;
+    printf("%s %dx%d OpenCL: %.1f fps, upload %.2f ms, kernel %.2f ms, download %.2f ms\n", name, f.rgb_width, f.rgb_height,
+           cl_frames / (cl_ms / 1000.0), isp.upload_ms / cl_frames, isp.kernel_ms / cl_frames, isp.download_ms / cl_frames);
+
+    IspTimes times;
+    start = millis_since_boot();
+    for (int i = 0; i < ref_frames; ++i) {
+      process_raw_reference(f, raws[i % raws.size()].data(), yuv.data(), 256, &times);
+    }
+    double ref_ms = millis_since_boot() - start;
+    printf("%s %dx%d reference: %.1f fps, unpack %.2f ms, debayer %.2f ms, yuv %.2f ms\n", name, f.rgb_width, f.rgb_height,
+           ref_frames / (ref_ms / 1000.0), times.unpack_ms / ref_frames, times.debayer_ms / ref_frames, times.yuv_ms / ref_frames);
+  }
+}
@@ -41,6 +41,10 @@ namespace Path {
     return "ipc:///tmp/logmessage" + Path::openpilot_prefix();
   }
 
+  inline std::string cl_cache() {
+    return util::getenv("CL_CACHE_DIR", Hardware::PC() ? Path::comma_home() + "/cl_cache" : "/data/cl_cache");
+  }
+
   inline std::string download_cache_root() {
     if (const char *env = getenv("COMMA_CACHE")) {
       return env;
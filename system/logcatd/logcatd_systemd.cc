@@ -1,20 +1,52 @@
+#include <syslog.h>
 #include <systemd/sd-journal.h>
 
+#include <algorithm>
 #include <cassert>
 #include <csignal>
-#include <map>
+#include <cstdlib>
+#include <cstring>
 #include <string>
-
-#include "third_party/json11/json11.hpp"
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "common/timing.h"
 #include "common/util.h"
+#include "system/logcatd/rate_limiter.h"
+
+// all the journal entries available on a wakeup are published in one androidLogBatch.
+// entries are rate limited per SYSLOG_IDENTIFIER, to LOGCATD_RATE_LIMIT entries/s (default 100),
+// overridden per identifier with LOGCATD_RATE_LIMITS="kernel:50,NetworkManager:10". 0 is unlimited.
+// errors are never dropped, controlsd looks for camera errors in the kernel log during log storms.
+
+const size_t MAX_BATCH_SIZE = 1000;
+
+struct Entry {
+  uint64_t ts;
+  int priority;
+  int pid;
+  std::string tag;
+  std::string message;
+  uint32_t repeated;
+};
+
+// reads a single field of the current entry without the "FIELD=" prefix
+bool get_field(sd_journal *journal, const char *field, std::string &value) {
+  const void *data;
+  size_t length;
+  if (sd_journal_get_data(journal, field, &data, &length) < 0) {
+    value.clear();
+    return false;
+  }
+  const size_t prefix = strlen(field) + 1;
+  value.assign((const char *)data + prefix, length - prefix);
+  return true;
+}
 
 ExitHandler do_exit;
 int main(int argc, char *argv[]) {
 
-  PubMaster pm({"androidLog"});
+  PubMaster pm({"androidLogBatch"});
 
   sd_journal *journal;
   int err = sd_journal_open(&journal, 0);
@@ -28,46 +60,67 @@ int main(int argc, char *argv[]) {
   // call sd_journal_previous_skip after sd_journal_seek_tail (like journalctl -f does) to makes things work.
   sd_journal_previous_skip(journal, 1);
 
+  RateLimiter rate_limiter(util::getenv("LOGCATD_RATE_LIMIT", 100.0f), util::getenv("LOGCATD_RATE_LIMITS"));
+  // entries and field buffers are reused, so their strings keep their capacity
+  std::vector<Entry> batch(MAX_BATCH_SIZE);
+  std::string tag, message, field;
+  uint32_t dropped = 0, coalesced = 0;
+
   while (!do_exit) {
-    err = sd_journal_next(journal);
-    assert(err >= 0);
+    size_t count = 0;
+    while (count < MAX_BATCH_SIZE && (err = sd_journal_next(journal)) > 0) {
+      get_field(journal, "SYSLOG_IDENTIFIER", tag);
+      get_field(journal, "MESSAGE", message);
+
+      // storms are often the same line over and over
+      if (count > 0 && batch[count - 1].tag == tag && batch[count - 1].message == message) {
+        batch[count - 1].repeated++;
+        coalesced++;
+        continue;
+      }
+      const int priority = get_field(journal, "PRIORITY", field) ? std::atoi(field.c_str()) : -1;
+      const bool error = priority >= 0 && priority <= LOG_ERR;
+      if (!error && !rate_limiter.allow(tag, millis_since_boot() / 1000.0)) {
+        dropped++;
+        continue;
+      }
 
-    // Wait for new message if we didn't receive anything
-    if (err == 0) {
-      err = sd_journal_wait(journal, 1000 * 1000);
+      Entry &e = batch[count++];
+      err = sd_journal_get_realtime_usec(journal, &e.ts);
       assert(err >= 0);
-      continue; // Try again
+      e.priority = std::max(priority, 0);
+      e.pid = get_field(journal, "_PID", field) ? std::atoi(field.c_str()) : 0;
+      e.tag.swap(tag);
+      e.message.swap(message);
+      e.repeated = 0;
     }
-
-    uint64_t timestamp = 0;
-    err = sd_journal_get_realtime_usec(journal, &timestamp);
     assert(err >= 0);
 
-    const void *data;
-    size_t length;
-    std::map<std::string, std::string> kv;
-
-    SD_JOURNAL_FOREACH_DATA(journal, data, length) {
-      std::string str((char*)data, length);
-
-      // Split "KEY=VALUE"" on "=" and put in map
-      std::size_t found = str.find("=");
-      if (found != std::string::npos) {
-        kv[str.substr(0, found)] = str.substr(found + 1, std::string::npos);
+    if (count > 0 || dropped > 0) {
+      MessageBuilder msg;
+      auto log_batch = msg.initEvent().initAndroidLogBatch();
+      log_batch.setDropped(dropped);
+      log_batch.setCoalesced(coalesced);
+      auto entries = log_batch.initEntries(count);
+      for (size_t i = 0; i < count; ++i) {
+        const Entry &e = batch[i];
+        auto entry = entries[i];
+        entry.setTs(e.ts);
+        entry.setPriority(e.priority);
+        entry.setPid(e.pid);
+        entry.setTag(e.tag);
+        entry.setMessage(e.message);
+        entry.setRepeated(e.repeated);
       }
+      pm.send("androidLogBatch", msg);
+      dropped = coalesced = 0;
     }
 
-    MessageBuilder msg;
-
-    // Build message
-    auto androidEntry = msg.initEvent().initAndroidLog();
-    androidEntry.setTs(timestamp);
-    androidEntry.setMessage(json11::Json(kv).dump());
-    if (kv.count("_PID")) androidEntry.setPid(std::atoi(kv["_PID"].c_str()));
-    if (kv.count("PRIORITY")) androidEntry.setPriority(std::atoi(kv["PRIORITY"].c_str()));
-    if (kv.count("SYSLOG_IDENTIFIER")) androidEntry.setTag(kv["SYSLOG_IDENTIFIER"]);
-
-    pm.send("androidLog", msg);
+    // Wait for new messages once the journal is drained
+    if (count < MAX_BATCH_SIZE) {
+      err = sd_journal_wait(journal, 1000 * 1000);
+      assert(err >= 0);
+    }
   }
 
   sd_journal_close(journal);
@@ -0,0 +1,35 @@
+#include "system/logcatd/rate_limiter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+RateLimiter::RateLimiter(double default_rate, const std::string &limits) : default_rate(default_rate) {
+  std::istringstream stream(limits);
+  for (std::string limit; std::getline(stream, limit, ',');) {
+    if (size_t pos = limit.rfind(':'); pos != std::string::npos) {
+      buckets[limit.substr(0, pos)].rate = std::atof(limit.c_str() + pos + 1);
+    }
+  }
+}
+
+double RateLimiter::rate(const std::string &tag) const {
+  auto it = buckets.find(tag);
+  return it != buckets.end() ? it->second.rate : default_rate;
+}
+
+bool RateLimiter::allow(const std::string &tag, double ts) {
+  auto it = buckets.find(tag);
+  if (it == buckets.end()) {
+    it = buckets.emplace(tag, Bucket{default_rate}).first;
+  }
+  Bucket &b = it->second;
+  if (b.rate <= 0) return true;
+
+  const double burst = std::max(b.rate, 1.0);
+  b.tokens = b.last_ts == 0 ? burst : std::min(burst, b.tokens + (ts - b.last_ts) * b.rate);
+  b.last_ts = ts;
+  if (b.tokens < 1) return false;
+  b.tokens -= 1;
+  return true;
+}
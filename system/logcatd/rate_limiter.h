@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+// a token bucket per identifier, holding up to a second of entries
+class RateLimiter {
+public:
+  // limits overrides the default rate per identifier, e.g. "kernel:50,NetworkManager:10". 0 is unlimited.
+  RateLimiter(double default_rate, const std::string &limits = "");
+  bool allow(const std::string &tag, double ts);
+  double rate(const std::string &tag) const;
+
+private:
+  struct Bucket {
+    double rate = 0;  // entries per second
+    double tokens = 0;
+    double last_ts = 0;
+  };
+  double default_rate;
+  std::unordered_map<std::string, Bucket> buckets;
+};
@@ -0,0 +1,37 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+#include "system/logcatd/rate_limiter.h"
+
+TEST_CASE("RateLimiter parses per identifier limits") {
+  RateLimiter limiter(100, "kernel:50,NetworkManager:0,bad,a:b:2.5");
+  REQUIRE(limiter.rate("kernel") == 50);
+  REQUIRE(limiter.rate("NetworkManager") == 0);
+  REQUIRE(limiter.rate("a:b") == 2.5);
+  REQUIRE(limiter.rate("bad") == 100);
+  REQUIRE(limiter.rate("systemd") == 100);
+  REQUIRE(RateLimiter(10).rate("kernel") == 10);
+}
+
+TEST_CASE("RateLimiter::allow") {
+  RateLimiter limiter(10, "kernel:2,unlimited:0");
+
+  SECTION("bursts up to a second of entries, then refills at the rate") {
+    int allowed = 0;
+    for (int i = 0; i < 100; ++i) allowed += limiter.allow("systemd", 1.0);
+    REQUIRE(allowed == 10);
+    REQUIRE_FALSE(limiter.allow("systemd", 1.05));
+    REQUIRE(limiter.allow("systemd", 1.2));
+  }
+
+  SECTION("identifiers have their own buckets") {
+    REQUIRE(limiter.allow("kernel", 1.0));
+    REQUIRE(limiter.allow("kernel", 1.0));
+    REQUIRE_FALSE(limiter.allow("kernel", 1.0));
+    REQUIRE(limiter.allow("systemd", 1.0));
+    REQUIRE(limiter.allow("kernel", 1.5));
+  }
+
+  SECTION("a rate of 0 is unlimited") {
+    for (int i = 0; i < 1000; ++i) REQUIRE(limiter.allow("unlimited", 1.0));
+  }
+}
@@ -1,5 +1,8 @@
 #!/usr/bin/env python3
+import json
+import struct
 import zmq
+from collections.abc import Iterator
 from typing import NoReturn
 
 import cereal.messaging as messaging
@@ -7,6 +10,53 @@ from openpilot.common.logging_extra import SwagLogFileFormatter
 from openpilot.system.hardware.hw import Paths
 from openpilot.common.swaglog import get_file_handler
 
+# batches of records in the compact binary format of common/swaglog.cc (SWAGLOG_BINARY=1)
+SWAGLOG_BINARY_MAGIC = 0xFF
+SWAGLOG_BINARY_VERSION = 1
+
+
+def expand_records(dat: bytes) -> Iterator[tuple[int, str]]:
+  if dat[0] != SWAGLOG_BINARY_MAGIC:
+    yield dat[0], dat[1:].decode("utf-8")
+    return
+
+  # header: u8 magic, u8 version, u32 ctx_len, ctx json, u32 count
+  # record: u8 levelnum, u8 msg_is_json, u32 lineno, f64 created,
+  #         u16 filename_len, filename, u16 funcname_len, funcname, u32 msg_len, msg
+  if dat[1] != SWAGLOG_BINARY_VERSION:
+    print("WARNING: unknown swaglog binary version", dat[1])
+    return
+
+  ctx_len, = struct.unpack_from("<I", dat, 2)
+  ctx = json.loads(dat[6:6 + ctx_len])
+  pos = 6 + ctx_len
+  count, = struct.unpack_from("<I", dat, pos)
+  pos += 4
+  for _ in range(count):
+    levelnum, msg_is_json, lineno, created, filename_len = struct.unpack_from("<BBIdH", dat, pos)
+    pos += 16
+    filename = dat[pos:pos + filename_len].decode("utf-8")
+    pos += filename_len
+    funcname_len, = struct.unpack_from("<H", dat, pos)
+    pos += 2
+    funcname = dat[pos:pos + funcname_len].decode("utf-8")
+    pos += funcname_len
+    msg_len, = struct.unpack_from("<I", dat, pos)
+    pos += 4
+    msg = dat[pos:pos + msg_len].decode("utf-8", errors="replace")
+    pos += msg_len
+
+    record = {
+      "created": created,
+      "ctx": ctx,
+      "filename": filename,
+      "funcname": funcname,
+      "levelnum": levelnum,
+      "lineno": lineno,
+      "msg": json.loads(msg) if msg_is_json else msg,
+    }
+    yield levelnum, json.dumps(record)
+
 
 def main() -> NoReturn:
   log_handler = get_file_handler()
@@ -24,23 +74,22 @@ def main() -> NoReturn:
   try:
     while True:
       dat = b''.join(sock.recv_multipart())
-      level = dat[0]
-      record = dat[1:].decode("utf-8")
-      if level >= log_level:
-        log_handler.emit(record)
-
-      if len(record) > 2*1024*1024:
-        print("WARNING: log too big to publish", len(record))
-        print(record[:100])
-        continue
-
-      # then we publish them
-      msg = messaging.new_message(None, valid=True, logMessage=record)
-      log_message_sock.send(msg.to_bytes())
-
-      if level >= 40:  # logging.ERROR
-        msg = messaging.new_message(None, valid=True, errorLogMessage=record)
-        error_log_message_sock.send(msg.to_bytes())
+      for level, record in expand_records(dat):
+        if level >= log_level:
+          log_handler.emit(record)
+
+        if len(record) > 2*1024*1024:
+          print("WARNING: log too big to publish", len(record))
+          print(record[:100])
+          continue
+
+        # then we publish them
+        msg = messaging.new_message(None, valid=True, logMessage=record)
+        log_message_sock.send(msg.to_bytes())
+
+        if level >= 40:  # logging.ERROR
+          msg = messaging.new_message(None, valid=True, errorLogMessage=record)
+          error_log_message_sock.send(msg.to_bytes())
   finally:
     sock.close()
     ctx.term()
@@ -1,7 +1,6 @@
 import importlib
 import os
 import signal
-import struct
 import time
 import subprocess
 from collections.abc import Callable, ValuesView
@@ -16,10 +15,12 @@ import openpilot.system.sentry as sentry
 from openpilot.common.basedir import BASEDIR
 from openpilot.common.params import Params
 from openpilot.common.swaglog import cloudlog
+from openpilot.common.watchdog import WatchdogTable
 
-WATCHDOG_FN = "/dev/shm/wd_"
 ENABLE_WATCHDOG = os.getenv("NO_WATCHDOG") is None
 
+watchdog_table = WatchdogTable()
+
 
 def launcher(proc: str, name: str) -> None:
   try:
@@ -92,13 +93,8 @@ class ManagerProcess(ABC):
     if self.watchdog_max_dt is None or self.proc is None:
       return
 
-    try:
-      fn = WATCHDOG_FN + str(self.proc.pid)
-      with open(fn, "rb") as f:
-        # TODO: why can't pylint find struct.unpack?
-        self.last_watchdog_time = struct.unpack('Q', f.read())[0]
-    except Exception:
-      pass
+    if (state := watchdog_table.get(self.proc.pid)) is not None:
+      self.last_watchdog_time = state.last_kick
 
     dt = time.monotonic() - self.last_watchdog_time / 1e9
 
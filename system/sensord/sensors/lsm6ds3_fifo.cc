@@ -0,0 +1,158 @@
+#include "system/sensord/sensors/lsm6ds3_fifo.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "common/swaglog.h"
+
+LSM6DS3_Fifo::LSM6DS3_Fifo(I2CBus *bus, LSM6DS3_Accel *accel, LSM6DS3_Gyro *gyro, int watermark) :
+  bus(bus), watermark(watermark), accel(accel), gyro(gyro) {}
+
+int LSM6DS3_Fifo::read_register(uint register_address, uint8_t *buffer, uint8_t len) {
+  return bus->read_register(LSM6DS3_FIFO_I2C_ADDR, register_address, buffer, len);
+}
+
+int LSM6DS3_Fifo::set_register(uint register_address, uint8_t data) {
+  return bus->set_register(LSM6DS3_FIFO_I2C_ADDR, register_address, data);
+}
+
+int LSM6DS3_Fifo::init() {
+  // expects accel and gyro to be initialized, they set up the ODR and auto increment
+  uint8_t value = 0;
+  int fth = watermark * LSM6DS3_FIFO_PATTERN_WORDS;
+
+  // bypass mode clears the FIFO
+  int ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, LSM6DS3_FIFO_MODE_BYPASS);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL1, fth & 0xFF);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL2, (fth >> 8) & 0x0F);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL3, LSM6DS3_FIFO_DEC_G_NONE | LSM6DS3_FIFO_DEC_XL_NONE);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  // route the FIFO threshold to INT1 instead of the data ready signals
+  ret = read_register(LSM6DS3_FIFO_I2C_REG_INT1_CTRL, &value, 1);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  value &= ~(LSM6DS3_ACCEL_INT1_DRDY_XL | LSM6DS3_GYRO_INT1_DRDY_G);
+  value |= LSM6DS3_FIFO_INT1_FTH;
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_INT1_CTRL, value);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, LSM6DS3_FIFO_ODR_104HZ | LSM6DS3_FIFO_MODE_CONTINUOUS);
+
+fail:
+  return ret;
+}
+
+int LSM6DS3_Fifo::shutdown() {
+  int ret = 0;
+
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5, LSM6DS3_FIFO_MODE_BYPASS);
+  if (ret < 0) {
+    LOGE("Could not disable lsm6ds3 FIFO!");
+    goto fail;
+  }
+
+  // restore the data ready interrupts
+  uint8_t value;
+  value = 0;
+  ret = read_register(LSM6DS3_FIFO_I2C_REG_INT1_CTRL, &value, 1);
+  if (ret < 0) {
+    goto fail;
+  }
+
+  value &= ~(LSM6DS3_FIFO_INT1_FTH);
+  value |= LSM6DS3_ACCEL_INT1_DRDY_XL | LSM6DS3_GYRO_INT1_DRDY_G;
+  ret = set_register(LSM6DS3_FIFO_I2C_REG_INT1_CTRL, value);
+
+fail:
+  return ret;
+}
+
+bool LSM6DS3_Fifo::above_watermark() {
+  uint8_t status = 0;
+  if (read_register(LSM6DS3_FIFO_I2C_REG_FIFO_STATUS2, &status, 1) != 1) {
+    return true;
+  }
+  return status & LSM6DS3_FIFO_STATUS2_WATERMARK;
+}
+
+int LSM6DS3_Fifo::read_samples(uint64_t irq_ts, std::vector<LSM6DS3_FifoSample> &samples) {
+  // FIFO_STATUS1-4: unread words, flags and the pattern index of the next word
+  uint8_t status[4];
+  int len = read_register(LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1, status, sizeof(status));
+  if (len != sizeof(status)) {
+    return -1;
+  }
+
+  if (status[1] & LSM6DS3_FIFO_STATUS2_OVER_RUN) {
+    LOGE("LSM6DS3 FIFO overrun");
+  }
+
+  int words = ((status[1] << 8) | status[0]) & LSM6DS3_FIFO_DIFF_MASK;
+  int pattern = ((status[3] << 8) | status[2]) & LSM6DS3_FIFO_PATTERN_MASK;
+
+  // skip a partially read set, and leave an incomplete trailing set for the next interrupt
+  int skip = (LSM6DS3_FIFO_PATTERN_WORDS - pattern) % LSM6DS3_FIFO_PATTERN_WORDS;
+  int sets = std::max(words - skip, 0) / LSM6DS3_FIFO_PATTERN_WORDS;
+  if (sets == 0) {
+    return 0;
+  }
+
+  // with auto increment the address wraps from DATA_OUT_H back to DATA_OUT_L,
+  // so the whole FIFO is drained with a few block reads
+  std::vector<uint8_t> buffer((skip + sets * LSM6DS3_FIFO_PATTERN_WORDS) * 2);
+  for (size_t pos = 0; pos < buffer.size(); pos += LSM6DS3_FIFO_BURST_LEN) {
+    uint8_t chunk = std::min<size_t>(LSM6DS3_FIFO_BURST_LEN, buffer.size() - pos);
+    len = read_register(LSM6DS3_FIFO_I2C_REG_DATA_OUT_L, &buffer[pos], chunk);
+    if (len != chunk) {
+      LOGE("LSM6DS3 FIFO read failed: %d", len);
+      return -1;
+    }
+  }
+
+  // the watermark set arrived at the interrupt, the others are spaced by the ODR.
+  // without an interrupt the sets follow the last one that was read
+  const int64_t period = sample_period_ns();
+  const uint64_t first_ts = irq_ts != 0 ? irq_ts - (watermark - 1) * period : next_ts;
+  if (first_ts == 0) {
+    LOGE("LSM6DS3 FIFO dropped %d sets read before the first interrupt", sets);
+    return 0;
+  }
+  next_ts = first_ts + sets * period;
+
+  const uint8_t *data = &buffer[skip * 2];
+  for (int i = 0; i < sets; ++i) {
+    uint64_t ts = first_ts + i * period;
+
+    auto &g = samples.emplace_back();
+    g.gyro = true;
+    g.ts = ts;
+    memcpy(g.data, data, sizeof(g.data));
+    data += sizeof(g.data);
+
+    auto &a = samples.emplace_back();
+    a.gyro = false;
+    a.ts = ts;
+    memcpy(a.data, data, sizeof(a.data));
+    data += sizeof(a.data);
+  }
+  return sets * 2;
+}
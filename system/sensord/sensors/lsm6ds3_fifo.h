@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include "system/sensord/sensors/lsm6ds3_accel.h"
+#include "system/sensord/sensors/lsm6ds3_gyro.h"
+
+// Address of the chip on the bus
+#define LSM6DS3_FIFO_I2C_ADDR       0x6A
+
+// Registers of the chip
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL1   0x06
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL2   0x07
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL3   0x08
+#define LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5   0x0A
+#define LSM6DS3_FIFO_I2C_REG_INT1_CTRL    0x0D
+#define LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1 0x3A
+#define LSM6DS3_FIFO_I2C_REG_FIFO_STATUS2 0x3B
+#define LSM6DS3_FIFO_I2C_REG_DATA_OUT_L   0x3E
+
+// Constants
+#define LSM6DS3_FIFO_INT1_FTH          (1 << 3)
+#define LSM6DS3_FIFO_DEC_XL_NONE       0b001
+#define LSM6DS3_FIFO_DEC_G_NONE        (0b001 << 3)
+#define LSM6DS3_FIFO_ODR_104HZ         (0b0100 << 3)
+#define LSM6DS3_FIFO_MODE_BYPASS       0b000
+#define LSM6DS3_FIFO_MODE_CONTINUOUS   0b110
+#define LSM6DS3_FIFO_STATUS2_WATERMARK (1 << 7)
+#define LSM6DS3_FIFO_STATUS2_OVER_RUN  (1 << 6)
+#define LSM6DS3_FIFO_DIFF_MASK         0x0FFF
+#define LSM6DS3_FIFO_PATTERN_MASK      0x03FF
+#define LSM6DS3_FIFO_PATTERN_WORDS     6   // gyro x/y/z, then accel x/y/z
+#define LSM6DS3_FIFO_BURST_LEN         30  // SMBus block reads are limited to 32 bytes
+#define LSM6DS3_FIFO_ODR_HZ            104
+#define LSM6DS3_FIFO_DEFAULT_WATERMARK 4   // in pattern sets (one gyro + one accel sample)
+
+struct LSM6DS3_FifoSample {
+  bool gyro;
+  uint64_t ts;
+  uint8_t data[6];
+};
+
+// Drains the shared accel/gyro FIFO of the LSM6DS3 in burst reads. The
+// watermark interrupt replaces the per-sample data ready interrupts, and
+// sample timestamps are reconstructed from the interrupt time and the FIFO ODR.
+class LSM6DS3_Fifo {
+  I2CBus *bus;
+  int watermark;
+  uint64_t next_ts = 0;  // timestamp of the next unread set, 0 until the first interrupt
+
+  int read_register(uint register_address, uint8_t *buffer, uint8_t len);
+  int set_register(uint register_address, uint8_t data);
+
+public:
+  LSM6DS3_Accel *accel;
+  LSM6DS3_Gyro *gyro;
+
+  LSM6DS3_Fifo(I2CBus *bus, LSM6DS3_Accel *accel, LSM6DS3_Gyro *gyro, int watermark = LSM6DS3_FIFO_DEFAULT_WATERMARK);
+  int init();
+  int shutdown();
+  // irq_ts is the time of the watermark interrupt, 0 continues from the sets of the previous read
+  int read_samples(uint64_t irq_ts, std::vector<LSM6DS3_FifoSample> &samples);
+  // true while the FIFO holds at least the watermark, or if the status can't be read
+  bool above_watermark();
+  bool owns(Sensor *sensor) const { return sensor == accel || sensor == gyro; }
+  static constexpr uint64_t sample_period_ns() { return 1e9 / LSM6DS3_FIFO_ODR_HZ; }
+};
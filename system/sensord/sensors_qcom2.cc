@@ -4,6 +4,9 @@
 #include <thread>
 #include <vector>
 #include <map>
+#include <memory>
+#include <set>
+#include <cstring>
 #include <poll.h>
 #include <linux/gpio.h>
 
@@ -20,6 +23,7 @@
 #include "system/sensord/sensors/bmx055_temp.h"
 #include "system/sensord/sensors/constants.h"
 #include "system/sensord/sensors/lsm6ds3_accel.h"
+#include "system/sensord/sensors/lsm6ds3_fifo.h"
 #include "system/sensord/sensors/lsm6ds3_gyro.h"
 #include "system/sensord/sensors/lsm6ds3_temp.h"
 #include "system/sensord/sensors/mmc5603nj_magn.h"
@@ -28,8 +32,39 @@
 
 ExitHandler do_exit;
 
-void interrupt_loop(std::vector<std::tuple<Sensor *, std::string>> sensors) {
+void publish_fifo_samples(LSM6DS3_Fifo *fifo, const std::vector<LSM6DS3_FifoSample> &samples, PubMaster &pm) {
+  for (auto &s : samples) {
+    Sensor *sensor = s.gyro ? (Sensor *)fifo->gyro : (Sensor *)fifo->accel;
+    if (!sensor->is_data_valid(s.ts)) {
+      continue;
+    }
+
+    MessageBuilder msg;
+    if (s.gyro) {
+      fifo->gyro->build_event(msg, s.data, s.ts);
+      pm.send("gyroscope", msg);
+    } else {
+      fifo->accel->build_event(msg, s.data, s.ts);
+      pm.send("accelerometer", msg);
+    }
+  }
+}
+
+// the watermark interrupt is a level, it only has a new rising edge once the FIFO is below the watermark.
+// there is no interrupt time for these reads, their timestamps continue from the previous read
+void drain_fifo(LSM6DS3_Fifo *fifo, std::vector<LSM6DS3_FifoSample> &samples, PubMaster &pm) {
+  for (int i = 0; i < 3 && fifo->above_watermark(); ++i) {
+    samples.clear();
+    if (fifo->read_samples(0, samples) < 0) {
+      LOGE("LSM6DS3 FIFO read failed");
+    }
+    publish_fifo_samples(fifo, samples, pm);
+  }
+}
+
+void interrupt_loop(std::vector<std::tuple<Sensor *, std::string>> sensors, LSM6DS3_Fifo *fifo) {
   PubMaster pm({"gyroscope", "accelerometer"});
+  std::vector<LSM6DS3_FifoSample> samples;
 
   int fd = -1;
   for (auto &[sensor, msg_name] : sensors) {
@@ -52,6 +87,9 @@ void interrupt_loop(std::vector<std::tuple<Sensor *, std::string>> sensors) {
       return;
     } else if (err == 0) {
       LOGE("poll timed out");
+      if (fifo) {
+        drain_fifo(fifo, samples, pm);
+      }
       continue;
     }
 
@@ -72,8 +110,26 @@ void interrupt_loop(std::vector<std::tuple<Sensor *, std::string>> sensors) {
     uint64_t offset = nanos_since_epoch() - nanos_since_boot();
     uint64_t ts = evdata[num_events - 1].timestamp - offset;
 
+    if (fifo) {
+      // the watermark interrupt is a level, only its rising edge means new data
+      uint64_t irq_ts = 0;
+      for (int i = 0; i < num_events; ++i) {
+        if (evdata[i].id == GPIOEVENT_EVENT_RISING_EDGE) {
+          irq_ts = evdata[i].timestamp - offset;
+        }
+      }
+
+      samples.clear();
+      int ret = irq_ts != 0 ? fifo->read_samples(irq_ts, samples) : 0;
+      publish_fifo_samples(fifo, samples, pm);
+      if (ret < 0) {
+        LOGE("LSM6DS3 FIFO read failed");
+        drain_fifo(fifo, samples, pm);
+      }
+    }
+
     for (auto &[sensor, msg_name] : sensors) {
-      if (!sensor->has_interrupt_enabled()) {
+      if (!sensor->has_interrupt_enabled() || (fifo && fifo->owns(sensor))) {
         continue;
       }
 
@@ -104,6 +160,9 @@ void polling_loop(Sensor *sensor, std::string msg_name) {
 }
 
 int sensor_loop(I2CBus *i2c_bus_imu) {
+  auto lsm_accel = new LSM6DS3_Accel(i2c_bus_imu, GPIO_LSM_INT);
+  auto lsm_gyro = new LSM6DS3_Gyro(i2c_bus_imu, GPIO_LSM_INT, true);
+
   // Sensor init
   std::vector<std::tuple<Sensor *, std::string>> sensors_init = {
     {new BMX055_Accel(i2c_bus_imu), "accelerometer2"},
@@ -111,8 +170,8 @@ int sensor_loop(I2CBus *i2c_bus_imu) {
     {new BMX055_Magn(i2c_bus_imu), "magnetometer"},
     {new BMX055_Temp(i2c_bus_imu), "temperatureSensor2"},
 
-    {new LSM6DS3_Accel(i2c_bus_imu, GPIO_LSM_INT), "accelerometer"},
-    {new LSM6DS3_Gyro(i2c_bus_imu, GPIO_LSM_INT, true), "gyroscope"},
+    {lsm_accel, "accelerometer"},
+    {lsm_gyro, "gyroscope"},
     {new LSM6DS3_Temp(i2c_bus_imu), "temperatureSensor"},
 
     {new MMC5603NJ_Magn(i2c_bus_imu), "magnetometer"},
@@ -120,17 +179,32 @@ int sensor_loop(I2CBus *i2c_bus_imu) {
 
   // Initialize sensors
   std::vector<std::thread> threads;
+  std::set<Sensor *> initialized;
   for (auto &[sensor, msg_name] : sensors_init) {
     int err = sensor->init();
     if (err < 0) {
       continue;
     }
+    initialized.insert(sensor);
 
     if (!sensor->has_interrupt_enabled()) {
       threads.emplace_back(polling_loop, sensor, msg_name);
     }
   }
 
+  // batch LSM6DS3 reads through its hardware FIFO
+  std::unique_ptr<LSM6DS3_Fifo> lsm_fifo;
+  const char *env_lsm_fifo = std::getenv("LSM_FIFO");
+  if (env_lsm_fifo != nullptr && strncmp(env_lsm_fifo, "1", 1) == 0 &&
+      initialized.count(lsm_accel) && initialized.count(lsm_gyro)) {
+    lsm_fifo = std::make_unique<LSM6DS3_Fifo>(i2c_bus_imu, lsm_accel, lsm_gyro);
+    if (lsm_fifo->init() < 0) {
+      LOGE("LSM6DS3 FIFO init failed, falling back to data ready interrupts");
+      lsm_fifo->shutdown();
+      lsm_fifo.reset();
+    }
+  }
+
   // increase interrupt quality by pinning interrupt and process to core 1
   setpriority(PRIO_PROCESS, 0, -18);
   util::set_core_affinity({1});
@@ -143,13 +217,17 @@ int sensor_loop(I2CBus *i2c_bus_imu) {
   std::system(util::string_format("sudo su -c 'echo 1 > %s'", irq_path.c_str()).c_str());
 
   // thread for reading events via interrupts
-  threads.emplace_back(&interrupt_loop, std::ref(sensors_init));
+  threads.emplace_back(&interrupt_loop, std::ref(sensors_init), lsm_fifo.get());
 
   // wait for all threads to finish
   for (auto &t : threads) {
     t.join();
   }
 
+  if (lsm_fifo) {
+    lsm_fifo->shutdown();
+  }
+
   for (auto &[sensor, msg_name] : sensors_init) {
     sensor->shutdown();
     delete sensor;
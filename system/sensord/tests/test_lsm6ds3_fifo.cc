@@ -0,0 +1,174 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+
+#include <cstring>
+#include <deque>
+#include <map>
+
+#include "catch2/catch.hpp"
+#include "system/sensord/sensors/lsm6ds3_fifo.h"
+
+// replays a register trace: FIFO registers serve a byte stream, others their last written value
+class MockI2CBus : public I2CBus {
+public:
+  std::map<uint, uint8_t> registers;
+  std::map<uint, std::deque<uint8_t>> streams;
+  int transactions = 0;
+
+  int read_register(uint8_t device_address, uint register_address, uint8_t *buffer, uint8_t len) override {
+    transactions++;
+    auto it = streams.find(register_address);
+    for (int i = 0; i < len; ++i) {
+      if (it != streams.end()) {
+        REQUIRE(!it->second.empty());
+        buffer[i] = it->second.front();
+        it->second.pop_front();
+      } else {
+        buffer[i] = registers[register_address + i];
+      }
+    }
+    return len;
+  }
+
+  int set_register(uint8_t device_address, uint register_address, uint8_t data) override {
+    transactions++;
+    registers[register_address] = data;
+    return 0;
+  }
+
+  // fills the FIFO with complete sets, starting at the given pattern index
+  void fill_fifo(int sets, int pattern = 0) {
+    int words = sets * LSM6DS3_FIFO_PATTERN_WORDS + (LSM6DS3_FIFO_PATTERN_WORDS - pattern) % LSM6DS3_FIFO_PATTERN_WORDS;
+    for (int w = 0; w < words; ++w) {
+      int idx = (pattern + w) % LSM6DS3_FIFO_PATTERN_WORDS;
+      int16_t value = (w / LSM6DS3_FIFO_PATTERN_WORDS) * 100 + idx;
+      streams[LSM6DS3_FIFO_I2C_REG_DATA_OUT_L].push_back(value & 0xFF);
+      streams[LSM6DS3_FIFO_I2C_REG_DATA_OUT_L].push_back(value >> 8);
+    }
+    streams[LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1] = {
+      uint8_t(words & 0xFF), uint8_t((words >> 8) & 0x0F), uint8_t(pattern & 0xFF), uint8_t(pattern >> 8)};
+  }
+};
+
+TEST_CASE("LSM6DS3_Fifo::init") {
+  MockI2CBus bus;
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+  bus.registers[LSM6DS3_FIFO_I2C_REG_INT1_CTRL] = LSM6DS3_ACCEL_INT1_DRDY_XL | LSM6DS3_GYRO_INT1_DRDY_G;
+
+  LSM6DS3_Fifo fifo(&bus, &accel, &gyro, 4);
+  REQUIRE(fifo.init() == 0);
+  REQUIRE(bus.registers[LSM6DS3_FIFO_I2C_REG_FIFO_CTRL1] == 24);
+  REQUIRE(bus.registers[LSM6DS3_FIFO_I2C_REG_FIFO_CTRL2] == 0);
+  REQUIRE(bus.registers[LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5] == (LSM6DS3_FIFO_ODR_104HZ | LSM6DS3_FIFO_MODE_CONTINUOUS));
+  REQUIRE(bus.registers[LSM6DS3_FIFO_I2C_REG_INT1_CTRL] == LSM6DS3_FIFO_INT1_FTH);
+
+  REQUIRE(fifo.shutdown() == 0);
+  REQUIRE(bus.registers[LSM6DS3_FIFO_I2C_REG_FIFO_CTRL5] == LSM6DS3_FIFO_MODE_BYPASS);
+  REQUIRE(bus.registers[LSM6DS3_FIFO_I2C_REG_INT1_CTRL] == (LSM6DS3_ACCEL_INT1_DRDY_XL | LSM6DS3_GYRO_INT1_DRDY_G));
+}
+
+TEST_CASE("LSM6DS3_Fifo::read_samples") {
+  MockI2CBus bus;
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+  LSM6DS3_Fifo fifo(&bus, &accel, &gyro, 4);
+  const uint64_t irq_ts = 10e9;
+  const uint64_t period = LSM6DS3_Fifo::sample_period_ns();
+  std::vector<LSM6DS3_FifoSample> samples;
+
+  SECTION("aligned") {
+    bus.fill_fifo(5);
+    REQUIRE(fifo.read_samples(irq_ts, samples) == 10);
+    REQUIRE(bus.streams[LSM6DS3_FIFO_I2C_REG_DATA_OUT_L].empty());
+    // one status read and ceil(60 / 30) bursts
+    REQUIRE(bus.transactions == 3);
+
+    for (int i = 0; i < samples.size(); ++i) {
+      int set = i / 2;
+      REQUIRE(samples[i].gyro == (i % 2 == 0));
+      REQUIRE(samples[i].ts == irq_ts + (set - 3) * period);
+      int first_word = (i % 2) * 3;
+      REQUIRE(read_16_bit(samples[i].data[0], samples[i].data[1]) == set * 100 + first_word);
+      REQUIRE(read_16_bit(samples[i].data[4], samples[i].data[5]) == set * 100 + first_word + 2);
+    }
+  }
+
+  SECTION("starts mid pattern") {
+    bus.fill_fifo(4, 4);
+    REQUIRE(fifo.read_samples(irq_ts, samples) == 8);
+    REQUIRE(bus.streams[LSM6DS3_FIFO_I2C_REG_DATA_OUT_L].empty());
+    REQUIRE(samples[0].gyro);
+    REQUIRE(read_16_bit(samples[0].data[0], samples[0].data[1]) % 100 == 0);
+  }
+
+  SECTION("reads without an interrupt continue the timestamps") {
+    bus.fill_fifo(5);
+    REQUIRE(fifo.read_samples(irq_ts, samples) == 10);
+    samples.clear();
+    bus.fill_fifo(3);
+    REQUIRE(fifo.read_samples(0, samples) == 6);
+    for (int i = 0; i < samples.size(); ++i) {
+      REQUIRE(samples[i].ts == irq_ts + (i / 2 + 2) * period);
+    }
+  }
+
+  SECTION("reads before the first interrupt are dropped") {
+    bus.fill_fifo(5);
+    REQUIRE(fifo.read_samples(0, samples) == 0);
+    REQUIRE(samples.empty());
+    REQUIRE(bus.streams[LSM6DS3_FIFO_I2C_REG_DATA_OUT_L].empty());
+  }
+
+  SECTION("incomplete set stays in the FIFO") {
+    bus.streams[LSM6DS3_FIFO_I2C_REG_FIFO_STATUS1] = {5, 0, 0, 0};
+    REQUIRE(fifo.read_samples(irq_ts, samples) == 0);
+    REQUIRE(samples.empty());
+    REQUIRE(bus.transactions == 1);
+  }
+}
+
+TEST_CASE("LSM6DS3_Fifo::above_watermark") {
+  MockI2CBus bus;
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+  LSM6DS3_Fifo fifo(&bus, &accel, &gyro, 4);
+
+  bus.registers[LSM6DS3_FIFO_I2C_REG_FIFO_STATUS2] = LSM6DS3_FIFO_STATUS2_WATERMARK;
+  REQUIRE(fifo.above_watermark());
+  bus.registers[LSM6DS3_FIFO_I2C_REG_FIFO_STATUS2] = LSM6DS3_FIFO_STATUS2_OVER_RUN;
+  REQUIRE_FALSE(fifo.above_watermark());
+}
+
+TEST_CASE("LSM6DS3 I2C transactions per sample", "[.][benchmark]") {
+  const int sets = LSM6DS3_FIFO_DEFAULT_WATERMARK;
+
+  MockI2CBus bus;
+  LSM6DS3_Accel accel(&bus);
+  LSM6DS3_Gyro gyro(&bus);
+
+  // data ready: every interrupt reads the status and data of both sensors
+  bus.registers[LSM6DS3_ACCEL_I2C_REG_STAT_REG] = LSM6DS3_ACCEL_DRDY_XLDA | LSM6DS3_GYRO_DRDY_GDA;
+  for (int i = 0; i < sets; ++i) {
+    MessageBuilder accel_msg, gyro_msg;
+    REQUIRE(accel.get_event(accel_msg, i));
+    REQUIRE(gyro.get_event(gyro_msg, i));
+  }
+  double drdy = (double)bus.transactions / (sets * 2);
+
+  bus.transactions = 0;
+  LSM6DS3_Fifo fifo(&bus, &accel, &gyro, sets);
+  std::vector<LSM6DS3_FifoSample> samples;
+  bus.fill_fifo(sets);
+  REQUIRE(fifo.read_samples(1e9, samples) == sets * 2);
+  double batched = (double)bus.transactions / samples.size();
+
+  printf("I2C transactions per sample: data ready %.2f, FIFO %.2f\n", drdy, batched);
+  REQUIRE(batched < drdy);
+
+  BENCHMARK("FIFO drain") {
+    samples.clear();
+    bus.fill_fifo(sets);
+    return fifo.read_samples(1e9, samples);
+  };
+}
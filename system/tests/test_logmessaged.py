@@ -1,11 +1,15 @@
 import glob
+import json
 import os
+import struct
 import time
+import zmq
 
 import cereal.messaging as messaging
 from openpilot.system.manager.process_config import managed_processes
 from openpilot.system.hardware.hw import Paths
 from openpilot.common.swaglog import cloudlog, ipchandler
+from openpilot.system.logmessaged import SWAGLOG_BINARY_MAGIC, SWAGLOG_BINARY_VERSION
 
 
 class TestLogmessaged:
@@ -53,3 +57,23 @@ class TestLogmessaged:
     logsize = sum([os.path.getsize(f) for f in self._get_log_files()])
     assert (n*len(msg)) < logsize < (n*(len(msg)+1024))
 
+
+  def test_binary_batch(self):
+    ctx = json.dumps({"daemon": "testy"}).encode()
+    batch = struct.pack("<BBI", SWAGLOG_BINARY_MAGIC, SWAGLOG_BINARY_VERSION, len(ctx)) + ctx
+    msgs = [f"abc {i}" for i in range(10)]
+    batch += struct.pack("<I", len(msgs))
+    for m in msgs:
+      batch += struct.pack("<BBIdH", 40, 0, 123, time.time(), len(b"file.cc")) + b"file.cc"
+      batch += struct.pack("<H", len(b"func")) + b"func"
+      batch += struct.pack("<I", len(m)) + m.encode()
+
+    sock = zmq.Context.instance().socket(zmq.PUSH)
+    sock.connect(Paths.swaglog_ipc())
+    sock.send(batch)
+    time.sleep(3)
+    sock.close()
+
+    records = [json.loads(m.logMessage) for m in messaging.drain_sock(self.sock)]
+    assert [r["msg"] for r in records] == msgs
+    assert all(r["ctx"]["daemon"] == "testy" and r["levelnum"] == 40 and r["lineno"] == 123 for r in records)
@@ -306,20 +306,22 @@ void BinaryViewModel::updateState() {
   const double max_f = 255.0;
   const double factor = 0.25;
   const double scaler = max_f / log2(1.0 + factor);
+  const auto &colors = last_msg.colors();
   for (int i = 0; i < binary.size(); ++i) {
+    const auto bit_change_counts = last_msg.bitChangeCounts(i);
     for (int j = 0; j < 8; ++j) {
       auto &item = items[i * column_count + j];
       int val = ((binary[i] >> (7 - j)) & 1) != 0 ? 1 : 0;
       // Bit update frequency based highlighting
       double offset = !item.sigs.empty() ? 50 : 0;
-      auto n = last_msg.last_changes[i].bit_change_counts[j];
+      auto n = bit_change_counts[j];
       double min_f = n == 0 ? offset : offset + 25;
       double alpha = std::clamp(offset + log2(1.0 + factor * (double)n / (double)last_msg.count) * scaler, min_f, max_f);
       auto color = item.bg_color;
       color.setAlpha(alpha);
       updateItem(i, j, val, color);
     }
-    updateItem(i, 8, binary[i], last_msg.colors[i]);
+    updateItem(i, 8, binary[i], colors[i]);
   }
 }
 
@@ -10,57 +10,129 @@ void Sparkline::update(const MessageId &msg_id, const cabana::Signal *sig, doubl
   const auto &msgs = can->events(msg_id);
   uint64_t ts = (last_msg_ts + can->routeStartTime()) * 1e9;
   uint64_t first_ts = (ts > range * 1e9) ? ts - range * 1e9 : 0;
-  auto first = std::lower_bound(msgs.cbegin(), msgs.cend(), first_ts, CompareCanEvent());
-  auto last = std::upper_bound(first, msgs.cend(), ts, CompareCanEvent());
 
-  if (first == last || size.isEmpty()) {
-    pixmap = QPixmap();
-    return;
+  // start over after seeking backwards, a change of range, or when events were merged in before the last decoded one
+  bool continued = msg_id == msg_id_ && sig == sig_ && range == range_ && last_event && last_index < msgs.size() &&
+                   msgs[last_index] == last_event && ts >= last_event->mono_time;
+  if (!continued) {
+    reset();
+    msg_id_ = msg_id;
+    sig_ = sig;
   }
 
-  points.clear();
+  expire(first_ts);
+  auto first = std::lower_bound(msgs.cbegin(), msgs.cend(), first_ts, CompareCanEvent());
+  if (last_event) {
+    first = std::max(first, msgs.cbegin() + last_index + 1);
+  }
+  auto last = std::upper_bound(first, msgs.cend(), ts, CompareCanEvent());
   double value = 0;
   for (auto it = first; it != last; ++it) {
     if (sig->getValue((*it)->dat, (*it)->size, &value)) {
-      points.emplace_back(((*it)->mono_time - (*first)->mono_time) / 1e9, value);
+      append({(*it)->mono_time, value});
     }
   }
+  if (first != last) {
+    last_index = std::prev(last) - msgs.cbegin();
+    last_event = msgs[last_index];
+  }
 
-  if (points.empty()) {
+  if (points.empty() || size.isEmpty()) {
     pixmap = QPixmap();
     return;
   }
 
-  const auto [min, max] = std::minmax_element(points.begin(), points.end(),
-                                              [](auto &l, auto &r) { return l.y() < r.y(); });
-  min_val = min->y() == max->y() ? min->y() - 1 : min->y();
-  max_val = min->y() == max->y() ? max->y() + 1 : max->y();
-  freq_ = points.size() / std::max(points.back().x() - points.front().x(), 1.0);
-  render(sig->color, range, size);
+  const double min = min_queue.front().value;
+  const double max = max_queue.front().value;
+  min_val = min == max ? min - 1 : min;
+  max_val = min == max ? max + 1 : max;
+  freq_ = points.size() / std::max((points.back().mono_time - points.front().mono_time) / 1e9, 1.0);
+  render(sig->color, range, size, ts);
+}
+
+void Sparkline::reset() {
+  sig_ = nullptr;
+  last_event = nullptr;
+  points.clear();
+  min_queue.clear();
+  max_queue.clear();
+  pixmap = QPixmap();
 }
 
-void Sparkline::render(const QColor &color, int range, QSize size) {
-  const double xscale = (size.width() - 1) / (double)range;
-  const double yscale = (size.height() - 3) / (max_val - min_val);
-  for (auto &v : points) {
-    v = QPoint(v.x() * xscale, 1 + std::abs(v.y() - max_val) * yscale);
+void Sparkline::append(const Point &p) {
+  points.push_back(p);
+  while (!min_queue.empty() && min_queue.back().value >= p.value) min_queue.pop_back();
+  min_queue.push_back(p);
+  while (!max_queue.empty() && max_queue.back().value <= p.value) max_queue.pop_back();
+  max_queue.push_back(p);
+}
+
+void Sparkline::expire(uint64_t first_ts) {
+  while (!points.empty() && points.front().mono_time < first_ts) points.pop_front();
+  while (!min_queue.empty() && min_queue.front().mono_time < first_ts) min_queue.pop_front();
+  while (!max_queue.empty() && max_queue.front().mono_time < first_ts) max_queue.pop_front();
+}
+
+QPointF Sparkline::mapToPixmap(const Point &p) const {
+  // x is rounded to device pixels since boot, so scrolled pixels stay where they would be drawn
+  int64_t x = int64_t(p.mono_time / 1e9 * xscale) - right_edge + pixmap.width() - 1;
+  double yscale = (pixmap.height() / dpr_ - 3) / (drawn_max - drawn_min);
+  return QPointF(x / dpr_, 1 + std::abs(p.value - drawn_max) * yscale);
+}
+
+void Sparkline::render(const QColor &color, int range, QSize size, uint64_t ts) {
+  const qreal dpr = qApp->devicePixelRatio();
+  const double scale = (size.width() - 1) * dpr / range;
+  const int64_t edge = ts / 1e9 * scale;
+  const bool antialias = points.size() < 500;
+  const bool dots = (points.back().mono_time - points.front().mono_time) / 1e9 * scale / dpr / points.size() > 8;
+
+  bool full = pixmap.isNull() || pixmap.size() != size * dpr || dpr != dpr_ || range != range_ || color != color_ ||
+              min_val != drawn_min || max_val != drawn_max || antialias != antialiasing || dots != draw_points ||
+              edge < right_edge || edge - right_edge >= pixmap.width();
+  if (!full && edge == right_edge && points.back().mono_time == drawn_until) return;
+
+  auto from = points.cbegin();
+  if (full) {
+    if (pixmap.size() != size * dpr) {
+      pixmap = QPixmap(size * dpr);
+    }
+    pixmap.setDevicePixelRatio(dpr);
+    pixmap.fill(Qt::transparent);
+    range_ = range;
+    color_ = color;
+    dpr_ = dpr;
+    xscale = scale;
+    drawn_min = min_val;
+    drawn_max = max_val;
+    antialiasing = antialias;
+    draw_points = dots;
+  } else {
+    // continue the line from the last point drawn
+    from = std::lower_bound(points.cbegin(), points.cend(), drawn_until, [](auto &p, uint64_t t) { return p.mono_time < t; });
+    if (int dx = int(edge - right_edge); dx > 0) {
+      pixmap.scroll(-dx, 0, pixmap.rect());
+      QPainter painter(&pixmap);
+      painter.setCompositionMode(QPainter::CompositionMode_Source);
+      painter.fillRect(QRectF((pixmap.width() - dx) / dpr_, 0, dx / dpr_, pixmap.height() / dpr_), Qt::transparent);
+    }
   }
+  right_edge = edge;
 
-  qreal dpr = qApp->devicePixelRatio();
-  size *= dpr;
-  if (size != pixmap.size()) {
-    pixmap = QPixmap(size);
+  std::vector<QPointF> polyline;
+  polyline.reserve(points.cend() - from);
+  for (auto it = from; it != points.cend(); ++it) {
+    polyline.push_back(mapToPixmap(*it));
   }
-  pixmap.setDevicePixelRatio(dpr);
-  pixmap.fill(Qt::transparent);
+
   QPainter painter(&pixmap);
-  painter.setRenderHint(QPainter::Antialiasing, points.size() < 500);
+  painter.setRenderHint(QPainter::Antialiasing, antialiasing);
   painter.setPen(color);
-  painter.drawPolyline(points.data(), points.size());
-  painter.setPen(QPen(color, 3));
-  if ((points.back().x() - points.front().x()) / points.size() > 8) {
-    painter.drawPoints(points.data(), points.size());
-  } else {
-    painter.drawPoint(points.back());
+  painter.drawPolyline(polyline.data(), polyline.size());
+  if (draw_points) {
+    painter.setPen(QPen(color, 3));
+    painter.drawPoints(polyline.data(), polyline.size());
   }
+  drawn_until = points.back().mono_time;
+  last_point = polyline.back();
 }
@@ -1,24 +1,60 @@
 #pragma once
 
+#include <QColor>
 #include <QPixmap>
 #include <QPointF>
+#include <deque>
 #include <vector>
 
 #include "tools/cabana/dbc/dbc.h"
 
+struct CanEvent;
+
+// the decoded points of the sparkline range are kept between updates: new events are appended,
+// expired ones dropped, and the pixmap is scrolled and only drawn from scratch when the scale changes.
 class Sparkline {
 public:
   void update(const MessageId &msg_id, const cabana::Signal *sig, double last_msg_ts, int range, QSize size);
+  // drops the decoded points, after the signal was edited
+  void reset();
   inline double freq() const { return freq_; }
   bool isEmpty() const { return pixmap.isNull(); }
 
   QPixmap pixmap;
+  QPointF last_point;  // drawn over the pixmap, so it isn't left behind when the pixmap scrolls
   double min_val = 0;
   double max_val = 0;
 
 private:
-  void render(const QColor &color, int range, QSize size);
+  struct Point {
+    uint64_t mono_time;
+    double value;
+  };
+
+  void append(const Point &p);
+  void expire(uint64_t first_ts);
+  QPointF mapToPixmap(const Point &p) const;
+  void render(const QColor &color, int range, QSize size, uint64_t ts);
+
+  MessageId msg_id_;
+  const cabana::Signal *sig_ = nullptr;
+  const CanEvent *last_event = nullptr;  // the last event decoded, and its index in the message's events
+  size_t last_index = 0;
+  std::deque<Point> points;
+  // monotonic queues, their fronts are the min and max of points
+  std::deque<Point> min_queue;
+  std::deque<Point> max_queue;
 
-  std::vector<QPointF> points;
+  // what the pixmap was drawn with
+  int range_ = 0;
+  QColor color_;
+  qreal dpr_ = 1;
+  double xscale = 0;       // device pixels per second
+  int64_t right_edge = 0;  // device pixels since boot
+  double drawn_min = 0;
+  double drawn_max = 0;
+  uint64_t drawn_until = 0;
+  bool antialiasing = false;
+  bool draw_points = false;
   double freq_ = 0;
 };
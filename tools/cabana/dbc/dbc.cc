@@ -1,9 +1,26 @@
 #include "tools/cabana/dbc/dbc.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "tools/cabana/utils/util.h"
 
+namespace {
+
+template <bool big_endian, bool is_signed>
+double extract_signal(const cabana::Signal::Plan &plan, const uint8_t *data) {
+  uint64_t word;
+  memcpy(&word, data + plan.base, sizeof(word));
+  if constexpr (big_endian) {
+    word = __builtin_bswap64(word);
+  }
+  uint64_t raw = (word >> plan.shift) & plan.mask;
+  int64_t val = is_signed ? (int64_t)(raw << plan.sign_shift) >> plan.sign_shift : (int64_t)raw;
+  return val * plan.factor + plan.offset;
+}
+
+}  // namespace
+
 uint qHash(const MessageId &item) {
   return qHash(item.source) ^ qHash(item.address);
 }
@@ -140,6 +157,30 @@ void cabana::Signal::update() {
 
   color = QColor::fromHsvF(h, s, v);
   precision = std::max(num_decimals(factor), num_decimals(offset));
+  compile();
+}
+
+void cabana::Signal::compile() {
+  plan = {};
+  // the bytes holding the msb and lsb, walked from the msb by get_raw_value()
+  const int first_byte = is_little_endian ? lsb / 8 : msb / 8;
+  const int last_byte = is_little_endian ? msb / 8 : lsb / 8;
+  if (size < 1 || size > 64 || first_byte < 0 || last_byte - first_byte > 7) return;
+
+  // the 8 bytes loaded end at the last byte, so signals at the end of 8 byte messages stay in bounds
+  plan.base = std::max(0, last_byte - 7);
+  plan.min_size = std::max(8, last_byte + 1);
+  plan.shift = is_little_endian ? lsb - plan.base * 8 : (plan.base + 7 - lsb / 8) * 8 + lsb % 8;
+  plan.mask = size == 64 ? ~0ULL : (1ULL << size) - 1;
+  plan.sign_shift = 64 - size;
+  plan.factor = factor;
+  plan.offset = offset;
+
+  static constexpr decltype(Plan::extract) extract_fns[2][2] = {
+    {extract_signal<false, false>, extract_signal<false, true>},
+    {extract_signal<true, false>, extract_signal<true, true>},
+  };
+  plan.extract = extract_fns[!is_little_endian][is_signed];
 }
 
 QString cabana::Signal::formatValue(double value, bool with_unit) const {
@@ -159,10 +200,10 @@ QString cabana::Signal::formatValue(double value, bool with_unit) const {
 }
 
 bool cabana::Signal::getValue(const uint8_t *data, size_t data_size, double *val) const {
-  if (multiplexor && get_raw_value(data, data_size, *multiplexor) != multiplex_value) {
+  if (multiplexor && multiplexor->extract(data, data_size) != multiplex_value) {
     return false;
   }
-  *val = get_raw_value(data, data_size, *this);
+  *val = extract(data, data_size);
   return true;
 }
 
@@ -194,7 +235,8 @@ double get_raw_value(const uint8_t *data, size_t data_size, const cabana::Signal
     bits -= size;
     i = sig.is_little_endian ? i - 1 : i + 1;
   }
-  if (sig.is_signed) {
+  // 64 bit values are already in two's complement
+  if (sig.is_signed && sig.size < 64) {
     val -= ((val >> (sig.size - 1)) & 0x1) ? (1ULL << sig.size) : 0;
   }
   return val * sig.factor + sig.offset;
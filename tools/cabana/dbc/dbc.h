@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <limits>
 #include <utility>
 #include <vector>
@@ -54,7 +55,9 @@ public:
   Signal() = default;
   Signal(const Signal &other) = default;
   void update();
+  void compile();
   bool getValue(const uint8_t *data, size_t data_size, double *val) const;
+  inline double extract(const uint8_t *data, size_t data_size) const;
   QString formatValue(double value, bool with_unit = true) const;
   bool operator==(const cabana::Signal &other) const;
   inline bool operator!=(const cabana::Signal &other) const { return !(*this == other); }
@@ -83,6 +86,20 @@ public:
   // Multiplexed
   int multiplex_value = 0;
   Signal *multiplexor = nullptr;
+
+  // compiled from the fields above by compile(): the value is shifted and masked out of 8 bytes loaded
+  // at `base`, byte swapped for big endian signals. signals not compiled, spanning 9 bytes, or messages
+  // shorter than min_size take get_raw_value()
+  struct Plan {
+    double (*extract)(const Plan &plan, const uint8_t *data) = nullptr;
+    size_t min_size = std::numeric_limits<size_t>::max();
+    int base = 0;
+    int shift = 0;
+    int sign_shift = 0;  // 64 - size
+    uint64_t mask = 0;
+    double factor = 1.0;
+    double offset = 0;
+  } plan;
 };
 
 class Msg {
@@ -118,3 +135,7 @@ double get_raw_value(const uint8_t *data, size_t data_size, const cabana::Signal
 void updateMsbLsb(cabana::Signal &s);
 inline int flipBitPos(int start_bit) { return 8 * (start_bit / 8) + 7 - start_bit % 8; }
 inline QString doubleToString(double value) { return QString::number(value, 'g', std::numeric_limits<double>::digits10); }
+
+inline double cabana::Signal::extract(const uint8_t *data, size_t data_size) const {
+  return data_size >= plan.min_size ? plan.extract(plan, data) : get_raw_value(data, data_size, *this);
+}
@@ -1,8 +1,101 @@
 #include "tools/cabana/dbc/dbcfile.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
 #include <QFile>
 #include <QFileInfo>
-#include <QRegularExpression>
+#include <QLocale>
+
+namespace {
+
+bool is_word(char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+bool is_digit(char c) { return c >= '0' && c <= '9'; }
+bool is_number(char c) { return is_digit(c) || c == '.' || c == '+' || c == '-' || c == 'e' || c == 'E'; }
+bool is_whitespace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && is_whitespace(s.front())) s.remove_prefix(1);
+  while (!s.empty() && is_whitespace(s.back())) s.remove_suffix(1);
+  return s;
+}
+
+template <class T>
+T to_int(std::string_view s) {
+  T value = 0;
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  return ec == std::errc() && ptr == s.data() + s.size() ? value : 0;
+}
+
+double to_double(std::string_view s) {
+  // numbers are ascii, widened on the stack to use Qt's locale independent conversion
+  static const QLocale c_locale = QLocale::c();
+  char16_t buf[64];
+  if (s.size() > std::size(buf)) return 0;
+  std::copy(s.begin(), s.end(), buf);
+  return c_locale.toDouble(QStringView(buf, s.size()));
+}
+
+QString to_qstring(std::string_view s) { return QString::fromUtf8(s.data(), s.size()); }
+QString to_comment(std::string_view s) { return to_qstring(s).trimmed().replace("\\\"", "\""); }
+
+// splits a statement into tokens, failing with `error` at the first one that doesn't match
+class Tokenizer {
+public:
+  Tokenizer(const char *begin, const char *end, const char *error) : p(begin), end(end), error(error) {}
+  Tokenizer(std::string_view s, const char *error) : Tokenizer(s.data(), s.data() + s.size(), error) {}
+
+  const char *pos() const { return p; }
+  std::string_view rest() { skipSpaces(); return {p, size_t(end - p)}; }
+  bool peek(char c) { skipSpaces(); return p < end && *p == c; }
+  void expect(std::string_view s) {
+    skipSpaces();
+    if (size_t(end - p) < s.size() || std::string_view(p, s.size()) != s) fail();
+    p += s.size();
+  }
+  // the terminating ';' of a statement, which may be on a later line
+  void expectEnd() {
+    while (p < end && is_whitespace(*p)) ++p;
+    expect(";");
+  }
+  char oneOf(std::string_view chars) {
+    if (p == end || chars.find(*p) == std::string_view::npos) fail();
+    return *p++;
+  }
+  std::string_view word() { return take(is_word); }
+  std::string_view digits() { return take(is_digit); }
+  std::string_view number() { return take(is_number); }
+  // a double quoted string, with backslash escaped characters kept as they are when `escapes` is set
+  std::string_view quoted(bool escapes) {
+    expect("\"");
+    const char *start = p;
+    for (; p < end && *p != '"'; ++p) {
+      if (escapes && *p == '\\' && (++p == end || *p == '\n')) fail();
+    }
+    if (p == end) fail();
+    return {start, size_t(p++ - start)};
+  }
+  [[noreturn]] void fail() const { throw std::runtime_error(error); }
+
+private:
+  void skipSpaces() {
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+  }
+  template <class Pred>
+  std::string_view take(Pred pred) {
+    skipSpaces();
+    const char *start = p;
+    while (p < end && pred(*p)) ++p;
+    if (p == start) fail();
+    return {start, size_t(p - start)};
+  }
+
+  const char *p, *end;
+  const char *error;
+};
+
+}  // namespace
 
 DBCFile::DBCFile(const QString &dbc_file_name) {
   QFile file(dbc_file_name);
@@ -13,7 +106,13 @@ DBCFile::DBCFile(const QString &dbc_file_name) {
     if (dbc_file_name.endsWith(AUTO_SAVE_EXTENSION)) {
       filename.chop(AUTO_SAVE_EXTENSION.length());
     }
-    parse(file.readAll());
+    // parsed in place from the mapped file, empty files can't be mapped
+    if (const uchar *data = file.size() > 0 ? file.map(0, file.size()) : nullptr) {
+      parse((const char *)data, (const char *)data + file.size());
+    } else {
+      QByteArray content = file.readAll();
+      parse(content.constData(), content.constData() + content.size());
+    }
   } else {
     throw std::runtime_error("Failed to open file.");
   }
@@ -21,7 +120,8 @@ DBCFile::DBCFile(const QString &dbc_file_name) {
 
 DBCFile::DBCFile(const QString &name, const QString &content) : name_(name), filename("") {
   // Open from clipboard
-  parse(content);
+  QByteArray utf8 = content.toUtf8();
+  parse(utf8.constData(), utf8.constData() + utf8.size());
 }
 
 bool DBCFile::save() {
@@ -80,45 +180,59 @@ cabana::Signal *DBCFile::signal(uint32_t address, const QString name) {
   return m ? (cabana::Signal *)m->sig(name) : nullptr;
 }
 
-void DBCFile::parse(const QString &content) {
+void DBCFile::parse(const char *begin, const char *end) {
   msgs.clear();
 
   int line_num = 0;
-  QString line;
   cabana::Msg *current_msg = nullptr;
   int multiplexor_cnt = 0;
   bool seen_first = false;
-  QTextStream stream((QString *)&content);
+  const std::string_view bom = "\xEF\xBB\xBF";
+  if (std::string_view(begin, end - begin).substr(0, bom.size()) == bom) {
+    begin += bom.size();
+  }
 
-  while (!stream.atEnd()) {
+  for (const char *pos = begin; pos < end;) {
     ++line_num;
-    QString raw_line = stream.readLine();
-    line = raw_line.trimmed();
+    const char *eol = (const char *)memchr(pos, '\n', end - pos);
+    if (!eol) eol = end;
+    std::string_view raw_line(pos, eol - pos);
+    if (!raw_line.empty() && raw_line.back() == '\r') raw_line.remove_suffix(1);
+    std::string_view line = trim(raw_line);
+    pos = eol < end ? eol + 1 : end;
 
     bool seen = true;
     try {
-      if (line.startsWith("BO_ ")) {
+      const char *statement_end = nullptr;
+      if (line.substr(0, 4) == "BO_ ") {
         multiplexor_cnt = 0;
         current_msg = parseBO(line);
-      } else if (line.startsWith("SG_ ")) {
+      } else if (line.substr(0, 4) == "SG_ ") {
         parseSG(line, current_msg, multiplexor_cnt);
-      } else if (line.startsWith("VAL_ ")) {
+      } else if (line.substr(0, 5) == "VAL_ ") {
         parseVAL(line);
-      } else if (line.startsWith("CM_ BO_")) {
-        parseCM_BO(line, content, raw_line, stream);
-      } else if (line.startsWith("CM_ SG_ ")) {
-        parseCM_SG(line, content, raw_line, stream);
+      } else if (line.substr(0, 7) == "CM_ BO_") {
+        statement_end = parseCM_BO(line.data(), end);
+      } else if (line.substr(0, 8) == "CM_ SG_ ") {
+        statement_end = parseCM_SG(line.data(), end);
       } else {
         seen = false;
       }
+
+      // continue after the last line of a comment spanning lines
+      if (statement_end && statement_end > eol) {
+        line_num += std::count(eol, statement_end, '\n');
+        eol = (const char *)memchr(statement_end, '\n', end - statement_end);
+        pos = eol ? eol + 1 : end;
+      }
     } catch (std::exception &e) {
-      throw std::runtime_error(QString("[%1:%2]%3: %4").arg(filename).arg(line_num).arg(e.what()).arg(line).toStdString());
+      throw std::runtime_error(QString("[%1:%2]%3: %4").arg(filename).arg(line_num).arg(e.what()).arg(to_qstring(line)).toStdString());
     }
 
     if (seen) {
       seen_first = true;
     } else if (!seen_first) {
-      header += raw_line + "\n";
+      header += to_qstring(raw_line) + "\n";
     }
   }
 
@@ -127,125 +241,125 @@ void DBCFile::parse(const QString &content) {
   }
 }
 
-cabana::Msg *DBCFile::parseBO(const QString &line) {
-  static QRegularExpression bo_regexp(R"(^BO_ (?<address>\w+) (?<name>\w+) *: (?<size>\w+) (?<transmitter>\w+))");
+cabana::Msg *DBCFile::parseBO(std::string_view line) {
+  Tokenizer tok(line, "Invalid BO_ line format");
+  tok.expect("BO_");
+  uint32_t address = to_int<uint32_t>(tok.word());
+  auto name = tok.word();
+  tok.expect(":");
+  auto size = tok.word();
+  auto transmitter = tok.word();
 
-  QRegularExpressionMatch match = bo_regexp.match(line);
-  if (!match.hasMatch())
-    throw std::runtime_error("Invalid BO_ line format");
-
-  uint32_t address = match.captured("address").toUInt();
   if (msgs.count(address) > 0)
     throw std::runtime_error(QString("Duplicate message address: %1").arg(address).toStdString());
 
   // Create a new message object
   cabana::Msg *msg = &msgs[address];
   msg->address = address;
-  msg->name = match.captured("name");
-  msg->size = match.captured("size").toULong();
-  msg->transmitter = match.captured("transmitter").trimmed();
+  msg->name = to_qstring(name);
+  msg->size = to_int<uint32_t>(size);
+  msg->transmitter = to_qstring(transmitter);
   return msg;
 }
 
-void DBCFile::parseCM_BO(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
-  static QRegularExpression msg_comment_regexp(R"(^CM_ BO_ *(?<address>\w+) *\"(?<comment>(?:[^"\\]|\\.)*)\"\s*;)");
-
-  QString parse_line = line;
-  if (!parse_line.endsWith("\";")) {
-    int pos = stream.pos() - raw_line.length() - 1;
-    parse_line = content.mid(pos, content.indexOf("\";", pos));
-  }
-  auto match = msg_comment_regexp.match(parse_line);
-  if (!match.hasMatch())
-    throw std::runtime_error("Invalid message comment format");
-
-  if (auto m = (cabana::Msg *)msg(match.captured("address").toUInt()))
-    m->comment = match.captured("comment").trimmed().replace("\\\"", "\"");
+const char *DBCFile::parseCM_BO(const char *begin, const char *end) {
+  Tokenizer tok(begin, end, "Invalid message comment format");
+  tok.expect("CM_");
+  tok.expect("BO_");
+  uint32_t address = to_int<uint32_t>(tok.word());
+  auto comment = tok.quoted(true);
+  tok.expectEnd();
+
+  if (auto m = msg(address))
+    m->comment = to_comment(comment);
+  return tok.pos();
 }
 
-void DBCFile::parseSG(const QString &line, cabana::Msg *current_msg, int &multiplexor_cnt) {
-  static QRegularExpression sg_regexp(R"(^SG_ (\w+) : (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
-  static QRegularExpression sgm_regexp(R"(^SG_ (\w+) (\w+) *: (\d+)\|(\d+)@(\d+)([\+|\-]) \(([0-9.+\-eE]+),([0-9.+\-eE]+)\) \[([0-9.+\-eE]+)\|([0-9.+\-eE]+)\] \"(.*)\" (.*))");
-
+void DBCFile::parseSG(std::string_view line, cabana::Msg *current_msg, int &multiplexor_cnt) {
   if (!current_msg)
     throw std::runtime_error("No Message");
 
-  int offset = 0;
-  auto match = sg_regexp.match(line);
-  if (!match.hasMatch()) {
-    match = sgm_regexp.match(line);
-    offset = 1;
+  Tokenizer tok(line, "Invalid SG_ line format");
+  tok.expect("SG_");
+  QString name = to_qstring(tok.word());
+  std::string_view indicator;
+  if (!tok.peek(':')) {
+    indicator = tok.word();
   }
-  if (!match.hasMatch())
-    throw std::runtime_error("Invalid SG_ line format");
+  tok.expect(":");
+
+  cabana::Signal s{};
+  s.start_bit = to_int<int>(tok.digits());
+  tok.expect("|");
+  s.size = to_int<int>(tok.digits());
+  tok.expect("@");
+  s.is_little_endian = to_int<int>(tok.digits()) == 1;
+  s.is_signed = tok.oneOf("+|-") == '-';
+  tok.expect("(");
+  s.factor = to_double(tok.number());
+  tok.expect(",");
+  s.offset = to_double(tok.number());
+  tok.expect(")");
+  tok.expect("[");
+  s.min = to_double(tok.number());
+  tok.expect("|");
+  s.max = to_double(tok.number());
+  tok.expect("]");
+
+  // the unit runs up to the last quote followed by a space, the receiver is the rest of the line
+  std::string_view rest = tok.rest();
+  size_t unit_end = rest.rfind("\" ");
+  if (rest.empty() || rest.front() != '"' || unit_end == std::string_view::npos || unit_end == 0)
+    tok.fail();
+  s.unit = to_qstring(rest.substr(1, unit_end - 1));
+  s.receiver_name = to_qstring(trim(rest.substr(unit_end + 2)));
 
-  QString name = match.captured(1);
   if (current_msg->sig(name) != nullptr)
     throw std::runtime_error("Duplicate signal name");
 
-  cabana::Signal s{};
-  if (offset == 1) {
-    auto indicator = match.captured(2);
-    if (indicator == "M") {
-      ++multiplexor_cnt;
-      // Only one signal within a single message can be the multiplexer switch.
-      if (multiplexor_cnt >= 2)
-        throw std::runtime_error("Multiple multiplexor");
-
-      s.type = cabana::Signal::Type::Multiplexor;
-    } else {
-      s.type = cabana::Signal::Type::Multiplexed;
-      s.multiplex_value = indicator.mid(1).toInt();
-    }
+  if (indicator == "M") {
+    ++multiplexor_cnt;
+    // Only one signal within a single message can be the multiplexer switch.
+    if (multiplexor_cnt >= 2)
+      throw std::runtime_error("Multiple multiplexor");
+
+    s.type = cabana::Signal::Type::Multiplexor;
+  } else if (!indicator.empty()) {
+    s.type = cabana::Signal::Type::Multiplexed;
+    s.multiplex_value = to_int<int>(indicator.substr(1));
   }
   s.name = name;
-  s.start_bit = match.captured(offset + 2).toInt();
-  s.size = match.captured(offset + 3).toInt();
-  s.is_little_endian = match.captured(offset + 4).toInt() == 1;
-  s.is_signed = match.captured(offset + 5) == "-";
-  s.factor = match.captured(offset + 6).toDouble();
-  s.offset = match.captured(offset + 7).toDouble();
-  s.min = match.captured(8 + offset).toDouble();
-  s.max = match.captured(9 + offset).toDouble();
-  s.unit = match.captured(10 + offset);
-  s.receiver_name = match.captured(11 + offset).trimmed();
   current_msg->sigs.push_back(new cabana::Signal(s));
 }
 
-void DBCFile::parseCM_SG(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream) {
-  static QRegularExpression sg_comment_regexp(R"(^CM_ SG_ *(\w+) *(\w+) *\"((?:[^"\\]|\\.)*)\"\s*;)");
-
-  QString parse_line = line;
-  if (!parse_line.endsWith("\";")) {
-    int pos = stream.pos() - raw_line.length() - 1;
-    parse_line = content.mid(pos, content.indexOf("\";", pos));
-  }
-  auto match = sg_comment_regexp.match(parse_line);
-  if (!match.hasMatch())
-    throw std::runtime_error("Invalid CM_ SG_ line format");
-
-  if (auto s = signal(match.captured(1).toUInt(), match.captured(2))) {
-    s->comment = match.captured(3).trimmed().replace("\\\"", "\"");
-  }
+const char *DBCFile::parseCM_SG(const char *begin, const char *end) {
+  Tokenizer tok(begin, end, "Invalid CM_ SG_ line format");
+  tok.expect("CM_");
+  tok.expect("SG_");
+  uint32_t address = to_int<uint32_t>(tok.word());
+  auto name = tok.word();
+  auto comment = tok.quoted(true);
+  tok.expectEnd();
+
+  if (auto s = signal(address, to_qstring(name)))
+    s->comment = to_comment(comment);
+  return tok.pos();
 }
 
-void DBCFile::parseVAL(const QString &line) {
-  static QRegularExpression val_regexp(R"(VAL_ (\w+) (\w+) (\s*[-+]?[0-9]+\s+\".+?\"[^;]*))");
-
-  auto match = val_regexp.match(line);
-  if (!match.hasMatch())
-    throw std::runtime_error("invalid VAL_ line format");
-
-  if (auto s = signal(match.captured(1).toUInt(), match.captured(2))) {
-    QStringList desc_list = match.captured(3).trimmed().split('"');
-    for (int i = 0; i < desc_list.size(); i += 2) {
-      auto val = desc_list[i].trimmed();
-      if (!val.isEmpty() && (i + 1) < desc_list.size()) {
-        auto desc = desc_list[i + 1].trimmed();
-        s->val_desc.push_back({val.toDouble(), desc});
-      }
+void DBCFile::parseVAL(std::string_view line) {
+  Tokenizer tok(line, "invalid VAL_ line format");
+  tok.expect("VAL_");
+  uint32_t address = to_int<uint32_t>(tok.word());
+  auto s = signal(address, to_qstring(tok.word()));
+
+  // pairs of a value and its description, up to the terminating ';'
+  do {
+    double value = to_double(tok.number());
+    auto desc = trim(tok.quoted(false));
+    if (s) {
+      s->val_desc.push_back({value, to_qstring(desc)});
     }
-  }
+  } while (!tok.rest().empty() && !tok.peek(';'));
 }
 
 QString DBCFile::generateDBC() {
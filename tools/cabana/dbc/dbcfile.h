@@ -1,7 +1,7 @@
 #pragma once
 
 #include <map>
-#include <QTextStream>
+#include <string_view>
 
 #include "tools/cabana/dbc/dbc.h"
 
@@ -35,12 +35,13 @@ public:
   QString filename;
 
 private:
-  void parse(const QString &content);
-  cabana::Msg *parseBO(const QString &line);
-  void parseSG(const QString &line, cabana::Msg *current_msg, int &multiplexor_cnt);
-  void parseCM_BO(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream);
-  void parseCM_SG(const QString &line, const QString &content, const QString &raw_line, const QTextStream &stream);
-  void parseVAL(const QString &line);
+  void parse(const char *begin, const char *end);
+  cabana::Msg *parseBO(std::string_view line);
+  void parseSG(std::string_view line, cabana::Msg *current_msg, int &multiplexor_cnt);
+  // comments may span lines, these return the end of the comment
+  const char *parseCM_BO(const char *begin, const char *end);
+  const char *parseCM_SG(const char *begin, const char *end);
+  void parseVAL(std::string_view line);
 
   QString header;
   std::map<uint32_t, cabana::Msg> msgs;
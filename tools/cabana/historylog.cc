@@ -1,14 +1,107 @@
 #include "tools/cabana/historylog.h"
 
-#include <functional>
+#include <algorithm>
 
 #include <QFileDialog>
 #include <QPainter>
 #include <QVBoxLayout>
+#include <QtConcurrent>
 
 #include "tools/cabana/commands.h"
 #include "tools/cabana/utils/export.h"
 
+namespace {
+
+inline bool filterPasses(FilterOp op, double v, double value) {
+  switch (op) {
+    case FilterOp::Greater: return v > value;
+    case FilterOp::Equal: return v == value;
+    case FilterOp::NotEqual: return v != value;
+    case FilterOp::Less: return v < value;
+  }
+  return false;
+}
+
+inline bool zoneMayPass(const SignalColumns::Zone &z, FilterOp op, double value) {
+  switch (op) {
+    case FilterOp::Greater: return z.max > value;
+    case FilterOp::Equal: return z.min <= value && value <= z.max;
+    case FilterOp::NotEqual: return z.min != value || z.max != value;
+    case FilterOp::Less: return z.min < value;
+  }
+  return true;
+}
+
+}  // namespace
+
+// SignalColumns
+
+SignalColumns::SignalColumns(const std::vector<cabana::Signal *> &signals) : values(signals.size()), zones(signals.size()) {
+  sigs.reserve(signals.size());
+  for (auto s : signals) {
+    sigs.push_back(*s);
+  }
+  // point the multiplexed signals to the copy of their multiplexor
+  for (auto &s : sigs) {
+    if (s.multiplexor) {
+      auto it = std::find(signals.begin(), signals.end(), s.multiplexor);
+      s.multiplexor = it != signals.end() ? &sigs[it - signals.begin()] : nullptr;
+    }
+  }
+}
+
+void SignalColumns::append(const CanEvent *const *first, const CanEvent *const *last) {
+  const size_t begin = events.size();
+  events.insert(events.end(), first, last);
+  for (int i = 0; i < sigs.size(); ++i) {
+    auto &column = values[i];
+    auto &column_zones = zones[i];
+    column.reserve(events.size());
+    // a multiplexed signal keeps its value through the events of the other multiplexes
+    double value = column.empty() ? 0 : column.back();
+    for (size_t j = begin; j < events.size(); ++j) {
+      sigs[i].getValue(events[j]->dat, events[j]->size, &value);
+      column.push_back(value);
+      if (j % CHUNK_SIZE == 0) {
+        column_zones.push_back({value, value});
+      } else {
+        column_zones.back().min = std::min(column_zones.back().min, value);
+        column_zones.back().max = std::max(column_zones.back().max, value);
+      }
+    }
+  }
+}
+
+std::vector<int> SignalColumns::findPrev(int end, int sig_idx, FilterOp op, double value, int max_count, const std::atomic<bool> &abort) const {
+  std::vector<int> result;
+  const bool filter = sig_idx >= 0 && sig_idx < sigs.size();
+  for (int i = end - 1; i >= 0 && result.size() < max_count && !abort;) {
+    const int chunk_begin = (i / CHUNK_SIZE) * CHUNK_SIZE;
+    if (filter && !zoneMayPass(zones[sig_idx][i / CHUNK_SIZE], op, value)) {
+      i = chunk_begin - 1;
+      continue;
+    }
+    for (; i >= chunk_begin && result.size() < max_count; --i) {
+      if (!filter || filterPasses(op, values[sig_idx][i], value)) {
+        result.push_back(i);
+      }
+    }
+  }
+  return result;
+}
+
+// HistoryLogModel
+
+HistoryLogModel::HistoryLogModel(QObject *parent) : QAbstractTableModel(parent) {
+  QObject::connect(&build_watcher, &QFutureWatcher<std::shared_ptr<SignalColumns>>::finished, this, &HistoryLogModel::columnsBuilt);
+  QObject::connect(&search_watcher, &QFutureWatcher<std::vector<int>>::finished, this, &HistoryLogModel::searchFinished);
+}
+
+HistoryLogModel::~HistoryLogModel() {
+  abortSearch();
+  build_watcher.waitForFinished();
+}
+
 QVariant HistoryLogModel::data(const QModelIndex &index, int role) const {
   const auto &m = messages[index.row()];
   const int col = index.column();
@@ -32,6 +125,7 @@ void HistoryLogModel::setMessage(const MessageId &message_id) {
 }
 
 void HistoryLogModel::reset() {
+  abortSearch();
   beginResetModel();
   sigs.clear();
   if (auto dbc_msg = dbc()->msg(msg_id)) {
@@ -39,8 +133,11 @@ void HistoryLogModel::reset() {
   }
   messages.clear();
   hex_colors = {};
+  columns.reset();
+  building = false;
+  fetched_begin = fetched_end = -1;
   endResetModel();
-  setFilter(0, "", nullptr);
+  setFilter(0, "", FilterOp::Greater);
 }
 
 QVariant HistoryLogModel::headerData(int section, Qt::Orientation orientation, int role) const {
@@ -67,69 +164,151 @@ void HistoryLogModel::setHexMode(bool hex) {
   reset();
 }
 
-void HistoryLogModel::setFilter(int sig_idx, const QString &value, std::function<bool(double, double)> cmp) {
+void HistoryLogModel::setFilter(int sig_idx, const QString &value, FilterOp op) {
   filter_sig_idx = sig_idx;
   filter_value = value.toDouble();
-  filter_cmp = value.isEmpty() ? nullptr : cmp;
+  filter_op = op;
+  filter_active = !value.isEmpty() && sig_idx >= 0 && sig_idx < sigs.size();
   updateState(true);
 }
 
 void HistoryLogModel::updateState(bool clear) {
-  if (clear && !messages.empty()) {
-    beginRemoveRows({}, 0, messages.size() - 1);
-    messages.clear();
-    endRemoveRows();
+  if (clear) {
+    abortSearch();
+    if (!messages.empty()) {
+      beginRemoveRows({}, 0, messages.size() - 1);
+      messages.clear();
+      endRemoveRows();
+    }
+    fetched_begin = fetched_end = -1;
+  }
+  if (!syncColumns()) return;
+
+  const uint64_t current_time = (can->lastMessage(msg_id).ts + can->routeStartTime()) * 1e9 + 1;
+  const auto &events = columns->events;
+  const int end = std::lower_bound(events.begin(), events.end(), current_time, [](auto e, uint64_t ts) {
+    return e->mono_time < ts;
+  }) - events.begin();
+
+  if (fetched_end < 0) {
+    fetched_begin = fetched_end = end;
+    fetchMore({});
+  } else if (end > fetched_end) {
+    std::vector<int> indices;
+    for (int i = end - 1; i >= fetched_end; --i) {
+      if (filterPass(i)) indices.push_back(i);
+    }
+    fetched_end = end;
+    addRows(0, indices);
   }
-  uint64_t current_time = (can->lastMessage(msg_id).ts + can->routeStartTime()) * 1e9 + 1;
-  fetchData(messages.begin(), current_time, messages.empty() ? 0 : messages.front().mono_time);
 }
 
-bool HistoryLogModel::canFetchMore(const QModelIndex &parent) const {
+bool HistoryLogModel::syncColumns() {
+  if (building) return false;
+  if (!columns) {
+    buildColumns();
+    return false;
+  }
+
   const auto &events = can->events(msg_id);
-  return !events.empty() && !messages.empty() && messages.back().mono_time > events.front()->mono_time;
+  const size_t n = columns->events.size();
+  if (events.size() < n || (n > 0 && events[n - 1] != columns->events[n - 1])) {
+    // events were merged in before the ones in the columns
+    buildColumns();
+    return false;
+  }
+  // the new events are added on a later update if a search is reading the columns
+  if (events.size() > n && !searching) {
+    columns->append(events.data() + n, events.data() + events.size());
+  }
+  return true;
+}
+
+void HistoryLogModel::buildColumns() {
+  // a running search reads the old columns, its indices don't apply to the new ones
+  abortSearch();
+  columns.reset();
+  building = true;
+  auto cols = std::make_shared<SignalColumns>(sigs);
+  build_watcher.setFuture(QtConcurrent::run([cols, events = can->events(msg_id)]() {
+    cols->append(events.data(), events.data() + events.size());
+    return cols;
+  }));
+}
+
+void HistoryLogModel::columnsBuilt() {
+  if (!building) return;
+
+  building = false;
+  columns = build_watcher.result();
+  updateState(true);
+}
+
+bool HistoryLogModel::canFetchMore(const QModelIndex &parent) const {
+  return columns && !searching && fetched_begin > 0;
 }
 
 void HistoryLogModel::fetchMore(const QModelIndex &parent) {
-  if (!messages.empty())
-    fetchData(messages.end(), messages.back().mono_time, 0);
+  if (!canFetchMore(parent)) return;
+
+  // a filter on a rare value may scan most of the events, search off the UI thread
+  searching = true;
+  const int sig_idx = filter_active ? filter_sig_idx : -1;
+  search_watcher.setFuture(QtConcurrent::run([cols = columns, end = fetched_begin, sig_idx, op = filter_op,
+                                              value = filter_value, count = batch_size, &abort = abort_search]() {
+    return cols->findPrev(end, sig_idx, op, value, count, abort);
+  }));
 }
 
-void HistoryLogModel::fetchData(std::deque<Message>::iterator insert_pos, uint64_t from_time, uint64_t min_time) {
-  const auto &events = can->events(msg_id);
-  auto first = std::upper_bound(events.rbegin(), events.rend(), from_time, [](uint64_t ts, auto e) {
-    return ts > e->mono_time;
-  });
-
-  std::vector<HistoryLogModel::Message> msgs;
-  std::vector<double> values(sigs.size());
-  msgs.reserve(batch_size);
-  for (; first != events.rend() && (*first)->mono_time > min_time; ++first) {
-    const CanEvent *e = *first;
-    for (int i = 0; i < sigs.size(); ++i) {
-      sigs[i]->getValue(e->dat, e->size, &values[i]);
-    }
-    if (!filter_cmp || filter_cmp(values[filter_sig_idx], filter_value)) {
-       msgs.emplace_back(Message{e->mono_time, values, {e->dat, e->dat + e->size}});
-      if (msgs.size() >= batch_size && min_time == 0) {
-        break;
-      }
+void HistoryLogModel::abortSearch() {
+  if (searching) {
+    abort_search = true;
+    search_watcher.waitForFinished();
+    abort_search = false;
+    searching = false;
+  }
+}
+
+void HistoryLogModel::searchFinished() {
+  if (!searching) return;
+
+  searching = false;
+  if (!columns || building) return;
+
+  auto indices = search_watcher.result();
+  fetched_begin = indices.size() < batch_size ? 0 : indices.back();
+  addRows(messages.size(), indices);
+}
+
+bool HistoryLogModel::filterPass(int event_idx) const {
+  return !filter_active || filterPasses(filter_op, columns->values[filter_sig_idx][event_idx], filter_value);
+}
+
+void HistoryLogModel::addRows(int pos, const std::vector<int> &event_indices) {
+  if (event_indices.empty()) return;
+
+  std::vector<Message> msgs;
+  msgs.reserve(event_indices.size());
+  for (int idx : event_indices) {
+    const CanEvent *e = columns->events[idx];
+    auto &m = msgs.emplace_back(Message{e->mono_time, {}, {e->dat, e->dat + e->size}});
+    m.sig_values.reserve(columns->values.size());
+    for (const auto &column : columns->values) {
+      m.sig_values.push_back(column[idx]);
     }
   }
 
-  if (!msgs.empty()) {
-    if (isHexMode() && (min_time > 0 || messages.empty())) {
-      const auto freq = can->lastMessage(msg_id).freq;
-      const std::vector<uint8_t> no_mask;
-      for (auto &m : msgs) {
-        hex_colors.compute(msg_id, m.data.data(), m.data.size(), m.mono_time / (double)1e9, can->getSpeed(), no_mask, freq);
-        m.colors = hex_colors.colors;
-      }
+  if (isHexMode() && (pos == 0 || messages.empty())) {
+    const auto freq = can->lastMessage(msg_id).freq;
+    const std::vector<uint8_t> no_mask;
+    for (auto &m : msgs) {
+      hex_colors.compute(msg_id, m.data.data(), m.data.size(), m.mono_time / (double)1e9, can->getSpeed(), no_mask, freq);
+      m.colors = hex_colors.colors();
     }
-    int pos = std::distance(messages.begin(), insert_pos);
-    beginInsertRows({}, pos , pos + msgs.size() - 1);
-    messages.insert(insert_pos, std::move_iterator(msgs.begin()), std::move_iterator(msgs.end()));
-    endInsertRows();
   }
+  beginInsertRows({}, pos, pos + msgs.size() - 1);
+  messages.insert(messages.begin() + pos, std::move_iterator(msgs.begin()), std::move_iterator(msgs.end()));
+  endInsertRows();
 }
 
 // HeaderView
@@ -227,22 +406,16 @@ void LogsWidget::modelReset() {
 void LogsWidget::filterChanged() {
   if (value_edit->text().isEmpty() && !value_edit->isModified()) return;
 
-  std::function<bool(double, double)> cmp = nullptr;
-  switch (comp_box->currentIndex()) {
-    case 0: cmp = std::greater<double>{}; break;
-    case 1: cmp = std::equal_to<double>{}; break;
-    case 2: cmp = [](double l, double r) { return l != r; }; break; // not equal
-    case 3: cmp = std::less<double>{}; break;
-  }
-  model->setFilter(signals_cb->currentIndex(), value_edit->text(), cmp);
+  // the comparison items are in FilterOp order
+  model->setFilter(signals_cb->currentIndex(), value_edit->text(), (FilterOp)comp_box->currentIndex());
 }
 
 void LogsWidget::exportToCSV() {
   QString dir = QString("%1/%2_%3.csv").arg(settings.last_dir).arg(can->routeName()).arg(msgName(model->msg_id));
   QString fn = QFileDialog::getSaveFileName(this, QString("Export %1 to CSV file").arg(msgName(model->msg_id)),
-                                            dir, tr("csv (*.csv)"));
+                                            dir, utils::exportFileFilter());
   if (!fn.isEmpty()) {
-    model->isHexMode() ? utils::exportToCSV(fn, model->msg_id)
-                       : utils::exportSignalsToCSV(fn, model->msg_id);
+    model->isHexMode() ? utils::exportToCSV(fn, model->msg_id, this)
+                       : utils::exportSignalsToCSV(fn, model->msg_id, this);
   }
 }
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <deque>
+#include <memory>
 #include <vector>
 
 #include <QComboBox>
+#include <QFutureWatcher>
 #include <QHeaderView>
 #include <QLineEdit>
 #include <QTableView>
@@ -18,14 +21,36 @@ public:
   void paintSection(QPainter *painter, const QRect &rect, int logicalIndex) const;
 };
 
+enum class FilterOp { Greater, Equal, NotEqual, Less };
+
+// the decoded signal values of a message's events, stored by column, with the min and max of every
+// chunk of events. filters skip the chunks whose range can't match.
+struct SignalColumns {
+  static constexpr int CHUNK_SIZE = 256;
+  struct Zone {
+    double min, max;
+  };
+
+  SignalColumns(const std::vector<cabana::Signal *> &signals);
+  void append(const CanEvent *const *first, const CanEvent *const *last);
+  // indices of the events before `end` that pass the filter, newest first. stops after `max_count`.
+  std::vector<int> findPrev(int end, int sig_idx, FilterOp op, double value, int max_count, const std::atomic<bool> &abort) const;
+
+  std::vector<cabana::Signal> sigs;  // copies, the build runs in the background
+  std::vector<const CanEvent *> events;
+  std::vector<std::vector<double>> values;  // [signal][event]
+  std::vector<std::vector<Zone>> zones;     // [signal][chunk]
+};
+
 class HistoryLogModel : public QAbstractTableModel {
   Q_OBJECT
 
 public:
-  HistoryLogModel(QObject *parent) : QAbstractTableModel(parent) {}
+  HistoryLogModel(QObject *parent);
+  ~HistoryLogModel();
   void setMessage(const MessageId &message_id);
   void updateState(bool clear = false);
-  void setFilter(int sig_idx, const QString &value, std::function<bool(double, double)> cmp);
+  void setFilter(int sig_idx, const QString &value, FilterOp op);
   QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
   QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
   void fetchMore(const QModelIndex &parent) override;
@@ -43,17 +68,35 @@ public:
     std::vector<QColor> colors;
   };
 
-  void fetchData(std::deque<Message>::iterator insert_pos, uint64_t from_time, uint64_t min_time);
+private:
+  bool syncColumns();
+  void buildColumns();
+  void columnsBuilt();
+  void abortSearch();
+  void searchFinished();
+  bool filterPass(int event_idx) const;
+  void addRows(int pos, const std::vector<int> &event_indices);
 
+public:
   MessageId msg_id;
   CanData hex_colors;
   const int batch_size = 50;
   int filter_sig_idx = -1;
   double filter_value = 0;
-  std::function<bool(double, double)> filter_cmp = nullptr;
+  FilterOp filter_op = FilterOp::Greater;
+  bool filter_active = false;
   std::deque<Message> messages;
   std::vector<cabana::Signal *> sigs;
   bool hex_mode = false;
+
+private:
+  std::shared_ptr<SignalColumns> columns;
+  QFutureWatcher<std::shared_ptr<SignalColumns>> build_watcher;
+  QFutureWatcher<std::vector<int>> search_watcher;
+  bool building = false, searching = false;
+  std::atomic<bool> abort_search = false;
+  // the rows were taken from the events in [fetched_begin, fetched_end) of the columns
+  int fetched_begin = -1, fetched_end = -1;
 };
 
 class LogsWidget : public QFrame {
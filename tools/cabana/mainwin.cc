@@ -278,9 +278,9 @@ void MainWindow::closeStream() {
 
 void MainWindow::exportToCSV() {
   QString dir = QString("%1/%2.csv").arg(settings.last_dir).arg(can->routeName());
-  QString fn = QFileDialog::getSaveFileName(this, "Export stream to CSV file", dir, tr("csv (*.csv)"));
+  QString fn = QFileDialog::getSaveFileName(this, "Export stream to CSV file", dir, utils::exportFileFilter());
   if (!fn.isEmpty()) {
-    utils::exportToCSV(fn);
+    utils::exportToCSV(fn, std::nullopt, this);
   }
 }
 
@@ -212,7 +212,7 @@ QVariant MessageListModel::data(const QModelIndex &index, int role) const {
       case Column::DATA: return item.id.source != INVALID_SOURCE ? "" : NA;
     }
   } else if (role == ColorsRole) {
-    return QVariant::fromValue((void*)(&can->lastMessage(item.id).colors));
+    return QVariant::fromValue((void*)(&can->lastMessage(item.id).colors()));
   } else if (role == BytesRole && index.column() == Column::DATA && item.id.source != INVALID_SOURCE) {
     return QVariant::fromValue((void*)(&can->lastMessage(item.id).dat));
   } else if (role == Qt::ForegroundRole && !item.active) {
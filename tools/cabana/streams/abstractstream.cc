@@ -1,6 +1,7 @@
 #include "tools/cabana/streams/abstractstream.h"
 
 #include <algorithm>
+#include <cstring>
 #include <utility>
 
 #include <QApplication>
@@ -46,13 +47,7 @@ void AbstractStream::updateMasks() {
   }
   // clear bit change counts
   for (auto &[id, m] : messages_) {
-    auto &mask = masks_[id];
-    const int size = std::min(mask.size(), m.last_changes.size());
-    for (int i = 0; i < size; ++i) {
-      for (int j = 0; j < 8; ++j) {
-        if (((mask[i] >> (7 - j)) & 1) != 0) m.last_changes[i].bit_change_counts[j] = 0;
-      }
-    }
+    m.clearBitChangeCounts(masks_[id]);
   }
 }
 
@@ -71,10 +66,10 @@ size_t AbstractStream::suppressHighlighted() {
       if (dt < 2.0) {
         last_change.suppressed = true;
       }
-      // clear bit change counts
-      last_change.bit_change_counts.fill(0);
       cnt += last_change.suppressed;
     }
+    // clear bit change counts
+    m.resetBitChangeCounts();
   }
   return cnt;
 }
@@ -219,8 +214,9 @@ void AbstractStream::mergeEvents(const std::vector<const CanEvent *> &events) {
 namespace {
 
 enum Color { GREYISH_BLUE, CYAN, RED};
+constexpr int start_alpha = 128;
+
 QColor getColor(int c) {
-  constexpr int start_alpha = 128;
   static const QColor colors[] = {
       [GREYISH_BLUE] = QColor(102, 86, 169, start_alpha / 2),
       [CYAN] = QColor(0, 187, 255, start_alpha),
@@ -248,6 +244,12 @@ double calc_freq(const MessageId &msg_id, double current_sec) {
   return 0;
 }
 
+inline uint64_t load64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
 }  // namespace
 
 void CanData::compute(const MessageId &msg_id, const uint8_t *can_data, const int size, double current_sec,
@@ -261,25 +263,46 @@ void CanData::compute(const MessageId &msg_id, const uint8_t *can_data, const in
   }
 
   if (dat.size() != size) {
+    resizeBitChangeCounts(dat.size(), size);
     dat.resize(size);
-    colors.assign(size, QColor(0, 0, 0, 0));
     last_changes.resize(size);
-    std::for_each(last_changes.begin(), last_changes.end(), [current_sec](auto &c) { c.ts = current_sec; });
-  } else {
+    std::for_each(last_changes.begin(), last_changes.end(), [current_sec](auto &c) {
+      c.ts = current_sec;
+      c.trend = Trend::None;
+      c.periodic_changes = 0;
+    });
+  } else if (memcmp(dat.data(), can_data, size) != 0) {
     constexpr int periodic_threshold = 10;
     constexpr float fade_time = 2.0;
-    const float alpha_delta = 1.0 / (freq + 1) / (fade_time * playback_speed);
-
-    for (int i = 0; i < size; ++i) {
-      auto &last_change = last_changes[i];
-
-      uint8_t mask_byte = last_change.suppressed ? 0x00 : 0xFF;
-      if (i < mask.size()) mask_byte &= ~(mask[i]);
+    alpha_delta = 1.0 / (freq + 1) / (fade_time * playback_speed);
+
+    // compare 8 bytes at a time, only bytes in changed words are looked at one by one
+    const size_t words = (size + 7) / 8;
+    for (size_t w = 0; w < words; ++w) {
+      const size_t offset = w * 8;
+      const size_t n = std::min<size_t>(8, size - offset);
+      uint8_t last[8] = {}, cur[8] = {}, ignored[8] = {};
+      memcpy(last, &dat[offset], n);
+      memcpy(cur, can_data + offset, n);
+      if (offset < mask.size()) memcpy(ignored, &mask[offset], std::min(n, mask.size() - offset));
+
+      uint64_t changed = (load64(last) ^ load64(cur)) & ~load64(ignored);
+      if (changed == 0) continue;
+
+      uint8_t changed_bytes[8];
+      memcpy(changed_bytes, &changed, 8);
+      for (size_t b = 0; b < n; ++b) {
+        if (changed_bytes[b] == 0) continue;
+
+        auto &last_change = last_changes[offset + b];
+        if (last_change.suppressed) {
+          changed_bytes[b] = 0;
+          continue;
+        }
 
-      const uint8_t last = dat[i] & mask_byte;
-      const uint8_t cur = can_data[i] & mask_byte;
-      if (last != cur) {
-        const int delta = cur - last;
+        const uint8_t last_byte = last[b] & ~ignored[b];
+        const uint8_t cur_byte = cur[b] & ~ignored[b];
+        const int delta = cur_byte - last_byte;
         // Keep track if signal is changing randomly, or mostly moving in the same direction
         last_change.same_delta_counter += std::signbit(delta) == std::signbit(last_change.delta) ? 1 : -4;
         last_change.same_delta_counter = std::clamp(last_change.same_delta_counter, 0, 16);
@@ -288,27 +311,99 @@ void CanData::compute(const MessageId &msg_id, const uint8_t *can_data, const in
         // Mostly moves in the same direction, color based on delta up/down
         if (delta_t * freq > periodic_threshold || last_change.same_delta_counter > 8) {
           // Last change was while ago, choose color based on delta up or down
-          colors[i] = getColor(cur > last ? CYAN : RED);
+          last_change.trend = cur_byte > last_byte ? Trend::Up : Trend::Down;
+          last_change.periodic_changes = 0;
         } else {
-          // Periodic changes
-          colors[i] = blend(colors[i], getColor(GREYISH_BLUE));
-        }
-
-        // Track bit level changes
-        const uint8_t diff = (cur ^ last);
-        for (int bit = 0; bit < 8; bit++) {
-          if (diff & (1u << bit)) {
-            ++last_change.bit_change_counts[7 - bit];
+          // Periodic changes blend from the trend color as it had faded by now
+          if (last_change.periodic_changes == 0) {
+            const float trend_alpha = last_change.trend == Trend::None ? 0 : start_alpha / 255.0f;
+            last_change.trend_alpha = std::max(0.0f, trend_alpha - (count - last_change.change_count) * alpha_delta);
           }
+          last_change.periodic_changes = std::min(last_change.periodic_changes + 1, 8);
         }
 
         last_change.ts = ts;
         last_change.delta = delta;
-      } else {
-        // Fade out
-        colors[i].setAlphaF(std::max(0.0, colors[i].alphaF() - alpha_delta));
+        last_change.change_count = count;
+      }
+
+      // Track bit level changes
+      memcpy(&changed, changed_bytes, 8);
+      const size_t planes = bit_change_planes.size() / words;
+      for (size_t k = 0; changed != 0 && k < planes; ++k) {
+        uint64_t &plane = bit_change_planes[k * words + w];
+        const uint64_t carry = plane & changed;
+        plane ^= changed;
+        changed = carry;
+      }
+      // counters wrap around at 32 bits
+      if (changed != 0 && planes < 32) {
+        bit_change_planes.resize((planes + 1) * words);
+        bit_change_planes[planes * words + w] = changed;
       }
     }
   }
   memcpy(dat.data(), can_data, size);
 }
+
+void CanData::resizeBitChangeCounts(size_t old_size, size_t new_size) {
+  const size_t old_words = (old_size + 7) / 8;
+  const size_t words = (new_size + 7) / 8;
+  const size_t planes = old_words > 0 ? bit_change_planes.size() / old_words : 0;
+  std::vector<uint64_t> resized(planes * words);
+  for (size_t k = 0; k < planes && words > 0; ++k) {
+    memcpy(&resized[k * words], &bit_change_planes[k * old_words], std::min(old_size, new_size));
+  }
+  bit_change_planes = std::move(resized);
+}
+
+std::array<uint32_t, 8> CanData::bitChangeCounts(int byte) const {
+  std::array<uint32_t, 8> counts = {};
+  const size_t words = (dat.size() + 7) / 8;
+  if (words == 0) return counts;
+
+  const uint8_t *planes = (const uint8_t *)bit_change_planes.data();
+  for (size_t k = 0; k < bit_change_planes.size() / words; ++k) {
+    const uint8_t bits = planes[k * words * 8 + byte];
+    for (int j = 0; j < 8; ++j) {
+      counts[j] |= uint32_t((bits >> (7 - j)) & 1) << k;
+    }
+  }
+  return counts;
+}
+
+void CanData::clearBitChangeCounts(const std::vector<uint8_t> &mask) {
+  const size_t words = (dat.size() + 7) / 8;
+  const size_t size = std::min(mask.size(), dat.size());
+  uint8_t *planes = (uint8_t *)bit_change_planes.data();
+  for (size_t k = 0; words > 0 && k < bit_change_planes.size() / words; ++k) {
+    for (size_t i = 0; i < size; ++i) {
+      planes[k * words * 8 + i] &= ~mask[i];
+    }
+  }
+}
+
+const std::vector<QColor> &CanData::colors() const {
+  if (colors_.size() == last_changes.size() && colors_count_ == count && colors_theme_ == settings.theme) {
+    return colors_;
+  }
+
+  colors_count_ = count;
+  colors_theme_ = settings.theme;
+  colors_.resize(last_changes.size());
+  const QColor up = getColor(CYAN), down = getColor(RED), periodic = getColor(GREYISH_BLUE);
+  for (size_t i = 0; i < last_changes.size(); ++i) {
+    const auto &c = last_changes[i];
+    QColor color = c.trend == Trend::Up ? up : c.trend == Trend::Down ? down : QColor(0, 0, 0, 0);
+    if (c.periodic_changes > 0) {
+      color.setAlphaF(c.trend_alpha);
+      for (int k = 0; k < c.periodic_changes; ++k) {
+        color = blend(color, periodic);
+      }
+    }
+    // Fade out
+    color.setAlphaF(std::max(0.0, color.alphaF() - (count - c.change_count) * alpha_delta));
+    colors_[i] = color;
+  }
+  return colors_;
+}
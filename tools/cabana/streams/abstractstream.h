@@ -20,22 +20,42 @@
 struct CanData {
   void compute(const MessageId &msg_id, const uint8_t *dat, const int size, double current_sec,
                double playback_speed, const std::vector<uint8_t> &mask, double in_freq = 0);
+  // how often each bit of a byte changed, msb first
+  std::array<uint32_t, 8> bitChangeCounts(int byte) const;
+  void clearBitChangeCounts(const std::vector<uint8_t> &mask);
+  void resetBitChangeCounts() { bit_change_planes.clear(); }
+  // the highlight of every byte, only computed for messages that are shown
+  const std::vector<QColor> &colors() const;
 
   double ts = 0.;
   uint32_t count = 0;
   double freq = 0;
   std::vector<uint8_t> dat;
-  std::vector<QColor> colors;
 
+  enum class Trend : uint8_t { None, Up, Down };
   struct ByteLastChange {
     double ts;
     int delta;
     int same_delta_counter;
     bool suppressed;
-    std::array<uint32_t, 8> bit_change_counts;
+    Trend trend;               // direction of the last change that wasn't periodic
+    uint8_t periodic_changes;  // periodic changes since then, each blends the color towards grey
+    float trend_alpha;         // alpha the trend color had faded to when the periodic changes started
+    uint32_t change_count;     // count at the last change, the color fades with every frame after it
   };
   std::vector<ByteLastChange> last_changes;
   double last_freq_update_ts = 0;
+
+private:
+  void resizeBitChangeCounts(size_t old_size, size_t new_size);
+
+  // bit-sliced change counters: plane k holds bit k of the counter of every payload bit,
+  // so a frame's changed bits are added to 64 counters at once with a carry across the planes.
+  std::vector<uint64_t> bit_change_planes;
+  float alpha_delta = 0;
+  mutable std::vector<QColor> colors_;
+  mutable uint32_t colors_count_ = 0;
+  mutable int colors_theme_ = -1;
 };
 
 struct CanEvent {
@@ -23,10 +23,6 @@ ReplayStream::ReplayStream(QObject *parent) : AbstractStream(parent) {
   });
 }
 
-static bool event_filter(const Event *e, void *opaque) {
-  return ((ReplayStream *)opaque)->eventFilter(e);
-}
-
 void ReplayStream::mergeSegments() {
   for (auto &[n, seg] : replay->segments()) {
     if (seg && seg->isLoaded() && !processed_segments.count(n)) {
@@ -52,7 +48,8 @@ bool ReplayStream::loadRoute(const QString &route, const QString &data_dir, uint
   replay.reset(new Replay(route, {"can", "roadEncodeIdx", "driverEncodeIdx", "wideRoadEncodeIdx", "carParams"},
                           {}, nullptr, replay_flags, data_dir, this));
   replay->setSegmentCacheLimit(settings.max_cached_minutes);
-  replay->installEventFilter(event_filter, this);
+  // nothing is published, the can messages are consumed in-process
+  replay->addConsumer({}, [this](const std::vector<ReplayEvent> &events) { processEvents(events); });
   QObject::connect(replay.get(), &Replay::seeking, this, &AbstractStream::seeking);
   QObject::connect(replay.get(), &Replay::seekedTo, this, &AbstractStream::seekedTo);
   QObject::connect(replay.get(), &Replay::segmentsMerged, this, &ReplayStream::mergeSegments);
@@ -94,16 +91,16 @@ void ReplayStream::stop() {
   }
 }
 
-bool ReplayStream::eventFilter(const Event *event) {
+void ReplayStream::processEvents(const std::vector<ReplayEvent> &events) {
   static double prev_update_ts = 0;
-  if (event->which == cereal::Event::Which::CAN) {
-    double current_sec = event->mono_time / 1e9 - routeStartTime();
-    capnp::FlatArrayMessageReader reader(event->data);
-    auto e = reader.getRoot<cereal::Event>();
-    for (const auto &c : e.getCan()) {
-      MessageId id = {.source = c.getSrc(), .address = c.getAddress()};
-      const auto dat = c.getDat();
-      updateEvent(id, current_sec, (const uint8_t*)dat.begin(), dat.size());
+  for (const auto &e : events) {
+    if (e.which == cereal::Event::Which::CAN) {
+      double current_sec = e.mono_time / 1e9 - routeStartTime();
+      for (const auto &c : e.event.getCan()) {
+        MessageId id = {.source = c.getSrc(), .address = c.getAddress()};
+        const auto dat = c.getDat();
+        updateEvent(id, current_sec, (const uint8_t*)dat.begin(), dat.size());
+      }
     }
   }
 
@@ -112,7 +109,6 @@ bool ReplayStream::eventFilter(const Event *event) {
     emit privateUpdateLastMsgsSignal();
     prev_update_ts = ts;
   }
-  return true;
 }
 
 void ReplayStream::seekTo(double ts) {
@@ -18,7 +18,6 @@ public:
   void start() override;
   void stop() override;
   bool loadRoute(const QString &route, const QString &data_dir, uint32_t replay_flags = REPLAY_FLAG_NONE);
-  bool eventFilter(const Event *event);
   void seekTo(double ts) override;
   bool liveStreaming() const override { return false; }
   inline QString routeName() const override { return replay->route()->name(); }
@@ -35,6 +34,7 @@ public:
   static AbstractOpenStreamWidget *widget(AbstractStream **stream);
 
 private:
+  void processEvents(const std::vector<ReplayEvent> &events);
   void mergeSegments();
   std::unique_ptr<Replay> replay = nullptr;
   std::set<int> processed_segments;
@@ -1,9 +1,17 @@
 
 #undef INFO
+#include <cstring>
+#include <random>
+
 #include <QDir>
+#include <QTemporaryDir>
+#include <QThreadPool>
 
 #include "catch2/catch.hpp"
+#include "common/timing.h"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/historylog.h"
+#include "tools/cabana/utils/export.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
 
@@ -155,3 +163,433 @@ TEST_CASE("parse_opendbc") {
   INFO(errors.join("\n").toStdString());
   REQUIRE(errors.empty());
 }
+
+TEST_CASE("DBCFile round trip on opendbc") {
+  QDir dir(OPENDBC_FILE_PATH);
+  for (auto fn : dir.entryList({"*.dbc"}, QDir::Files, QDir::Name)) {
+    INFO(fn.toStdString());
+    DBCFile dbc(dir.filePath(fn));
+    QString generated = dbc.generateDBC();
+    DBCFile reparsed("", generated);
+    REQUIRE(reparsed.generateDBC() == generated);
+
+    auto &msgs = dbc.getMessages();
+    auto &new_msgs = reparsed.getMessages();
+    REQUIRE(msgs.size() == new_msgs.size());
+    for (auto &[address, m] : msgs) {
+      auto &new_m = new_msgs.at(address);
+      REQUIRE(m.name == new_m.name);
+      REQUIRE(m.size == new_m.size);
+      REQUIRE(m.transmitter == new_m.transmitter);
+      REQUIRE(m.comment == new_m.comment);
+      REQUIRE(m.sigs.size() == new_m.sigs.size());
+      for (size_t i = 0; i < m.sigs.size(); ++i) {
+        REQUIRE(*m.sigs[i] == *new_m.sigs[i]);
+      }
+    }
+  }
+}
+
+TEST_CASE("DBCFile parse benchmark", "[.][benchmark]") {
+  QDir dir(OPENDBC_FILE_PATH);
+  const int runs = 20;
+  double total_ms = 0;
+  qint64 total_size = 0;
+  for (auto &info : dir.entryInfoList({"*.dbc"}, QDir::Files, QDir::Name)) {
+    double start = millis_since_boot();
+    for (int i = 0; i < runs; ++i) DBCFile dbc(info.filePath());
+    double ms = (millis_since_boot() - start) / runs;
+    total_ms += ms;
+    total_size += info.size();
+    printf("%s: %.3f ms\n", info.fileName().toStdString().c_str(), ms);
+  }
+  printf("all files: %.1f ms, %.1f MB/s\n", total_ms, total_size / 1e3 / total_ms);
+}
+
+// reads the tables of an Arrow flatbuffer, enough to check the footer and the messages of an exported file
+struct FlatTable {
+  const char *buf;
+  uint32_t pos;
+
+  template <class T>
+  static T read(const char *buf, uint32_t pos) {
+    T value;
+    memcpy(&value, buf + pos, sizeof(T));
+    return value;
+  }
+  static FlatTable root(const char *buf) { return {buf, read<uint32_t>(buf, 0)}; }
+
+  // position of a field, 0 if it is not set
+  uint32_t field(int id) const {
+    uint32_t vtable = pos - read<int32_t>(buf, pos);
+    uint32_t entry = 4 + id * 2;
+    uint16_t offset = entry < read<uint16_t>(buf, vtable) ? read<uint16_t>(buf, vtable + entry) : 0;
+    return offset ? pos + offset : 0;
+  }
+  template <class T>
+  T scalar(int id) const { return field(id) ? read<T>(buf, field(id)) : T{}; }
+  uint32_t ref(int id) const { return field(id) + read<uint32_t>(buf, field(id)); }
+  FlatTable table(int id) const { return {buf, ref(id)}; }
+  std::string string(int id) const { return std::string(buf + ref(id) + 4, read<uint32_t>(buf, ref(id))); }
+  uint32_t vectorSize(int id) const { return read<uint32_t>(buf, ref(id)); }
+  FlatTable tableAt(int id, int i) const {
+    uint32_t p = ref(id) + 4 + i * 4;
+    return {buf, p + read<uint32_t>(buf, p)};
+  }
+  template <class T>
+  T structAt(int id, int i) const { return read<T>(buf, ref(id) + 4 + i * sizeof(T)); }
+};
+
+TEST_CASE("utils::exportEvents") {
+  DBCFile file("", R"(BO_ 160 message_1: 8 EON
+ SG_ mux M : 0|4@1+ (1,0) [0|15] "" XXX
+ SG_ signal_1 m2 : 8|12@1- (0.25,-10) [0|4095] "unit" XXX
+ SG_ signal_2 : 63|16@0+ (1,0) [0|65535] "" XXX
+)");
+  auto msg = file.msg(160);
+  REQUIRE(msg != nullptr);
+  std::vector<const cabana::Signal *> sigs(msg->sigs.begin(), msg->sigs.end());
+
+  // enough events to span several chunks
+  const double start_time = 100;
+  std::vector<std::vector<uint8_t>> storage;
+  std::vector<const CanEvent *> events;
+  for (int i = 0; i < 200000; ++i) {
+    auto &buf = storage.emplace_back(sizeof(CanEvent) + 8);
+    CanEvent *e = (CanEvent *)buf.data();
+    e->src = i % 3;
+    e->address = 160;
+    e->mono_time = (start_time + i * 0.01) * 1e9;
+    e->size = 1 + i % 8;
+    for (int j = 0; j < e->size; ++j) e->dat[j] = (i * 31 + j * 7) & 0xFF;
+    events.push_back(e);
+  }
+
+  QTemporaryDir dir;
+  std::atomic<size_t> progress = 0;
+
+  SECTION("csv matches the QString formatting") {
+    QString expected_raw = "time,addr,bus,data\n";
+    QString expected_sigs = "time,addr,bus,mux,signal_1,signal_2\n";
+    for (auto e : events) {
+      QString prefix = QString::number((e->mono_time / 1e9) - start_time, 'f', 2) + ",0x" + QString::number(e->address, 16) + "," + QString::number(e->src);
+      expected_raw += prefix + ",0x" + QByteArray::fromRawData((const char *)e->dat, e->size).toHex().toUpper() + "\n";
+      expected_sigs += prefix;
+      for (auto s : sigs) {
+        double value = 0;
+        s->getValue(e->dat, e->size, &value);
+        expected_sigs += "," + QString::number(value, 'f', s->precision);
+      }
+      expected_sigs += "\n";
+    }
+
+    auto read_all = [](const QString &fn) {
+      QFile f(fn);
+      REQUIRE(f.open(QIODevice::ReadOnly));
+      return QString(f.readAll());
+    };
+    QString fn = dir.filePath("raw.csv");
+    REQUIRE(utils::exportEvents(fn, utils::ExportFormat::CSV, events, {}, start_time, nullptr, &progress));
+    REQUIRE(progress == events.size());
+    REQUIRE(read_all(fn) == expected_raw);
+
+    fn = dir.filePath("signals.csv");
+    REQUIRE(utils::exportEvents(fn, utils::ExportFormat::CSV, events, sigs, start_time));
+    REQUIRE(read_all(fn) == expected_sigs);
+  }
+
+  SECTION("arrow file framing") {
+    QString fn = dir.filePath("signals.arrow");
+    REQUIRE(utils::exportFormat(fn) == utils::ExportFormat::Arrow);
+    REQUIRE(utils::exportEvents(fn, utils::ExportFormat::Arrow, events, sigs, start_time));
+    QFile f(fn);
+    REQUIRE(f.open(QIODevice::ReadOnly));
+    QByteArray content = f.readAll();
+    REQUIRE(content.startsWith(QByteArray("ARROW1\0\0", 8)));
+    REQUIRE(content.endsWith("ARROW1"));
+
+    // the footer flatbuffer is followed by its length and the magic, and preceded by the end of stream marker
+    int32_t footer_size = 0;
+    memcpy(&footer_size, content.constData() + content.size() - 10, sizeof(footer_size));
+    const int64_t footer_start = content.size() - 10 - footer_size;
+    REQUIRE(footer_size > 0);
+    REQUIRE(footer_start > 16);
+    REQUIRE(content.mid(footer_start - 8, 8) == QByteArray("\xff\xff\xff\xff\0\0\0\0", 8));
+
+    auto footer = FlatTable::root(content.constData() + footer_start);
+    auto schema = footer.table(1);
+    std::vector<std::string> names;
+    for (int i = 0; i < schema.vectorSize(1); ++i) {
+      names.push_back(schema.tableAt(1, i).string(0));
+    }
+    REQUIRE(names == std::vector<std::string>{"time", "addr", "bus", "mux", "signal_1", "signal_2"});
+
+    // the record batches are contiguous up to the end of stream marker, their row counts add up to the events
+    struct Block {
+      int64_t offset;
+      int32_t metadata_length;
+      int32_t padding;
+      int64_t body_length;
+    };
+    const int blocks = footer.vectorSize(3);
+    REQUIRE(blocks > 1);
+    int64_t rows = 0;
+    int64_t next_offset = footer.structAt<Block>(3, 0).offset;
+    for (int i = 0; i < blocks; ++i) {
+      auto block = footer.structAt<Block>(3, i);
+      REQUIRE(block.offset == next_offset);
+      next_offset = block.offset + block.metadata_length + block.body_length;
+
+      // continuation marker and metadata length, then the Message flatbuffer
+      auto message = FlatTable::root(content.constData() + block.offset + 8);
+      REQUIRE(message.scalar<uint8_t>(1) == 3);  // RecordBatch
+      REQUIRE(message.scalar<int64_t>(3) == block.body_length);
+      auto batch = message.table(2);
+      REQUIRE(batch.vectorSize(1) == names.size());
+      rows += batch.scalar<int64_t>(0);
+    }
+    REQUIRE(next_offset == footer_start - 8);
+    REQUIRE(rows == events.size());
+  }
+
+  SECTION("abort") {
+    std::atomic<bool> abort = true;
+    REQUIRE(!utils::exportEvents(dir.filePath("aborted.csv"), utils::ExportFormat::CSV, events, sigs, start_time, &abort));
+  }
+}
+
+TEST_CASE("SignalColumns::findPrev") {
+  DBCFile file("", R"(BO_ 160 message_1: 8 EON
+ SG_ signal_1 : 0|8@1+ (1,0) [0|255] "" XXX
+ SG_ signal_2 : 8|16@1- (0.5,0) [0|65535] "" XXX
+)");
+  auto msg = file.msg(160);
+  REQUIRE(msg != nullptr);
+
+  // a slow ramp so most chunks can be skipped, with rare spikes
+  std::vector<std::vector<uint8_t>> storage;
+  std::vector<const CanEvent *> events;
+  for (int i = 0; i < 100000; ++i) {
+    auto &buf = storage.emplace_back(sizeof(CanEvent) + 8);
+    CanEvent *e = (CanEvent *)buf.data();
+    e->address = 160;
+    e->mono_time = i * 1e7;
+    e->size = 8;
+    e->dat[0] = i % 997 == 0 ? 255 : (i / 1000) % 200;
+    e->dat[1] = i & 0xFF;
+    e->dat[2] = (i >> 8) & 0xFF;
+    events.push_back(e);
+  }
+
+  SignalColumns columns(msg->sigs);
+  columns.append(events.data(), events.data() + events.size() / 2);
+  columns.append(events.data() + events.size() / 2, events.data() + events.size());
+  REQUIRE(columns.events.size() == events.size());
+
+  const std::atomic<bool> abort = false;
+  auto [sig_idx, op, value] = GENERATE(table<int, FilterOp, double>({
+    {0, FilterOp::Equal, 255}, {0, FilterOp::Greater, 150}, {0, FilterOp::Less, 3},
+    {0, FilterOp::NotEqual, 42}, {1, FilterOp::Equal, 1000.5}, {-1, FilterOp::Equal, 0},
+  }));
+  std::vector<int> expected;
+  for (int i = events.size() - 1; i >= 0 && expected.size() < 100; --i) {
+    double v = 0;
+    if (sig_idx >= 0) msg->sigs[sig_idx]->getValue(events[i]->dat, events[i]->size, &v);
+    bool pass = sig_idx < 0 || (op == FilterOp::Equal && v == value) || (op == FilterOp::Greater && v > value) ||
+                (op == FilterOp::Less && v < value) || (op == FilterOp::NotEqual && v != value);
+    if (pass) expected.push_back(i);
+  }
+  REQUIRE(columns.findPrev(events.size(), sig_idx, op, value, 100, abort) == expected);
+}
+
+class TestStream : public AbstractStream {
+public:
+  TestStream(QObject *parent) : AbstractStream(parent) {}
+  void start() override {}
+  QString routeName() const override { return "test"; }
+  void merge(const std::vector<const CanEvent *> &events) { mergeEvents(events); }
+  void update(const CanEvent *e) {
+    updateEvent({.source = e->src, .address = e->address}, e->mono_time / 1e9, e->dat, e->size);
+    emit privateUpdateLastMsgsSignal();
+  }
+};
+
+TEST_CASE("HistoryLogModel merges events during a search") {
+  QObject parent;
+  TestStream stream(&parent);
+  AbstractStream *prev_can = std::exchange(can, &stream);
+
+  std::vector<std::vector<uint8_t>> storage;
+  auto make_events = [&storage](int begin, int end) {
+    std::vector<const CanEvent *> events;
+    for (int i = begin; i < end; ++i) {
+      auto &buf = storage.emplace_back(sizeof(CanEvent) + 8);
+      CanEvent *e = (CanEvent *)buf.data();
+      e->address = 160;
+      e->mono_time = (i + 1) * 1e7;
+      e->size = 8;
+      e->dat[0] = i & 0xFF;
+      events.push_back(e);
+    }
+    return events;
+  };
+  // runs the background builds and searches, then delivers their results
+  auto settle = []() {
+    for (int i = 0; i < 3; ++i) {
+      QThreadPool::globalInstance()->waitForDone();
+      QCoreApplication::processEvents();
+    }
+  };
+
+  auto newer = make_events(1000, 20000);
+  stream.merge(newer);
+  stream.update(newer.back());
+  settle();
+
+  HistoryLogModel model(nullptr);
+  model.setMessage({.source = 0, .address = 160});
+  settle();
+  REQUIRE(model.rowCount() == model.batch_size);
+
+  // the search of the next batch finishes, then older events are merged in before its result is delivered
+  model.fetchMore({});
+  QThreadPool::globalInstance()->waitForDone();
+  stream.merge(make_events(0, 1000));
+  model.updateState();
+  settle();
+
+  const auto &events = can->events({.source = 0, .address = 160});
+  REQUIRE(events.size() == 20000);
+  REQUIRE(model.rowCount() == model.batch_size);
+  for (int i = 0; i < model.rowCount(); ++i) {
+    REQUIRE(model.messages[i].mono_time == events[events.size() - 1 - i]->mono_time);
+  }
+  can = prev_can;
+}
+
+TEST_CASE("Signal::compile matches get_raw_value") {
+  std::mt19937 rng(0);
+  uint8_t data[64];
+  for (auto &b : data) b = rng();
+
+  // every signal of a CAN FD message, read from messages shorter than it as well
+  int compiled = 0;
+  for (bool little_endian : {true, false}) {
+    for (bool is_signed : {false, true}) {
+      for (int size = 1; size <= 64; ++size) {
+        for (int start_bit = 0; start_bit < 64 * 8; ++start_bit) {
+          cabana::Signal sig{};
+          sig.start_bit = start_bit;
+          sig.size = size;
+          sig.is_little_endian = little_endian;
+          sig.is_signed = is_signed;
+          sig.factor = 0.25;
+          sig.offset = -7;
+          updateMsbLsb(sig);
+          sig.compile();
+          compiled += sig.plan.extract != nullptr;
+
+          for (size_t data_size : {3, 8, 12, 64}) {
+            double value = sig.extract(data, data_size);
+            double expected = get_raw_value(data, data_size, sig);
+            if (memcmp(&value, &expected, sizeof(value)) != 0) {
+              FAIL_CHECK("start " << start_bit << " size " << size << (little_endian ? " LE" : " BE") << (is_signed ? " signed" : "")
+                         << " data_size " << data_size << ": " << value << " != " << expected);
+            }
+          }
+        }
+      }
+    }
+  }
+  // only signals spanning 9 bytes aren't compiled
+  REQUIRE(compiled > 0.9 * 2 * 2 * 64 * 64 * 8);
+}
+
+TEST_CASE("Signal::extract benchmark", "[.][benchmark]") {
+  DBCFile file("", R"(BO_ 160 message_1: 8 EON
+ SG_ aligned_8 : 8|8@1+ (1,0) [0|255] "" XXX
+ SG_ unaligned_12 : 3|12@1- (0.1,0) [0|4095] "" XXX
+ SG_ big_endian_16 : 23|16@0+ (0.01,0) [0|65535] "" XXX
+ SG_ big_endian_13 : 39|13@0- (0.5,-10) [0|8191] "" XXX
+ SG_ aligned_64 : 0|64@1+ (1,0) [0|1] "" XXX
+)");
+  auto msg = file.msg(160);
+  REQUIRE(msg != nullptr);
+
+  std::mt19937 rng(0);
+  std::vector<uint8_t> frames(4096 * 8);
+  for (auto &b : frames) b = rng();
+
+  const int runs = 10000000;
+  for (auto sig : msg->sigs) {
+    double sum = 0;
+    double start = millis_since_boot();
+    for (int i = 0; i < runs; ++i) sum += get_raw_value(&frames[(i & 4095) * 8], 8, *sig);
+    double generic_ns = (millis_since_boot() - start) * 1e6 / runs;
+
+    start = millis_since_boot();
+    for (int i = 0; i < runs; ++i) sum -= sig->extract(&frames[(i & 4095) * 8], 8);
+    double compiled_ns = (millis_since_boot() - start) * 1e6 / runs;
+    printf("%s: get_raw_value %.2f ns, compiled %.2f ns (%g)\n", sig->name.toStdString().c_str(), generic_ns, compiled_ns, sum);
+  }
+}
+
+TEST_CASE("CanData::compute bit change counts") {
+  std::mt19937 rng(0);
+  CanData data;
+  std::vector<std::array<uint32_t, 8>> expected;
+  std::vector<uint8_t> prev, mask(20, 0);
+  mask[3] = 0xF0;
+  mask[17] = 0xFF;
+
+  for (int frame = 0; frame < 2000; ++frame) {
+    // CAN-FD sizes, including ones that don't fill a whole word
+    const int size = frame < 1000 ? 64 : 20;
+    std::vector<uint8_t> dat(size);
+    for (int i = 0; i < size; ++i) {
+      dat[i] = rng() % 4 == 0 ? rng() : (i < prev.size() ? prev[i] : 0);
+    }
+    if (prev.size() == size) {
+      for (int i = 0; i < size; ++i) {
+        const uint8_t diff = (prev[i] ^ dat[i]) & ~(i < mask.size() ? mask[i] : 0);
+        for (int bit = 0; bit < 8; ++bit) {
+          if (diff & (1u << bit)) ++expected[i][7 - bit];
+        }
+      }
+    }
+    expected.resize(size);
+    data.compute({}, dat.data(), size, frame * 0.01, 1, mask, 100);
+    prev = dat;
+
+    for (int i = 0; i < size; ++i) {
+      REQUIRE(data.bitChangeCounts(i) == expected[i]);
+    }
+    REQUIRE(data.colors().size() == size);
+  }
+
+  data.clearBitChangeCounts({0xFF, 0x0F});
+  REQUIRE(data.bitChangeCounts(0) == std::array<uint32_t, 8>{});
+  REQUIRE(data.bitChangeCounts(1)[0] == expected[1][0]);
+  REQUIRE(data.bitChangeCounts(1)[7] == 0);
+  data.resetBitChangeCounts();
+  REQUIRE(data.bitChangeCounts(5) == std::array<uint32_t, 8>{});
+}
+
+TEST_CASE("CanData::compute benchmark", "[.][benchmark]") {
+  std::mt19937 rng(0);
+  // 64-byte frames with a counter, a checksum and slowly changing signals
+  std::vector<std::vector<uint8_t>> frames(1000, std::vector<uint8_t>(64));
+  for (int i = 0; i < frames.size(); ++i) {
+    frames[i][0] = i;
+    frames[i][63] = rng();
+    frames[i][10] = i / 50;
+  }
+
+  CanData data;
+  const int runs = 1000000;
+  double start = millis_since_boot();
+  for (int i = 0; i < runs; ++i) {
+    data.compute({}, frames[i % frames.size()].data(), 64, i * 0.01, 1, {}, 100);
+  }
+  printf("compute: %.1f ns per 64-byte frame\n", (millis_since_boot() - start) * 1e6 / runs);
+}
@@ -43,10 +43,10 @@ void FindSignalModel::search(std::function<bool(double)> cmp) {
       last = std::upper_bound(events.cbegin(), events.cend(), last_time, CompareCanEvent());
     }
 
-    auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(get_raw_value(e->dat, e->size, s.sig)); });
+    auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(s.sig.extract(e->dat, e->size)); });
     if (it != last) {
       auto values = s.values;
-      values += QString("(%1, %2)").arg((*it)->mono_time / 1e9 - can->routeStartTime(), 0, 'f', 2).arg(get_raw_value((*it)->dat, (*it)->size, s.sig));
+      values += QString("(%1, %2)").arg((*it)->mono_time / 1e9 - can->routeStartTime(), 0, 'f', 2).arg(s.sig.extract((*it)->dat, (*it)->size));
       std::lock_guard lk(lock);
       filtered_signals.push_back({.id = s.id, .mono_time = (*it)->mono_time, .sig = s.sig, .values = values});
     }
@@ -236,7 +236,8 @@ void FindSignalDlg::setInitialSignals() {
             s.sig.start_bit = start;
             s.sig.size = size;
             updateMsbLsb(s.sig);
-            s.value = get_raw_value((*e)->dat, (*e)->size, s.sig);
+            s.sig.compile();
+            s.value = s.sig.extract((*e)->dat, (*e)->size);
             model->initial_signals.push_back(s);
           }
         }
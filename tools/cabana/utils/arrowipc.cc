@@ -0,0 +1,328 @@
+#include "tools/cabana/utils/arrowipc.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace arrow_ipc {
+
+namespace {
+
+// enum values of the Arrow flatbuffer schemas (format/Schema.fbs, Message.fbs, File.fbs)
+constexpr int16_t METADATA_V5 = 4;
+constexpr uint8_t TYPE_INT = 2;
+constexpr uint8_t TYPE_FLOATING_POINT = 3;
+constexpr uint8_t TYPE_BINARY = 4;
+constexpr int16_t PRECISION_DOUBLE = 2;
+constexpr uint8_t HEADER_SCHEMA = 1;
+constexpr uint8_t HEADER_RECORD_BATCH = 3;
+constexpr char MAGIC[] = "ARROW1";
+constexpr uint32_t CONTINUATION = 0xFFFFFFFF;
+
+// flatbuffer structs
+struct FieldNode {
+  int64_t length;
+  int64_t null_count;
+};
+
+struct Buffer {
+  int64_t offset;
+  int64_t length;
+};
+
+struct FooterBlock {
+  int64_t offset;
+  int32_t metadata_length;
+  int32_t padding;
+  int64_t body_length;
+};
+
+static_assert(sizeof(FooterBlock) == 24, "FooterBlock must match the flatbuffer struct layout");
+
+// Builds a flatbuffer back to front like the reference implementation, so
+// references to objects are distances from the end of the buffer. The
+// metadata is a few hundred bytes, prepending to a string is good enough.
+class FlatBufferBuilder {
+public:
+  uint32_t size() const { return buf.size(); }
+  void align(size_t alignment, size_t extra = 0) { buf.insert(0, (alignment - (buf.size() + extra) % alignment) % alignment, '\0'); }
+  void prepend(const void *data, size_t len) { buf.insert(0, (const char *)data, len); }
+  template <class T>
+  void push(T value) {
+    align(sizeof(T));
+    prepend(&value, sizeof(T));
+  }
+  void pushOffset(uint32_t ref) {
+    align(4);
+    push<uint32_t>(size() + 4 - ref);
+  }
+
+  void startTable() {
+    fields.clear();
+    table_start = size();
+  }
+  template <class T>
+  void addField(int id, T value) {
+    push(value);
+    fields.push_back({id, size()});
+  }
+  void addOffset(int id, uint32_t ref) {
+    pushOffset(ref);
+    fields.push_back({id, size()});
+  }
+  uint32_t endTable() {
+    push<int32_t>(0);  // offset to the vtable, patched below
+    const uint32_t table = size();
+    int max_id = -1;
+    for (auto &f : fields) max_id = std::max(max_id, f.first);
+
+    std::vector<uint16_t> vtable(2 + max_id + 1, 0);
+    vtable[0] = vtable.size() * sizeof(uint16_t);
+    vtable[1] = table - table_start;
+    for (auto &[id, ref] : fields) {
+      vtable[2 + id] = table - ref;
+    }
+    prepend(vtable.data(), vtable.size() * sizeof(uint16_t));
+    int32_t vtable_offset = size() - table;
+    memcpy(&buf[buf.size() - table], &vtable_offset, sizeof(vtable_offset));
+    return table;
+  }
+
+  uint32_t createString(const std::string &s) {
+    align(4, s.size() + 1);
+    buf.insert(0, 1, '\0');
+    prepend(s.data(), s.size());
+    push<uint32_t>(s.size());
+    return size();
+  }
+  uint32_t createOffsetVector(const std::vector<uint32_t> &refs) {
+    for (auto it = refs.rbegin(); it != refs.rend(); ++it) {
+      pushOffset(*it);
+    }
+    push<uint32_t>(refs.size());
+    return size();
+  }
+  template <class T>
+  uint32_t createStructVector(const std::vector<T> &v) {
+    align(8, v.size() * sizeof(T));
+    prepend(v.data(), v.size() * sizeof(T));
+    push<uint32_t>(v.size());
+    return size();
+  }
+
+  std::string finish(uint32_t root) {
+    align(8, 4);
+    pushOffset(root);
+    return std::move(buf);
+  }
+
+private:
+  std::string buf;
+  std::vector<std::pair<int, uint32_t>> fields;
+  uint32_t table_start = 0;
+};
+
+uint32_t createSchema(FlatBufferBuilder &fbb, const std::vector<Field> &schema) {
+  std::vector<uint32_t> fields;
+  for (const auto &f : schema) {
+    uint32_t name = fbb.createString(f.name);
+    // readers reject fields without a children vector
+    uint32_t children = fbb.createOffsetVector({});
+
+    uint8_t type_type = TYPE_BINARY;
+    fbb.startTable();
+    if (f.type == Type::UInt8 || f.type == Type::UInt32) {
+      type_type = TYPE_INT;
+      fbb.addField<int32_t>(0, f.type == Type::UInt8 ? 8 : 32);  // bitWidth
+      fbb.addField<uint8_t>(1, false);                            // is_signed
+    } else if (f.type == Type::Float64) {
+      type_type = TYPE_FLOATING_POINT;
+      fbb.addField<int16_t>(0, PRECISION_DOUBLE);
+    }
+    uint32_t type = fbb.endTable();
+
+    fbb.startTable();
+    fbb.addOffset(0, name);
+    fbb.addOffset(3, type);
+    fbb.addOffset(5, children);
+    fbb.addField<uint8_t>(1, f.nullable);
+    fbb.addField<uint8_t>(2, type_type);
+    fields.push_back(fbb.endTable());
+  }
+  uint32_t fields_vector = fbb.createOffsetVector(fields);
+
+  fbb.startTable();
+  fbb.addOffset(1, fields_vector);
+  fbb.addField<int16_t>(0, 0);  // little endian
+  return fbb.endTable();
+}
+
+Message encodeMessage(FlatBufferBuilder &fbb, uint8_t header_type, uint32_t header, const std::string &body) {
+  fbb.startTable();
+  fbb.addField<int64_t>(3, body.size());
+  fbb.addOffset(2, header);
+  fbb.addField<int16_t>(0, METADATA_V5);
+  fbb.addField<uint8_t>(1, header_type);
+  std::string metadata = fbb.finish(fbb.endTable());
+
+  Message msg;
+  int32_t len = metadata.size();
+  msg.bytes.reserve(8 + metadata.size() + body.size());
+  msg.bytes.append((const char *)&CONTINUATION, 4);
+  msg.bytes.append((const char *)&len, 4);
+  msg.bytes += metadata;
+  msg.bytes += body;
+  msg.metadata_length = 8 + metadata.size();
+  msg.body_length = body.size();
+  return msg;
+}
+
+int typeWidth(Type type) {
+  switch (type) {
+    case Type::UInt8: return 1;
+    case Type::UInt32: return 4;
+    case Type::Float64: return 8;
+    default: return 0;
+  }
+}
+
+}  // namespace
+
+// RecordBatch
+
+RecordBatch::RecordBatch(const std::vector<Field> &schema, size_t reserve_rows) {
+  columns.resize(schema.size());
+  for (int i = 0; i < schema.size(); ++i) {
+    auto &c = columns[i];
+    c.type = schema[i].type;
+    if (c.type == Type::Binary) {
+      c.offsets.reserve(reserve_rows + 1);
+      c.offsets.push_back(0);
+    }
+    c.data.reserve(reserve_rows * (c.type == Type::Binary ? 8 : typeWidth(c.type)));
+  }
+}
+
+void RecordBatch::setValid(Column &c, bool valid) {
+  if (!valid && c.validity.empty()) {
+    c.validity.assign(c.length / 8 + 1, 0);
+    for (int64_t i = 0; i < c.length; ++i) {
+      c.validity[i / 8] |= 1 << (i % 8);
+    }
+  }
+  if (!c.validity.empty()) {
+    if (c.validity.size() <= c.length / 8) {
+      c.validity.push_back(0);
+    }
+    if (valid) {
+      c.validity[c.length / 8] |= 1 << (c.length % 8);
+    }
+  }
+  c.null_count += !valid;
+  ++c.length;
+}
+
+void RecordBatch::appendBinary(int col, const uint8_t *data, size_t size) {
+  auto &c = columns[col];
+  c.data.append((const char *)data, size);
+  c.offsets.push_back(c.data.size());
+  setValid(c, true);
+}
+
+void RecordBatch::appendNull(int col) {
+  auto &c = columns[col];
+  if (c.type == Type::Binary) {
+    c.offsets.push_back(c.data.size());
+  } else {
+    c.data.append(typeWidth(c.type), '\0');
+  }
+  setValid(c, false);
+}
+
+Message RecordBatch::encode() const {
+  std::string body;
+  std::vector<FieldNode> nodes;
+  std::vector<Buffer> buffers;
+  auto add_buffer = [&](const void *data, size_t size) {
+    buffers.push_back({(int64_t)body.size(), (int64_t)size});
+    if (size > 0) body.append((const char *)data, size);
+    body.append((8 - body.size() % 8) % 8, '\0');
+  };
+
+  for (const auto &c : columns) {
+    nodes.push_back({c.length, c.null_count});
+    if (c.null_count > 0) {
+      std::vector<uint8_t> validity(c.validity);
+      validity.resize((c.length + 7) / 8);
+      add_buffer(validity.data(), validity.size());
+    } else {
+      add_buffer(nullptr, 0);
+    }
+    if (c.type == Type::Binary) {
+      add_buffer(c.offsets.data(), c.offsets.size() * sizeof(int32_t));
+    }
+    add_buffer(c.data.data(), c.data.size());
+  }
+
+  FlatBufferBuilder fbb;
+  uint32_t buffers_vector = fbb.createStructVector(buffers);
+  uint32_t nodes_vector = fbb.createStructVector(nodes);
+  fbb.startTable();
+  fbb.addField<int64_t>(0, columns.empty() ? 0 : columns[0].length);
+  fbb.addOffset(1, nodes_vector);
+  fbb.addOffset(2, buffers_vector);
+  uint32_t record_batch = fbb.endTable();
+  return encodeMessage(fbb, HEADER_RECORD_BATCH, record_batch, body);
+}
+
+// FileWriter
+
+FileWriter::FileWriter(FILE *f, const std::vector<Field> &schema) : f(f), schema(schema) {
+  // the magic is padded to 8 bytes at the start of the file
+  char magic[8] = {};
+  memcpy(magic, MAGIC, strlen(MAGIC));
+  writeBytes(magic, sizeof(magic));
+
+  FlatBufferBuilder fbb;
+  uint32_t root = createSchema(fbb, schema);
+  Message msg = encodeMessage(fbb, HEADER_SCHEMA, root, {});
+  writeBytes(msg.bytes.data(), msg.bytes.size());
+}
+
+bool FileWriter::writeBytes(const void *data, size_t size) {
+  if (!error && size > 0) {
+    error = fwrite(data, 1, size, f) != size;
+    pos += size;
+  }
+  return !error;
+}
+
+bool FileWriter::write(const Message &batch) {
+  blocks.push_back({pos, batch.metadata_length, batch.body_length});
+  return writeBytes(batch.bytes.data(), batch.bytes.size());
+}
+
+bool FileWriter::finish() {
+  const uint32_t eos[] = {CONTINUATION, 0};
+  writeBytes(eos, sizeof(eos));
+
+  std::vector<FooterBlock> footer_blocks;
+  for (auto &b : blocks) {
+    footer_blocks.push_back({b.offset, b.metadata_length, 0, b.body_length});
+  }
+  FlatBufferBuilder fbb;
+  uint32_t record_batches = fbb.createStructVector(footer_blocks);
+  uint32_t schema_table = createSchema(fbb, schema);
+  fbb.startTable();
+  fbb.addOffset(1, schema_table);
+  fbb.addOffset(3, record_batches);
+  fbb.addField<int16_t>(0, METADATA_V5);
+  std::string footer = fbb.finish(fbb.endTable());
+
+  int32_t footer_size = footer.size();
+  writeBytes(footer.data(), footer.size());
+  writeBytes(&footer_size, sizeof(footer_size));
+  writeBytes(MAGIC, strlen(MAGIC));
+  return !error;
+}
+
+}  // namespace arrow_ipc
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Minimal writer for the Arrow IPC file format (Feather V2), enough to export
+// flat tables of integer, double and binary columns without pulling in libarrow.
+// The files can be read by pyarrow, pandas, polars, DuckDB, etc.
+namespace arrow_ipc {
+
+enum class Type {
+  UInt8,
+  UInt32,
+  Float64,
+  Binary,
+};
+
+struct Field {
+  std::string name;
+  Type type;
+  bool nullable = false;
+};
+
+// An encapsulated IPC message: metadata flatbuffer followed by the body
+struct Message {
+  std::string bytes;
+  int32_t metadata_length = 0;  // including the continuation marker, length prefix and padding
+  int64_t body_length = 0;
+};
+
+// Column buffers of one record batch. Build one per chunk of rows, then encode() it.
+class RecordBatch {
+public:
+  RecordBatch(const std::vector<Field> &schema, size_t reserve_rows = 0);
+  template <class T>
+  void append(int col, T value) {
+    auto &c = columns[col];
+    c.data.append((const char *)&value, sizeof(T));
+    setValid(c, true);
+  }
+  void appendBinary(int col, const uint8_t *data, size_t size);
+  void appendNull(int col);
+  Message encode() const;
+
+private:
+  struct Column {
+    Type type;
+    std::string data;
+    std::vector<int32_t> offsets;
+    std::vector<uint8_t> validity;  // empty until the first null
+    int64_t length = 0;
+    int64_t null_count = 0;
+  };
+  void setValid(Column &c, bool valid);
+  std::vector<Column> columns;
+};
+
+class FileWriter {
+public:
+  FileWriter(FILE *f, const std::vector<Field> &schema);
+  bool write(const Message &batch);
+  // writes the end of stream marker and the footer. does not close the FILE.
+  bool finish();
+  bool ok() const { return !error; }
+
+private:
+  struct Block {
+    int64_t offset;
+    int32_t metadata_length;
+    int64_t body_length;
+  };
+  bool writeBytes(const void *data, size_t size);
+
+  FILE *f;
+  std::vector<Field> schema;
+  std::vector<Block> blocks;
+  int64_t pos = 0;
+  bool error = false;
+};
+
+}  // namespace arrow_ipc
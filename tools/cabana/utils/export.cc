@@ -1,46 +1,232 @@
 #include "tools/cabana/utils/export.h"
 
+#include <charconv>
+#include <cstdio>
+#include <limits>
+#include <thread>
+
+#include <QEventLoop>
 #include <QFile>
-#include <QTextStream>
+#include <QFileInfo>
+#include <QMessageBox>
+#include <QProgressDialog>
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
 
-#include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/utils/arrowipc.h"
 
 namespace utils {
 
-void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id) {
-  QFile file(file_name);
-  if (file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
-    const uint64_t start_time = can->routeStartTime();
-    QTextStream stream(&file);
-    stream << "time,addr,bus,data\n";
-    for (auto e : msg_id ? can->events(*msg_id) : can->allEvents()) {
-      stream << QString::number((e->mono_time / 1e9) - start_time, 'f', 2) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src << ","
-             << "0x" << QByteArray::fromRawData((const char *)e->dat, e->size).toHex().toUpper() << "\n";
-    }
-  }
-}
-
-void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id) {
-  QFile file(file_name);
-  if (auto msg = dbc()->msg(msg_id); msg && msg->sigs.size() && file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
-    QTextStream stream(&file);
-    stream << "time,addr,bus";
-    for (auto s : msg->sigs)
-      stream << "," << s->name;
-    stream << "\n";
-
-    const uint64_t start_time = can->routeStartTime();
-    for (auto e : can->events(msg_id)) {
-      stream << QString::number((e->mono_time / 1e9) - start_time, 'f', 2) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src;
-      for (auto s : msg->sigs) {
+namespace {
+
+const int CHUNK_ROWS = 64 * 1024;
+const size_t WRITE_BUFFER_SIZE = 8 * 1024 * 1024;
+
+inline void appendFixed(std::string &out, double value, int precision) {
+  char buf[std::numeric_limits<double>::max_exponent10 + 64];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, std::min(precision, 32));
+  out.append(buf, ec == std::errc() ? end : buf);
+}
+
+template <class T>
+inline void appendInt(std::string &out, T value, int base = 10) {
+  char buf[16];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value, base);
+  out.append(buf, end);
+}
+
+std::string formatCSVChunk(const CanEvent *const *first, const CanEvent *const *last,
+                           const std::vector<const cabana::Signal *> &sigs, double start_time) {
+  static const char hex[] = "0123456789ABCDEF";
+  std::string out;
+  out.reserve((last - first) * (sigs.empty() ? 48 : 24 + sigs.size() * 8));
+  for (auto it = first; it != last; ++it) {
+    const CanEvent *e = *it;
+    appendFixed(out, (e->mono_time / 1e9) - start_time, 2);
+    out += ",0x";
+    appendInt(out, e->address, 16);
+    out += ',';
+    appendInt(out, e->src);
+    if (sigs.empty()) {
+      out += ",0x";
+      for (int i = 0; i < e->size; ++i) {
+        out += hex[e->dat[i] >> 4];
+        out += hex[e->dat[i] & 0xF];
+      }
+    } else {
+      for (auto s : sigs) {
         double value = 0;
         s->getValue(e->dat, e->size, &value);
-        stream << "," << QString::number(value, 'f', s->precision);
+        out += ',';
+        appendFixed(out, value, s->precision);
       }
-      stream << "\n";
     }
+    out += '\n';
+  }
+  return out;
+}
+
+std::vector<arrow_ipc::Field> arrowSchema(const std::vector<const cabana::Signal *> &sigs) {
+  std::vector<arrow_ipc::Field> schema = {
+    {"time", arrow_ipc::Type::Float64},
+    {"addr", arrow_ipc::Type::UInt32},
+    {"bus", arrow_ipc::Type::UInt8},
+  };
+  if (sigs.empty()) {
+    schema.push_back({"data", arrow_ipc::Type::Binary});
+  }
+  for (auto s : sigs) {
+    // null where the signal is not present, e.g. other multiplexed values
+    schema.push_back({s->name.toStdString(), arrow_ipc::Type::Float64, true});
+  }
+  return schema;
+}
+
+arrow_ipc::Message encodeArrowChunk(const CanEvent *const *first, const CanEvent *const *last,
+                                    const std::vector<arrow_ipc::Field> &schema,
+                                    const std::vector<const cabana::Signal *> &sigs, double start_time) {
+  arrow_ipc::RecordBatch batch(schema, last - first);
+  for (auto it = first; it != last; ++it) {
+    const CanEvent *e = *it;
+    batch.append<double>(0, (e->mono_time / 1e9) - start_time);
+    batch.append<uint32_t>(1, e->address);
+    batch.append<uint8_t>(2, e->src);
+    if (sigs.empty()) {
+      batch.appendBinary(3, e->dat, e->size);
+    }
+    for (int i = 0; i < sigs.size(); ++i) {
+      double value = 0;
+      if (sigs[i]->getValue(e->dat, e->size, &value)) {
+        batch.append<double>(3 + i, value);
+      } else {
+        batch.appendNull(3 + i);
+      }
+    }
+  }
+  return batch.encode();
+}
+
+// Encodes chunks on the thread pool a few at a time, keeping memory bounded,
+// and hands the results to write() in order.
+template <class T, class Encode, class Write>
+bool encodeChunks(size_t total, const std::atomic<bool> *abort, std::atomic<size_t> *progress, Encode encode, Write write) {
+  struct Chunk {
+    size_t begin, end;
+    T result;
+  };
+  const size_t wave_size = std::max(1, QThread::idealThreadCount()) * 2;
+  std::vector<Chunk> wave;
+  for (size_t begin = 0; begin < total;) {
+    wave.clear();
+    for (; begin < total && wave.size() < wave_size; begin += CHUNK_ROWS) {
+      wave.push_back({begin, std::min(begin + CHUNK_ROWS, total)});
+    }
+    QtConcurrent::blockingMap(wave, [&](Chunk &c) {
+      if (abort && *abort) return;
+      c.result = encode(c.begin, c.end);
+      if (progress) *progress += c.end - c.begin;
+    });
+    if (abort && *abort) return false;
+    for (auto &c : wave) {
+      if (!write(c.result)) return false;
+    }
+  }
+  return true;
+}
+
+void exportWithProgress(const QString &file_name, const std::vector<const CanEvent *> &events,
+                        const std::vector<const cabana::Signal *> &sigs, QWidget *parent) {
+  std::atomic<bool> abort = false, done = false;
+  std::atomic<size_t> progress = 0;
+  bool ret = false;
+  const ExportFormat format = exportFormat(file_name);
+  const double start_time = can->routeStartTime();
+  std::thread thread([&]() {
+    ret = exportEvents(file_name, format, events, sigs, start_time, &abort, &progress);
+    done = true;
+  });
+
+  QProgressDialog dlg(QObject::tr("Exporting %1...").arg(QFileInfo(file_name).fileName()), QObject::tr("Cancel"), 0, 100, parent);
+  dlg.setWindowModality(Qt::WindowModal);
+  dlg.setMinimumDuration(500);
+  QObject::connect(&dlg, &QProgressDialog::canceled, [&]() { abort = true; });
+
+  QEventLoop loop;
+  QTimer timer;
+  QObject::connect(&timer, &QTimer::timeout, [&]() {
+    if (done) {
+      loop.quit();
+    } else if (!events.empty()) {
+      dlg.setValue(progress * 100 / events.size());
+    }
+  });
+  timer.start(50);
+  loop.exec();
+  thread.join();
+  dlg.reset();
+
+  if (!ret) {
+    QFile::remove(file_name);
+    if (!abort) {
+      QMessageBox::warning(parent, QObject::tr("Export failed"), QObject::tr("Failed to write %1").arg(file_name));
+    }
+  }
+}
+
+}  // namespace
+
+QString exportFileFilter() {
+  return QObject::tr("csv (*.csv);;Arrow IPC (*.arrow *.feather)");
+}
+
+ExportFormat exportFormat(const QString &file_name) {
+  QString suffix = QFileInfo(file_name).suffix().toLower();
+  return suffix == "arrow" || suffix == "feather" ? ExportFormat::Arrow : ExportFormat::CSV;
+}
+
+bool exportEvents(const QString &file_name, ExportFormat format, const std::vector<const CanEvent *> &events,
+                  const std::vector<const cabana::Signal *> &sigs, double start_time,
+                  const std::atomic<bool> *abort, std::atomic<size_t> *progress) {
+  FILE *f = fopen(file_name.toLocal8Bit().constData(), "wb");
+  if (!f) return false;
+  setvbuf(f, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+  const CanEvent *const *data = events.data();
+  bool ret = false;
+  if (format == ExportFormat::CSV) {
+    std::string header = "time,addr,bus";
+    header += sigs.empty() ? ",data" : "";
+    for (auto s : sigs) {
+      header += "," + s->name.toStdString();
+    }
+    header += "\n";
+    ret = fwrite(header.data(), 1, header.size(), f) == header.size();
+    ret = ret && encodeChunks<std::string>(events.size(), abort, progress,
+      [&](size_t begin, size_t end) { return formatCSVChunk(data + begin, data + end, sigs, start_time); },
+      [&](const std::string &chunk) { return fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size(); });
+  } else {
+    const auto schema = arrowSchema(sigs);
+    arrow_ipc::FileWriter writer(f, schema);
+    ret = encodeChunks<arrow_ipc::Message>(events.size(), abort, progress,
+      [&](size_t begin, size_t end) { return encodeArrowChunk(data + begin, data + end, schema, sigs, start_time); },
+      [&](const arrow_ipc::Message &batch) { return writer.write(batch); });
+    ret = ret && writer.finish();
+  }
+  return (fclose(f) == 0) && ret;
+}
+
+void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id, QWidget *parent) {
+  // copy the event list, a live stream keeps appending to it
+  std::vector<const CanEvent *> events = msg_id ? can->events(*msg_id) : can->allEvents();
+  exportWithProgress(file_name, events, {}, parent);
+}
+
+void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id, QWidget *parent) {
+  if (auto msg = dbc()->msg(msg_id); msg && msg->sigs.size()) {
+    std::vector<const CanEvent *> events = can->events(msg_id);
+    std::vector<const cabana::Signal *> sigs(msg->sigs.begin(), msg->sigs.end());
+    exportWithProgress(file_name, events, sigs, parent);
   }
 }
 
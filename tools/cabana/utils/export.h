@@ -1,10 +1,32 @@
 #pragma once
 
+#include <atomic>
 #include <optional>
+#include <vector>
+
+#include <QWidget>
 
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/abstractstream.h"
 
 namespace utils {
-void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id = std::nullopt);
-void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id);
+
+enum class ExportFormat {
+  CSV,
+  Arrow,  // Arrow IPC file (Feather V2), columnar with typed signal columns
+};
+
+QString exportFileFilter();
+ExportFormat exportFormat(const QString &file_name);
+
+// Decodes and writes the events in parallel chunks, in order. With no signals the raw
+// data is exported. Does not touch the stream or the DBC manager, so it can run off
+// the UI thread. Returns false on write errors or when aborted.
+bool exportEvents(const QString &file_name, ExportFormat format, const std::vector<const CanEvent *> &events,
+                  const std::vector<const cabana::Signal *> &sigs, double start_time,
+                  const std::atomic<bool> *abort = nullptr, std::atomic<size_t> *progress = nullptr);
+
+// export with a progress dialog, the format is picked by the file suffix
+void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id = std::nullopt, QWidget *parent = nullptr);
+void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id, QWidget *parent = nullptr);
 }  // namespace utils
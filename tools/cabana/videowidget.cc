@@ -2,14 +2,18 @@
 
 #include <algorithm>
 #include <utility>
+#include <vector>
 
 #include <QAction>
+#include <QElapsedTimer>
 #include <QActionGroup>
+#include <QHelpEvent>
 #include <QMenu>
 #include <QMouseEvent>
 #include <QPainter>
 #include <QStackedLayout>
 #include <QStyleOptionSlider>
+#include <QToolTip>
 #include <QVBoxLayout>
 #include <QtConcurrent>
 
@@ -17,6 +21,8 @@
 
 const int MIN_VIDEO_HEIGHT = 100;
 const int THUMBNAIL_MARGIN = 3;
+const int MAX_DECODED_THUMBNAILS = 64;
+const int PREFETCH_THUMBNAILS = 3;  // on each side of the hovered one
 
 static const QColor timeline_colors[] = {
   [(int)TimelineType::None] = QColor(111, 143, 175),
@@ -234,10 +240,111 @@ void VideoWidget::updatePlayBtnState() {
   play_btn->setToolTip(can->isPaused() ? tr("Play") : tr("Pause"));
 }
 
+// ThumbnailCache
+
+ThumbnailCache::ThumbnailCache(QObject *parent) : QObject(parent) {
+  pool.setMaxThreadCount(2);
+}
+
+ThumbnailCache::~ThumbnailCache() {
+  pool.clear();
+  pool.waitForDone();
+}
+
+void ThumbnailCache::add(uint64_t mono_time, const capnp::Data::Reader &jpeg) {
+  QByteArray data((const char *)jpeg.begin(), jpeg.size());
+  std::lock_guard lk(mutex);
+  auto [it, inserted] = compressed.emplace(mono_time, data);
+  if (inserted) {
+    ++stats_.thumbnails;
+    stats_.compressed_bytes += data.size();
+  }
+}
+
+std::optional<QPixmap> ThumbnailCache::get(uint64_t mono_time) {
+  std::unique_lock lk(mutex);
+  auto it = compressed.lower_bound(mono_time);
+  if (it == compressed.end()) return std::nullopt;
+
+  // the hovered thumbnail is requested first, then outwards from it
+  requested.clear();
+  std::vector<std::pair<uint64_t, QByteArray>> to_decode;
+  auto request = [&](auto i) {
+    requested.insert(i->first);
+    if (!decoded_thumbnails.count(i->first) && pending.insert(i->first).second) {
+      to_decode.emplace_back(i->first, i->second);
+    }
+  };
+  request(it);
+  auto next = std::next(it), prev = it;
+  for (int i = 0; i < PREFETCH_THUMBNAILS; ++i) {
+    if (next != compressed.end()) request(next++);
+    if (prev != compressed.begin()) request(--prev);
+  }
+  const uint64_t key = it->first;
+  lk.unlock();
+
+  for (auto &[t, data] : to_decode) {
+    QtConcurrent::run(&pool, [this, t = t, data = data]() {
+      {
+        std::lock_guard lk(mutex);
+        if (!requested.count(t)) {
+          // the cursor moved on before this was started
+          QMetaObject::invokeMethod(this, [=]() { decodeFinished(t, {}, 0); }, Qt::QueuedConnection);
+          return;
+        }
+      }
+      QElapsedTimer timer;
+      timer.start();
+      QImage image;
+      if (image.loadFromData(data, "jpeg")) {
+        image = image.scaledToHeight(MIN_VIDEO_HEIGHT - THUMBNAIL_MARGIN * 2, Qt::SmoothTransformation);
+      }
+      double ms = timer.nsecsElapsed() / 1e6;
+      QMetaObject::invokeMethod(this, [=]() { decodeFinished(t, image, ms); }, Qt::QueuedConnection);
+    });
+  }
+
+  auto decoded = decoded_thumbnails.find(key);
+  if (decoded == decoded_thumbnails.end()) return QPixmap();
+  lru.splice(lru.begin(), lru, decoded->second);
+  return decoded->second->second;
+}
+
+void ThumbnailCache::decodeFinished(uint64_t mono_time, const QImage &image, double ms) {
+  {
+    std::lock_guard lk(mutex);
+    pending.erase(mono_time);
+  }
+  if (image.isNull()) return;
+
+  ++stats_.decodes;
+  stats_.total_decode_ms += ms;
+  stats_.max_decode_ms = std::max(stats_.max_decode_ms, ms);
+
+  // pixmaps can only be created on the UI thread
+  auto pixmap_bytes = [](const QPixmap &pm) { return (size_t)pm.width() * pm.height() * pm.depth() / 8; };
+  lru.emplace_front(mono_time, QPixmap::fromImage(image));
+  decoded_thumbnails[mono_time] = lru.begin();
+  stats_.decoded_bytes += pixmap_bytes(lru.front().second);
+  while (lru.size() > MAX_DECODED_THUMBNAILS) {
+    auto &[t, pm] = lru.back();
+    stats_.decoded_bytes -= pixmap_bytes(pm);
+    decoded_thumbnails.erase(t);
+    lru.pop_back();
+  }
+  stats_.decoded = lru.size();
+  emit decoded();
+}
+
 // Slider
 
 Slider::Slider(QWidget *parent) : QSlider(Qt::Horizontal, parent) {
   thumbnail_label = new InfoLabel(parent);
+  thumbnails = new ThumbnailCache(this);
+  QObject::connect(thumbnails, &ThumbnailCache::decoded, this, [this]() {
+    if (hover_pos >= 0) showThumbnail(hover_pos);
+  });
   setMouseTracking(true);
 }
 
@@ -248,10 +355,9 @@ AlertInfo Slider::alertInfo(double seconds) {
   return has_alert ? alert_it->second : AlertInfo{};
 }
 
-QPixmap Slider::thumbnail(double seconds)  {
+std::optional<QPixmap> Slider::thumbnail(double seconds) {
   uint64_t mono_time = (seconds + can->routeStartTime()) * 1e9;
-  auto it = thumbnails.lowerBound(mono_time);
-  return it != thumbnails.end() ? it.value() : QPixmap();
+  return thumbnails->get(mono_time);
 }
 
 void Slider::setTimeRange(double min, double max) {
@@ -265,12 +371,7 @@ void Slider::parseQLog(std::shared_ptr<LogReader> qlog) {
     if (e.which == cereal::Event::Which::THUMBNAIL) {
       capnp::FlatArrayMessageReader reader(e.data);
       auto thumb = reader.getRoot<cereal::Event>().getThumbnail();
-      auto data = thumb.getThumbnail();
-      if (QPixmap pm; pm.loadFromData(data.begin(), data.size(), "jpeg")) {
-        QPixmap scaled = pm.scaledToHeight(MIN_VIDEO_HEIGHT - THUMBNAIL_MARGIN * 2, Qt::SmoothTransformation);
-        std::lock_guard lk(mutex);
-        thumbnails[thumb.getTimestampEof()] = scaled;
-      }
+      thumbnails->add(thumb.getTimestampEof(), thumb.getThumbnail());
     } else if (e.which == cereal::Event::Which::CONTROLS_STATE) {
       capnp::FlatArrayMessageReader reader(e.data);
       auto cs = reader.getRoot<cereal::Event>().getControlsState();
@@ -328,17 +429,22 @@ void Slider::mousePressEvent(QMouseEvent *e) {
 }
 
 void Slider::mouseMoveEvent(QMouseEvent *e) {
-  int pos = std::clamp(e->pos().x(), 0, width());
+  hover_pos = std::clamp(e->pos().x(), 0, width());
+  showThumbnail(hover_pos);
+  QSlider::mouseMoveEvent(e);
+}
+
+void Slider::showThumbnail(int pos) {
   double seconds = (minimum() + pos * ((maximum() - minimum()) / (double)width())) / factor;
-  QPixmap thumb = thumbnail(seconds);
-  if (!thumb.isNull()) {
-    int x = std::clamp(pos - thumb.width() / 2, THUMBNAIL_MARGIN, width() - thumb.width() - THUMBNAIL_MARGIN + 1);
-    int y = -thumb.height() - THUMBNAIL_MARGIN;
-    thumbnail_label->showPixmap(mapToParent(QPoint(x, y)), utils::formatSeconds(seconds), thumb, alertInfo(seconds));
-  } else {
+  auto thumb = thumbnail(seconds);
+  if (!thumb) {
     thumbnail_label->hide();
+  } else if (!thumb->isNull()) {
+    int x = std::clamp(pos - thumb->width() / 2, THUMBNAIL_MARGIN, width() - thumb->width() - THUMBNAIL_MARGIN + 1);
+    int y = -thumb->height() - THUMBNAIL_MARGIN;
+    thumbnail_label->showPixmap(mapToParent(QPoint(x, y)), utils::formatSeconds(seconds), *thumb, alertInfo(seconds));
   }
-  QSlider::mouseMoveEvent(e);
+  // while it's being decoded, the label keeps the previous thumbnail until decoded() shows this one
 }
 
 bool Slider::event(QEvent *event) {
@@ -348,8 +454,19 @@ bool Slider::event(QEvent *event) {
     case QEvent::FocusIn:
     case QEvent::FocusOut:
     case QEvent::Leave:
+      hover_pos = -1;
       thumbnail_label->hide();
       break;
+    case QEvent::ToolTip: {
+      auto &s = thumbnails->stats();
+      QToolTip::showText(static_cast<QHelpEvent *>(event)->globalPos(),
+                         tr("Thumbnails: %1, %2 compressed\nDecoded: %3, %4\nDecodes: %5, avg %6 ms, max %7 ms")
+                             .arg(s.thumbnails).arg(formattedDataSize(s.compressed_bytes).c_str())
+                             .arg(s.decoded).arg(formattedDataSize(s.decoded_bytes).c_str())
+                             .arg(s.decodes).arg(s.decodes ? s.total_decode_ms / s.decodes : 0, 0, 'f', 1).arg(s.max_decode_ms, 0, 'f', 1),
+                         this);
+      return true;
+    }
     default:
       break;
   }
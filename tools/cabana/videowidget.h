@@ -1,15 +1,19 @@
 #pragma once
 
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
+#include <unordered_map>
 #include <utility>
 
 #include <QHBoxLayout>
 #include <QFrame>
 #include <QSlider>
 #include <QTabBar>
+#include <QThreadPool>
 
 #include "selfdrive/ui/qt/widgets/cameraview.h"
 #include "tools/cabana/utils/util.h"
@@ -32,6 +36,50 @@ public:
   AlertInfo alert_info;
 };
 
+// thumbnails of the route are kept jpeg compressed. the ones around the hovered time are decoded
+// and scaled on a worker pool, and only the most recently used are kept decoded.
+class ThumbnailCache : public QObject {
+  Q_OBJECT
+
+public:
+  struct Stats {
+    size_t thumbnails = 0;
+    size_t compressed_bytes = 0;
+    size_t decoded = 0;
+    size_t decoded_bytes = 0;
+    size_t decodes = 0;
+    double total_decode_ms = 0;
+    double max_decode_ms = 0;
+  };
+
+  ThumbnailCache(QObject *parent);
+  ~ThumbnailCache();
+  // thread safe
+  void add(uint64_t mono_time, const capnp::Data::Reader &jpeg);
+  // the thumbnail at or after mono_time, a null pixmap while it's being decoded.
+  // requests it and its neighbours from the pool
+  std::optional<QPixmap> get(uint64_t mono_time);
+  // memory and decode time, shown in the tooltip of the slider
+  const Stats &stats() const { return stats_; }
+
+signals:
+  void decoded();
+
+private:
+  void decodeFinished(uint64_t mono_time, const QImage &image, double ms);
+
+  QThreadPool pool;
+  std::mutex mutex;
+  std::map<uint64_t, QByteArray> compressed;
+  std::set<uint64_t> requested;  // the neighbourhood of the last get(), decodes outside of it are skipped
+  std::set<uint64_t> pending;
+
+  // most recently used first
+  std::list<std::pair<uint64_t, QPixmap>> lru;
+  std::unordered_map<uint64_t, decltype(lru)::iterator> decoded_thumbnails;
+  Stats stats_;
+};
+
 class Slider : public QSlider {
   Q_OBJECT
 
@@ -41,7 +89,7 @@ public:
   void setCurrentSecond(double sec) { setValue(sec * factor); }
   void setTimeRange(double min, double max);
   AlertInfo alertInfo(double sec);
-  QPixmap thumbnail(double sec);
+  std::optional<QPixmap> thumbnail(double sec);
   void parseQLog(std::shared_ptr<LogReader> qlog);
 
   const double factor = 1000.0;
@@ -51,8 +99,10 @@ private:
   void mouseMoveEvent(QMouseEvent *e) override;
   bool event(QEvent *event) override;
   void paintEvent(QPaintEvent *ev) override;
+  void showThumbnail(int pos);
 
-  QMap<uint64_t, QPixmap> thumbnails;
+  ThumbnailCache *thumbnails;
+  int hover_pos = -1;
   std::map<uint64_t, AlertInfo> alerts;
   InfoLabel *thumbnail_label;
 };
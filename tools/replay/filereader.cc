@@ -1,33 +1,142 @@
 #include "tools/replay/filereader.h"
 
-#include <fstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <tuple>
+#include <vector>
 
 #include "common/util.h"
 #include "system/hardware/hw.h"
 #include "tools/replay/util.h"
 
-std::string cacheFilePath(const std::string &url) {
+namespace {
+
+const size_t DEFAULT_CACHE_SIZE_LIMIT = 20ull * 1024 * 1024 * 1024;
+// trimming stats every file in the cache, so it runs on the first write and then every this many bytes
+const size_t TRIM_INTERVAL_BYTES = 256 * 1024 * 1024;
+const char *TMP_SUFFIX = ".tmp";
+
+const std::string &cacheDir() {
   static std::string cache_path = [] {
     const std::string comma_cache = Path::download_cache_root();
     util::create_directories(comma_cache, 0755);
     return comma_cache.back() == '/' ? comma_cache : comma_cache + "/";
   }();
+  return cache_path;
+}
+
+}  // namespace
+
+std::string cacheFilePath(const std::string &url, CacheTier tier) {
+  std::string path = cacheDir() + sha256(getUrlWithoutQuery(url));
+  switch (tier) {
+    case CacheTier::Decompressed: return path + ".decompressed";
+    case CacheTier::Timeline: return path + ".timeline";
+    default: return path;
+  }
+}
+
+FileCacheStats &cacheStats() {
+  static FileCacheStats stats;
+  return stats;
+}
+
+bool touchCacheFile(const std::string &file, CacheTier tier) {
+  // the modification time orders the LRU, atime is unreliable with relatime/noatime mounts
+  bool hit = utimensat(AT_FDCWD, file.c_str(), nullptr, 0) == 0;
+  (hit ? cacheStats().hits : cacheStats().misses)[(int)tier]++;
+  return hit;
+}
+
+bool readCacheFile(const std::string &file, CacheTier tier, std::string &content) {
+  if (!touchCacheFile(file, tier)) return false;
+  content = util::read_file(file);
+  return !content.empty();
+}
 
-  return cache_path + sha256(getUrlWithoutQuery(url));
+bool writeCacheFile(const std::string &file, const std::string &content) {
+  // write to a temporary file first so that readers never see partial files
+  const std::string tmp_file = file + "." + util::random_string(8) + TMP_SUFFIX;
+  if (util::write_file(tmp_file.c_str(), content.data(), content.size(), O_WRONLY | O_CREAT | O_TRUNC) != 0 ||
+      rename(tmp_file.c_str(), file.c_str()) != 0) {
+    unlink(tmp_file.c_str());
+    return false;
+  }
+  static std::atomic<size_t> untrimmed_bytes = TRIM_INTERVAL_BYTES;
+  if ((untrimmed_bytes += content.size()) >= TRIM_INTERVAL_BYTES) {
+    untrimmed_bytes = 0;
+    trimCache(cacheDir(), cacheSizeLimit());
+  }
+  return true;
+}
+
+size_t cacheSizeLimit() {
+  const char *env = getenv("COMMA_CACHE_LIMIT_MB");
+  return env ? std::strtoull(env, nullptr, 10) * 1024 * 1024 : DEFAULT_CACHE_SIZE_LIMIT;
+}
+
+void trimCache(const std::string &dir, size_t limit) {
+  // one scan at a time is enough, concurrent writers skip it
+  static std::mutex lock;
+  std::unique_lock lk(lock, std::try_to_lock);
+  if (!lk.owns_lock()) return;
+
+  struct CacheFile {
+    std::string path;
+    size_t size;
+    timespec mtime;
+  };
+  std::vector<CacheFile> files;
+  size_t total = 0;
+
+  const std::string prefix = dir.back() == '/' ? dir : dir + "/";
+  if (DIR *d = opendir(dir.c_str())) {
+    while (struct dirent *de = readdir(d)) {
+      std::string path = prefix + de->d_name;
+      struct stat st;
+      if (de->d_name[0] == '.' || util::ends_with(de->d_name, TMP_SUFFIX) ||
+          stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      files.push_back({path, (size_t)st.st_size, st.st_mtim});
+      total += st.st_size;
+    }
+    closedir(d);
+  }
+  if (total <= limit) return;
+
+  std::sort(files.begin(), files.end(), [](auto &a, auto &b) {
+    return std::tie(a.mtime.tv_sec, a.mtime.tv_nsec) < std::tie(b.mtime.tv_sec, b.mtime.tv_nsec);
+  });
+  for (auto it = files.begin(); it != files.end() && total > limit; ++it) {
+    if (unlink(it->path.c_str()) == 0) {
+      total -= it->size;
+      cacheStats().evicted_files++;
+      cacheStats().evicted_bytes += it->size;
+    }
+  }
+  rDebug("file cache: evicted %lu files, %s in total", cacheStats().evicted_files.load(),
+         formattedDataSize(cacheStats().evicted_bytes).c_str());
 }
 
 std::string FileReader::read(const std::string &file, std::atomic<bool> *abort) {
   const bool is_remote = file.find("https://") == 0;
-  const std::string local_file = is_remote ? cacheFilePath(file) : file;
   std::string result;
 
-  if ((!is_remote || cache_to_local_) && util::file_exists(local_file)) {
-    result = util::read_file(local_file);
-  } else if (is_remote) {
+  if (!is_remote) {
+    if (util::file_exists(file)) {
+      result = util::read_file(file);
+    }
+  } else if (!cache_to_local_ || !readCacheFile(cacheFilePath(file), CacheTier::Download, result)) {
     result = download(file, abort);
     if (cache_to_local_ && !result.empty()) {
-      std::ofstream fs(local_file, std::ios::binary | std::ios::out);
-      fs.write(result.data(), result.size());
+      writeCacheFile(cacheFilePath(file), result);
     }
   }
   return result;
@@ -3,6 +3,22 @@
 #include <atomic>
 #include <string>
 
+// the download cache keeps remote files as downloaded, compressed logs
+// decompressed with an event index so cached loads skip bz2 entirely, and
+// the timeline computed from each qlog.
+enum class CacheTier {
+  Download = 0,
+  Decompressed = 1,
+  Timeline = 2,
+};
+
+struct FileCacheStats {
+  std::atomic<uint64_t> hits[3] = {};
+  std::atomic<uint64_t> misses[3] = {};
+  std::atomic<uint64_t> evicted_files = 0;
+  std::atomic<uint64_t> evicted_bytes = 0;
+};
+
 class FileReader {
 public:
   FileReader(bool cache_to_local, size_t chunk_size = 0, int retries = 3)
@@ -17,4 +33,15 @@ private:
   bool cache_to_local_;
 };
 
-std::string cacheFilePath(const std::string &url);
+std::string cacheFilePath(const std::string &url, CacheTier tier = CacheTier::Download);
+// reads a cached file and marks it as recently used. counts a miss if it doesn't exist.
+bool readCacheFile(const std::string &file, CacheTier tier, std::string &content);
+// marks a cached file that is read in place as recently used
+bool touchCacheFile(const std::string &file, CacheTier tier);
+// writes atomically. every 256MB written, evicts the least recently used files beyond the size limit
+bool writeCacheFile(const std::string &file, const std::string &content);
+// COMMA_CACHE_LIMIT_MB overrides the default of 20GB
+size_t cacheSizeLimit();
+// evicts the least recently used files in dir until it's within limit
+void trimCache(const std::string &dir, size_t limit);
+FileCacheStats &cacheStats();
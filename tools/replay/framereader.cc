@@ -1,5 +1,10 @@
 #include "tools/replay/framereader.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <tuple>
@@ -19,6 +24,8 @@
 
 namespace {
 
+const int64_t MAX_HEADER_SIZE = 1024 * 1024;
+
 enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *pix_fmts) {
   enum AVPixelFormat *hw_pix_fmt = reinterpret_cast<enum AVPixelFormat *>(ctx->opaque);
   for (const enum AVPixelFormat *p = pix_fmts; *p != -1; p++) {
@@ -29,27 +36,47 @@ enum AVPixelFormat get_hw_format(AVCodecContext *ctx, const enum AVPixelFormat *
   return AV_PIX_FMT_YUV420P;
 }
 
-struct DecoderManager {
-  VideoDecoder *acquire(CameraType type, AVCodecParameters *codecpar, bool hw_decoder) {
-    auto key = std::tuple(type, codecpar->width, codecpar->height);
-    std::unique_lock lock(mutex_);
-    if (auto it = decoders_.find(key); it != decoders_.end()) {
-      return it->second.get();
+// Hands every FrameReader a decoder of its own, so that adjacent segments decode in parallel
+// without seeking a shared decoder back and forth. Released decoders are kept for reuse.
+struct DecoderPool {
+  using Key = std::tuple<CameraType, int, int, bool>;
+
+  std::unique_ptr<VideoDecoder> acquire(CameraType type, AVCodecParameters *codecpar, bool hw_decoder) {
+    auto key = std::tuple(type, codecpar->width, codecpar->height, hw_decoder);
+    {
+      std::unique_lock lock(mutex_);
+      if (auto it = idle_.find(key); it != idle_.end()) {
+        auto decoder = std::move(it->second);
+        idle_.erase(it);
+        return decoder;
+      }
     }
 
     auto decoder = std::make_unique<VideoDecoder>();
-    if (!decoder->open(codecpar, hw_decoder)) {
-      decoder.reset(nullptr);
+    if (!decoder->open(codecpar, hw_decoder, decoder_threads)) {
+      return nullptr;
     }
-    decoders_[key] = std::move(decoder);
-    return decoders_[key].get();
+    decoder->key = key;
+    return decoder;
   }
 
+  void release(std::unique_ptr<VideoDecoder> decoder) {
+    decoder->reset();
+    std::unique_lock lock(mutex_);
+    if (idle_.count(decoder->key) < MAX_IDLE_DECODERS) {
+      idle_.emplace(decoder->key, std::move(decoder));
+    }
+  }
+
+  static const size_t MAX_IDLE_DECODERS = 2;
+  // several segments and cameras decode at once, so each decoder only gets a few threads
+  static const int DEFAULT_DECODER_THREADS = 2;
+  int decoder_threads = DEFAULT_DECODER_THREADS;
   std::mutex mutex_;
-  std::map<std::tuple<CameraType, int, int>, std::unique_ptr<VideoDecoder>> decoders_;
+  std::multimap<Key, std::unique_ptr<VideoDecoder>> idle_;
 };
 
-DecoderManager decoder_manager;
+DecoderPool decoder_pool;
 
 }  // namespace
 
@@ -58,12 +85,18 @@ FrameReader::FrameReader() {
 }
 
 FrameReader::~FrameReader() {
+  if (decoder_) decoder_pool.release(std::move(decoder_));
   if (input_ctx) avformat_close_input(&input_ctx);
 }
 
+void setVideoDecoderThreads(int threads) {
+  decoder_pool.decoder_threads = std::max(0, threads);
+}
+
 bool FrameReader::load(CameraType type, const std::string &url, bool no_hw_decoder, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  auto local_file_path = url.find("https://") == 0 ? cacheFilePath(url) : url;
-  if (!util::file_exists(local_file_path)) {
+  const bool is_remote = url.find("https://") == 0;
+  auto local_file_path = is_remote ? cacheFilePath(url) : url;
+  if (is_remote ? !touchCacheFile(local_file_path, CacheTier::Download) : !util::file_exists(local_file_path)) {
     FileReader f(local_cache, chunk_size, retries);
     if (f.read(url, abort).empty()) {
       return false;
@@ -80,25 +113,87 @@ bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no
   }
   input_ctx->probesize = 10 * 1024 * 1024;  // 10MB
 
-  decoder_ = decoder_manager.acquire(type, input_ctx->streams[0]->codecpar, !no_hw_decoder);
+  decoder_ = decoder_pool.acquire(type, input_ctx->streams[0]->codecpar, !no_hw_decoder);
   if (!decoder_) {
     return false;
   }
   width = decoder_->width;
   height = decoder_->height;
 
+  file_ = file;
+  abort_ = abort;
+  return true;
+}
+
+bool FrameReader::setPacketIndex(const std::vector<EncodedPacket> &packets) {
+  std::lock_guard lk(index_lock_);
+  if (indexed_ || packets.empty() || !packets[0].keyframe || strcmp(input_ctx->iformat->name, "hevc") != 0) {
+    return false;
+  }
+
+  // loggerd writes the codec header, then the packets as they were logged
+  int64_t packets_size = 0;
+  for (const auto &p : packets) packets_size += p.len;
+  const int64_t header_size = avio_size(input_ctx->pb) - packets_size;
+  if (header_size < 0 || header_size > MAX_HEADER_SIZE) {
+    return false;
+  }
+
+  std::vector<PacketInfo> index;
+  index.reserve(packets.size());
+  int64_t pos = header_size;
+  for (const auto &p : packets) {
+    index.push_back({.flags = p.keyframe ? AV_PKT_FLAG_KEY : 0, .pos = pos});
+    pos += p.len;
+  }
+  // the demuxer returns the header with the first packet
+  index[0].pos = 0;
+
+  // the packets we seek to must start with a NAL start code
+  int fd = HANDLE_EINTR(open(file_.c_str(), O_RDONLY));
+  if (fd < 0) return false;
+  bool valid = true;
+  for (size_t i = 1; i < index.size() && valid; ++i) {
+    if ((index[i].flags & AV_PKT_FLAG_KEY) || i == index.size() - 1) {
+      uint8_t code[4] = {};
+      valid = HANDLE_EINTR(pread(fd, code, sizeof(code), index[i].pos)) == sizeof(code) &&
+              code[0] == 0 && code[1] == 0 && (code[2] == 1 || (code[2] == 0 && code[3] == 1));
+    }
+  }
+  close(fd);
+  if (!valid) {
+    return false;
+  }
+
+  packets_info = std::move(index);
+  indexed_ = true;
+  // drop what avformat_find_stream_info() buffered
+  avformat_flush(input_ctx);
+  avio_seek(input_ctx->pb, 0, SEEK_SET);
+  return true;
+}
+
+void FrameReader::scanPackets() {
+  std::lock_guard lk(index_lock_);
+  if (indexed_) return;
+
+  indexed_ = true;
   AVPacket pkt;
   packets_info.reserve(60 * 20);  // 20fps, one minute
-  while (!(abort && *abort) && av_read_frame(input_ctx, &pkt) == 0) {
+  while (!(abort_ && *abort_) && av_read_frame(input_ctx, &pkt) == 0) {
     packets_info.emplace_back(PacketInfo{.flags = pkt.flags, .pos = pkt.pos});
     av_packet_unref(&pkt);
   }
   avio_seek(input_ctx->pb, 0, SEEK_SET);
-  return !packets_info.empty();
+}
+
+size_t FrameReader::getFrameCount() {
+  scanPackets();
+  return packets_info.size();
 }
 
 bool FrameReader::get(int idx, VisionBuf *buf) {
-  if (!buf || idx < 0 || idx >= packets_info.size()) {
+  if (!buf || idx < 0 || idx >= getFrameCount()) {
     return false;
   }
   return decoder_->decode(this, idx, buf);
@@ -118,7 +213,7 @@ VideoDecoder::~VideoDecoder() {
   av_frame_free(&hw_frame_);
 }
 
-bool VideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder) {
+bool VideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder, int threads) {
   const AVCodec *decoder = avcodec_find_decoder(codecpar->codec_id);
   if (!decoder) return false;
 
@@ -133,6 +228,11 @@ bool VideoDecoder::open(AVCodecParameters *codecpar, bool hw_decoder) {
   if (hw_decoder && !initHardwareDecoder(HW_DEVICE_TYPE)) {
     rWarning("No device with hardware decoder found. fallback to CPU decoding.");
   }
+  if (hw_pix_fmt == AV_PIX_FMT_NONE) {
+    // 0 lets FFmpeg pick the number of threads from the cores available, for every decoder
+    decoder_ctx->thread_count = threads;
+    decoder_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  }
 
   if (avcodec_open2(decoder_ctx, decoder, nullptr) < 0) {
     rError("Failed to open codec");
@@ -167,62 +267,77 @@ bool VideoDecoder::initHardwareDecoder(AVHWDeviceType hw_device_type) {
   return true;
 }
 
+void VideoDecoder::reset() {
+  avcodec_flush_buffers(decoder_ctx);
+  next_packet_ = 0;
+}
+
 bool VideoDecoder::decode(FrameReader *reader, int idx, VisionBuf *buf) {
-  int from_idx = idx;
   if (idx != reader->prev_idx + 1) {
     // seeking to the nearest key frame
+    int from_idx = idx;
     for (int i = idx; i >= 0; --i) {
       if (reader->packets_info[i].flags & AV_PKT_FLAG_KEY) {
         from_idx = i;
         break;
       }
     }
+    avcodec_flush_buffers(decoder_ctx);
+    avformat_flush(reader->input_ctx);
     avio_seek(reader->input_ctx->pb, reader->packets_info[from_idx].pos, SEEK_SET);
+    next_packet_ = from_idx;
   }
   reader->prev_idx = idx;
 
-  bool result = false;
-  AVPacket pkt;
-  for (int i = from_idx; i <= idx; ++i) {
-    if (av_read_frame(reader->input_ctx, &pkt) == 0) {
-      AVFrame *f = decodeFrame(&pkt);
-      if (f && i == idx) {
-        result = copyBuffer(f, buf);
-      }
-      av_packet_unref(&pkt);
+  // with frame threading, frames come out a few packets after they went in.
+  // the packet index travels with the frame as its pts.
+  while (true) {
+    int ret = avcodec_receive_frame(decoder_ctx, av_frame_);
+    if (ret == AVERROR(EAGAIN)) {
+      if (!sendPacket(reader)) return false;
+    } else if (ret < 0) {
+      if (ret != AVERROR_EOF) rError("avcodec_receive_frame error: %d", ret);
+      return false;
+    } else if (av_frame_->pts >= idx) {
+      return av_frame_->pts == idx && copyBuffer(av_frame_, buf);
     }
   }
-  return result;
 }
 
-AVFrame *VideoDecoder::decodeFrame(AVPacket *pkt) {
-  int ret = avcodec_send_packet(decoder_ctx, pkt);
-  if (ret < 0) {
-    rError("Error sending a packet for decoding: %d", ret);
-    return nullptr;
-  }
-
-  ret = avcodec_receive_frame(decoder_ctx, av_frame_);
-  if (ret != 0) {
-    rError("avcodec_receive_frame error: %d", ret);
-    return nullptr;
+bool VideoDecoder::sendPacket(FrameReader *reader) {
+  AVPacket pkt;
+  if (next_packet_ >= reader->packets_info.size() || av_read_frame(reader->input_ctx, &pkt) != 0) {
+    // end of file, drain the frames still being decoded
+    return avcodec_send_packet(decoder_ctx, nullptr) == 0;
   }
 
-  if (av_frame_->format == hw_pix_fmt && av_hwframe_transfer_data(hw_frame_, av_frame_, 0) < 0) {
-    rError("error transferring frame data from GPU to CPU");
-    return nullptr;
+  pkt.pts = pkt.dts = next_packet_++;
+  int ret = avcodec_send_packet(decoder_ctx, &pkt);
+  av_packet_unref(&pkt);
+  if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+    rError("Error sending a packet for decoding: %d", ret);
+    return false;
   }
-  return (av_frame_->format == hw_pix_fmt) ? hw_frame_ : av_frame_;
+  return true;
 }
 
 bool VideoDecoder::copyBuffer(AVFrame *f, VisionBuf *buf) {
-  if (hw_pix_fmt == HW_PIX_FMT) {
+  if (f->format == hw_pix_fmt) {
+    if (downloadToBuffer(f, buf)) return true;
+
+    if (av_hwframe_transfer_data(hw_frame_, f, 0) < 0) {
+      rError("error transferring frame data from GPU to CPU");
+      return false;
+    }
     for (int i = 0; i < height/2; i++) {
-      memcpy(buf->y + (i*2 + 0)*buf->stride, f->data[0] + (i*2 + 0)*f->linesize[0], width);
-      memcpy(buf->y + (i*2 + 1)*buf->stride, f->data[0] + (i*2 + 1)*f->linesize[0], width);
-      memcpy(buf->uv + i*buf->stride, f->data[1] + i*f->linesize[1], width);
+      memcpy(buf->y + (i*2 + 0)*buf->stride, hw_frame_->data[0] + (i*2 + 0)*hw_frame_->linesize[0], width);
+      memcpy(buf->y + (i*2 + 1)*buf->stride, hw_frame_->data[0] + (i*2 + 1)*hw_frame_->linesize[0], width);
+      memcpy(buf->uv + i*buf->stride, hw_frame_->data[1] + i*hw_frame_->linesize[1], width);
     }
+    av_frame_unref(hw_frame_);
   } else {
+    // the software decoder outputs planar YUV and keeps its frames as references,
+    // so they are converted rather than decoded into the VisionBuf.
     libyuv::I420ToNV12(f->data[0], f->linesize[0],
                        f->data[1], f->linesize[1],
                        f->data[2], f->linesize[2],
@@ -232,3 +347,17 @@ bool VideoDecoder::copyBuffer(AVFrame *f, VisionBuf *buf) {
   }
   return true;
 }
+
+bool VideoDecoder::downloadToBuffer(AVFrame *f, VisionBuf *buf) {
+  // hardware frames are NV12 already, download them straight into the VisionBuf
+  hw_frame_->format = AV_PIX_FMT_NV12;
+  hw_frame_->width = f->width;
+  hw_frame_->height = f->height;
+  hw_frame_->data[0] = buf->y;
+  hw_frame_->data[1] = buf->uv;
+  hw_frame_->linesize[0] = hw_frame_->linesize[1] = buf->stride;
+  hw_frame_->buf[0] = av_buffer_create((uint8_t *)buf->addr, buf->len, [](void *, uint8_t *) {}, nullptr, 0);
+  bool ret = hw_frame_->buf[0] && av_hwframe_transfer_data(hw_frame_, f, 0) == 0;
+  av_frame_unref(hw_frame_);
+  return ret;
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "msgq/visionipc/visionbuf.h"
@@ -14,6 +18,14 @@ extern "C" {
 
 class VideoDecoder;
 
+// threads of each software decoder, 2 by default. 0 uses all cores.
+void setVideoDecoderThreads(int threads);
+
+struct EncodedPacket {
+  uint32_t len;
+  bool keyframe;
+};
+
 class FrameReader {
 public:
   FrameReader();
@@ -21,12 +33,15 @@ public:
   bool load(CameraType type, const std::string &url, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr, bool local_cache = false,
             int chunk_size = -1, int retries = 0);
   bool loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr);
+  // locates the packets of a raw HEVC file from the logged encodeIdx sizes and keyframe flags, in file order.
+  // returns false if they don't match the file, the packets are then indexed by demuxing on first use.
+  bool setPacketIndex(const std::vector<EncodedPacket> &packets);
   bool get(int idx, VisionBuf *buf);
-  size_t getFrameCount() const { return packets_info.size(); }
+  size_t getFrameCount();
 
   int width = 0, height = 0;
 
-  VideoDecoder *decoder_ = nullptr;
+  std::unique_ptr<VideoDecoder> decoder_;
   AVFormatContext *input_ctx = nullptr;
   int prev_idx = -1;
   struct PacketInfo {
@@ -34,6 +49,14 @@ public:
     int64_t pos;
   };
   std::vector<PacketInfo> packets_info;
+
+private:
+  void scanPackets();
+
+  std::mutex index_lock_;
+  bool indexed_ = false;
+  std::string file_;
+  std::atomic<bool> *abort_ = nullptr;
 };
 
 
@@ -41,17 +64,21 @@ class VideoDecoder {
 public:
   VideoDecoder();
   ~VideoDecoder();
-  bool open(AVCodecParameters *codecpar, bool hw_decoder);
+  bool open(AVCodecParameters *codecpar, bool hw_decoder, int threads);
   bool decode(FrameReader *reader, int idx, VisionBuf *buf);
+  void reset();
   int width = 0, height = 0;
+  std::tuple<CameraType, int, int, bool> key;
 
 private:
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
-  AVFrame *decodeFrame(AVPacket *pkt);
+  bool sendPacket(FrameReader *reader);
   bool copyBuffer(AVFrame *f, VisionBuf *buf);
+  bool downloadToBuffer(AVFrame *f, VisionBuf *buf);
 
   AVFrame *av_frame_, *hw_frame_;
   AVCodecContext *decoder_ctx = nullptr;
   AVPixelFormat hw_pix_fmt = AV_PIX_FMT_NONE;
   AVBufferRef *hw_device_ctx = nullptr;
+  int next_packet_ = 0;
 };
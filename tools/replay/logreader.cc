@@ -1,57 +1,103 @@
 #include "tools/replay/logreader.h"
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <cstring>
 #include <utility>
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
 
+namespace {
+
+// decompressed cache file: header, index of the events in log order, then the decompressed log
+const char DECOMPRESSED_CACHE_MAGIC[8] = "RLOGIDX";
+const uint32_t DECOMPRESSED_CACHE_VERSION = 1;
+
+struct DecompressedCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t num_events;
+  uint64_t data_size;
+};
+
+}  // namespace
+
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
+  const bool compressed = url.find(".bz2") != std::string::npos;
+  const std::string cache_file = local_cache && compressed && url.find("https://") == 0
+                                     ? cacheFilePath(url, CacheTier::Decompressed) : "";
+  if (!cache_file.empty() && loadDecompressedCache(cache_file, abort)) {
+    return true;
+  }
+
   std::string data = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (!data.empty() && url.find(".bz2") != std::string::npos)
+  if (!data.empty() && compressed)
     data = decompressBZ2(data, abort);
 
-  bool success = !data.empty() && load(data.data(), data.size(), abort);
+  std::vector<IndexEntry> index;
+  bool success = !data.empty() && parse(data.data(), data.size(), abort, cache_file.empty() ? nullptr : &index);
+  if (success && !cache_file.empty()) {
+    saveDecompressedCache(cache_file, data, index);
+  }
   if (filters_.empty())
     raw_ = std::move(data);
   return success;
 }
 
 bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
+  return parse(data, size, abort, nullptr);
+}
+
+bool LogReader::parse(const char *data, size_t size, std::atomic<bool> *abort, std::vector<IndexEntry> *index) {
   try {
     events.reserve(65000);
-    kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
+    const capnp::word *begin = (const capnp::word *)data;
+    kj::ArrayPtr<const capnp::word> words(begin, size / sizeof(capnp::word));
     while (words.size() > 0 && !(abort && *abort)) {
       capnp::FlatArrayMessageReader reader(words);
       auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
       auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
       words = kj::arrayPtr(reader.getEnd(), words.end());
 
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
-      }
-
       uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
-        }
+      if (index) {
+        index->push_back({mono_time, (uint32_t)(event_data.begin() - begin), (uint32_t)event_data.size(), (uint16_t)event.which()});
       }
+      addEvent(event.which(), mono_time, event_data);
     }
   } catch (const kj::Exception &e) {
     rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
+  return finishLoading(abort);
+}
 
+void LogReader::addEvent(cereal::Event::Which which, uint64_t mono_time, kj::ArrayPtr<const capnp::word> event_data) {
+  if (!filters_.empty()) {
+    if (which >= filters_.size() || !filters_[which])
+      return;
+    auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+    memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+    event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+  }
+
+  events.emplace_back(which, mono_time, event_data);
+  // Add encodeIdx packet again as a frame packet for the video stream
+  if (which == cereal::Event::ROAD_ENCODE_IDX ||
+      which == cereal::Event::DRIVER_ENCODE_IDX ||
+      which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+    capnp::FlatArrayMessageReader reader(event_data);
+    auto event = reader.getRoot<cereal::Event>();
+    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+    if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+      uint64_t sof = idx.getTimestampSof();
+      events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
+    }
+  }
+}
+
+bool LogReader::finishLoading(std::atomic<bool> *abort) {
   if (!events.empty() && !(abort && *abort)) {
     events.shrink_to_fit();
     std::sort(events.begin(), events.end());
@@ -59,3 +105,58 @@ bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
   }
   return false;
 }
+
+bool LogReader::loadDecompressedCache(const std::string &file, std::atomic<bool> *abort) {
+  std::string content;
+  if (!readCacheFile(file, CacheTier::Decompressed, content)) {
+    return false;
+  }
+
+  DecompressedCacheHeader header = {};
+  if (content.size() >= sizeof(header)) {
+    memcpy(&header, content.data(), sizeof(header));
+  }
+  const size_t index_size = header.num_events * sizeof(IndexEntry);
+  if (memcmp(header.magic, DECOMPRESSED_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != DECOMPRESSED_CACHE_VERSION ||
+      content.size() != sizeof(header) + index_size + header.data_size) {
+    rWarning("invalid decompressed cache file %s", file.c_str());
+    unlink(file.c_str());
+    return false;
+  }
+
+  const IndexEntry *index = (const IndexEntry *)(content.data() + sizeof(header));
+  const capnp::word *words = (const capnp::word *)(content.data() + sizeof(header) + index_size);
+  const size_t num_words = header.data_size / sizeof(capnp::word);
+  events.reserve(header.num_events + header.num_events / 10);
+  for (size_t i = 0; i < header.num_events && !(abort && *abort); ++i) {
+    const IndexEntry &e = index[i];
+    if ((size_t)e.offset + e.size > num_words) {
+      rWarning("invalid decompressed cache file %s", file.c_str());
+      unlink(file.c_str());
+      events.clear();
+      return false;
+    }
+    addEvent((cereal::Event::Which)e.which, e.mono_time, kj::arrayPtr(words + e.offset, e.size));
+  }
+
+  bool success = finishLoading(abort);
+  if (filters_.empty())
+    raw_ = std::move(content);
+  return success;
+}
+
+void LogReader::saveDecompressedCache(const std::string &file, const std::string &data, const std::vector<IndexEntry> &index) {
+  DecompressedCacheHeader header = {};
+  memcpy(header.magic, DECOMPRESSED_CACHE_MAGIC, sizeof(header.magic));
+  header.version = DECOMPRESSED_CACHE_VERSION;
+  header.num_events = index.size();
+  header.data_size = data.size();
+
+  std::string content;
+  content.reserve(sizeof(header) + index.size() * sizeof(IndexEntry) + data.size());
+  content.append((const char *)&header, sizeof(header));
+  content.append((const char *)index.data(), index.size() * sizeof(IndexEntry));
+  content.append(data);
+  writeCacheFile(file, content);
+}
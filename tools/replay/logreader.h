@@ -34,6 +34,19 @@ public:
   std::vector<Event> events;
 
 private:
+  struct IndexEntry {
+    uint64_t mono_time;
+    uint32_t offset;  // in words
+    uint32_t size;
+    uint16_t which;
+    uint16_t reserved[3];  // written to the cache file, so no uninitialized padding
+  };
+  bool parse(const char *data, size_t size, std::atomic<bool> *abort, std::vector<IndexEntry> *index);
+  void addEvent(cereal::Event::Which which, uint64_t mono_time, kj::ArrayPtr<const capnp::word> event_data);
+  bool finishLoading(std::atomic<bool> *abort);
+  bool loadDecompressedCache(const std::string &file, std::atomic<bool> *abort);
+  void saveDecompressedCache(const std::string &file, const std::string &data, const std::vector<IndexEntry> &index);
+
   std::string raw_;
   std::vector<bool> filters_;
   MonotonicBuffer buffer_{1024 * 1024};
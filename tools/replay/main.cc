@@ -22,7 +22,8 @@ int main(int argc, char *argv[]) {
       {"no-hw-decoder", REPLAY_FLAG_NO_HW_DECODER, "disable HW video decoding"},
       {"no-vipc", REPLAY_FLAG_NO_VIPC, "do not output video"},
       {"all", REPLAY_FLAG_ALL_SERVICES, "do output all messages including uiDebug, userFlag"
-                                        ". this may causes issues when used along with UI"}
+                                        ". this may causes issues when used along with UI"},
+      {"lockstep", REPLAY_FLAG_LOCKSTEP, "publish as fast as the consumers keep up instead of in real time"}
   };
 
   QCommandLineParser parser;
@@ -35,6 +36,10 @@ int main(int argc, char *argv[]) {
   parser.addOption({{"s", "start"}, "start from <seconds>", "seconds"});
   parser.addOption({"x", QString("playback <speed>. between %1 - %2")
                         .arg(ConsoleUI::speed_array.front()).arg(ConsoleUI::speed_array.back()), "speed"});
+  parser.addOption({"responses", "lockstep: services to wait for, published by the consumers", "services"});
+  parser.addOption({"window", "lockstep: number of responses the consumers may lag behind. default is 0", "n"});
+  parser.addOption({"lockstep-timeout", "lockstep: seconds to wait for a response before skipping it, 0 waits forever. default is 10", "seconds"});
+  parser.addOption({"decoder-threads", "threads of each software video decoder, 0 for all cores. default is 2", "n"});
   parser.addOption({"demo", "use a demo route instead of providing your own"});
   parser.addOption({"data_dir", "local directory with routes", "data_dir"});
   parser.addOption({"prefix", "set OPENPILOT_PREFIX", "prefix"});
@@ -51,6 +56,7 @@ int main(int argc, char *argv[]) {
   const QString route = args.empty() ? DEMO_ROUTE : args.first();
   QStringList allow = parser.value("allow").isEmpty() ? QStringList{} : parser.value("allow").split(",");
   QStringList block = parser.value("block").isEmpty() ? QStringList{} : parser.value("block").split(",");
+  QStringList responses = parser.value("responses").isEmpty() ? QStringList{} : parser.value("responses").split(",");
 
   uint32_t replay_flags = REPLAY_FLAG_NONE;
   for (const auto &[name, flag, _] : flags) {
@@ -58,6 +64,10 @@ int main(int argc, char *argv[]) {
       replay_flags |= flag;
     }
   }
+  if (replay_flags & REPLAY_FLAG_LOCKSTEP) {
+    // the consumers publish the responses
+    block += responses;
+  }
 
   std::unique_ptr<OpenpilotPrefix> op_prefix;
   auto prefix = parser.value("prefix");
@@ -69,6 +79,13 @@ int main(int argc, char *argv[]) {
   if (!parser.value("c").isEmpty()) {
     replay->setSegmentCacheLimit(parser.value("c").toInt());
   }
+  if (!parser.value("decoder-threads").isEmpty()) {
+    setVideoDecoderThreads(parser.value("decoder-threads").toInt());
+  }
+  if (replay_flags & REPLAY_FLAG_LOCKSTEP) {
+    const QString timeout = parser.value("lockstep-timeout");
+    replay->setLockstepResponses(responses, parser.value("window").toInt(), timeout.isEmpty() ? 10 : timeout.toDouble());
+  }
   if (!parser.value("x").isEmpty()) {
     replay->setSpeed(std::clamp(parser.value("x").toFloat(),
                                 ConsoleUI::speed_array.front(), ConsoleUI::speed_array.back()));
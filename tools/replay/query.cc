@@ -0,0 +1,209 @@
+#include "tools/replay/query.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include <QThreadPool>
+#include <QtConcurrent>
+
+EventQuery::EventQuery(const std::string &service) {
+  try {
+    service_field_ = capnp::Schema::from<cereal::Event>().asStruct().getFieldByName(service);
+    which_ = (cereal::Event::Which)service_field_.getProto().getDiscriminantValue();
+    valid_ = true;
+  } catch (const kj::Exception &e) {
+    rWarning("query: unknown service %s", service.c_str());
+  }
+}
+
+bool EventQuery::compile(const std::string &path, FieldPath &fields) {
+  if (!valid_) return false;
+
+  auto type = service_field_.getType();
+  std::istringstream stream(path);
+  for (std::string name; std::getline(stream, name, '.');) {
+    if (name.empty()) continue;
+    if (!type.isStruct()) {
+      rWarning("query: %s is not a struct field path", path.c_str());
+      return valid_ = false;
+    }
+    try {
+      fields.push_back(type.asStruct().getFieldByName(name));
+    } catch (const kj::Exception &e) {
+      rWarning("query: unknown field %s in %s", name.c_str(), path.c_str());
+      return valid_ = false;
+    }
+    type = fields.back().getType();
+  }
+  return true;
+}
+
+EventQuery &EventQuery::where(const std::string &path, Predicate predicate) {
+  FieldPath fields;
+  if (compile(path, fields)) {
+    conditions_.emplace_back(std::move(fields), std::move(predicate));
+  }
+  return *this;
+}
+
+EventQuery &EventQuery::splitOn(const std::string &path) {
+  FieldPath fields;
+  if (compile(path, fields)) {
+    split_on_ = std::move(fields);
+  }
+  return *this;
+}
+
+EventQuery &EventQuery::maxGap(double seconds) {
+  max_gap_ = seconds * 1e9;
+  return *this;
+}
+
+capnp::DynamicValue::Reader EventQuery::get(const cereal::Event::Reader &event, const FieldPath &fields) const {
+  capnp::DynamicValue::Reader value = capnp::toDynamic(event).get(service_field_);
+  for (const auto &field : fields) {
+    value = value.as<capnp::DynamicStruct>().get(field);
+  }
+  return value;
+}
+
+bool EventQuery::matches(const cereal::Event::Reader &event) const {
+  if (!valid_ || event.which() != which_) return false;
+
+  for (const auto &[fields, predicate] : conditions_) {
+    if (!predicate(get(event, fields))) return false;
+  }
+  return true;
+}
+
+std::string EventQuery::key(const cereal::Event::Reader &event) const {
+  if (!split_on_) return {};
+
+  auto value = get(event, *split_on_);
+  switch (value.getType()) {
+    case capnp::DynamicValue::TEXT: return value.as<capnp::Text>().cStr();
+    case capnp::DynamicValue::BOOL: return value.as<bool>() ? "1" : "0";
+    case capnp::DynamicValue::INT: return std::to_string(value.as<int64_t>());
+    case capnp::DynamicValue::UINT: return std::to_string(value.as<uint64_t>());
+    case capnp::DynamicValue::FLOAT: return std::to_string(value.as<double>());
+    case capnp::DynamicValue::ENUM: return std::to_string(value.as<capnp::DynamicEnum>().getRaw());
+    default: return kj::str(value).cStr();
+  }
+}
+
+EventQuery::Partial EventQuery::scan(const std::vector<Event> &events) const {
+  Partial p;
+  if (!valid_) return p;
+
+  bool in_range = false;
+  std::string cur_key;
+  uint64_t last_match = 0;
+  for (const Event &e : events) {
+    if (e.which != which_ || e.eidx_segnum != -1) continue;
+
+    capnp::FlatArrayMessageReader reader(e.data);
+    auto event = reader.getRoot<cereal::Event>();
+    const bool match = matches(event);
+    const std::string k = match ? key(event) : std::string{};
+    if (in_range) {
+      if (e.mono_time - last_match > max_gap_) {
+        in_range = false;
+      } else if (!match || k != cur_key) {
+        p.ranges.back().end = e.mono_time;
+        in_range = false;
+      }
+    }
+    if (match) {
+      if (!in_range) {
+        if (p.events == 0) {
+          p.open_begin = true;
+          p.begin_key = k;
+        }
+        p.ranges.push_back({e.mono_time, e.mono_time});
+        cur_key = k;
+        in_range = true;
+      }
+      p.ranges.back().end = last_match = e.mono_time;
+    }
+    if (p.events++ == 0) {
+      p.first_time = e.mono_time;
+    }
+  }
+  p.open_end = in_range;
+  p.end_key = cur_key;
+  return p;
+}
+
+void EventQuery::join(Partial &acc, Partial &&next) const {
+  if (next.events == 0) return;
+  if (acc.events == 0) {
+    acc = std::move(next);
+    return;
+  }
+
+  auto first = next.ranges.begin();
+  if (acc.open_end && next.first_time - acc.ranges.back().end <= max_gap_) {
+    if (next.open_begin && next.begin_key == acc.end_key) {
+      // the range continues into the next log
+      acc.ranges.back().end = first->end;
+      ++first;
+    } else {
+      acc.ranges.back().end = next.first_time;
+    }
+  }
+  acc.ranges.insert(acc.ranges.end(), first, next.ranges.end());
+  acc.open_end = next.open_end;
+  acc.end_key = next.end_key;
+  acc.events += next.events;
+}
+
+std::vector<EventQuery::Partial> queryLogs(const std::vector<EventQuery> &queries, const std::vector<std::string> &logs,
+                                           QThreadPool &pool, const LogQueryHooks &hooks, bool local_cache, std::atomic<bool> *abort) {
+  std::vector<bool> filters;
+  if (!hooks.keep_logs) {
+    filters.resize(capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size());
+    for (const auto &q : queries) {
+      if (q.isValid()) filters[q.which()] = true;
+    }
+  }
+
+  std::vector<std::vector<EventQuery::Partial>> partials(logs.size());
+  std::vector<QFuture<void>> futures;
+  for (size_t i = 0; i < logs.size(); ++i) {
+    futures.push_back(QtConcurrent::run(&pool, [&, i]() {
+      if (abort && *abort) return;
+
+      auto &log_partials = partials[i];
+      const bool loaded = hooks.load && hooks.load(i, log_partials);
+      std::shared_ptr<LogReader> log;
+      if (!loaded || hooks.keep_logs) {
+        log = std::make_shared<LogReader>(filters);
+        if (!log->load(logs[i], abort, local_cache, 0, 3)) {
+          rWarning("query: failed to load %s", logs[i].c_str());
+          log_partials.clear();
+          return;
+        }
+      }
+      if (!loaded) {
+        log_partials.clear();
+        for (const auto &q : queries) {
+          log_partials.push_back(q.scan(log->events));
+        }
+      }
+      if (hooks.done) {
+        hooks.done(i, log_partials, log);
+      }
+    }));
+  }
+  for (auto &f : futures) {
+    f.waitForFinished();
+  }
+
+  std::vector<EventQuery::Partial> results(queries.size());
+  for (auto &log_partials : partials) {
+    for (size_t q = 0; q < std::min(queries.size(), log_partials.size()); ++q) {
+      queries[q].join(results[q], std::move(log_partials[q]));
+    }
+  }
+  return results;
+}
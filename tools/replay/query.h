@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <capnp/dynamic.h>
+
+#include "tools/replay/logreader.h"
+
+class QThreadPool;
+
+struct QueryRange {
+  uint64_t begin;  // mono time of the first matching event
+  uint64_t end;    // mono time of the event that ended the range, or of the last matching one
+};
+
+// matches the events of one service on which all conditions hold, and returns the time ranges
+// of consecutive matching events. field paths are resolved against the schema once.
+class EventQuery {
+public:
+  typedef std::function<bool(const capnp::DynamicValue::Reader &value)> Predicate;
+
+  explicit EventQuery(const std::string &service);
+  // `path` is dot separated and relative to the service, e.g. "cruiseState.enabled".
+  // an empty path passes the service itself to the predicate.
+  EventQuery &where(const std::string &path, Predicate predicate);
+  // ranges also end where the value of this field changes
+  EventQuery &splitOn(const std::string &path);
+  // ranges also end when the next matching event is more than `seconds` later
+  EventQuery &maxGap(double seconds);
+  inline bool isValid() const { return valid_; }
+  inline cereal::Event::Which which() const { return which_; }
+  bool matches(const cereal::Event::Reader &event) const;
+
+  // the ranges matched in one log, joined with the ones of the following logs by join()
+  struct Partial {
+    std::vector<QueryRange> ranges;
+    size_t events = 0;  // of the service
+    uint64_t first_time = 0;
+    bool open_begin = false;  // the first range starts at the first event of the service
+    bool open_end = false;    // the last range still matched at the last event of the service
+    std::string begin_key, end_key;
+  };
+  Partial scan(const std::vector<Event> &events) const;
+  void join(Partial &acc, Partial &&next) const;
+
+private:
+  typedef std::vector<capnp::StructSchema::Field> FieldPath;
+  bool compile(const std::string &path, FieldPath &fields);
+  capnp::DynamicValue::Reader get(const cereal::Event::Reader &event, const FieldPath &fields) const;
+  std::string key(const cereal::Event::Reader &event) const;
+
+  bool valid_ = false;
+  cereal::Event::Which which_;
+  capnp::StructSchema::Field service_field_;
+  std::vector<std::pair<FieldPath, Predicate>> conditions_;
+  std::optional<FieldPath> split_on_;
+  uint64_t max_gap_ = UINT64_MAX;
+};
+
+// optional callbacks of queryLogs, called on the pool threads
+struct LogQueryHooks {
+  // may fill in the partials of log i, e.g. from a cache, so that it's not scanned
+  std::function<bool(size_t i, std::vector<EventQuery::Partial> &partials)> load;
+  // called once log i is done, in any order. `log` is null if its partials came from load()
+  // and keep_logs isn't set
+  std::function<void(size_t i, const std::vector<EventQuery::Partial> &partials, std::shared_ptr<LogReader> log)> done;
+  // load the logs with all services, and also the ones whose partials came from load()
+  bool keep_logs = false;
+};
+
+// scans the logs on `pool`, by default keeping only the queried services, and returns the
+// partials of each query joined over all logs in log order. logs that fail to load are skipped.
+std::vector<EventQuery::Partial> queryLogs(const std::vector<EventQuery> &queries, const std::vector<std::string> &logs,
+                                           QThreadPool &pool, const LogQueryHooks &hooks = {},
+                                           bool local_cache = true, std::atomic<bool> *abort = nullptr);
@@ -1,12 +1,18 @@
 #include "tools/replay/replay.h"
 
+#include <unistd.h>
+
 #include <QDebug>
 #include <QtConcurrent>
 #include <capnp/dynamic.h>
 #include <csignal>
+#include <iomanip>
+#include <sstream>
 #include "cereal/services.h"
 #include "common/params.h"
 #include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
 
 static void interrupt_sleep_handler(int signal) {}
@@ -64,6 +70,13 @@ void Replay::stop() {
   timeline_future.waitForFinished();
   camera_server_.reset(nullptr);
   segments_.clear();
+
+  auto &stats = cacheStats();
+  if (stats.hits[0] + stats.misses[0] + stats.hits[2] > 0) {
+    rInfo("file cache: downloads %lu hits, %lu misses. decompressed logs %lu hits, %lu misses. timelines %lu hits, %lu misses. evicted %lu files",
+          stats.hits[0].load(), stats.misses[0].load(), stats.hits[1].load(), stats.misses[1].load(),
+          stats.hits[2].load(), stats.misses[2].load(), stats.evicted_files.load());
+  }
 }
 
 bool Replay::load() {
@@ -102,6 +115,62 @@ void Replay::updateEvents(const std::function<bool()> &update_events_function) {
   stream_cv_.notify_one();
 }
 
+void Replay::setLockstepResponses(const QStringList &response_services, int window, double timeout) {
+  auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+  lockstep_window_ = std::max(0, window);
+  lockstep_timeout_ns_ = std::max(0.0, timeout) * 1e9;
+  lockstep_index_.assign(sockets_.size(), -1);
+  lockstep_responses_.clear();
+  lockstep_ctx_.reset(Context::create());
+  lockstep_poller_.reset(Poller::create());
+
+  for (const auto &name : response_services) {
+    const std::string service = name.toStdString();
+    if (services.count(service) == 0) {
+      rWarning("lockstep: unknown service %s", service.c_str());
+      continue;
+    }
+    uint16_t which = event_struct.getFieldByName(service).getProto().getDiscriminantValue();
+    if (sockets_[which]) {
+      rWarning("lockstep: %s is also published by replay, it should be blocked", service.c_str());
+    }
+    // keep the logged responses, they are the points to sync on
+    if (!filters_.empty()) {
+      filters_[which] = true;
+    }
+    auto &r = lockstep_responses_.emplace_back();
+    r.name = service;
+    r.sock.reset(SubSocket::create(lockstep_ctx_.get(), service));
+    lockstep_poller_->registerSocket(r.sock.get());
+    lockstep_index_[which] = lockstep_responses_.size() - 1;
+  }
+  addFlag(REPLAY_FLAG_LOCKSTEP);
+}
+
+void Replay::addConsumer(const QStringList &service_names, ReplayConsumer consumer) {
+  auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+  auto &c = consumers_.emplace_back();
+  c.callback = std::move(consumer);
+  c.services.assign(sockets_.size(), service_names.empty());
+  for (const auto &name : service_names) {
+    const std::string service = name.toStdString();
+    if (services.count(service) == 0) {
+      rWarning("consumer: unknown service %s", service.c_str());
+      continue;
+    }
+    uint16_t which = event_struct.getFieldByName(service).getProto().getDiscriminantValue();
+    if (!sockets_[which]) {
+      rWarning("consumer: %s is not replayed", service.c_str());
+    }
+    c.services[which] = true;
+  }
+
+  consumed_.resize(sockets_.size());
+  for (int i = 0; i < consumed_.size(); ++i) {
+    consumed_[i] = consumed_[i] || c.services[i];
+  }
+}
+
 void Replay::seekTo(double seconds, bool relative) {
   updateEvents([&]() {
     double target_time = relative ? seconds + currentSeconds() : seconds;
@@ -144,66 +213,157 @@ void Replay::seekToFlag(FindFlag flag) {
   }
 }
 
-void Replay::buildTimeline() {
-  uint64_t engaged_begin = 0;
-  bool engaged = false;
-
-  auto alert_status = cereal::ControlsState::AlertStatus::NORMAL;
-  auto alert_size = cereal::ControlsState::AlertSize::NONE;
-  uint64_t alert_begin = 0;
-  std::string alert_type;
-
-  const TimelineType timeline_types[] = {
-    [(int)cereal::ControlsState::AlertStatus::NORMAL] = TimelineType::AlertInfo,
-    [(int)cereal::ControlsState::AlertStatus::USER_PROMPT] = TimelineType::AlertWarning,
-    [(int)cereal::ControlsState::AlertStatus::CRITICAL] = TimelineType::AlertCritical,
+namespace {
+
+// each worker downloads and decompresses a qlog, keep it to a few connections and cores
+const int TIMELINE_THREADS = 4;
+const int TIMELINE_CACHE_VERSION = 1;
+
+std::vector<std::pair<TimelineType, EventQuery>> timelineQueries() {
+  using cereal::ControlsState;
+  std::vector<std::pair<TimelineType, EventQuery>> queries;
+  queries.emplace_back(TimelineType::Engaged, EventQuery("controlsState").where("enabled", [](const capnp::DynamicValue::Reader &v) {
+    return v.as<bool>();
+  }));
+  const std::pair<ControlsState::AlertStatus, TimelineType> alert_types[] = {
+    {ControlsState::AlertStatus::NORMAL, TimelineType::AlertInfo},
+    {ControlsState::AlertStatus::USER_PROMPT, TimelineType::AlertWarning},
+    {ControlsState::AlertStatus::CRITICAL, TimelineType::AlertCritical},
   };
+  for (auto [status, type] : alert_types) {
+    auto query = EventQuery("controlsState")
+      .where("alertStatus", [status = status](const capnp::DynamicValue::Reader &v) { return v.as<ControlsState::AlertStatus>() == status; })
+      .where("alertSize", [](const capnp::DynamicValue::Reader &v) { return v.as<ControlsState::AlertSize>() != ControlsState::AlertSize::NONE; })
+      .where("alertType", [](const capnp::DynamicValue::Reader &v) { return v.as<capnp::Text>().size() > 0; })
+      .splitOn("alertType");
+    queries.emplace_back(type, std::move(query));
+  }
+  queries.emplace_back(TimelineType::UserFlag, EventQuery("userFlag").maxGap(0));
+  return queries;
+}
+
+bool loadTimelineCache(const std::string &file, size_t num_queries, uint64_t &last_mono_time, std::vector<EventQuery::Partial> &partials) {
+  std::string content;
+  if (!readCacheFile(file, CacheTier::Timeline, content)) return false;
+
+  std::istringstream stream(content);
+  int version = 0;
+  size_t n = 0;
+  stream >> version >> last_mono_time >> n;
+  partials.resize(n);
+  for (auto &p : partials) {
+    size_t num_ranges = 0;
+    stream >> p.events >> p.first_time >> p.open_begin >> p.open_end >> std::quoted(p.begin_key) >> std::quoted(p.end_key) >> num_ranges;
+    p.ranges.resize(stream ? num_ranges : 0);
+    for (auto &r : p.ranges) {
+      stream >> r.begin >> r.end;
+    }
+  }
+  if (!stream || version != TIMELINE_CACHE_VERSION || n != num_queries) {
+    rWarning("invalid timeline cache file %s", file.c_str());
+    unlink(file.c_str());
+    return false;
+  }
+  return true;
+}
 
+void saveTimelineCache(const std::string &file, uint64_t last_mono_time, const std::vector<EventQuery::Partial> &partials) {
+  std::ostringstream stream;
+  stream << TIMELINE_CACHE_VERSION << ' ' << last_mono_time << ' ' << partials.size() << '\n';
+  for (const auto &p : partials) {
+    stream << p.events << ' ' << p.first_time << ' ' << p.open_begin << ' ' << p.open_end << ' '
+           << std::quoted(p.begin_key) << ' ' << std::quoted(p.end_key) << ' ' << p.ranges.size();
+    for (const auto &r : p.ranges) {
+      stream << ' ' << r.begin << ' ' << r.end;
+    }
+    stream << '\n';
+  }
+  writeCacheFile(file, stream.str());
+}
+
+}  // namespace
+
+void Replay::buildTimeline() {
   const auto &route_segments = route_->segments();
-  for (auto it = route_segments.cbegin(); it != route_segments.cend() && !exit_; ++it) {
-    std::shared_ptr<LogReader> log(new LogReader());
-    if (!log->load(it->second.qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3) || log->events.empty()) continue;
-
-    std::vector<std::tuple<double, double, TimelineType>> timeline;
-    for (const Event &e : log->events) {
-      if (e.which == cereal::Event::Which::CONTROLS_STATE) {
-        capnp::FlatArrayMessageReader reader(e.data);
-        auto event = reader.getRoot<cereal::Event>();
-        auto cs = event.getControlsState();
-
-        if (engaged != cs.getEnabled()) {
-          if (engaged) {
-            timeline.push_back({toSeconds(engaged_begin), toSeconds(e.mono_time), TimelineType::Engaged});
-          }
-          engaged_begin = e.mono_time;
-          engaged = cs.getEnabled();
-        }
-
-        if (alert_type != cs.getAlertType().cStr() || alert_status != cs.getAlertStatus()) {
-          if (!alert_type.empty() && alert_size != cereal::ControlsState::AlertSize::NONE) {
-            timeline.push_back({toSeconds(alert_begin), toSeconds(e.mono_time), timeline_types[(int)alert_status]});
-          }
-          alert_begin = e.mono_time;
-          alert_type = cs.getAlertType().cStr();
-          alert_size = cs.getAlertSize();
-          alert_status = cs.getAlertStatus();
-        }
-      } else if (e.which == cereal::Event::Which::USER_FLAG) {
-        timeline.push_back({toSeconds(e.mono_time), toSeconds(e.mono_time), TimelineType::UserFlag});
+  if (route_segments.empty()) return;
+
+  const auto timeline_queries = timelineQueries();
+  std::vector<EventQuery> queries;
+  for (const auto &[type, query] : timeline_queries) {
+    queries.push_back(query);
+  }
+  std::vector<int> segments;
+  std::vector<std::string> qlogs;
+  for (const auto &[n, files] : route_segments) {
+    segments.push_back(n);
+    qlogs.push_back(files.qlog.toStdString());
+  }
+
+  const bool local_cache = !hasFlag(REPLAY_FLAG_NO_FILE_CACHE);
+  // the qlogs of cached timelines are only loaded if someone uses them
+  const bool load_qlogs = isSignalConnected(QMetaMethod::fromSignal(&Replay::qLogLoaded));
+  std::vector<std::string> cache_files(qlogs.size());
+  std::vector<uint64_t> last_mono_times(qlogs.size());
+  std::vector<char> cached(qlogs.size());
+
+  LogQueryHooks hooks;
+  hooks.keep_logs = load_qlogs;
+  hooks.load = [&](size_t i, std::vector<EventQuery::Partial> &partials) {
+    if (local_cache && qlogs[i].find("https://") == 0) {
+      cache_files[i] = cacheFilePath(qlogs[i], CacheTier::Timeline);
+      cached[i] = loadTimelineCache(cache_files[i], queries.size(), last_mono_times[i], partials);
+    }
+    return (bool)cached[i];
+  };
+  hooks.done = [&](size_t i, const std::vector<EventQuery::Partial> &partials, std::shared_ptr<LogReader> log) {
+    if (!cached[i]) {
+      last_mono_times[i] = log->events.back().mono_time;
+      if (!cache_files[i].empty()) {
+        saveTimelineCache(cache_files[i], last_mono_times[i], partials);
       }
     }
 
-    {
-      std::lock_guard lk(timeline_lock);
-      timeline_.insert(timeline_.end(), timeline.begin(), timeline.end());
-      std::sort(timeline_.begin(), timeline_.end(), [](auto &l, auto &r) { return std::get<2>(l) < std::get<2>(r); });
+    mergeTimeline(segments[i], std::vector<EventQuery::Partial>(partials), timeline_queries);
+    if (segments[i] == segments.back()) {
+      emit totalSecondsUpdated(toSeconds(last_mono_times[i]));
+    }
+    if (load_qlogs) {
+      emit qLogLoaded(log);
     }
+  };
 
-    if (it->first == route_segments.rbegin()->first) {
-      emit totalSecondsUpdated(toSeconds(log->events.back().mono_time));
+  QThreadPool pool;
+  pool.setMaxThreadCount(std::min(TIMELINE_THREADS, QThread::idealThreadCount()));
+  queryLogs(queries, qlogs, pool, hooks, local_cache, &exit_);
+}
+
+void Replay::mergeTimeline(int n, std::vector<EventQuery::Partial> &&partials,
+                           const std::vector<std::pair<TimelineType, EventQuery>> &queries) {
+  std::lock_guard lk(timeline_lock);
+  segment_timelines_[n] = std::move(partials);
+
+  // segments finish in any order. the runs of each segment are sorted, so joining them in segment
+  // order gives each type's ranges in time order, and the types in TimelineType order.
+  std::vector<std::tuple<double, double, TimelineType>> timeline;
+  for (int i = 0; i < queries.size(); ++i) {
+    const auto &[type, query] = queries[i];
+    EventQuery::Partial acc;
+    auto append = [&, type = type]() {
+      for (const auto &r : acc.ranges) {
+        timeline.push_back({toSeconds(r.begin), toSeconds(r.end), type});
+      }
+      acc = {};
+    };
+    int prev = -1;
+    for (const auto &[seg, seg_partials] : segment_timelines_) {
+      // ranges don't continue across segments that aren't loaded yet
+      if (prev != -1 && seg != prev + 1) append();
+      query.join(acc, EventQuery::Partial(seg_partials[i]));
+      prev = seg;
     }
-    emit qLogLoaded(log);
+    append();
   }
+  timeline_ = std::move(timeline);
 }
 
 std::optional<uint64_t> Replay::find(FindFlag flag) {
@@ -323,7 +483,7 @@ void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::
     size_t size = new_events.size();
     const auto &events = segments_.at(n)->log->events;
     std::copy_if(events.begin(), events.end(), std::back_inserter(new_events),
-                  [this](const Event &e) { return e.which < sockets_.size() && sockets_[e.which] != nullptr; });
+                  [this](const Event &e) { return e.which < sockets_.size() && (sockets_[e.which] != nullptr || isLockstepResponse(e.which)); });
     std::inplace_merge(new_events.begin(), new_events.begin() + size, new_events.end());
   }
 
@@ -398,20 +558,45 @@ void Replay::startStream(const Segment *cur_segment) {
 void Replay::publishMessage(const Event *e) {
   if (event_filter && event_filter(e, filter_opaque)) return;
 
-  if (sm == nullptr) {
+  const bool consumed = !consumed_.empty() && consumed_[e->which];
+  if (sm == nullptr && !consumed) {
     auto bytes = e->data.asBytes();
     int ret = pm->send(sockets_[e->which], (capnp::byte *)bytes.begin(), bytes.size());
     if (ret == -1) {
       rWarning("stop publishing %s due to multiple publishers error", sockets_[e->which]);
       sockets_[e->which] = nullptr;
     }
+    return;
+  }
+
+  // in-process, the event is parsed once and delivered with the others of this pacing tick
+  auto event = batch_readers_.emplace_back(e->data).getRoot<cereal::Event>();
+  if (consumed) {
+    for (auto &c : consumers_) {
+      if (c.services[e->which]) c.batch.push_back({e->which, e->mono_time, event});
+    }
   } else {
-    capnp::FlatArrayMessageReader reader(e->data);
-    auto event = reader.getRoot<cereal::Event>();
-    sm->update_msgs(nanos_since_boot(), {{sockets_[e->which], event}});
+    sm_batch_.emplace_back(sockets_[e->which], event);
+  }
+  if (batch_readers_.size() >= MAX_BATCH_SIZE) {
+    deliverBatch();
   }
 }
 
+void Replay::deliverBatch() {
+  for (auto &c : consumers_) {
+    if (!c.batch.empty()) {
+      c.callback(c.batch);
+      c.batch.clear();
+    }
+  }
+  if (!sm_batch_.empty()) {
+    sm->update_msgs(nanos_since_boot(), sm_batch_);
+    sm_batch_.clear();
+  }
+  batch_readers_.clear();
+}
+
 void Replay::publishFrame(const Event *e) {
   CameraType cam;
   switch (e->which) {
@@ -475,6 +660,11 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
   uint64_t loop_start_ts = nanos_since_boot();
   double prev_replay_speed = speed_;
 
+  const bool lockstep = hasFlag(REPLAY_FLAG_LOCKSTEP) && sm == nullptr;
+  if (lockstep && cur_mono_time_ != lockstep_resume_ts_) {
+    resetLockstep();
+  }
+
   for (; !paused_ && first != last; ++first) {
     const Event &evt = *first;
     int segment = toSeconds(evt.mono_time) / 60;
@@ -484,22 +674,31 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
       QMetaObject::invokeMethod(this, &Replay::updateSegmentsCache, Qt::QueuedConnection);
     }
 
+    if (lockstep && isLockstepResponse(evt.which)) {
+      deliverBatch();
+      if (!waitForResponses(lockstep_index_[evt.which])) break;
+      continue;
+    }
+
      // Skip events if socket is not present
     if (!sockets_[evt.which]) continue;
 
     cur_mono_time_ = evt.mono_time;
-    const uint64_t current_nanos = nanos_since_boot();
-    const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
-
-    // Reset timestamps for potential synchronization issues:
-    // - A negative time_diff may indicate slow execution or system wake-up,
-    // - A time_diff exceeding 1 second suggests a skipped segment.
-    if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
-      evt_start_ts = evt.mono_time;
-      loop_start_ts = current_nanos;
-      prev_replay_speed = speed_;
-    } else if (time_diff > 0) {
-      precise_nano_sleep(time_diff, paused_);
+    if (!lockstep) {
+      const uint64_t current_nanos = nanos_since_boot();
+      const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
+
+      // Reset timestamps for potential synchronization issues:
+      // - A negative time_diff may indicate slow execution or system wake-up,
+      // - A time_diff exceeding 1 second suggests a skipped segment.
+      if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
+        evt_start_ts = evt.mono_time;
+        loop_start_ts = current_nanos;
+        prev_replay_speed = speed_;
+      } else if (time_diff > 0) {
+        deliverBatch();
+        precise_nano_sleep(time_diff, paused_);
+      }
     }
 
     if (paused_) break;
@@ -507,12 +706,117 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
     if (evt.eidx_segnum == -1) {
       publishMessage(&evt);
     } else if (camera_server_) {
-      if (speed_ > 1.0) {
+      deliverBatch();
+      if (speed_ > 1.0 || lockstep) {
         camera_server_->waitForSent();
       }
       publishFrame(&evt);
     }
+
+    if (lockstep) {
+      ++lockstep_stats_.events;
+      reportLockstep();
+    }
   }
+  deliverBatch();
 
+  if (lockstep) {
+    lockstep_resume_ts_ = cur_mono_time_;
+    if (first == last && current_segment_ >= segments_.rbegin()->first) {
+      reportLockstep(true);
+    }
+  }
   return first;
 }
+
+void Replay::resetLockstep() {
+  // start over after a seek, responses to the events published before are stale
+  for (auto &r : lockstep_responses_) {
+    while (Message *msg = r.sock->receive(true)) {
+      delete msg;
+    }
+    static_cast<LockstepCounter &>(r) = {};
+  }
+
+  auto &s = lockstep_stats_;
+  const uint64_t now = nanos_since_boot();
+  s = {.start_ns = now, .start_mono_time = cur_mono_time_, .events = 0,
+       .report_ns = now, .report_mono_time = cur_mono_time_, .report_events = 0};
+}
+
+bool Replay::waitForResponses(int idx) {
+  auto &r = lockstep_responses_[idx];
+  ++r.expected;
+
+  const uint64_t start_ts = nanos_since_boot();
+  uint64_t warning_ts = start_ts;
+  bool timed_out = false;
+  while (true) {
+    for (auto &resp : lockstep_responses_) {
+      while (Message *msg = resp.sock->receive(true)) {
+        delete msg;
+        resp.receive();
+      }
+    }
+    if (r.responded(lockstep_window_) || paused_) break;
+
+    lockstep_poller_->poll(100);
+    if (uint64_t now = nanos_since_boot(); lockstep_timeout_ns_ > 0 && now - start_ts > lockstep_timeout_ns_) {
+      // the consumer is slow or dropped the event, move on instead of hanging the run
+      rError("lockstep: no %s after %.1f s, received %lu of %lu. skipping it", r.name.c_str(),
+             lockstep_timeout_ns_ / 1e9, r.received, r.expected);
+      r.timeout();
+      timed_out = true;
+    } else if (now - warning_ts > 5e9) {
+      rWarning("lockstep: waiting for %s, received %lu of %lu", r.name.c_str(), r.received, r.expected);
+      warning_ts = now;
+    }
+  }
+
+  const uint64_t blocked = nanos_since_boot() - start_ts;
+  r.blocked_ns += blocked;
+  r.total_blocked_ns += blocked;
+  if (!r.responded(lockstep_window_)) {
+    // interrupted, the event is revisited on resume
+    --r.expected;
+    return false;
+  }
+  r.timed_out = timed_out;
+  return true;
+}
+
+void Replay::reportLockstep(bool done) {
+  auto &s = lockstep_stats_;
+  const uint64_t now = nanos_since_boot();
+  if (!done && now - s.report_ns < 5e9) return;
+
+  const double seconds = (now - (done ? s.start_ns : s.report_ns)) / 1e9;
+  const double log_seconds = (cur_mono_time_ - (done ? s.start_mono_time : s.report_mono_time)) / 1e9;
+  const uint64_t events = s.events - (done ? 0 : s.report_events);
+  auto blocked_ns = [done](const LockstepResponse &r) { return done ? r.total_blocked_ns : r.blocked_ns; };
+
+  // the consumer that held back the stream the most
+  std::string blocking = "none";
+  auto it = std::max_element(lockstep_responses_.begin(), lockstep_responses_.end(),
+                             [&](auto &a, auto &b) { return blocked_ns(a) < blocked_ns(b); });
+  if (it != lockstep_responses_.end() && blocked_ns(*it) > 0) {
+    blocking = util::string_format("%s %.0f%%", it->name.c_str(), blocked_ns(*it) / 1e7 / seconds);
+  }
+  rInfo("lockstep%s: %.0f events/s, %.1fx realtime, blocked on %s", done ? " finished" : "",
+        events / seconds, log_seconds / seconds, blocking.c_str());
+  if (done) {
+    for (auto &r : lockstep_responses_) {
+      if (r.timeouts > 0) {
+        rError("lockstep: %lu of %lu %s responses timed out, %lu of them never arrived", r.timeouts, r.expected,
+               r.name.c_str(), r.dropped + r.skipped);
+      }
+    }
+  }
+
+  s.report_ns = now;
+  s.report_mono_time = cur_mono_time_;
+  s.report_events = s.events;
+  for (auto &r : lockstep_responses_) {
+    r.blocked_ns = 0;
+  }
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <optional>
@@ -13,12 +15,15 @@
 #include <QThread>
 
 #include "tools/replay/camera.h"
+#include "tools/replay/query.h"
 #include "tools/replay/route.h"
 
 const QString DEMO_ROUTE = "a2a0ccea32023010|2023-07-27--13-01-19";
 
 // one segment uses about 100M of memory
 constexpr int MIN_SEGMENTS_CACHE = 5;
+// in-process consumers get the pending events at least this often when replay runs behind or unpaced
+constexpr int MAX_BATCH_SIZE = 1000;
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -30,6 +35,7 @@ enum REPLAY_FLAGS {
   REPLAY_FLAG_NO_HW_DECODER = 0x0100,
   REPLAY_FLAG_NO_VIPC = 0x0400,
   REPLAY_FLAG_ALL_SERVICES = 0x0800,
+  REPLAY_FLAG_LOCKSTEP = 0x1000,
 };
 
 enum class FindFlag {
@@ -43,8 +49,39 @@ enum class FindFlag {
 
 enum class TimelineType { None, Engaged, AlertInfo, AlertWarning, AlertCritical, UserFlag };
 typedef bool (*replayEventFilter)(const Event *, void *);
+
+// an event delivered to in-process consumers. `event` reads straight from the segment's log,
+// it's only valid during the consumer call.
+struct ReplayEvent {
+  cereal::Event::Which which;
+  uint64_t mono_time;
+  cereal::Event::Reader event;
+};
+typedef std::function<void(const std::vector<ReplayEvent> &events)> ReplayConsumer;
 Q_DECLARE_METATYPE(std::shared_ptr<LogReader>);
 
+// counts the responses of one lockstep service. a wait that times out skips its response, and if
+// that response arrives late it takes the place of the skipped one. if the next wait times out
+// too, the skipped response is taken as dropped by the consumer.
+struct LockstepCounter {
+  uint64_t expected = 0;  // logged responses up to the current event
+  uint64_t received = 0;
+  uint64_t skipped = 0;
+  uint64_t dropped = 0;
+  uint64_t timeouts = 0;
+  bool timed_out = false;  // the previous wait timed out
+
+  inline bool responded(int window) const { return received + skipped + dropped + window >= expected; }
+  inline void receive() {
+    ++received;
+    if (skipped > 0) --skipped;
+  }
+  inline void timeout() {
+    ++timeouts;
+    ++(timed_out ? dropped : skipped);
+  }
+};
+
 class Replay : public QObject {
   Q_OBJECT
 
@@ -67,6 +104,10 @@ public:
     filter_opaque = opaque;
     event_filter = filter;
   }
+  // events of `services` (all replayed services if empty) are delivered to the consumer in the stream
+  // thread instead of being published, in batches of the events due at each pacing tick. every event
+  // is parsed once and shared by the consumers. must be called before start().
+  void addConsumer(const QStringList &services, ReplayConsumer consumer);
   inline int segmentCacheLimit() const { return segment_cache_limit; }
   inline void setSegmentCacheLimit(int n) { segment_cache_limit = std::max(MIN_SEGMENTS_CACHE, n); }
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
@@ -79,6 +120,12 @@ public:
   inline uint64_t routeStartTime() const { return route_start_ts_; }
   inline double toSeconds(uint64_t mono_time) const { return (mono_time - route_start_ts_) / 1e9; }
   inline int totalSeconds() const { return (!segments_.empty()) ? (segments_.rbegin()->first + 1) * 60 : 0; }
+  // in lockstep mode, events are published without wall clock pacing. when the stream reaches a
+  // logged message of a response service, it waits until the consumers have published as many
+  // messages on it, give or take `window`. a response missing for `timeout` seconds is reported
+  // and skipped, 0 waits forever. must be called before load(), the response services should
+  // also be blocked so replay doesn't publish them.
+  void setLockstepResponses(const QStringList &services, int window = 0, double timeout = 10);
   inline void setSpeed(float speed) { speed_ = speed; }
   inline float getSpeed() const { return speed_; }
   inline const std::vector<Event> *events() const { return &events_; }
@@ -113,10 +160,17 @@ protected:
   std::vector<Event>::const_iterator publishEvents(std::vector<Event>::const_iterator first,
                                                    std::vector<Event>::const_iterator last);
   void publishMessage(const Event *e);
+  void deliverBatch();
   void publishFrame(const Event *e);
+  void resetLockstep();
+  bool waitForResponses(int idx);
+  void reportLockstep(bool done = false);
   void buildTimeline();
+  void mergeTimeline(int n, std::vector<EventQuery::Partial> &&partials,
+                     const std::vector<std::pair<TimelineType, EventQuery>> &queries);
   void checkSeekProgress();
   inline bool isSegmentMerged(int n) const { return merged_segments_.count(n) > 0; }
+  inline bool isLockstepResponse(int which) const { return !lockstep_index_.empty() && lockstep_index_[which] >= 0; }
 
   pthread_t stream_thread_id = 0;
   QThread *stream_thread_ = nullptr;
@@ -141,6 +195,15 @@ protected:
   std::unique_ptr<PubMaster> pm;
   std::vector<const char*> sockets_;
   std::vector<bool> filters_;
+  struct Consumer {
+    std::vector<bool> services;  // Event::Which -> subscribed
+    ReplayConsumer callback;
+    std::vector<ReplayEvent> batch;
+  };
+  std::vector<Consumer> consumers_;
+  std::vector<bool> consumed_;  // Event::Which -> delivered to a consumer instead of published
+  std::deque<capnp::FlatArrayMessageReader> batch_readers_;
+  std::vector<std::pair<std::string, cereal::Event::Reader>> sm_batch_;
   std::unique_ptr<Route> route_;
   std::unique_ptr<CameraServer> camera_server_;
   std::atomic<uint32_t> flags_ = REPLAY_FLAG_NONE;
@@ -148,9 +211,29 @@ protected:
   std::mutex timeline_lock;
   QFuture<void> timeline_future;
   std::vector<std::tuple<double, double, TimelineType>> timeline_;
+  std::map<int, std::vector<EventQuery::Partial>> segment_timelines_;
   std::string car_fingerprint_;
   std::atomic<float> speed_ = 1.0;
   replayEventFilter event_filter = nullptr;
   void *filter_opaque = nullptr;
   int segment_cache_limit = MIN_SEGMENTS_CACHE;
+
+  // lockstep
+  struct LockstepResponse : LockstepCounter {
+    std::string name;
+    std::unique_ptr<SubSocket> sock;
+    uint64_t blocked_ns = 0;  // since the last report
+    uint64_t total_blocked_ns = 0;
+  };
+  std::unique_ptr<Context> lockstep_ctx_;
+  std::unique_ptr<Poller> lockstep_poller_;
+  std::vector<LockstepResponse> lockstep_responses_;
+  std::vector<int> lockstep_index_;  // Event::Which -> index in lockstep_responses_, or -1
+  int lockstep_window_ = 0;
+  uint64_t lockstep_timeout_ns_ = 0;
+  uint64_t lockstep_resume_ts_ = 0;
+  struct {
+    uint64_t start_ns, start_mono_time, events;
+    uint64_t report_ns, report_mono_time, report_events;
+  } lockstep_stats_ = {};
 };
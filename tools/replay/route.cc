@@ -6,6 +6,7 @@
 #include <QJsonDocument>
 #include <QRegularExpression>
 #include <QtConcurrent>
+#include <algorithm>
 #include <array>
 
 #include "selfdrive/ui/qt/api.h"
@@ -13,6 +14,12 @@
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
 
+namespace {
+
+const uint32_t ENCODE_IDX_FLAG_KEYFRAME = 8;  // V4L2_BUF_FLAG_KEYFRAME
+
+}  // namespace
+
 Route::Route(const QString &route, const QString &data_dir) : data_dir_(data_dir) {
   route_ = parseRoute(route);
 }
@@ -180,6 +187,45 @@ void Segment::loadFile(int id, const std::string file) {
   }
 
   if (--loading_ == 0) {
+    if (!abort_) indexFrames();
     emit loadFinished(!abort_);
   }
 }
+
+void Segment::indexFrames() {
+  if (!log) return;
+
+  // the encodeIdx events locate every packet in the raw HEVC files,
+  // which saves demuxing the whole file before the first frame is decoded.
+  std::vector<std::pair<uint32_t, EncodedPacket>> packets[MAX_CAMERAS];
+  for (const Event &e : log->events) {
+    if (e.eidx_segnum != -1) continue;
+
+    CameraType cam;
+    if (e.which == cereal::Event::ROAD_ENCODE_IDX) cam = RoadCam;
+    else if (e.which == cereal::Event::DRIVER_ENCODE_IDX) cam = DriverCam;
+    else if (e.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) cam = WideRoadCam;
+    else continue;
+    if (!frames[cam]) continue;
+
+    capnp::FlatArrayMessageReader reader(e.data);
+    auto event = reader.getRoot<cereal::Event>();
+    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+    if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+      packets[cam].push_back({idx.getSegmentId(), {idx.getLen(), (idx.getFlags() & ENCODE_IDX_FLAG_KEYFRAME) != 0}});
+    }
+  }
+
+  for (int i = 0; i < MAX_CAMERAS; ++i) {
+    if (packets[i].empty()) continue;
+
+    // the log is sorted by time, the file is in encoding order
+    std::stable_sort(packets[i].begin(), packets[i].end(), [](auto &a, auto &b) { return a.first < b.first; });
+    std::vector<EncodedPacket> index;
+    index.reserve(packets[i].size());
+    for (const auto &[id, packet] : packets[i]) index.push_back(packet);
+    if (!frames[i]->setPacketIndex(index)) {
+      rDebug("segment %d: encodeIdx doesn't match camera %d, indexing the video file", seg_num, i);
+    }
+  }
+}
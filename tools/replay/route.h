@@ -79,6 +79,7 @@ signals:
 
 protected:
   void loadFile(int id, const std::string file);
+  void indexFrames();
 
   std::atomic<bool> abort_ = false;
   std::atomic<int> loading_ = 0;
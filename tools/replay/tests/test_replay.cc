@@ -1,10 +1,15 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include <chrono>
 #include <thread>
 
 #include <QEventLoop>
+#include <QThreadPool>
 
 #include "catch2/catch.hpp"
 #include "common/util.h"
+#include "tools/replay/query.h"
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
 
@@ -106,6 +111,17 @@ void read_segment(int n, const SegmentFile &segment_file, uint32_t flags) {
       }
     }
 
+    // the packet index built from encodeIdx matches demuxing the whole file
+    const auto &road_file = (flags & REPLAY_FLAG_QCAMERA) || segment_file.road_cam.isEmpty() ? segment_file.qcamera : segment_file.road_cam;
+    FrameReader scanned;
+    REQUIRE(scanned.load(RoadCam, road_file.toStdString(), true, nullptr, true));
+    auto &road = segment.frames[RoadCam];
+    REQUIRE(scanned.getFrameCount() == road->getFrameCount());
+    for (int i = 0; i < road->packets_info.size(); ++i) {
+      REQUIRE(road->packets_info[i].pos == scanned.packets_info[i].pos);
+      REQUIRE((road->packets_info[i].flags & AV_PKT_FLAG_KEY) == (scanned.packets_info[i].flags & AV_PKT_FLAG_KEY));
+    }
+
     loop.quit();
   });
   loop.exec();
@@ -174,3 +190,312 @@ TEST_CASE("seek_to") {
 
   loop.exec();
 }
+
+TEST_CASE("consumer") {
+  QEventLoop loop;
+  Replay replay(DEMO_ROUTE, {}, {}, nullptr, REPLAY_FLAG_NO_VIPC);
+  int batches = 0, events = 0, unordered = 0, unexpected = 0;
+  uint64_t prev_mono_time = 0;
+  replay.addConsumer({"carState", "controlsState"}, [&](const std::vector<ReplayEvent> &batch) {
+    if (batches == 100) return;
+
+    for (const auto &e : batch) {
+      unexpected += (e.which != e.event.which()) ||
+                    (e.which != cereal::Event::CAR_STATE && e.which != cereal::Event::CONTROLS_STATE);
+      unordered += e.mono_time < prev_mono_time;
+      prev_mono_time = e.mono_time;
+    }
+    events += batch.size();
+    if (++batches == 100) {
+      QMetaObject::invokeMethod(&loop, &QEventLoop::quit, Qt::QueuedConnection);
+    }
+  });
+
+  REQUIRE(replay.load());
+  replay.setSpeed(10);
+  replay.start();
+  loop.exec();
+  REQUIRE(events >= batches);
+  REQUIRE(unordered == 0);
+  REQUIRE(unexpected == 0);
+}
+
+TEST_CASE("LockstepCounter") {
+  LockstepCounter c;
+  ++c.expected;
+  c.receive();
+  REQUIRE(c.responded(0));
+
+  SECTION("response after the timeout") {
+    ++c.expected;
+    REQUIRE_FALSE(c.responded(0));
+    c.timeout();
+    REQUIRE(c.responded(0));
+    c.timed_out = true;
+
+    // the late response doesn't answer the next event
+    c.receive();
+    ++c.expected;
+    REQUIRE_FALSE(c.responded(0));
+    c.receive();
+    REQUIRE(c.responded(0));
+    c.timed_out = false;
+
+    ++c.expected;
+    REQUIRE_FALSE(c.responded(0));
+    c.receive();
+    REQUIRE(c.responded(0));
+    REQUIRE((c.timeouts == 1 && c.skipped == 0 && c.dropped == 0));
+  }
+
+  SECTION("dropped response") {
+    ++c.expected;
+    c.timeout();
+    c.timed_out = true;
+
+    // the response to the next event is taken as the late one until that wait times out too
+    ++c.expected;
+    c.receive();
+    REQUIRE_FALSE(c.responded(0));
+    c.timeout();
+    REQUIRE(c.responded(0));
+    c.timed_out = true;
+
+    // back in step
+    for (int i = 0; i < 3; ++i) {
+      ++c.expected;
+      REQUIRE_FALSE(c.responded(0));
+      c.receive();
+      REQUIRE(c.responded(0));
+      c.timed_out = false;
+    }
+    REQUIRE((c.timeouts == 2 && c.dropped == 1));
+  }
+}
+
+TEST_CASE("EventQuery") {
+  // controlsState at 1Hz, engaged during [2, 5) and [7, 10), with a userFlag at 3s and 8s
+  std::vector<kj::Array<capnp::word>> messages;
+  std::vector<Event> events;
+  for (int i = 0; i < 10; ++i) {
+    MessageBuilder msg;
+    auto cs = msg.initEvent().initControlsState();
+    cs.setEnabled((i >= 2 && i < 5) || i >= 7);
+    msg.getRoot<cereal::Event>().setLogMonoTime(i * 1e9);
+    messages.push_back(capnp::messageToFlatArray(msg));
+    events.emplace_back(cereal::Event::CONTROLS_STATE, i * 1e9, messages.back().asPtr());
+    if (i == 3 || i == 8) {
+      MessageBuilder flag;
+      flag.initEvent().initUserFlag();
+      messages.push_back(capnp::messageToFlatArray(flag));
+      events.emplace_back(cereal::Event::USER_FLAG, i * 1e9 + 1, messages.back().asPtr());
+    }
+  }
+
+  auto engaged = EventQuery("controlsState").where("enabled", [](const capnp::DynamicValue::Reader &v) { return v.as<bool>(); });
+  auto flags = EventQuery("userFlag").maxGap(0);
+  REQUIRE(engaged.isValid());
+  REQUIRE_FALSE(EventQuery("controlsState").where("noSuchField", nullptr).isValid());
+
+  auto split = GENERATE(0, 3, 6, 8);
+  auto run = [&](const EventQuery &q) {
+    EventQuery::Partial acc;
+    q.join(acc, q.scan({events.begin(), events.begin() + split}));
+    q.join(acc, q.scan({events.begin() + split, events.end()}));
+    return acc.ranges;
+  };
+  INFO("split at event " << split);
+
+  auto ranges = run(engaged);
+  REQUIRE(ranges.size() == 2);
+  REQUIRE((ranges[0].begin == 2e9 && ranges[0].end == 5e9));
+  REQUIRE((ranges[1].begin == 7e9 && ranges[1].end == 9e9));
+
+  ranges = run(flags);
+  REQUIRE(ranges.size() == 2);
+  REQUIRE((ranges[0].begin == 3e9 + 1 && ranges[0].end == 3e9 + 1));
+  REQUIRE((ranges[1].begin == 8e9 + 1 && ranges[1].end == 8e9 + 1));
+}
+
+TEST_CASE("EventQuery splitOn") {
+  // controlsState at 1Hz with alertType "a" during [1, 4), "b" during [4, 6) and [7, 10)
+  std::vector<kj::Array<capnp::word>> messages;
+  std::vector<Event> events;
+  for (int i = 0; i < 10; ++i) {
+    MessageBuilder msg;
+    auto cs = msg.initEvent().initControlsState();
+    cs.setAlertType(i >= 1 && i < 4 ? "a" : (i >= 4 && i != 6) ? "b" : "");
+    msg.getRoot<cereal::Event>().setLogMonoTime(i * 1e9);
+    messages.push_back(capnp::messageToFlatArray(msg));
+    events.emplace_back(cereal::Event::CONTROLS_STATE, i * 1e9, messages.back().asPtr());
+  }
+
+  auto alerts = EventQuery("controlsState")
+    .where("alertType", [](const capnp::DynamicValue::Reader &v) { return v.as<capnp::Text>().size() > 0; })
+    .splitOn("alertType");
+  REQUIRE(alerts.isValid());
+
+  // 4 splits the logs right where the alert changes, 2 and 5 inside a range
+  auto split = GENERATE(0, 2, 4, 5, 7);
+  INFO("split at event " << split);
+  EventQuery::Partial acc;
+  alerts.join(acc, alerts.scan({events.begin(), events.begin() + split}));
+  alerts.join(acc, alerts.scan({events.begin() + split, events.end()}));
+
+  REQUIRE(acc.ranges.size() == 3);
+  REQUIRE((acc.ranges[0].begin == 1e9 && acc.ranges[0].end == 4e9));
+  REQUIRE((acc.ranges[1].begin == 4e9 && acc.ranges[1].end == 6e9));
+  REQUIRE((acc.ranges[2].begin == 7e9 && acc.ranges[2].end == 9e9));
+}
+
+TEST_CASE("queryLogs") {
+  // the alerts of the splitOn test in three logs, split inside a range and where the alert changes
+  char tmp_path[] = "/tmp/query_XXXXXX";
+  const std::string dir = mkdtemp(tmp_path);
+  std::vector<std::string> logs;
+  std::string content;
+  for (int i = 0; i < 10; ++i) {
+    MessageBuilder msg;
+    auto cs = msg.initEvent().initControlsState();
+    cs.setAlertType(i >= 1 && i < 4 ? "a" : (i >= 4 && i != 6) ? "b" : "");
+    msg.getRoot<cereal::Event>().setLogMonoTime(i * 1e9);
+    auto words = capnp::messageToFlatArray(msg);
+    content.append((const char *)words.begin(), words.size() * sizeof(capnp::word));
+    if (i == 1 || i == 3 || i == 9) {
+      logs.push_back(dir + "/" + std::to_string(logs.size()));
+      REQUIRE(util::write_file(logs.back().c_str(), content.data(), content.size(), O_WRONLY | O_CREAT) == 0);
+      content.clear();
+    }
+  }
+
+  auto alerts = EventQuery("controlsState")
+    .where("alertType", [](const capnp::DynamicValue::Reader &v) { return v.as<capnp::Text>().size() > 0; })
+    .splitOn("alertType");
+  auto check = [](const std::vector<EventQuery::Partial> &results) {
+    REQUIRE(results.size() == 1);
+    const auto &ranges = results[0].ranges;
+    REQUIRE(ranges.size() == 3);
+    REQUIRE((ranges[0].begin == 1e9 && ranges[0].end == 4e9));
+    REQUIRE((ranges[1].begin == 4e9 && ranges[1].end == 6e9));
+    REQUIRE((ranges[2].begin == 7e9 && ranges[2].end == 9e9));
+  };
+
+  QThreadPool pool;
+  pool.setMaxThreadCount(3);
+  // catch2 assertions aren't thread safe, the hooks only record
+  std::vector<std::vector<EventQuery::Partial>> scanned(logs.size());
+  LogQueryHooks hooks;
+  hooks.done = [&](size_t i, const std::vector<EventQuery::Partial> &partials, std::shared_ptr<LogReader> log) {
+    scanned[i] = partials;
+  };
+  check(queryLogs({alerts}, logs, pool, hooks));
+  for (const auto &partials : scanned) {
+    REQUIRE(partials.size() == 1);
+  }
+
+  // the partials of the middle log come from a cache, so it isn't loaded
+  std::vector<char> loaded(logs.size(), -1);
+  LogQueryHooks cached_hooks;
+  cached_hooks.load = [&](size_t i, std::vector<EventQuery::Partial> &partials) {
+    if (i != 1) return false;
+    partials = scanned[1];
+    return true;
+  };
+  cached_hooks.done = [&](size_t i, const std::vector<EventQuery::Partial> &partials, std::shared_ptr<LogReader> log) {
+    loaded[i] = log != nullptr;
+  };
+  check(queryLogs({alerts}, logs, pool, cached_hooks));
+  REQUIRE(loaded == std::vector<char>{1, 0, 1});
+  system(("rm -rf " + dir).c_str());
+}
+
+TEST_CASE("trimCache") {
+  char tmp_path[] = "/tmp/cache_XXXXXX";
+  const std::string dir = mkdtemp(tmp_path);
+  const uint64_t evicted = cacheStats().evicted_files;
+
+  // five 1KB files, used from oldest to newest
+  for (int i = 0; i < 5; ++i) {
+    std::string file = dir + "/" + std::to_string(i);
+    REQUIRE(util::write_file(file.c_str(), std::string(1024, 'x').data(), 1024, O_WRONLY | O_CREAT) == 0);
+    struct timespec times[2] = {{.tv_sec = 1000 + i}, {.tv_sec = 1000 + i}};
+    REQUIRE(utimensat(AT_FDCWD, file.c_str(), times, 0) == 0);
+  }
+  // a file being written is never evicted
+  REQUIRE(util::write_file((dir + "/5.abc.tmp").c_str(), "x", 1, O_WRONLY | O_CREAT) == 0);
+
+  trimCache(dir, 3 * 1024);
+  REQUIRE(cacheStats().evicted_files - evicted == 2);
+  for (int i = 0; i < 5; ++i) {
+    REQUIRE(util::file_exists(dir + "/" + std::to_string(i)) == (i >= 2));
+  }
+  REQUIRE(util::file_exists(dir + "/5.abc.tmp"));
+  system(("rm -rf " + dir).c_str());
+}
+
+TEST_CASE("LogReader decompressed cache") {
+  const std::string cache_file = cacheFilePath(TEST_RLOG_URL, CacheTier::Decompressed);
+  system(("rm " + cache_file + " -f").c_str());
+
+  LogReader log;
+  REQUIRE(log.load(TEST_RLOG_URL, nullptr, true));
+  REQUIRE(util::file_exists(cache_file));
+
+  const uint64_t hits = cacheStats().hits[(int)CacheTier::Decompressed];
+  LogReader cached_log;
+  REQUIRE(cached_log.load(TEST_RLOG_URL, nullptr, true));
+  REQUIRE(cacheStats().hits[(int)CacheTier::Decompressed] == hits + 1);
+  REQUIRE(cached_log.events.size() == log.events.size());
+  for (int i = 0; i < log.events.size(); ++i) {
+    REQUIRE(cached_log.events[i].which == log.events[i].which);
+    REQUIRE(cached_log.events[i].mono_time == log.events[i].mono_time);
+    REQUIRE(cached_log.events[i].eidx_segnum == log.events[i].eidx_segnum);
+    REQUIRE(cached_log.events[i].data.asBytes() == log.events[i].data.asBytes());
+  }
+
+  SECTION("corrupt cache file falls back to the download tier") {
+    std::string content = util::read_file(cache_file);
+    content.resize(content.size() / 2);
+    REQUIRE(util::write_file(cache_file.c_str(), content.data(), content.size(), O_WRONLY | O_TRUNC) == 0);
+    LogReader fallback_log;
+    REQUIRE(fallback_log.load(TEST_RLOG_URL, nullptr, true));
+    REQUIRE(fallback_log.events.size() == log.events.size());
+  }
+}
+
+TEST_CASE("software decoding fps", "[.][benchmark]") {
+  Route route(DEMO_ROUTE);
+  REQUIRE(route.load());
+  const auto &seg = route.at(0);
+  const std::pair<CameraType, QString> files[] = {{RoadCam, seg.road_cam}, {DriverCam, seg.driver_cam}, {WideRoadCam, seg.wide_road_cam}};
+
+  for (int threads : {1, 0}) {
+    setVideoDecoderThreads(threads);
+    // all cameras decode at once, as with --dcam --ecam
+    std::vector<std::thread> decode_threads;
+    std::atomic<int> failed = 0;
+    for (const auto &[cam, file] : files) {
+      decode_threads.emplace_back([&, cam = cam, file = file.toStdString()]() {
+        FrameReader fr;
+        if (!fr.load(cam, file, true, nullptr, true)) {
+          failed++;
+          return;
+        }
+        auto [nv12_width, nv12_height, nv12_buffer_size] = get_nv12_info(fr.width, fr.height);
+        VisionBuf buf;
+        buf.allocate(nv12_buffer_size);
+        buf.init_yuv(fr.width, fr.height, nv12_width, nv12_width * nv12_height);
+
+        double start = millis_since_boot();
+        for (int i = 0; i < fr.getFrameCount(); ++i) {
+          if (!fr.get(i, &buf)) failed++;
+        }
+        double fps = fr.getFrameCount() / ((millis_since_boot() - start) / 1000.0);
+        printf("camera[%d] decoder threads %s: %.1f fps\n", cam, threads ? std::to_string(threads).c_str() : "auto", fps);
+        buf.free();
+      });
+    }
+    for (auto &t : decode_threads) t.join();
+    REQUIRE(failed == 0);
+  }
+}